@@ -109,6 +109,12 @@ check_include_files(netdb.h BITD_HAVE_NETDB_H)
 
 check_include_files(netdb.h BITD_HAVE_POLL_H)
 
+check_include_files(sys/epoll.h BITD_HAVE_SYS_EPOLL_H)
+
+check_include_files(x86intrin.h BITD_HAVE_X86INTRIN_H)
+
+check_include_files(cpuid.h BITD_HAVE_CPUID_H)
+
 check_include_files(assert.h BITD_HAVE_ASSERT_H)
 if (NOT BITD_HAVE_ASSERT_H)
   message(FATAL_ERROR "assert.h not found.")
@@ -264,6 +270,16 @@ check_function_exists(posix_spawn BITD_HAVE_POSIX_SPAWN)
 
 check_function_exists(pipe2 BITD_HAVE_PIPE2)
 
+if ("${CMAKE_SYSTEM_NAME}" MATCHES "Linux")
+  check_function_exists(eventfd BITD_HAVE_EVENTFD)
+  check_function_exists(timerfd_create BITD_HAVE_TIMERFD)
+  check_function_exists(prctl BITD_HAVE_PRCTL)
+endif()
+
+check_function_exists(writev BITD_HAVE_WRITEV)
+check_function_exists(sendmmsg BITD_HAVE_SENDMMSG)
+check_function_exists(recvmmsg BITD_HAVE_RECVMMSG)
+
 check_function_exists(random BITD_HAVE_RANDOM)
 check_function_exists(rand BITD_HAVE_RAND)
 if (NOT BITD_HAVE_RANDOM AND NOT BITD_HAVE_RAND)
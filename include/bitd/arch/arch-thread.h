@@ -42,6 +42,7 @@ extern "C"
 typedef struct bitd_arch_thread_s *bitd_arch_thread;
 typedef struct bitd_arch_mutex_s *bitd_arch_mutex;
 typedef struct bitd_arch_event_s *bitd_arch_event;
+typedef struct bitd_arch_tls_s *bitd_arch_tls;
 struct bitd_thread_s;
 
 /* Thread entrypoint prototype */
@@ -104,6 +105,18 @@ void bitd_arch_event_set(bitd_arch_event e);
 void bitd_arch_event_clear(bitd_arch_event e);
 bitd_boolean bitd_arch_event_wait(bitd_arch_event e, bitd_uint32 timeout);
 
+/*
+ * Thread-local storage API
+ */
+
+/* Create/destroy a thread-local slot */
+bitd_arch_tls bitd_arch_tls_create(void (*destructor)(void *value));
+void bitd_arch_tls_destroy(bitd_arch_tls t);
+
+/* Get/set the slot value for the current thread */
+void *bitd_arch_tls_get(bitd_arch_tls t);
+void bitd_arch_tls_set(bitd_arch_tls t, void *value);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Curl multi handles driven by a reactor loop
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+#ifndef _BITD_CURL_MULTI_H_
+#define _BITD_CURL_MULTI_H_
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/log.h"
+#include "bitd/reactor.h"
+
+#include "curl/curl.h"
+
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* A curl multi handle, whose sockets and timer are registered with a
+   reactor loop. Implemented by the bitd-curl module dll. */
+typedef struct bitd_curl_multi_s *bitd_curl_multi;
+
+/* Called on the reactor loop thread each time curl has acted on a socket
+   or on the timer. Completed transfers are read with
+   curl_multi_info_read(). */
+typedef void (bitd_curl_multi_callback_t)(void *cookie);
+
+/*****************************************************************************
+ *                            FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* Create a multi handle driven by the loop. Call on the loop thread.
+   Errors are logged under log_keyid. Returns NULL on error. */
+bitd_curl_multi bitd_curl_multi_create(bitd_reactor_loop l,
+				       ttlog_keyid log_keyid,
+				       bitd_curl_multi_callback_t *cb,
+				       void *cookie);
+
+/* Destroy the multi handle. Call on the loop thread, after removing the
+   easy handles. The sockets and the timer are removed from the reactor
+   before curl closes the cached connections. */
+void bitd_curl_multi_destroy(bitd_curl_multi m);
+
+/* Get the curl multi handle, to add and remove easy handles */
+CURLM *bitd_curl_multi_get_handle(bitd_curl_multi m);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _BITD_CURL_MULTI_H_ */
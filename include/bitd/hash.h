@@ -62,7 +62,9 @@ typedef void (bitd_hash_free_t)(bitd_hash_key k, bitd_hash_value v);
 /* Hash mapping function prototype */
 typedef void (bitd_hash_map_t)(bitd_hash_key k, bitd_hash_value v, void *cookie);
 
-/* Create a hash, with a given hashing function */
+/* Create a hash, with a given hashing function. The hash is safe for
+   concurrent use: it is split into lock stripes, each an open addressing
+   table that grows on its own. */
 bitd_hash bitd_hash_create(bitd_hash_func_t *f, 
                        bitd_hash_compare_t *cmp,
                        bitd_hash_free_t *g);
@@ -76,8 +78,16 @@ bitd_boolean bitd_hash_add(bitd_hash h, bitd_hash_key k, bitd_hash_value v);
 /* Remove a hash element. Return TRUE if hash element was actually removed. */
 bitd_boolean bitd_hash_remove(bitd_hash h, bitd_hash_key k);
 
+/* Look up a hash element. Returns TRUE, and sets v if not NULL, if the
+   element was found. The value is not protected from a concurrent
+   remove once the call returns. */
+bitd_boolean bitd_hash_lookup(bitd_hash h, bitd_hash_key k, bitd_hash_value *v);
+
+/* Get the number of elements in the hash */
+bitd_uint32 bitd_hash_count(bitd_hash h);
+
 /* Call the passed-in map function for all elements in the hash.
-   The mapping function may NOT remove elements from the hash. */
+   The mapping function may NOT add or remove elements from the hash. */
 void bitd_hash_map(bitd_hash h, bitd_hash_map_t *m, void *cookie);
 
 /* Some predefined comparison routines */
@@ -43,6 +43,35 @@ extern "C"
 /* Handle passed during function execution */
 typedef struct bitd_lambda *bitd_lambda_handle;
 
+/* Task scheduling classes, from highest to lowest priority. Queued tasks 
+   are dequeued in weighted fair order across classes, and each class has 
+   a reserved minimum number of threads. */
+typedef enum {
+    bitd_lambda_class_high,
+    bitd_lambda_class_normal,
+    bitd_lambda_class_bulk,
+    bitd_lambda_class_count
+} bitd_lambda_class_t;
+
+/* Per-class counters */
+typedef struct {
+    int n_queued;              /* Tasks waiting for a thread */
+    int max_queued;            /* High water mark of n_queued */
+    int n_running;             /* Tasks executing */
+    bitd_uint64 n_executed;    /* Tasks dequeued for execution */
+    bitd_uint64 wait_nsec;     /* Total time spent queued */
+    bitd_uint64 max_wait_nsec; /* Longest time spent queued */
+    bitd_uint64 n_deadline_missed; /* Tasks dequeued past their deadline */
+} bitd_lambda_class_stats_t;
+
+/* Pool counters */
+typedef struct {
+    int thread_count;          /* Threads in the pool */
+    int thread_idle;           /* Threads waiting for a task */
+    int n_queued;              /* Tasks waiting for a thread */
+    int n_running;             /* Tasks executing */
+} bitd_lambda_stats_t;
+
 /* The prototype of the task function to be executed on a worker thread.
    This function can block. If stopping_p is set, function should exit
    immediately. */
@@ -59,6 +88,9 @@ void bitd_lambda_deinit(bitd_lambda_handle lambda);
 /* Set the max thread limit. A limit of zero means no limit. */
 void bitd_lambda_set_thread_max(bitd_lambda_handle lambda, int thread_max);
     
+/* Set the number of threads that are kept even when idle */
+void bitd_lambda_set_thread_min(bitd_lambda_handle lambda, int thread_min);
+
 /* Thread will exit if idle for longer than tmo_msec.
    The default idle timeout is 300,000 msecs (= 5 minutes). */
 void bitd_lambda_set_thread_idle_tmo(bitd_lambda_handle lambda, 
@@ -67,11 +99,48 @@ void bitd_lambda_set_thread_idle_tmo(bitd_lambda_handle lambda,
 /* Set the max task limit. A limit of zero means no limit, */
 void bitd_lambda_set_task_max(bitd_lambda_handle lambda, int task_max);
     
+/* Set the class weight, and the number of threads reserved for the 
+   class. The reservations apply only if the thread max is larger than 
+   the sum of the reserved threads. Defaults: high 16 and 2 threads, 
+   normal 4 and 2 threads, bulk 1 and 1 thread. */
+void bitd_lambda_set_class(bitd_lambda_handle lambda, 
+			   bitd_lambda_class_t cls,
+			   int weight,
+			   int thread_min);
+
+/* Get the pool counters */
+void bitd_lambda_get_stats(bitd_lambda_handle lambda, 
+			   bitd_lambda_stats_t *stats);
+
+/* Get the class counters */
+void bitd_lambda_get_class_stats(bitd_lambda_handle lambda, 
+				 bitd_lambda_class_t cls,
+				 bitd_lambda_class_stats_t *stats);
+
 /* Execute the passed-in routine in the worker thread pool */
 bitd_boolean bitd_lambda_exec_task(bitd_lambda_handle lambda,
 				   bitd_lambda_task_func_t f,
 				   void *cookie);
 
+/* Execute the routine in the given class. A task with weight N is 
+   charged 1/N of a dispatch against the class share. */
+bitd_boolean bitd_lambda_exec_task_class(bitd_lambda_handle lambda,
+					 bitd_lambda_class_t cls,
+					 int weight,
+					 bitd_lambda_task_func_t f,
+					 void *cookie);
+
+/* Execute the routine in the given class, with a deadline. Within a 
+   class, tasks are dequeued earliest deadline first. Tasks without a 
+   deadline (0) are ordered by the time they were queued, and are never
+   counted as missing their deadline. */
+bitd_boolean bitd_lambda_exec_task_deadline(bitd_lambda_handle lambda,
+					    bitd_lambda_class_t cls,
+					    int weight,
+					    bitd_uint64 deadline_nsec,
+					    bitd_lambda_task_func_t f,
+					    void *cookie);
+
 
 #ifdef __cplusplus
 }
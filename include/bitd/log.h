@@ -42,13 +42,31 @@ typedef enum {
  *                                  MACROS 
  *****************************************************************************/
 
-
+/* Is a message at this level logged under the key? Lock-free, and 
+   costs a single compare when the key is registered. */
+#define ttlog_enabled(level, keyid)					\
+    ((keyid) && (level) &&						\
+     (level) <= ((struct ttlog_keyid_hdr_s *)(keyid))->level_max)
+
+/* Log a message only if enabled. Otherwise, the args are not evaluated. */
+#define TTLOG(level, keyid, ...)					\
+    do {								\
+	if (ttlog_enabled(level, keyid)) {				\
+	    ttlog(level, keyid, __VA_ARGS__);				\
+	}								\
+    } while (0)
 
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
 typedef struct ttlog_keyid_s *ttlog_keyid;
 
+/* The start of a key. The max level is the highest of the key level
+   and the global level. */
+struct ttlog_keyid_hdr_s {
+    volatile ttlog_level level_max;
+};
+
 
 /*****************************************************************************
  *                            FUNCTION DEFINITIONS
@@ -62,6 +80,12 @@ void ttlog_deinit(bitd_boolean force_stop);
 bitd_boolean ttlog_set_log_file_name(char *log_file_name);
 bitd_boolean ttlog_set_log_file_size(int log_file_size);
 bitd_boolean ttlog_set_log_file_count(int log_file_count);
+bitd_boolean ttlog_set_log_file_binary(bitd_boolean binary_p);
+
+/* Configure the flush policy. Logged lines are written once a thread
+   logs flush_size bytes, or after flush_interval msecs. */
+bitd_boolean ttlog_set_flush_size(int flush_size);
+bitd_boolean ttlog_set_flush_interval(int flush_interval);
 
 /* Get the configured filter keys */
 void ttlog_get_keys(char ***key_names, int *n_keys);
@@ -93,6 +117,10 @@ int ttvlog_raw(char *format_string, va_list args);
 char *ttlog_get_level_name(ttlog_level level);
 ttlog_level ttlog_get_level_from_name(char *level_name);
 
+/* Render a binary log file as text. Returns the number of lines, 
+   or -1 on error. */
+int ttlog_decode(FILE *in, FILE *out);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -69,12 +69,22 @@ void mmr_deinit();
 mmr_err_t mmr_set_config(bitd_nvp_t config_nvp);
 mmr_err_t mmr_get_config(bitd_nvp_t *config_nvp);
 
+/* Declare named worker pools, each an nvp with a name, thread-min, 
+   thread-max, thread-idle-tmo, task-max, and module-name and task-name
+   bindings. Get the pool statistics. */
+mmr_err_t mmr_set_worker_pools(bitd_nvp_t pools_nvp);
+mmr_err_t mmr_get_worker_pool_stats(bitd_nvp_t *stats_nvp);
+
 typedef int (mmr_vlog_func_t)(ttlog_level level, char *format_string, 
 			      va_list args);
 
 /* Set a log function. Must be called after init. */
 mmr_err_t mmr_set_vlog_func(mmr_vlog_func_t *f);
 
+/* Set the key the log function logs under, if any. Messages not enabled
+   under the key are not formatted. Must be called after init. */
+mmr_err_t mmr_set_log_keyid(ttlog_keyid keyid);
+
 /* Set/get the global tags. The tags must be set after init. */
 mmr_err_t mmr_set_tags(bitd_nvp_t tags);
 mmr_err_t mmr_get_tags(bitd_nvp_t *tags);
@@ -74,6 +74,33 @@ typedef int (bitd_task_inst_run_t)(bitd_task_inst_t task_inst,
 typedef void (bitd_task_inst_kill_t)(bitd_task_inst_t task_inst, int signo);
 #define BITD_TASK_SIGSTOP 1
 
+/* Optional. Run a triggered task instance on n queued inputs at once,
+   instead of calling task_inst_run() once per input. */
+typedef int (bitd_task_inst_run_batch_t)(bitd_task_inst_t task_inst,
+					 bitd_object_t *inputs,
+					 int n);
+
+/* Optional. Start a task instance run and return without waiting for it
+   to end. The run ends when the module calls mmr_task_inst_run_complete(), 
+   from any thread - possibly before task_inst_run_async() returns. 
+   task_inst_kill() should complete the run early. Async runs of a task 
+   instance are serial, and replace task_inst_run() and 
+   task_inst_run_batch(). */
+typedef void (bitd_task_inst_run_async_t)(bitd_task_inst_t task_inst,
+					  bitd_object_t *input);
+
+/* Task capability flags */
+
+/* The task_inst_run() method may be called in parallel for the same
+   task instance. Triggered task instances of the task can then set the
+   max-concurrency schedule option. */
+#define BITD_TASK_FLAG_CONCURRENT_RUN 0x01
+
+/* The task_inst_run() method is cheap and does not block. Triggered task
+   instances of the task may run inline, on the worker thread that 
+   reported the triggering results, once its own run ends. */
+#define BITD_TASK_FLAG_INLINE_RUN 0x02
+
 /* Structure with the task APIs passed to module-mgr by module on load */
 typedef struct {
     bitd_task_inst_create_t *task_inst_create;
@@ -81,6 +108,9 @@ typedef struct {
     bitd_task_inst_destroy_t *task_inst_destroy;
     bitd_task_inst_run_t *task_inst_run;
     bitd_task_inst_kill_t *task_inst_kill;
+    bitd_task_inst_run_batch_t *task_inst_run_batch;
+    bitd_task_inst_run_async_t *task_inst_run_async;
+    int flags;               /* BITD_TASK_FLAG_ capabilities */
 } bitd_task_api_t;
 
 
@@ -105,6 +135,11 @@ extern void mmr_task_unregister(mmr_task_t task);
 extern void mmr_task_inst_report_results(mmr_task_inst_t mmr_task_inst,
 					 mmr_task_inst_results_t *results);
 
+/* Complete a run started by task_inst_run_async(). Called exactly once 
+   per async run, from any thread. The input of the run is released. */
+extern void mmr_task_inst_run_complete(mmr_task_inst_t mmr_task_inst,
+				       int ret);
+
 /* Task inst params utilities. The params struct is not assumed to be 
    heap-allocated */
 extern void mmr_task_inst_params_init(mmr_task_inst_params_t *p);
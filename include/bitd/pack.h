@@ -27,7 +27,16 @@ extern "C"
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* The compact encoding begins with a magic byte that is never a valid 
+   legacy type byte, so bitd_unpack_object() can tell the encodings apart */
+#define BITD_PACK_COMPACT_MAGIC 0xbd
+#define BITD_PACK_COMPACT_VERSION 1
 
+/* Compact encoding header flags */
+#define BITD_PACK_COMPACT_FLAG_LZ4 0x01 /* Payload is LZ4 block compressed */
+
+/* Default payload size above which compact payloads get compressed */
+#define BITD_PACK_LZ4_THRESHOLD_DEF 512
 
 /*****************************************************************************
  *                                  MACROS 
@@ -52,6 +61,18 @@ bitd_boolean bitd_unpack_object(char *buf, int size, int *idx,
 				bitd_object_t *a);
 int bitd_get_packed_size_object(bitd_object_t *a);
 
+/* Pack objects using the compact encoding: varint integers, and nvp
+   element names deduplicated within the message. Payloads of at least
+   lz4_threshold bytes are LZ4 compressed, if that makes them smaller. 
+   Set lz4_threshold to 0 to disable compression. Unpack with 
+   bitd_unpack_object(), which auto-detects the encoding. */
+bitd_boolean bitd_pack_object_compact(char *buf, int size, int *idx, 
+				      bitd_object_t *a, int lz4_threshold);
+
+/* Size of the uncompressed compact encoding. This is an upper bound on 
+   the size of the compressed encoding. */
+int bitd_get_packed_size_object_compact(bitd_object_t *a);
+
 /* Pack generic values by type */
 bitd_boolean bitd_pack_value(char *buf, int size, int *idx, 
 			     bitd_type_t t, bitd_value_t *v);
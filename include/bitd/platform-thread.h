@@ -43,6 +43,7 @@ extern "C"
 typedef struct bitd_thread_s *bitd_thread;
 typedef struct bitd_mutex_s *bitd_mutex;
 typedef struct bitd_event_s *bitd_event;
+typedef struct bitd_tls_s *bitd_tls;
 
 /* Thread entrypoint prototype */
 typedef void (bitd_thread_entrypoint_t)(void *thread_arg);
@@ -123,6 +124,24 @@ bitd_boolean bitd_event_wait(bitd_event e, bitd_uint32 timeout);
 /* Return the pollable vent file descriptor, if so equipped */
 bitd_socket_t bitd_event_to_fd(bitd_event e);
 
+/*
+ * Thread-local storage API
+ */
+
+/* 
+ * Create/destroy a thread-local slot. When a thread exits, the 
+ * destructor, if not NULL, is called with the thread's slot value, 
+ * unless that value is NULL. Destroying the slot does not call the 
+ * destructor.
+ */
+bitd_tls bitd_tls_create(void (*destructor)(void *value));
+void bitd_tls_destroy(bitd_tls t);
+
+/* Get/set the slot value for the current thread. The initial value 
+   is NULL. */
+void *bitd_tls_get(bitd_tls t);
+void bitd_tls_set(bitd_tls t, void *value);
+
 /*
  * Other APIs
  */
@@ -122,6 +122,37 @@ bitd_uint32 bitd_get_time_msec(void);
 /* returns nsecs since 1/1/1970 */
 bitd_uint64 bitd_get_time_nsec(void);
 
+/* Init the fast clock: calibrates the cpu timestamp counter, if it is
+   invariant and the kernel clock source is also the tsc. Setting the
+   BITD_SKIP_TSC environment variable disables the tsc. Called from
+   bitd_sys_init(). */
+bitd_boolean bitd_sys_time_init(void);
+
+/* returns nsecs since 1/1/1970, extrapolated from the timestamp counter
+   when calibrated, or else same as bitd_get_time_nsec(). Does not go
+   back within a thread, unless the system time is stepped back. */
+bitd_uint64 bitd_get_time_nsec_fast(void);
+
+/* returns the fast clock source name: "tsc" or "clock_gettime" */
+const char *bitd_get_time_fast_source(void);
+
+/* returns nsecs since 1/1/1970, at clock tick resolution */
+bitd_uint64 bitd_get_time_nsec_coarse(void);
+
+/* returns msecs since 1/1/1970, at clock tick resolution - may wrap
+   around */
+bitd_uint32 bitd_get_time_msec_coarse(void);
+
+/* 
+ * Per-thread cached time, for loops that read the time repeatedly in one
+ * iteration. bitd_time_cache_begin() reads and caches the fast clock,
+ * and bitd_get_time_nsec_cached() returns the cached time until
+ * bitd_time_cache_end(). Outside begin/end, returns the fast clock.
+ */
+bitd_uint64 bitd_time_cache_begin(void);
+void bitd_time_cache_end(void);
+bitd_uint64 bitd_get_time_nsec_cached(void);
+
 
 
 
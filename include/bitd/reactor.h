@@ -0,0 +1,127 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Shared I/O reactor
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+#ifndef _BITD_REACTOR_H_
+#define _BITD_REACTOR_H_
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/msg.h"
+
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* Default number of reactor I/O threads */
+#define BITD_REACTOR_LOOPS_DEF 2
+
+/* Reactor handle events */
+#define BITD_REACTOR_EV_READ  0x1
+#define BITD_REACTOR_EV_WRITE 0x2
+#define BITD_REACTOR_EV_ERROR 0x4 /* Error or hangup. Always reported. */
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* A reactor loop, served by one I/O thread */
+typedef struct bitd_reactor_loop_s *bitd_reactor_loop;
+
+/* A file descriptor, queue or timer registered with a reactor loop */
+typedef struct bitd_reactor_handle_s *bitd_reactor_handle;
+
+/* Handle callback. The events are zero for timer handles. */
+typedef void (bitd_reactor_callback_t)(bitd_reactor_handle h,
+				       bitd_uint32 events,
+				       void *cookie);
+
+/* Function executed on the reactor loop thread */
+typedef void (bitd_reactor_call_t)(void *cookie);
+
+/*****************************************************************************
+ *                            FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* Init/deinit the reactor. Init is a no-op if the reactor is already
+   initialized. If n_loops is 0, BITD_REACTOR_LOOPS_DEF loops are created. */
+bitd_boolean bitd_reactor_init(bitd_uint32 n_loops);
+void bitd_reactor_deinit(void);
+
+/* Get the loop with the fewest registered handles. Returns NULL if the
+   reactor is not initialized. */
+bitd_reactor_loop bitd_reactor_loop_get(void);
+
+/* Execute a function on the loop thread, optionally waiting for it to
+   complete. Called on the loop thread, the function executes
+   immediately. */
+void bitd_reactor_call(bitd_reactor_loop l,
+		       bitd_reactor_call_t *fn, void *cookie,
+		       bitd_boolean wait_p);
+
+/*
+ * The handle APIs below must be called on the loop thread - from a
+ * handle callback, or from a function passed to bitd_reactor_call().
+ * Callbacks of handles on the same loop never run concurrently.
+ */
+
+/* Register a file descriptor, waiting on BITD_REACTOR_EV_READ and/or
+   BITD_REACTOR_EV_WRITE events. Readiness is level-triggered. */
+bitd_reactor_handle bitd_reactor_fd_add(bitd_reactor_loop l,
+					bitd_socket_t fd,
+					bitd_uint32 events,
+					bitd_reactor_callback_t *cb,
+					void *cookie);
+
+/* Register a pollable queue. The callback is called with
+   BITD_REACTOR_EV_READ while the queue is not empty. */
+bitd_reactor_handle bitd_reactor_queue_add(bitd_reactor_loop l,
+					   bitd_queue q,
+					   bitd_reactor_callback_t *cb,
+					   void *cookie);
+
+/* Change the events waited on by a file descriptor or queue handle */
+void bitd_reactor_set_events(bitd_reactor_handle h, bitd_uint32 events);
+
+/* Get the file descriptor of a handle, or BITD_INVALID_SOCKID for timers */
+bitd_socket_t bitd_reactor_get_fd(bitd_reactor_handle h);
+
+/* Register a one-shot timer, initially not armed */
+bitd_reactor_handle bitd_reactor_timer_add(bitd_reactor_loop l,
+					   bitd_reactor_callback_t *cb,
+					   void *cookie);
+
+/* Arm a timer handle, or disarm it if tmo_msec is BITD_FOREVER */
+void bitd_reactor_timer_set(bitd_reactor_handle h, bitd_uint32 tmo_msec);
+
+/* Unregister a handle. Its callback will not be called again. */
+void bitd_reactor_remove(bitd_reactor_handle h);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _BITD_REACTOR_H_ */
@@ -0,0 +1,124 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Caching asynchronous name resolver
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+#ifndef _BITD_RESOLVE_H_
+#define _BITD_RESOLVE_H_
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* Default time to live of resolved, and of failed entries, in msecs */
+#define BITD_RESOLVE_TTL_DEF 300000
+#define BITD_RESOLVE_NEG_TTL_DEF 30000
+
+/* Default number of resolver threads */
+#define BITD_RESOLVE_THREADS_DEF 4
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* An asynchronous resolve request */
+typedef struct bitd_resolve_req_s *bitd_resolve_req;
+
+/* Completion callback. Called on a resolver thread, or on the calling
+   thread if the request completes from the cache. The ret and sa are
+   as returned by bitd_resolve_hostport(). */
+typedef void (bitd_resolve_callback_t)(bitd_resolve_req r,
+				       int ret,
+				       struct sockaddr_storage *sa,
+				       void *cookie);
+
+/* Resolver counters */
+typedef struct {
+    bitd_uint64 lookups;       /* Cache lookups */
+    bitd_uint64 hits;          /* Lookups answered from a resolved entry */
+    bitd_uint64 negative_hits; /* Lookups answered from a failed entry */
+    bitd_uint64 misses;        /* Lookups that waited for a resolution */
+    bitd_uint64 coalesced;     /* Misses joining a resolution in progress */
+    bitd_uint64 resolves;      /* Calls to bitd_resolve_hostport() */
+    bitd_uint64 failures;      /* Failed resolutions */
+    bitd_uint64 prefetches;    /* Resolutions started before expiry */
+    bitd_uint64 evictions;     /* Expired entries removed from the cache */
+    bitd_uint64 entries;       /* Entries currently in the cache */
+} bitd_resolve_stats_t;
+
+/*****************************************************************************
+ *                            FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+/* Init/deinit the resolver. Init is a no-op if the resolver is already
+   initialized. Requests pending at deinit complete with EAI_AGAIN. */
+bitd_boolean bitd_resolve_init(void);
+void bitd_resolve_deinit(void);
+
+/* Set the time to live of resolved and failed cache entries. Resolved
+   entries are refreshed in the background once 80% of their time to
+   live has elapsed, if they are still being looked up. */
+void bitd_resolve_set_ttl(bitd_uint32 ttl_msec, bitd_uint32 neg_ttl_msec);
+
+/* Resolve hostport in host:port or [host]:port format. Completes from
+   the cache when possible, else through the resolver threads, with
+   concurrent requests for the same hostport sharing one resolution.
+   Returns NULL if the resolver is not initialized. */
+bitd_resolve_req bitd_resolve_hostport_async(char *hostport,
+					     bitd_resolve_callback_t *cb,
+					     void *cookie);
+
+/* Pollable file descriptor, readable once the request completes */
+bitd_socket_t bitd_resolve_req_fd(bitd_resolve_req r);
+
+/* Get the result of a completed request. Returns FALSE if the request
+   is still pending. */
+bitd_boolean bitd_resolve_req_result(bitd_resolve_req r, int *ret,
+				     struct sockaddr_storage *sa, int salen);
+
+/* Free the request. A pending request is cancelled, and its callback
+   will not be called. */
+void bitd_resolve_req_free(bitd_resolve_req r);
+
+/* Blocking equivalent of bitd_resolve_hostport() going through the
+   cache. Falls back to bitd_resolve_hostport() if the resolver is not
+   initialized. */
+int bitd_resolve_hostport_cached(struct sockaddr_storage *sa, int salen,
+				 char *hostport);
+
+/* Get the resolver counters */
+void bitd_resolve_get_stats(bitd_resolve_stats_t *stats);
+
+/* Drop all cache entries not being resolved */
+void bitd_resolve_flush(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _BITD_RESOLVE_H_ */
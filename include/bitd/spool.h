@@ -0,0 +1,90 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Durable on-disk message spool
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+#ifndef _BITD_SPOOL_H_
+#define _BITD_SPOOL_H_
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/msg.h"
+
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* Default size of a spool segment file */
+#define BITD_SPOOL_SEGMENT_SIZE_DEF (4*1024*1024)
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* The spool opaque type */
+typedef struct bitd_spool_s *bitd_spool;
+
+/*****************************************************************************
+ *                            FUNCTION DEFINITIONS
+ *****************************************************************************/
+
+#define BITD_SPOOL_FLAG_SYNC 0x1 /* Sync each record to disk, so records
+				    survive a system crash. Without it,
+				    records survive a process crash. */
+
+/* Open a spool in a directory, creating the directory if needed, and
+   recover the records left in it by a previous owner. The spool is an
+   append-only sequence of memory-mapped segment files. Returns NULL if
+   the spool can't be opened, or on platforms without mmap support. */
+bitd_spool bitd_spool_open(char *dir,
+			   bitd_uint32 segment_size, /* If 0, use default */
+			   bitd_uint64 size_quota,   /* If 0, one segment */
+			   bitd_uint32 flags);       /* BITD_SPOOL_FLAG_SYNC */
+void bitd_spool_close(bitd_spool s);
+
+/* Append a record. Fails if the record does not fit in a segment, or
+   if the spool quota has been reached. */
+bitd_boolean bitd_spool_append(bitd_spool s, char *buf, bitd_uint32 size);
+
+/* Read the oldest records, concatenated into one message of up to
+   max_size bytes. At least one record is read, even if larger than
+   max_size. Returns NULL if the spool is empty. The records stay in the
+   spool until bitd_spool_commit() is called, and are read again by the
+   next bitd_spool_read() if not committed. */
+bitd_msg bitd_spool_read(bitd_spool s, bitd_uint32 max_size);
+
+/* Consume the records returned by the last bitd_spool_read(). Fully
+   consumed segments are recycled. */
+void bitd_spool_commit(bitd_spool s);
+
+/* Get the spool record count & payload size */
+bitd_uint32 bitd_spool_count(bitd_spool s);
+bitd_uint64 bitd_spool_size(bitd_spool s);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _BITD_SPOOL_H_ */
@@ -27,6 +27,8 @@ extern "C"
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* No next expiration, as returned by bitd_timer_list_get_timeout_nsec() */
+#define BITD_FOREVER_NSEC 0xffffffffffffffffULL
 
 
 /*****************************************************************************
@@ -93,6 +95,10 @@ void bitd_timer_list_set_ticks_max(bitd_timer_list l, int ticks_max);
    timeout internally. */
 bitd_uint32 bitd_timer_list_get_timeout_msec(bitd_timer_list l);
 
+/* Returns the time until the next expiration in nsecs, zero if a timer
+   has expired, or BITD_FOREVER_NSEC if no next expiration */
+bitd_uint64 bitd_timer_list_get_timeout_nsec(bitd_timer_list l);
+
 /* Return the number of timers on list */
 long bitd_timer_list_count(bitd_timer_list l);
 
@@ -58,6 +58,18 @@ typedef struct {
     bitd_uint64 tstamp;  /* The timestamp in ns */
 } ts_timestamp_t;
 
+/* A datagram sent by ts_sendmmsg(), or received by ts_recvmmsg() */
+typedef struct {
+    void *buf;              /* The datagram buffer */
+    int len;                /* Bytes to send, or the buffer size. Set to
+			       the received datagram size on receive. */
+    struct sockaddr *addr;  /* Destination or source address, or NULL */
+    int addrlen;            /* Address size. Set on receive. */
+    ts_timestamp_t ts;      /* Receive timestamp. On send, the software
+			       send timestamp, and in ts.seq the key of
+			       the tx timestamps of the datagram. */
+} ts_mmsg_t;
+
 /*****************************************************************************
  *                            FUNCTION DEFINITIONS
  *****************************************************************************/
@@ -100,6 +112,17 @@ int ts_recvfrom(ts_socket_t sock, void *buf, int len, int flags,
 		struct sockaddr *from, int *fromlen,
 		ts_timestamp_t *ts);
 
+/* Send n datagrams, with as few system calls as possible. Returns the
+   number of datagrams sent, or -1 if none could be sent. The tx
+   timestamps are retrieved as with ts_send(). */
+int ts_sendmmsg(ts_socket_t s, ts_mmsg_t *msgs, int n, int flags);
+
+/* Receive up to n datagrams, each with its timestamp. Waits for the
+   first datagram only, unless flags has MSG_DONTWAIT or the socket is
+   non-blocking. Returns the number of datagrams received, or -1 if none
+   was received. */
+int ts_recvmmsg(ts_socket_t s, ts_mmsg_t *msgs, int n, int flags);
+
 /* Get the timestamp file id, to poll for tx timestamps. On some platforms
    this is same as the sock_fd. */
 int ts_get_tstamp_fd(ts_socket_t s);
@@ -107,6 +130,10 @@ int ts_get_tstamp_fd(ts_socket_t s);
 /* Get a transmit timestamp. Returns -1 on failure. */
 int ts_get_tstamp_tx(ts_socket_t s, ts_timestamp_t *ts);
 
+/* Get up to n transmit timestamps without waiting. Returns the number of
+   timestamps, or -1 on failure. */
+int ts_get_tstamp_tx_batch(ts_socket_t s, ts_timestamp_t *ts, int n);
+
 /*
  * Get and set socket options. The SOL_TS_SOCKET level is specific 
  * to ts_sockets.
@@ -16,6 +16,8 @@
 #include "bitd/mmr-api.h"
 #include "bitd/file.h"
 #include "bitd/timer-thread.h"
+#include "bitd/reactor.h"
+#include "bitd/resolve.h"
 #include "bitd/log.h"
 #include "signal.h" /* Should work for Win32 also */
 
@@ -99,6 +101,13 @@ static bitd_boolean g_xml_results;
 static long g_result_count = 0;
 static long g_max_result_count = 0;
 
+/* The number of reactor I/O threads, or 0 for the default */
+static bitd_uint32 g_n_io_threads = 0;
+
+/* The resolver cache ttls */
+static bitd_uint32 g_resolve_ttl = BITD_RESOLVE_TTL_DEF;
+static bitd_uint32 g_resolve_neg_ttl = BITD_RESOLVE_NEG_TTL_DEF;
+
 static bitd_boolean g_got_sigint;
 static bitd_boolean g_got_sigterm;
 static bitd_boolean g_got_sighup;
@@ -146,6 +155,17 @@ void usage() {
 	   "    DLL load library path.\n"
 	   "  --n-worker-threads thread_count\n"
 	   "    Set the max number of worker theads.\n"
+	   "  --timer-slack-nsec nsec\n"
+	   "    Allow task runs to be delayed by up to nsec, so nearby runs\n"
+	   "    share one event loop wakeup. Default: 0.\n"
+	   "  --n-io-threads thread_count\n"
+	   "    Set the number of I/O threads shared by the sink tasks.\n"
+	   "    Default: %d.\n"
+	   "  --resolve-ttl msec\n"
+	   "    Cache resolved host names for that long. Default: %d.\n"
+	   "  --resolve-neg-ttl msec\n"
+	   "    Cache host name resolution failures for that long.\n"
+	   "    Default: %d.\n"
            "  -l|--log-level none|crit|error|warn|info|debug|trace\n"
            "    Set the log level (default: none).\n"
  	   "  -lk|--log-key-level key_name none|crit|error|warn|info|debug|trace\n"
@@ -156,11 +176,17 @@ void usage() {
 	   "    Set the log file size. Default: %d.\n"
 	   "  -lc|--log-file-count count\n"
 	   "    Set the log file count. Default: %d.\n"
+	   "  -lb|--log-file-binary\n"
+	   "    Save log messages as binary records, rendered as text by\n"
+	   "    bitd-log-decode.\n"
            "  -h, --help, -?\n"
            "    Show this help.\n"
 	   "Environment vaiables (command line options take precedence):\n"
 	   "    %s - Dll load library path.\n",
 	   RESULT_FILE_DEF,
+	   BITD_REACTOR_LOOPS_DEF,
+	   BITD_RESOLVE_TTL_DEF,
+	   BITD_RESOLVE_NEG_TTL_DEF,
 	   LOG_FILE_NAME_DEF,
 	   LOG_FILE_SIZE_DEF,
 	   LOG_FILE_COUNT_DEF,
@@ -397,6 +423,7 @@ bitd_nvp_t parse_config_yaml(FILE *f) {
 bitd_boolean set_task_inst_config(bitd_nvp_t config_nvp) {
     bitd_nvp_t modules_nvp = NULL;
     bitd_nvp_t task_inst_nvp = NULL;
+    bitd_nvp_t pools_nvp = NULL;
     int i, idx;
     mmr_err_t ret;
 
@@ -410,6 +437,15 @@ bitd_boolean set_task_inst_config(bitd_nvp_t config_nvp) {
 	MMR_NOERROR(mmr_set_tags(tags));
     }
 
+    /* Declare the worker pools, before the task instances that use them */
+    {
+	char *elem_names[] = {"worker-pool"};
+	pools_nvp = bitd_nvp_trim_bytype(config_nvp, elem_names, 1,
+					 bitd_type_nvp);
+	MMR_NOERROR(mmr_set_worker_pools(pools_nvp));
+	bitd_nvp_free(pools_nvp);
+    }
+
     /* Find the list of modules */
     if (bitd_nvp_lookup_elem(config_nvp, "modules", &idx) &&
 	config_nvp->e[idx].type == bitd_type_nvp) {
@@ -922,6 +958,58 @@ int main(int argc, char **argv) {
 			    &v,
 			    bitd_type_int64);
 
+	} else if (!strcmp(argv[0], "--timer-slack-nsec")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+	    /* Replace the timer slack in the config */
+	    bitd_nvp_delete_elem(mmr_config_nvp, "timer-slack-nsec");
+	    v.value_int64 = (bitd_int64)atoll(argv[0]);
+
+	    bitd_nvp_add_elem(&mmr_config_nvp, 
+			    "timer-slack-nsec",
+			    &v,
+			    bitd_type_int64);
+
+	} else if (!strcmp(argv[0], "--n-io-threads")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+	    g_n_io_threads = (bitd_uint32)atoi(argv[0]);
+
+	} else if (!strcmp(argv[0], "--resolve-ttl") ||
+		   !strcmp(argv[0], "--resolve-neg-ttl")) {
+	    char *opt = argv[0];
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+	    if (!strcmp(opt, "--resolve-ttl")) {
+		g_resolve_ttl = (bitd_uint32)atoi(argv[0]);
+	    } else {
+		g_resolve_neg_ttl = (bitd_uint32)atoi(argv[0]);
+	    }
+
 	} else if (!strcmp(argv[0], "-c") ||
 		   !strcmp(argv[0], "-cx") ||
 		   !strcmp(argv[0], "-cy")) {
@@ -1110,6 +1198,11 @@ int main(int argc, char **argv) {
 
 	    ttlog_set_log_file_count(atoi(argv[0]));
 	    
+	} else if (!strcmp(argv[0], "-lb") ||
+		   !strcmp(argv[0], "--log-file-binary")) {
+
+	    ttlog_set_log_file_binary(TRUE);
+	    
         } else if (!strcmp(argv[0], "-h") ||
                    !strcmp(argv[0], "--help") ||
                    !strcmp(argv[0], "-?")) {
@@ -1157,11 +1250,19 @@ int main(int argc, char **argv) {
 	}
     }
     
+    /* Start the I/O threads shared by the modules */
+    bitd_reactor_init(g_n_io_threads);
+
+    /* Start the resolver cache shared by the modules */
+    bitd_resolve_init();
+    bitd_resolve_set_ttl(g_resolve_ttl, g_resolve_neg_ttl);
+
     /* Initialize the module manager */
     MMR_NOERROR(mmr_init());
 
     /* Set the mmr logger */
     MMR_NOERROR(mmr_set_vlog_func(&mvlog));
+    MMR_NOERROR(mmr_set_log_keyid(g_log_mmr_keyid));
 
     /* Set the results report callback */
     MMR_NOERROR(mmr_results_register(&report_results));
@@ -1248,6 +1349,8 @@ int main(int argc, char **argv) {
     /* Deinitialize logger */
     ttlog_deinit(FALSE);
 
+    bitd_resolve_deinit();
+    bitd_reactor_deinit();
     tth_deinit();
     bitd_sys_deinit();
 
@@ -0,0 +1,167 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:   
+ * Description: Render binary log files as text
+ * 
+ * Copyright (C) 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission, 
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES 
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/log.h"
+#include "bitd/file.h"
+
+#include <errno.h>
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS 
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static char* g_prog_name = "";
+static char* g_output_file = NULL;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void usage() {
+
+    printf("\nUsage: %s [OPTIONS ... ] input_file ...\n\n", g_prog_name);
+    printf("This program renders binary log files as text. Archived log\n"
+	   "files should be listed oldest first.\n\n");
+
+    printf("Options:\n"
+           "    -o|--output output_file\n"
+           "       Output file. Default: stdout.\n"
+           "    -h, --help, -?\n"
+           "       Show this help.\n");
+
+    exit(0);
+} 
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+int main(int argc, char **argv) {
+    FILE *in, *out = stdout;
+    int n_lines, ret = 0;
+
+    /* Parse program name argument */
+    g_prog_name = bitd_get_leaf_filename(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    /* Parse command line parameters */
+    while (argc && argv[0][0] == '-' && argv[0][1]) {
+        if (!strcmp(argv[0], "-o") ||
+	    !strcmp(argv[0], "--output")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (argc < 1) {
+                usage();
+            }
+
+	    g_output_file = argv[0];
+        } else {
+            usage();
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;        
+    }
+
+    if (!argc) {
+	usage();
+    }
+
+    if (g_output_file && strcmp(g_output_file, "stdout")) {
+	out = fopen(g_output_file, "w");
+	if (!out) {
+	    fprintf(stderr, "%s: Could not open %s: %s.\n",
+		    g_prog_name, g_output_file, strerror(errno));
+	    return -1;
+	}
+    }
+
+    /* Decode the input files */
+    for (; argc; argc--, argv++) {
+	if (!strcmp(argv[0], "-")) {
+	    in = stdin;
+	} else {
+	    in = fopen(argv[0], "rb");
+	    if (!in) {
+		fprintf(stderr, "%s: Could not open %s: %s.\n",
+			g_prog_name, argv[0], strerror(errno));
+		ret = -1;
+		continue;
+	    }
+	}
+
+	n_lines = ttlog_decode(in, out);
+	if (n_lines < 0) {
+	    fprintf(stderr, "%s: %s: Invalid binary log file.\n",
+		    g_prog_name, argv[0]);
+	    ret = -1;
+	}
+
+	if (in != stdin) {
+	    fclose(in);
+	}
+    }
+
+    if (out != stdout) {
+	fclose(out);
+    }
+
+    return ret;
+} 
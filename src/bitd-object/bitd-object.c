@@ -59,6 +59,8 @@ static bitd_boolean g_output_single_line = FALSE;
 static bitd_boolean g_output_full = FALSE;
 static int g_chunk_size = CHUNK_SIZE_DEF;
 static bitd_boolean g_pack = FALSE;
+static bitd_boolean g_pack_compact = FALSE;
+static int g_pack_lz4_threshold = 0;
 static bitd_boolean g_chunk = FALSE;
 static bitd_boolean g_unchunk = FALSE;
 static bitd_boolean g_sort = FALSE;
@@ -111,6 +113,11 @@ void usage() {
 	   "       Parse in this chunk size. Default: %d.\n"
 	   "    -p|--pack\n"
 	   "       Do a pack-unpack to test the packing mechanism.\n"
+	   "    -pc|--pack-compact\n"
+	   "       Same as --pack, using the compact encoding.\n"
+	   "    -pz|--pack-lz4 threshold\n"
+	   "       Same as --pack-compact, compressing payloads of at least\n"
+	   "       threshold bytes.\n"
 	   "    -chunk\n"
 	   "       Chunk the object nvp, to test the chunking mechanism.\n"
 	   "    -unchunk\n"
@@ -529,6 +536,23 @@ int main(int argc, char **argv) {
         } else if (!strcmp(argv[0], "-p") ||
 		   !strcmp(argv[0], "--pack")) {
 	    g_pack = TRUE;
+        } else if (!strcmp(argv[0], "-pc") ||
+		   !strcmp(argv[0], "--pack-compact")) {
+	    g_pack = TRUE;
+	    g_pack_compact = TRUE;
+        } else if (!strcmp(argv[0], "-pz") ||
+		   !strcmp(argv[0], "--pack-lz4")) {
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+
+            if (argc < 1) {
+                usage();
+            }
+
+	    g_pack = TRUE;
+	    g_pack_compact = TRUE;
+	    g_pack_lz4_threshold = atoi(argv[0]);
         } else if (!strcmp(argv[0], "-chunk")) {
 	    g_chunk = TRUE;
         } else if (!strcmp(argv[0], "-unchunk")) {
@@ -590,12 +614,20 @@ int main(int argc, char **argv) {
     }
 
     if (g_pack) {
-	size = bitd_get_packed_size_object(&a);
+	if (g_pack_compact) {
+	    size = bitd_get_packed_size_object_compact(&a);
+	} else {
+	    size = bitd_get_packed_size_object(&a);
+	}
 	
 	buf = malloc(size);
 	idx = 0;
 
-	if (!bitd_pack_object(buf, size, &idx, &a)) {
+	if ((g_pack_compact && 
+	     !bitd_pack_object_compact(buf, size, &idx, &a, 
+				       g_pack_lz4_threshold)) ||
+	    (!g_pack_compact && 
+	     !bitd_pack_object(buf, size, &idx, &a))) {
 	    fprintf(stderr, 
 		    "%s: Failed to pack the object, size = %d, idx = %d.\n",
 		    g_prog_name, size, idx);
@@ -607,13 +639,15 @@ int main(int argc, char **argv) {
 	bitd_object_free(&a);
 	bitd_object_init(&a);
 	
-	if (size != idx) {
+	/* Only compression can make the packed size smaller */
+	if (size != idx && (!g_pack_lz4_threshold || idx > size)) {
 	    fprintf(stderr, "%s: nvp packed into different size %d than allocated (%d).\n",
 		    g_prog_name, idx, size);
 	    free(buf);
 	    ret = -1;
 	    goto end;
 	}
+	size = idx;
 
 	idx = 0;
 	if (!bitd_unpack_object(buf, size, &idx, &a)) {
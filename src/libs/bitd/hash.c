@@ -19,31 +19,50 @@
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* Number of lock stripes. Must be a power of two. */
+#define HASH_STRIPE_BITS 6
+#define HASH_STRIPES (1 << HASH_STRIPE_BITS)
 
+/* Initial slot count of a stripe. Must be a power of two. */
+#define HASH_STRIPE_SLOTS_MIN 8
+
+/* The stored hash of an empty slot */
+#define HASH_EMPTY 0
 
 /*****************************************************************************
  *                                  MACROS
  *****************************************************************************/
 
-
+/* A stripe grows once it is more than 3/4 full */
+#define HASH_STRIPE_FULL(st) (4 * ((st)->count + 1) > 3 * ((st)->mask + 1))
 
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
 
-typedef struct hash_entry {
-    bitd_uint32 hashed_key;
+/* An open addressing slot */
+typedef struct hash_slot {
+    bitd_uint32 hashed_key;     /* Mixed hash, or HASH_EMPTY */
     bitd_hash_key key;
     bitd_hash_value value;
-    struct hash_entry *next;    
-} hash_entry;
+} hash_slot;
 
-struct bitd_hash_s {
+/* A lock stripe. Each stripe is a linear probing table of its own,
+   resized independently of the other stripes. */
+typedef struct hash_stripe {
     bitd_mutex lock;
+    bitd_uint32 mask;           /* Slot count - 1 */
+    bitd_uint32 count;          /* Used slots */
+    hash_slot *slots;           /* Allocated on first add */
+    char pad[64 - sizeof(bitd_mutex) - 2 * sizeof(bitd_uint32) -
+	     sizeof(hash_slot *)]; /* Avoid false sharing between stripes */
+} hash_stripe;
+
+struct bitd_hash_s {
     bitd_hash_func_t *hash_func;
     bitd_hash_compare_t *hash_cmp;
     bitd_hash_free_t *hash_free;
-    hash_entry *e[256];
+    hash_stripe stripes[HASH_STRIPES];
 };
 
 
@@ -64,6 +83,136 @@ struct bitd_hash_s {
  *****************************************************************************/
 
 
+/*
+ *============================================================================
+ *                        hash_mix
+ *============================================================================
+ * Description: Mix the user hash, so that both the stripe (high) bits and
+ *     the slot (low) bits are well distributed. Never returns HASH_EMPTY.
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint32 hash_mix(bitd_uint32 x) {
+
+    /* The murmur3 finalizer */
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+
+    return x == HASH_EMPTY ? 1 : x;
+}
+
+
+/*
+ *============================================================================
+ *                        hash_stripe_get
+ *============================================================================
+ * Description: Get the stripe of a mixed hash
+ * Parameters:
+ * Returns:
+ */
+static hash_stripe *hash_stripe_get(bitd_hash h, bitd_uint32 hashed_key) {
+    return &h->stripes[hashed_key >> (32 - HASH_STRIPE_BITS)];
+}
+
+
+/*
+ *============================================================================
+ *                        hash_stripe_find
+ *============================================================================
+ * Description: Find the slot of a key, or the empty slot ending its probe
+ *     sequence. Called with the stripe lock held, on an allocated stripe.
+ * Parameters:
+ * Returns:
+ */
+static hash_slot *hash_stripe_find(bitd_hash h, hash_stripe *st,
+				   bitd_uint32 hashed_key, bitd_hash_key k) {
+    bitd_uint32 idx;
+    hash_slot *sl;
+
+    for (idx = hashed_key & st->mask; ; idx = (idx + 1) & st->mask) {
+	sl = &st->slots[idx];
+	if (sl->hashed_key == HASH_EMPTY) {
+	    return sl;
+	}
+	if (sl->hashed_key == hashed_key && !h->hash_cmp(sl->key, k)) {
+	    return sl;
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        hash_stripe_grow
+ *============================================================================
+ * Description: Double the stripe slot count, or allocate the initial slots.
+ *     Called with the stripe lock held.
+ * Parameters:
+ * Returns:
+ */
+static void hash_stripe_grow(hash_stripe *st) {
+    hash_slot *old_slots = st->slots, *sl;
+    bitd_uint32 old_n = old_slots ? st->mask + 1 : 0, n, i, idx;
+
+    n = old_n ? 2 * old_n : HASH_STRIPE_SLOTS_MIN;
+    st->slots = calloc(n, sizeof(hash_slot));
+    st->mask = n - 1;
+
+    /* Rehash. The keys are known to be distinct. */
+    for (i = 0; i < old_n; i++) {
+	if (old_slots[i].hashed_key != HASH_EMPTY) {
+	    for (idx = old_slots[i].hashed_key & st->mask;
+		 st->slots[idx].hashed_key != HASH_EMPTY;
+		 idx = (idx + 1) & st->mask);
+	    sl = &st->slots[idx];
+	    *sl = old_slots[i];
+	}
+    }
+
+    if (old_slots) {
+	free(old_slots);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        hash_stripe_delete
+ *============================================================================
+ * Description: Empty a slot, shifting back the entries of its probe
+ *     sequence so that no tombstones are needed. Called with the stripe
+ *     lock held.
+ * Parameters:
+ * Returns:
+ */
+static void hash_stripe_delete(hash_stripe *st, hash_slot *sl) {
+    bitd_uint32 i, j, home;
+
+    i = (bitd_uint32)(sl - st->slots);
+    for (j = (i + 1) & st->mask;
+	 st->slots[j].hashed_key != HASH_EMPTY;
+	 j = (j + 1) & st->mask) {
+	home = st->slots[j].hashed_key & st->mask;
+
+	/* Move slot j into the hole at i, unless its home lies
+	   cyclically in (i, j] */
+	if ((j > i && (home <= i || home > j)) ||
+	    (j < i && (home <= i && home > j))) {
+	    st->slots[i] = st->slots[j];
+	    i = j;
+	}
+    }
+
+    st->slots[i].hashed_key = HASH_EMPTY;
+    st->slots[i].key = NULL;
+    st->slots[i].value = NULL;
+    st->count--;
+}
+
+
 /*
  *============================================================================
  *                        bitd_hash_create
@@ -81,6 +230,7 @@ bitd_hash bitd_hash_create(bitd_hash_func_t *f,
 			   bitd_hash_free_t *g) {
     bitd_hash h = NULL;
     int ret = -1;
+    int i;
 
     /* Paramter check */
     if (!f || !cmp) {
@@ -89,9 +239,11 @@ bitd_hash bitd_hash_create(bitd_hash_func_t *f,
 
     /* Allocate the hash control block */
     h = calloc(1, sizeof(*h));
-    h->lock = bitd_mutex_create();
-    if (!h->lock) {
-        goto end;
+    for (i = 0; i < HASH_STRIPES; i++) {
+	h->stripes[i].lock = bitd_mutex_create();
+	if (!h->stripes[i].lock) {
+	    goto end;
+	}
     }
     
     /* Copy the function pointers */
@@ -121,25 +273,27 @@ end:
  * Returns:
  */
 void bitd_hash_destroy(bitd_hash h) {
-    bitd_uint32 idx;
-    hash_entry *e, *e_next = NULL;
-
+    hash_stripe *st;
+    bitd_uint32 i, idx;
 
     if (h) {
-        for (idx = 0; idx < 255; idx++) {
-            for (e = h->e[idx]; e; e = e_next) {
-                e_next = e->next;
-                
-                if (h->hash_free) {
-                    h->hash_free(e->key, e->value);
-                }
-                free(e);
-            }
-        }
+	for (i = 0; i < HASH_STRIPES; i++) {
+	    st = &h->stripes[i];
+
+	    if (st->slots) {
+		for (idx = 0; idx <= st->mask; idx++) {
+		    if (st->slots[idx].hashed_key != HASH_EMPTY &&
+			h->hash_free) {
+			h->hash_free(st->slots[idx].key, st->slots[idx].value);
+		    }
+		}
+		free(st->slots);
+	    }
         
-        if (h->lock) {
-            bitd_mutex_destroy(h->lock);
-        }
+	    if (st->lock) {
+		bitd_mutex_destroy(st->lock);
+	    }
+	}
         free(h);
     }
 }
@@ -155,33 +309,37 @@ void bitd_hash_destroy(bitd_hash h) {
  */
 bitd_boolean bitd_hash_add(bitd_hash h, bitd_hash_key k, bitd_hash_value v) {
     bitd_uint32 hashed_key;
-    bitd_uint32 idx;
-    hash_entry *e;
+    hash_stripe *st;
+    hash_slot *sl;
 
-    hashed_key = h->hash_func(k);
-    idx = hashed_key & 0xff;
+    hashed_key = hash_mix(h->hash_func(k));
+    st = hash_stripe_get(h, hashed_key);
 
-    bitd_mutex_lock(h->lock);
+    bitd_mutex_lock(st->lock);
+
+    if (!st->slots) {
+	hash_stripe_grow(st);
+    }
 
     /* Make sure there's no key collision */
-    for (e = h->e[idx]; e; e = e->next) {
-        if (e->hashed_key == hashed_key &&
-            !h->hash_cmp(e->key, k)) {
-            /* Key collision */
-            bitd_mutex_unlock(h->lock);            
-            return FALSE;            
-        }
+    sl = hash_stripe_find(h, st, hashed_key, k);
+    if (sl->hashed_key != HASH_EMPTY) {
+	/* Key collision */
+	bitd_mutex_unlock(st->lock);
+	return FALSE;
+    }
+
+    if (HASH_STRIPE_FULL(st)) {
+	hash_stripe_grow(st);
+	sl = hash_stripe_find(h, st, hashed_key, k);
     }
-     
-    /* Insert at head of list */
-    e = malloc(sizeof(hash_entry));
-    e->hashed_key = hashed_key;
-    e->key = k;
-    e->value = v;
-    e->next = h->e[idx];
-    h->e[idx] = e;
 
-    bitd_mutex_unlock(h->lock);
+    sl->hashed_key = hashed_key;
+    sl->key = k;
+    sl->value = v;
+    st->count++;
+
+    bitd_mutex_unlock(st->lock);
 
     return TRUE;
 }
@@ -198,64 +356,127 @@ bitd_boolean bitd_hash_add(bitd_hash h, bitd_hash_key k, bitd_hash_value v) {
  */
 bitd_boolean bitd_hash_remove(bitd_hash h, bitd_hash_key k) {
     bitd_uint32 hashed_key;
-    bitd_uint32 idx;
-    hash_entry *e, *e_prev;
-
-    hashed_key = h->hash_func(k);
-    idx = hashed_key & 0xff;
-
-    bitd_mutex_lock(h->lock);
-
-    for (e = h->e[idx], e_prev = NULL; e; e_prev = e, e = e->next) {
-        if (e->hashed_key == hashed_key &&
-            !h->hash_cmp(e->key, k)) {
-            /* Key match */
-            if (!e_prev) {
-                bitd_assert(e == h->e[idx]);
-                h->e[idx] = e->next;
-            } else {
-                e_prev->next = e->next;
-            }
-
-            if (h->hash_free) {
-                h->hash_free(e->key, e->value);
-            }
-            free(e);
-            bitd_mutex_unlock(h->lock);
-            return TRUE;            
-        }
+    bitd_hash_key key;
+    bitd_hash_value value;
+    hash_stripe *st;
+    hash_slot *sl;
+
+    hashed_key = hash_mix(h->hash_func(k));
+    st = hash_stripe_get(h, hashed_key);
+
+    bitd_mutex_lock(st->lock);
+
+    if (st->slots) {
+	sl = hash_stripe_find(h, st, hashed_key, k);
+	if (sl->hashed_key != HASH_EMPTY) {
+	    /* Key match */
+	    key = sl->key;
+	    value = sl->value;
+	    hash_stripe_delete(st, sl);
+
+	    if (h->hash_free) {
+		h->hash_free(key, value);
+	    }
+	    bitd_mutex_unlock(st->lock);
+	    return TRUE;
+	}
     }
 
-    bitd_mutex_unlock(h->lock);
+    bitd_mutex_unlock(st->lock);
 
     return FALSE;
 }
 
 
+/*
+ *============================================================================
+ *                        bitd_hash_lookup
+ *============================================================================
+ * Description: Look up a hash element
+ * Parameters:
+ *     h - the hash
+ *     k - the key
+ *     v [OUT] - the element value, if found. May be NULL.
+ * Returns: TRUE if the element was found
+ */
+bitd_boolean bitd_hash_lookup(bitd_hash h, bitd_hash_key k, 
+			      bitd_hash_value *v) {
+    bitd_uint32 hashed_key;
+    bitd_boolean found_p = FALSE;
+    hash_stripe *st;
+    hash_slot *sl;
+
+    hashed_key = hash_mix(h->hash_func(k));
+    st = hash_stripe_get(h, hashed_key);
+
+    bitd_mutex_lock(st->lock);
+
+    if (st->slots) {
+	sl = hash_stripe_find(h, st, hashed_key, k);
+	if (sl->hashed_key != HASH_EMPTY) {
+	    if (v) {
+		*v = sl->value;
+	    }
+	    found_p = TRUE;
+	}
+    }
+
+    bitd_mutex_unlock(st->lock);
+
+    return found_p;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_hash_count
+ *============================================================================
+ * Description: Get the number of elements in the hash
+ * Parameters:
+ * Returns:
+ */
+bitd_uint32 bitd_hash_count(bitd_hash h) {
+    bitd_uint32 i, count = 0;
+
+    for (i = 0; i < HASH_STRIPES; i++) {
+	bitd_mutex_lock(h->stripes[i].lock);
+	count += h->stripes[i].count;
+	bitd_mutex_unlock(h->stripes[i].lock);
+    }
+
+    return count;
+}
+
+
 /*
  *============================================================================
  *                        bitd_hash_map
  *============================================================================
  * Description: Call the passed-in map function for all elements in the hash.
- *     The mapping function may safely remove or add elements to the hash.
+ *     The stripes are locked one at a time, so the map is not an atomic
+ *     snapshot of the hash. The mapping function may not add or remove
+ *     elements.
  * Parameters:
  * Returns:
  */
 void bitd_hash_map(bitd_hash h, bitd_hash_map_t *m, void *cookie) {
-    bitd_uint32 idx;
-    hash_entry *e;
-
-    bitd_mutex_lock(h->lock);
-
-    /* Make sure there's no key collision */
-    for (idx = 0; idx < 255; idx++) {
-        for (e = h->e[idx]; e; e = e->next) {
-            /* Execute the map function */
-            m(e->key, e->value, cookie);
-        }
+    hash_stripe *st;
+    bitd_uint32 i, idx;
+
+    for (i = 0; i < HASH_STRIPES; i++) {
+	st = &h->stripes[i];
+
+	bitd_mutex_lock(st->lock);
+	if (st->slots) {
+	    for (idx = 0; idx <= st->mask; idx++) {
+		if (st->slots[idx].hashed_key != HASH_EMPTY) {
+		    /* Execute the map function */
+		    m(st->slots[idx].key, st->slots[idx].value, cookie);
+		}
+	    }
+	}
+	bitd_mutex_unlock(st->lock);
     }
-
-    bitd_mutex_unlock(h->lock);
 }
 
 
@@ -294,12 +515,14 @@ bitd_int32 bitd_hash_compare_int32(bitd_hash_key k1, bitd_hash_key k2) {
  * Returns:
  */
 bitd_uint32 bitd_hash_func_string(bitd_hash_key k) {
-    bitd_uint32 hashed_key = 0;
+    bitd_uint32 hashed_key = 2166136261U;
     char *c = (char *)k, c1;
 
+    /* FNV-1a */
     if (c) {
         while((c1 = *c++)) {
-            hashed_key += c1;
+            hashed_key ^= (unsigned char)c1;
+            hashed_key *= 16777619U;
         }
     }
 
@@ -30,6 +30,13 @@
 #define THREAD_IDLE_TMO_DEF 300000 /* 300 secs (5 minutes) */
 #define TASK_MAX_DEF 0 /* Unlimited */
 
+/* The stride charged to a class for a task of weight 1 and a class 
+   weight of 1 */
+#define CLASS_STRIDE (1 << 20)
+
+/* The initial size of the class task heap */
+#define CLASS_HEAP_SIZE_DEF 16
+
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
@@ -60,10 +67,31 @@ typedef struct bitd_lambda_thread {
 typedef struct bitd_lambda_task {
     bitd_lambda_task_func_t *f;
     void *cookie;
-    struct bitd_lambda_task *next;
+    bitd_uint64 enqueue_nsec;  /* When the task was queued */
+    bitd_uint64 deadline_nsec; /* When the task should start, or 0 */
+    bitd_uint64 key_nsec;      /* The deadline, or the enqueue time */
+    bitd_uint64 seq;           /* Orders tasks with the same key */
+    bitd_uint32 stride;        /* What the task charges to its class */
 } bitd_lambda_task;
 
 
+/*
+ * Classes are served by stride scheduling: the class with queued tasks 
+ * and the lowest pass runs next, and its pass then advances by the 
+ * stride of the task. Within a class, tasks are kept in a min-heap and
+ * served earliest deadline first.
+ */
+typedef struct bitd_lambda_class {
+    bitd_lambda_task **heap;   /* Queued tasks, earliest key first */
+    int n_heap;
+    int n_heap_max;
+    int weight;                /* Class share */
+    int thread_min;            /* Threads reserved for the class */
+    bitd_uint64 pass;          /* Class virtual time */
+    bitd_lambda_class_stats_t stats;
+} bitd_lambda_class;
+
+
 typedef struct bitd_lambda {
     char *name; /* The thread pool name */
     struct bitd_lambda_thread *thread_head; /* List of all threads */
@@ -76,11 +104,15 @@ typedef struct bitd_lambda {
     int thread_count; /* How many threads are on thread list */
     int thread_idx;   /* Used to ensure new thread names are unique */
     int thread_max;   /* Max number of threads */
+    int thread_min;   /* Idle threads don't exit below this count */
+    int thread_exiting; /* Threads on the exited list */
     bitd_uint32 thread_idle_tmo; /* Threads idle for longer will exit (msec) */
     int n_tasks;
     int task_max;
-    bitd_lambda_task *task_start;
-    bitd_lambda_task *task_end;
+    int n_running;    /* Tasks executing, in all classes */
+    bitd_uint64 pass; /* Pool virtual time, the pass of the last class run */
+    bitd_uint64 seq;  /* Counts the queued tasks */
+    bitd_lambda_class classes[bitd_lambda_class_count];
     bitd_boolean stopping_p;  /* TRUE if the thread pool is stopping */
 } bitd_lambda;
 
@@ -96,13 +128,22 @@ typedef struct bitd_lambda {
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-
+static bitd_boolean lambda_task_before(bitd_lambda_task *t1,
+				       bitd_lambda_task *t2);
+static void lambda_heap_push(bitd_lambda_class *c, bitd_lambda_task *task);
+static bitd_lambda_task *lambda_heap_pop(bitd_lambda_class *c);
+static bitd_boolean lambda_class_can_run(bitd_lambda *lambda, int c);
+static bitd_lambda_task *lambda_dequeue_task(bitd_lambda *lambda,
+					     bitd_lambda_class **cls);
 
 
 /*****************************************************************************
  *                                VARIABLES
  *****************************************************************************/
 
+/* The default class weights and reserved threads */
+static int s_class_weight_def[bitd_lambda_class_count] = {16, 4, 1};
+static int s_class_thread_min_def[bitd_lambda_class_count] = {2, 2, 1};
 
 
 /*****************************************************************************
@@ -110,6 +151,187 @@ typedef struct bitd_lambda {
  *****************************************************************************/
 
 
+/*
+ *============================================================================
+ *                        lambda_task_before
+ *============================================================================
+ * Description:     Should task t1 be dequeued before task t2?
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean lambda_task_before(bitd_lambda_task *t1,
+				       bitd_lambda_task *t2) {
+
+    if (t1->key_nsec != t2->key_nsec) {
+	return t1->key_nsec < t2->key_nsec;
+    }
+
+    return t1->seq < t2->seq;
+} 
+
+
+/*
+ *============================================================================
+ *                        lambda_heap_push
+ *============================================================================
+ * Description:     Queue a task on the class heap. Called with the pool
+ *     mutex held.
+ * Parameters:    
+ * Returns:  
+ */
+static void lambda_heap_push(bitd_lambda_class *c, bitd_lambda_task *task) {
+    int i, parent;
+
+    if (c->n_heap == c->n_heap_max) {
+	c->n_heap_max = MAX(2 * c->n_heap_max, CLASS_HEAP_SIZE_DEF);
+	c->heap = realloc(c->heap, c->n_heap_max * sizeof(*c->heap));
+    }
+
+    /* Sift up */
+    for (i = c->n_heap++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (!lambda_task_before(task, c->heap[parent])) {
+	    break;
+	}
+	c->heap[i] = c->heap[parent];
+    }
+    c->heap[i] = task;
+} 
+
+
+/*
+ *============================================================================
+ *                        lambda_heap_pop
+ *============================================================================
+ * Description:     Dequeue the task with the earliest key from the class
+ *     heap. Called with the pool mutex held.
+ * Parameters:    
+ * Returns:  
+ *     The task, or NULL if the heap is empty
+ */
+static bitd_lambda_task *lambda_heap_pop(bitd_lambda_class *c) {
+    bitd_lambda_task *task, *last;
+    int i, child;
+
+    if (!c->n_heap) {
+	return NULL;
+    }
+
+    task = c->heap[0];
+    last = c->heap[--c->n_heap];
+
+    /* Sift the last task down from the root */
+    for (i = 0; (child = 2 * i + 1) < c->n_heap; i = child) {
+	if (child + 1 < c->n_heap &&
+	    lambda_task_before(c->heap[child + 1], c->heap[child])) {
+	    child++;
+	}
+	if (!lambda_task_before(c->heap[child], last)) {
+	    break;
+	}
+	c->heap[i] = c->heap[child];
+    }
+    if (c->n_heap) {
+	c->heap[i] = last;
+    }
+
+    return task;
+} 
+
+
+/*
+ *============================================================================
+ *                        lambda_class_can_run
+ *============================================================================
+ * Description:     Can a task of the class start, without taking the 
+ *     threads reserved for the other classes? Called with the pool mutex
+ *     held.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean lambda_class_can_run(bitd_lambda *lambda, int c) {
+    int i, reserved = 0, thread_min_total = 0;
+
+    if (!lambda->thread_max) {
+	/* Unlimited threads */
+	return TRUE;
+    }
+
+    for (i = 0; i < bitd_lambda_class_count; i++) {
+	thread_min_total += lambda->classes[i].thread_min;
+	if (i != c) {
+	    reserved += MAX(0, lambda->classes[i].thread_min - 
+			    lambda->classes[i].stats.n_running);
+	}
+    }
+
+    if (thread_min_total >= lambda->thread_max) {
+	/* The reservations don't fit the pool, ignore them */
+	return TRUE;
+    }
+
+    return lambda->n_running + 1 + reserved <= lambda->thread_max;
+} 
+
+
+/*
+ *============================================================================
+ *                        lambda_dequeue_task
+ *============================================================================
+ * Description:     Dequeue the next task to run, from the class with the
+ *     lowest pass that is allowed to run. Ties go to the higher priority
+ *     class. Called with the pool mutex held.
+ * Parameters:    
+ *     cls [OUT] - the class of the dequeued task
+ * Returns:  
+ *     The task, or NULL
+ */
+static bitd_lambda_task *lambda_dequeue_task(bitd_lambda *lambda,
+					     bitd_lambda_class **cls) {
+    bitd_lambda_class *c, *best = NULL;
+    bitd_lambda_task *task;
+    bitd_uint64 current_time, wait_nsec;
+    int i;
+
+    for (i = 0; i < bitd_lambda_class_count; i++) {
+	c = &lambda->classes[i];
+	if (c->n_heap && (!best || c->pass < best->pass) &&
+	    lambda_class_can_run(lambda, i)) {
+	    best = c;
+	}
+    }
+
+    if (!best) {
+	return NULL;
+    }
+
+    task = lambda_heap_pop(best);
+
+    lambda->n_tasks--;
+    bitd_assert(lambda->n_tasks >= 0);
+
+    /* Advance the pool and class virtual times */
+    lambda->pass = best->pass;
+    best->pass += task->stride;
+
+    /* Update the counters */
+    current_time = bitd_get_time_nsec_fast();
+    wait_nsec = current_time - task->enqueue_nsec;
+    if (task->deadline_nsec && current_time > task->deadline_nsec) {
+	best->stats.n_deadline_missed++;
+    }
+    best->stats.n_queued--;
+    best->stats.n_running++;
+    best->stats.n_executed++;
+    best->stats.wait_nsec += wait_nsec;
+    best->stats.max_wait_nsec = MAX(best->stats.max_wait_nsec, wait_nsec);
+    lambda->n_running++;
+
+    *cls = best;
+    return task;
+} 
+
+
 /*
  *============================================================================
  *                        lambda_entrypoint
@@ -122,6 +344,7 @@ static void lambda_entrypoint(void *thread_arg) {
     bitd_lambda_thread *thread = (bitd_lambda_thread *)thread_arg;
     bitd_lambda_task *task;
     bitd_lambda *lambda;
+    bitd_lambda_class *cls = NULL;
     bitd_uint32 current_time, tmo;
     
     /* Get the worker thread pool handle */
@@ -130,16 +353,7 @@ static void lambda_entrypoint(void *thread_arg) {
     while (!lambda->stopping_p) {
 	/* Is there a task block queued up? */
 	bitd_mutex_lock(lambda->m);
-	task = lambda->task_start;
-	if (task) {
-	    lambda->task_start = task->next;
-	    if (lambda->task_end == task) {
-		lambda->task_end = NULL;
-	    }
-	    
-	    lambda->n_tasks--;
-	    bitd_assert(lambda->n_tasks >= 0);
-	}
+	task = lambda_dequeue_task(lambda, &cls);
 	bitd_mutex_unlock(lambda->m);
 	
 	if (task) {
@@ -147,34 +361,54 @@ static void lambda_entrypoint(void *thread_arg) {
 	    task->f(task->cookie, &lambda->stopping_p);
 	    free(task);
 
+	    bitd_mutex_lock(lambda->m);
+	    cls->stats.n_running--;
+	    lambda->n_running--;
+	    bitd_mutex_unlock(lambda->m);
+
 	    /* Record the last active time */
-	    thread->last_active = bitd_get_time_msec();
+	    thread->last_active = bitd_get_time_msec_coarse();
 
 	    /* Go back to look for another task */
 	    continue;
 	}
             
-	current_time = bitd_get_time_msec();
+	current_time = bitd_get_time_msec_coarse();
 	bitd_mutex_lock(lambda->m);
 
 	/* Has the thread been idle for too long? */
-	if (current_time - thread->last_active >= lambda->thread_idle_tmo) {
-	    /* Thread needs to exit. Place it on the exited list, and exit. */
+	if (current_time - thread->last_active >= lambda->thread_idle_tmo &&
+	    lambda->thread_count - lambda->thread_exiting > 
+	    lambda->thread_min) {
+	    /* Thread needs to exit. It can't be woken up for a task
+	       anymore, so take it off the idle list. */
+	    if (thread->idle_next) {
+		thread->idle_prev->idle_next = thread->idle_next;
+		thread->idle_next->idle_prev = thread->idle_prev;
+		thread->idle_next = NULL;
+		thread->idle_prev = NULL;
+	    }
+
+	    /* Place it on the exited list, and exit. */
 	    thread->exited_prev = lambda->thread_exited_tail;
 	    thread->exited_next = lambda->thread_exited_tail->exited_next;
 	    thread->exited_prev->exited_next = thread;
 	    thread->exited_next->exited_prev = thread;
+	    lambda->thread_exiting++;
 	    bitd_mutex_unlock(lambda->m);
 	    dbg_printf("%s inactive for %d msecs, exited\n",
 		      thread->name, current_time - thread->last_active);
 	    return;
 	}
 	
-	/* Place the thread on the idle list */
-	thread->idle_prev = lambda->thread_idle_tail;
-	thread->idle_next = lambda->thread_idle_tail->idle_next;
-	thread->idle_prev->idle_next = thread;
-	thread->idle_next->idle_prev = thread;
+	/* Place the thread on the idle list, unless it is still there 
+	   from its last wait */
+	if (!thread->idle_next) {
+	    thread->idle_prev = lambda->thread_idle_tail;
+	    thread->idle_next = lambda->thread_idle_tail->idle_next;
+	    thread->idle_prev->idle_next = thread;
+	    thread->idle_next->idle_prev = thread;
+	}
         
         bitd_mutex_unlock(lambda->m);
 
@@ -237,7 +471,7 @@ struct bitd_lambda_thread *lambda_create_thread(bitd_lambda *lambda) {
     lambda->thread_idx++;
 
     /* Initialize the last active time */
-    thread->last_active = bitd_get_time_msec();
+    thread->last_active = bitd_get_time_msec_coarse();
 
     /* Create the event, then the thread */
     thread->ev = bitd_event_create(0);
@@ -283,6 +517,7 @@ void lambda_join_thread(bitd_lambda_thread *thread) {
 	bitd_assert(thread->exited_prev);
 	thread->exited_prev->exited_next = thread->exited_next;
 	thread->exited_next->exited_prev = thread->exited_prev;
+	thread->lambda->thread_exiting--;
     }
 
     thread->lambda->thread_count--;
@@ -357,6 +592,7 @@ static void lambda_wake_up_all_threads(bitd_lambda_handle lambda) {
  */
 bitd_lambda_handle bitd_lambda_init(char *name) {
     bitd_lambda *lambda;
+    int i;
 
     /* Parameter check */
     if (!name) {
@@ -369,6 +605,11 @@ bitd_lambda_handle bitd_lambda_init(char *name) {
     lambda->thread_idle_tmo = THREAD_IDLE_TMO_DEF;
     lambda->task_max = TASK_MAX_DEF;
 
+    for (i = 0; i < bitd_lambda_class_count; i++) {
+	lambda->classes[i].weight = s_class_weight_def[i];
+	lambda->classes[i].thread_min = s_class_thread_min_def[i];
+    }
+
     /* Create the pool mutex */
     lambda->m = bitd_mutex_create();
 
@@ -397,6 +638,8 @@ bitd_lambda_handle bitd_lambda_init(char *name) {
  */
 void bitd_lambda_deinit(bitd_lambda_handle lambda) {
     bitd_lambda_task *task;
+    bitd_lambda_class *cls;
+    int i;
 
     if (lambda) {
         lambda->stopping_p = TRUE;
@@ -414,16 +657,17 @@ void bitd_lambda_deinit(bitd_lambda_handle lambda) {
 
 	/* Free the task list, in case there were tasks pending 
 	   while the worker thread pool was stopped */
-	while (lambda->task_start) {
-	    task = lambda->task_start;
-	    lambda->task_start = task->next;
-	    
-	    /* Execute the task but tell it we're stopping so it can
-	       quickly exit */
-	    task->f(task->cookie, &lambda->stopping_p);
-	    free(task);
-
-	    lambda->n_tasks--;	    
+	for (i = 0; i < bitd_lambda_class_count; i++) {
+	    cls = &lambda->classes[i];
+	    while ((task = lambda_heap_pop(cls))) {
+		/* Execute the task but tell it we're stopping so it can
+		   quickly exit */
+		task->f(task->cookie, &lambda->stopping_p);
+		free(task);
+
+		lambda->n_tasks--;	    
+	    }
+	    free(cls->heap);
 	}
 
 	bitd_assert(!lambda->n_tasks);
@@ -452,6 +696,23 @@ void bitd_lambda_set_thread_max(bitd_lambda_handle lambda, int thread_max) {
 } 
 
 
+/*
+ *============================================================================
+ *                        bitd_lambda_set_thread_min
+ *============================================================================
+ * Description:     Set the number of threads kept by the pool even when
+ *     idle for longer than the thread_idle_tmo. Threads are still created
+ *     on demand.
+ * Parameters:    
+ *     lambda - the worker thread pool
+ *     thread_min - the min number of threads
+ * Returns:  
+ */
+void bitd_lambda_set_thread_min(bitd_lambda_handle lambda, int thread_min) {
+    lambda->thread_min = MAX(0, thread_min);
+} 
+
+
 /*
  *============================================================================
  *                        bitd_lambda_set_thread_idle_tmo
@@ -493,22 +754,159 @@ void bitd_lambda_set_task_max(bitd_lambda_handle lambda, int task_max) {
 } 
 
 
+/*
+ *============================================================================
+ *                        bitd_lambda_set_class
+ *============================================================================
+ * Description:     Set the class weight and reserved threads
+ * Parameters:    
+ *     lambda - the worker thread pool
+ *     cls - the class
+ *     weight - the class share, at least 1
+ *     thread_min - the threads reserved for the class
+ * Returns:  
+ */
+void bitd_lambda_set_class(bitd_lambda_handle lambda, 
+			   bitd_lambda_class_t cls,
+			   int weight,
+			   int thread_min) {
+
+    if (!lambda || cls < 0 || cls >= bitd_lambda_class_count) {
+	return;
+    }
+
+    bitd_mutex_lock(lambda->m);
+    lambda->classes[cls].weight = MAX(1, weight);
+    lambda->classes[cls].thread_min = MAX(0, thread_min);
+    bitd_mutex_unlock(lambda->m);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_lambda_get_stats
+ *============================================================================
+ * Description:     Get the pool counters
+ * Parameters:    
+ *     lambda - the worker thread pool
+ *     stats [OUT] - the counters
+ * Returns:  
+ */
+void bitd_lambda_get_stats(bitd_lambda_handle lambda, 
+			   bitd_lambda_stats_t *stats) {
+    bitd_lambda_thread *thread;
+
+    if (!lambda || !stats) {
+	return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    bitd_mutex_lock(lambda->m);
+    stats->thread_count = lambda->thread_count - lambda->thread_exiting;
+    for (thread = lambda->thread_idle_head;
+	 thread != THREAD_IDLE_HEAD(lambda);
+	 thread = thread->idle_next) {
+	stats->thread_idle++;
+    }
+    stats->n_queued = lambda->n_tasks;
+    stats->n_running = lambda->n_running;
+    bitd_mutex_unlock(lambda->m);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_lambda_get_class_stats
+ *============================================================================
+ * Description:     Get the class counters
+ * Parameters:    
+ *     lambda - the worker thread pool
+ *     cls - the class
+ *     stats [OUT] - the counters
+ * Returns:  
+ */
+void bitd_lambda_get_class_stats(bitd_lambda_handle lambda, 
+				 bitd_lambda_class_t cls,
+				 bitd_lambda_class_stats_t *stats) {
+
+    if (!lambda || !stats || cls < 0 || cls >= bitd_lambda_class_count) {
+	return;
+    }
+
+    bitd_mutex_lock(lambda->m);
+    *stats = lambda->classes[cls].stats;
+    bitd_mutex_unlock(lambda->m);
+} 
+
+
 /*
  *============================================================================
  *                        bitd_lambda_exec_task
  *============================================================================
- * Description:  Execute a task. User needs to free f_arg 
- *     if return code is FALSE.
+ * Description:  Execute a task in the normal class. User needs to free 
+ *     f_arg if return code is FALSE.
  * Parameters:
  * Returns:
  */
 bitd_boolean bitd_lambda_exec_task(bitd_lambda_handle lambda,
 				   bitd_lambda_task_func_t f,
 				   void *cookie) {
+
+    return bitd_lambda_exec_task_class(lambda, bitd_lambda_class_normal, 1,
+				       f, cookie);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_lambda_exec_task_class
+ *============================================================================
+ * Description:  Execute a task in the given class. User needs to free 
+ *     f_arg if return code is FALSE.
+ * Parameters:
+ *     lambda - the worker thread pool
+ *     cls - the task class
+ *     weight - the task weight. A task of weight N is charged 1/N of a 
+ *         dispatch against the class share.
+ * Returns:
+ */
+bitd_boolean bitd_lambda_exec_task_class(bitd_lambda_handle lambda,
+					 bitd_lambda_class_t cls,
+					 int weight,
+					 bitd_lambda_task_func_t f,
+					 void *cookie) {
+
+    return bitd_lambda_exec_task_deadline(lambda, cls, weight, 0, 
+					  f, cookie);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_lambda_exec_task_deadline
+ *============================================================================
+ * Description:  Execute a task in the given class, with a deadline. User
+ *     needs to free f_arg if return code is FALSE.
+ * Parameters:
+ *     lambda - the worker thread pool
+ *     cls - the task class
+ *     weight - the task weight
+ *     deadline_nsec - the time the task should start by, or 0 if none.
+ *         Tasks of a class are dequeued earliest deadline first.
+ * Returns:
+ */
+bitd_boolean bitd_lambda_exec_task_deadline(bitd_lambda_handle lambda,
+					    bitd_lambda_class_t cls,
+					    int weight,
+					    bitd_uint64 deadline_nsec,
+					    bitd_lambda_task_func_t f,
+					    void *cookie) {
     bitd_lambda_task *task = NULL;
     bitd_lambda_thread *thread;
+    bitd_lambda_class *c;
 
-    if (!lambda || !f) {
+    if (!lambda || !f || cls < 0 || cls >= bitd_lambda_class_count) {
         return FALSE;
     }
 
@@ -530,23 +928,32 @@ bitd_boolean bitd_lambda_exec_task(bitd_lambda_handle lambda,
 	return FALSE;
     }
 
+    c = &lambda->classes[cls];
+
     /* Allocate the task */
     task = calloc(1, sizeof(*task));
     task->f = f;
     task->cookie = cookie;
+    task->enqueue_nsec = bitd_get_time_nsec_fast();
+    task->deadline_nsec = deadline_nsec;
+    task->key_nsec = deadline_nsec ? deadline_nsec : task->enqueue_nsec;
+    task->seq = lambda->seq++;
+    task->stride = MAX(1, CLASS_STRIDE / c->weight / MAX(1, weight));
 
     /* Increment the number of tasks */
     lambda->n_tasks++;
 
-    /* Enqueue to the end of the task list */
-    if (!lambda->task_start) {
-        lambda->task_start = task;
-        
-    }
-    if (lambda->task_end) {
-        lambda->task_end->next = task;
+    /* A class becoming active doesn't get credit for the time it was 
+       idle */
+    if (!c->n_heap) {
+	c->pass = MAX(c->pass, lambda->pass);
     }
-    lambda->task_end = task;
+
+    /* Enqueue on the class task heap */
+    lambda_heap_push(c, task);
+
+    c->stats.n_queued++;
+    c->stats.max_queued = MAX(c->stats.max_queued, c->stats.n_queued);
 
     /* Is there an idle thread available? */
     thread = lambda->thread_idle_head;
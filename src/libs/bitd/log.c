@@ -15,7 +15,12 @@
 #include "bitd/log.h"
 #include "bitd/msg.h"
 #include <time.h>
-#include <sys/timeb.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#if defined(BITD_HAVE_WRITEV)
+# include <sys/uio.h>
+#endif
 
 /*****************************************************************************
  *                             MANIFEST CONSTANTS
@@ -29,8 +34,48 @@
 #define LOG_SIZE_MAX_DEF 1024*1024
 #define LOG_COUNT_DEF 3
 
+#define LOG_RING_SIZE (64*1024)  /* Per-thread ring size, a power of 2 */
+#define LOG_FLUSH_SIZE_DEF (16*1024) /* Wake up the logger at this ring fill */
+#define LOG_FLUSH_INTERVAL_DEF 50     /* Max msecs a line waits in a ring */
+#define LOG_FLUSH_INTERVAL_MIN 1      /* Min msecs the logger waits */
+#define LOG_SPACE_TMO 50         /* Recheck interval when a ring is full */
+#define LOG_LINE_SIZE 1024       /* Line formatting buffer on the stack */
+#define LOG_IOV_MAX 64           /* Max iovecs in one writev() */
+
+/* The binary log format */
+#define LOG_BINARY_MAGIC "BITDLOG1"
+#define LOG_BINARY_ORDER 0x01020304   /* Host byte order marker */
+#define LOG_REC_DICT 1          /* A dictionary record */
+#define LOG_REC_MSG 2           /* A log message record */
+#define LOG_REC_HDR_SIZE 5      /* Record length and type */
+#define LOG_REC_MSG_SIZE (LOG_REC_HDR_SIZE + 17) /* Without the args */
+#define LOG_REC_SIZE_MAX 4096   /* Max log message record size */
+#define LOG_DICT_FMT 1          /* A format string dictionary entry */
+#define LOG_DICT_KEY 2          /* A key name dictionary entry */
+#define LOG_ARGS_MAX 32         /* Max args of a binary format string */
+#define LOG_FMT_CACHE_SIZE 64   /* Per-thread format cache, a power of 2 */
+#define LOG_DICT_HASH_SIZE 256  /* A power of 2 */
+#define LOG_DICT_FMT_MAX 4096   /* Max format strings in the dictionary */
+#define LOG_DICT_HASH(ptr) \
+    ((((uintptr_t)(ptr)) >> 3) & (LOG_DICT_HASH_SIZE - 1))
+#define LOG_FMT_CACHE_HASH(ptr) \
+    ((((uintptr_t)(ptr)) >> 3) & (LOG_FMT_CACHE_SIZE - 1))
+
 #define bitd_printf if(0) printf
 
+/* Ring indices are shared between the owner thread and the logger */
+#if defined(_WIN32)
+# define LOG_LOAD_ACQUIRE(p) \
+    ((bitd_uint32)InterlockedCompareExchange((volatile LONG *)(p), 0, 0))
+# define LOG_STORE_RELEASE(p, v) \
+    InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+# define LOG_FENCE() MemoryBarrier()
+#else
+# define LOG_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define LOG_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define LOG_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
@@ -38,30 +83,105 @@
 #define KEYID_MAGIC 0x2239
 
 struct ttlog_keyid_s {
+    struct ttlog_keyid_hdr_s hdr; /* Read by ttlog_enabled() */
     int magic;
     struct ttlog_keyid_s *next;
     struct ttlog_keyid_s *prev;
-    char *name;
+    char *name;              /* Immutable, read without the lock */
     ttlog_level level;
     int refcount;
+    bitd_uint32 dict_id;     /* The binary log dictionary id, or 0 */
+};
+
+/* The argument types of a binary format string */
+typedef enum {
+    log_arg_int,
+    log_arg_long,
+    log_arg_llong,
+    log_arg_intmax,
+    log_arg_size,
+    log_arg_ptrdiff,
+    log_arg_double,
+    log_arg_string,
+    log_arg_ptr
+} log_arg_type;
+
+/* 
+ * A binary log dictionary entry: a format string or a key name. Log
+ * message records refer to the entries by id, and the logger writes 
+ * each entry to the log file before the first record that refers to it.
+ */
+struct log_dict_s {
+    struct log_dict_s *next; /* The hash chain */
+    const char *ptr;         /* The format string address */
+    bitd_uint32 id;
+    bitd_uint8 kind;
+    char *str;
+    int n_args;              /* -1 if the args can't be recorded */
+    bitd_uint8 arg_types[LOG_ARGS_MAX];
+};
+
+#if !defined(BITD_HAVE_WRITEV)
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
+/* 
+ * A single-producer, single-consumer ring of formatted log lines. 
+ * The owner thread advances the head, and the logger thread advances
+ * the tail. The indices are free running, and are masked on access.
+ */
+struct log_ring_s {
+    struct log_ring_s *next; /* The ring list, lock-protected */
+    bitd_uint32 head;        /* Written by the owner thread */
+    bitd_uint32 tail;        /* Written by the logger thread */
+    bitd_uint32 waiting_p;   /* Owner is waiting for ring space */
+    bitd_uint32 orphaned_p;  /* Owner thread exited */
+    bitd_event space_ev;     /* Set by the logger when space is freed */
+    time_t ts_sec;           /* The second of the cached timestamp */
+    int ts_len;              /* The cached timestamp length */
+    char ts[32];             /* The cached timestamp, up to the msecs */
+    struct log_dict_s *fmt_cache[LOG_FMT_CACHE_SIZE]; /* Binary formats */
+    char rec[LOG_REC_SIZE_MAX]; /* The binary record being encoded */
+    char text[LOG_LINE_SIZE]; /* Lines that can't be binary records */
+    char buf[LOG_RING_SIZE];
 };
 
 struct log_cb_s {
     bitd_mutex lock;
     ttlog_level level;
     bitd_thread th;          /* The event loop */
-    bitd_queue q;            /* The event loop queue */
-    int log_size;
+    bitd_queue q;            /* The event loop control queue */
+    bitd_event wake_ev;      /* Wakes up the event loop */
+    bitd_uint32 idle_p;      /* Event loop waits for wake_ev only */
+    bitd_tls ring_tls;       /* The current thread ring */
+    int log_size;            /* Running size of the log file */
     int log_size_max;
     int log_count;
+    int flush_size;          /* Ring fill that wakes up the logger */
+    int flush_interval;      /* Max msecs a line waits in a ring */
     FILE *f;               /* Log file handler */
     bitd_boolean force_stop_p; /* Logger is forced to stop immediately */
+    bitd_boolean binary_p;   /* Log binary records */
 
     /* Data members underneath are lock-protected */
     char *log_name;
     bitd_boolean reopen_log_file_p;
     ttlog_keyid key_head;
     ttlog_keyid key_tail;
+    ttlog_keyid retired_keys; /* Unregistered keys, freed on deinit */
+    struct log_ring_s *rings;
+    struct log_dict_s **dict; /* The dictionary, indexed by id - 1 */
+    int n_dict;
+    int n_dict_fmt;          /* The format string entries */
+    int dict_size;
+    struct log_dict_s *dict_hash[LOG_DICT_HASH_SIZE];
+    int dict_written;        /* Entries written to the current file */
+    bitd_boolean header_written_p; /* Binary header is in current file */
+    char *dict_buf;          /* The dictionary records being written */
+    int dict_buf_size;
 };
 
 #define KEY_LIST_HEAD(lcb) \
@@ -70,21 +190,17 @@ struct log_cb_s {
 
 
 typedef enum {
-    ttlog_opcode_log_msg,
     ttlog_opcode_flush,
     ttlog_opcode_exit,
     
     ttlog_opcode_max             /* Sentinel */
 } ttlog_opcode;
 
-typedef struct {
-    char buf[1024];
-} ttlog_msg_buffer;
-
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-
+static int log_write_binary(ttlog_level level, ttlog_keyid keyid,
+			    bitd_boolean wake_p, char *format_string, ...);
 
 
 /*****************************************************************************
@@ -92,6 +208,10 @@ typedef struct {
  *****************************************************************************/
 struct log_cb_s *g_log_cb;
 
+/* Lines that can't be logged as binary records are formatted, and 
+   logged with this format */
+static const char *s_log_text_fmt = "%s";
+
 
 /*****************************************************************************
  *                          FUNCTION IMPLEMENTATION
@@ -100,41 +220,61 @@ struct log_cb_s *g_log_cb;
 
 /*
  *============================================================================
- *                        write_log_msg
+ *                        write_log_iov
  *============================================================================
- * Description:     
+ * Description:     Write an array of buffers to the log file
  * Parameters:    
- * Returns:  
+ * Returns:         The number of bytes written, or -1 on error
  */
-static int write_log_msg(char *buf) {
-    int nbytes = 0, ret;
-    struct tm* it;
-    struct timeb ibtime;
+static int write_log_iov(struct iovec *iov, int n_iov) {
+    int nbytes = 0;
+#if defined(BITD_HAVE_WRITEV)
+    int ret;
+#else
+    int i;
+#endif
 
     if (!g_log_cb->f) {
 	return 0;
     }
 
-    ftime(&ibtime);
-    if ((it = localtime(&ibtime.time))) {
-        ret = fprintf(g_log_cb->f,
-		      "%02d-%02d-%4d %02d:%02d:%02d.%03d : ",
-		      it->tm_mon+1,it->tm_mday,it->tm_year + 1900,
-		      it->tm_hour,it->tm_min,it->tm_sec, ibtime.millitm);
+#if defined(BITD_HAVE_WRITEV)
+    /* Write past the stream buffer, which is flushed first in case 
+       the stream is shared, e.g. with stdout */
+    fflush(g_log_cb->f);
+
+    while (n_iov) {
+	ret = writev(fileno(g_log_cb->f), iov, n_iov);
 	if (ret < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
 	    return ret;
 	}
 	nbytes += ret;
-    }
 
-    ret = fprintf(g_log_cb->f, "%s", buf);
-    if (ret < 0) {
-	return ret;
+	/* Skip over the written buffers, in case of a short write */
+	while (n_iov && (size_t)ret >= iov->iov_len) {
+	    ret -= iov->iov_len;
+	    iov++;
+	    n_iov--;
+	}
+	if (n_iov) {
+	    iov->iov_base = (char *)iov->iov_base + ret;
+	    iov->iov_len -= ret;
+	}
+    }
+#else
+    for (i = 0; i < n_iov; i++) {
+	if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, g_log_cb->f) != 
+	    iov[i].iov_len) {
+	    return -1;
+	}
+	nbytes += iov[i].iov_len;
     }
-
-    nbytes += ret;
 
     fflush(g_log_cb->f);
+#endif
 
     return nbytes;
 } 
@@ -146,14 +286,29 @@ static int write_log_msg(char *buf) {
  *============================================================================
  * Description:     
  * Parameters:    
+ *     nbytes - the number of bytes about to be written
  * Returns:  
  */
-static void ensure_log_file() {
+static void ensure_log_file(int nbytes) {
     struct stat s;
+    bitd_boolean reopen_p;
+    char *log_name = NULL;
+    int log_size_max, log_count;
 
+    /* Take a snapshot of the file settings. The file stream and its
+       running size are owned by the logger thread, so the file is 
+       opened, archived and written without the lock. */
     bitd_mutex_lock(g_log_cb->lock);
+    reopen_p = g_log_cb->reopen_log_file_p;
+    g_log_cb->reopen_log_file_p = FALSE;
+    if (g_log_cb->log_name) {
+	log_name = strdup(g_log_cb->log_name);
+    }
+    log_size_max = g_log_cb->log_size_max;
+    log_count = g_log_cb->log_count;
+    bitd_mutex_unlock(g_log_cb->lock);
 
-    if (g_log_cb->reopen_log_file_p) {
+    if (reopen_p) {
 	/* Close the file stream */
 	if (g_log_cb->f && (g_log_cb->f != stdout)) {
 	    fclose(g_log_cb->f);
@@ -161,144 +316,987 @@ static void ensure_log_file() {
 	}
 	
 	/* Reopen the file stream */
-	if (!strcmp(g_log_cb->log_name, "stdout") ||
-	    !strcmp(g_log_cb->log_name, "/dev/stdout")) {
+	if (log_name && 
+	    (!strcmp(log_name, "stdout") || 
+	     !strcmp(log_name, "/dev/stdout"))) {
 	    /* Log to standard output */
 	    g_log_cb->f = stdout;
-	} else if (g_log_cb->log_name) {
+	} else if (log_name) {
 	    /* Open the log file */
-	    g_log_cb->f = fopen(g_log_cb->log_name, "a");
+	    g_log_cb->f = fopen(log_name, "a");
 	    if (!g_log_cb->f) {
 		/* Could not open the log file */
 		fprintf(stderr, "Failed to open %s, %s (errno %d)\n",
-			g_log_cb->log_name, strerror(errno), errno);
+			log_name, strerror(errno), errno);
 	    }
 	}
+
+	/* Get the current file size. From here on, the size is kept
+	   as a running count of the bytes written. */
+	g_log_cb->log_size = 0;
+	if (g_log_cb->f && g_log_cb->f != stdout &&
+	    !stat(log_name, &s)) {
+	    g_log_cb->log_size = s.st_size;
+	}
+
+	/* A binary file needs its header, unless we're appending, and 
+	   needs the whole dictionary */
+	g_log_cb->header_written_p = (g_log_cb->log_size > 0);
+	g_log_cb->dict_written = 0;
     
 	/* Else, we're not outputting to a log file. 
 	   Leave the file stream empty. */
     }
-    
-    g_log_cb->reopen_log_file_p = FALSE;
   
-    if (!g_log_cb->f || g_log_cb->f == stdout) {
+    if (!g_log_cb->f || g_log_cb->f == stdout || !log_name) {
 	/* No archiving needed */
-	bitd_mutex_unlock(g_log_cb->lock);
+	free(log_name);
 	return;
     }
 
-    /* Archiving might be needed. What is the current file size? */
-    if (!g_log_cb->log_size) {
-	if (!stat(g_log_cb->log_name, &s)) {
-	    g_log_cb->log_size = s.st_size;
-	}
-    }
-
-    if (g_log_cb->log_size + 2048 > g_log_cb->log_size_max) {
+    if (g_log_cb->log_size && 
+	g_log_cb->log_size + nbytes + 2048 > log_size_max) {
 	/* Attempt to archive the file */
 	fclose(g_log_cb->f);
 	g_log_cb->f = NULL;
+	g_log_cb->log_size = 0;
 
-	if (g_log_cb->log_count < 2) {
-	    unlink(g_log_cb->log_name);
+	if (log_count < 2) {
+	    unlink(log_name);
 	} else {
 	    char *fname1;
 	    char *fname2;
 	    int i;
 
-	    fname1 = malloc(strlen(g_log_cb->log_name + 24));
-	    fname2 = malloc(strlen(g_log_cb->log_name + 24));
+	    fname1 = malloc(strlen(log_name) + 24);
+	    fname2 = malloc(strlen(log_name) + 24);
 
-	    for (i = g_log_cb->log_count - 2; i >= 0; i--) {
+	    for (i = log_count - 2; i >= 0; i--) {
 		if (i) {
-		    sprintf(fname1, "%s.%u", g_log_cb->log_name, i-1);
+		    sprintf(fname1, "%s.%u", log_name, i-1);
 		} else {
-		    sprintf(fname1, "%s", g_log_cb->log_name);
+		    sprintf(fname1, "%s", log_name);
+		}
+		sprintf(fname2, "%s.%u", log_name, i);
+
+		unlink(fname2);
+		rename(fname1, fname2);
+	    }
+
+	    free(fname1);
+	    free(fname2);
+	}
+
+	/* Reopen the log file */
+	g_log_cb->f = fopen(log_name, "a");
+	if (!g_log_cb->f) {
+	    /* Could not open the log file */
+	    fprintf(stderr, "Failed to open %s, %s (errno %d)\n",
+		    log_name, strerror(errno), errno);
+	}
+	g_log_cb->header_written_p = FALSE;
+	g_log_cb->dict_written = 0;
+    }
+
+    free(log_name);
+} 
+
+
+/*
+ *============================================================================
+ *                        ring_release
+ *============================================================================
+ * Description:     Called when the ring owner thread exits. The logger 
+ *     frees the ring once it is drained.
+ * Parameters:    
+ * Returns:  
+ */
+static void ring_release(void *value) {
+    struct log_ring_s *r = (struct log_ring_s *)value;
+
+    LOG_STORE_RELEASE(&r->orphaned_p, TRUE);
+    if (g_log_cb) {
+	bitd_event_set(g_log_cb->wake_ev);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        ring_get
+ *============================================================================
+ * Description:     Get the current thread ring, creating it if needed
+ * Parameters:    
+ * Returns:  
+ */
+static struct log_ring_s *ring_get(void) {
+    struct log_ring_s *r;
+
+    r = (struct log_ring_s *)bitd_tls_get(g_log_cb->ring_tls);
+    if (r) {
+	return r;
+    }
+
+    r = calloc(1, sizeof(*r));
+    r->space_ev = bitd_event_create(0);
+
+    bitd_mutex_lock(g_log_cb->lock);
+    r->next = g_log_cb->rings;
+    g_log_cb->rings = r;
+    bitd_mutex_unlock(g_log_cb->lock);
+
+    bitd_tls_set(g_log_cb->ring_tls, r);
+
+    return r;
+} 
+
+
+/*
+ *============================================================================
+ *                        ring_write
+ *============================================================================
+ * Description:     Copy a formatted line into the current thread ring,
+ *     waiting for space if the ring is full. Lines longer than the ring
+ *     are copied in ring-sized pieces.
+ * Parameters:    
+ *     wake_p - wake up the logger right away
+ * Returns:  
+ */
+static void ring_write(struct log_ring_s *r, char *buf, bitd_uint32 size,
+		       bitd_boolean wake_p) {
+    bitd_uint32 n, used, idx;
+
+    while (size) {
+	n = MIN(size, LOG_RING_SIZE);
+
+	/* Wait for space */
+	for (;;) {
+	    used = r->head - LOG_LOAD_ACQUIRE(&r->tail);
+	    if (LOG_RING_SIZE - used >= n) {
+		break;
+	    }
+	    LOG_STORE_RELEASE(&r->waiting_p, TRUE);
+	    LOG_FENCE();
+	    used = r->head - LOG_LOAD_ACQUIRE(&r->tail);
+	    if (LOG_RING_SIZE - used >= n) {
+		LOG_STORE_RELEASE(&r->waiting_p, FALSE);
+		break;
+	    }
+	    bitd_event_set(g_log_cb->wake_ev);
+	    bitd_event_wait(r->space_ev, LOG_SPACE_TMO);
+	}
+
+	/* Copy the line, wrapping around the end of the ring */
+	idx = r->head & (LOG_RING_SIZE - 1);
+	if (idx + n <= LOG_RING_SIZE) {
+	    memcpy(r->buf + idx, buf, n);
+	} else {
+	    memcpy(r->buf + idx, buf, LOG_RING_SIZE - idx);
+	    memcpy(r->buf, buf + LOG_RING_SIZE - idx, n - LOG_RING_SIZE + idx);
+	}
+	LOG_STORE_RELEASE(&r->head, r->head + n);
+
+	buf += n;
+	size -= n;
+
+	/* Wake up the logger once a batch accumulates */
+	if (!g_log_cb->flush_interval ||
+	    (used < (bitd_uint32)g_log_cb->flush_size && 
+	     used + n >= (bitd_uint32)g_log_cb->flush_size)) {
+	    wake_p = TRUE;
+	}
+    }
+
+    /* Wake up the logger if it waits for the first line */
+    LOG_FENCE();
+    if (LOG_LOAD_ACQUIRE(&g_log_cb->idle_p)) {
+	LOG_STORE_RELEASE(&g_log_cb->idle_p, FALSE);
+	wake_p = TRUE;
+    }
+
+    if (wake_p) {
+	bitd_event_set(g_log_cb->wake_ev);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        rings_pending
+ *============================================================================
+ * Description:     Are there lines waiting in any ring?
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean rings_pending(void) {
+    struct log_ring_s *r;
+    bitd_boolean pending_p = FALSE;
+
+    bitd_mutex_lock(g_log_cb->lock);
+    for (r = g_log_cb->rings; r && !pending_p; r = r->next) {
+	pending_p = (LOG_LOAD_ACQUIRE(&r->head) != r->tail);
+    }
+    bitd_mutex_unlock(g_log_cb->lock);
+
+    return pending_p;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_dict_records
+ *============================================================================
+ * Description:     Format the binary file header, if not yet written, 
+ *     and the dictionary entries not yet written to the current file.
+ *     Called with the lock taken.
+ * Parameters:    
+ * Returns:         The size of the records in g_log_cb->dict_buf
+ */
+static int log_dict_records(void) {
+    struct log_dict_s *d;
+    int size = 0, len, i;
+    bitd_uint32 u32;
+
+    /* Size the records */
+    if (!g_log_cb->header_written_p) {
+	size += sizeof(LOG_BINARY_MAGIC) - 1 + 4;
+    }
+    for (i = g_log_cb->dict_written; i < g_log_cb->n_dict; i++) {
+	size += LOG_REC_HDR_SIZE + 5 + strlen(g_log_cb->dict[i]->str);
+    }
+    if (!size) {
+	return 0;
+    }
+
+    if (size > g_log_cb->dict_buf_size) {
+	g_log_cb->dict_buf_size = size;
+	g_log_cb->dict_buf = realloc(g_log_cb->dict_buf, size);
+    }
+
+    size = 0;
+    if (!g_log_cb->header_written_p) {
+	memcpy(g_log_cb->dict_buf, LOG_BINARY_MAGIC, 
+	       sizeof(LOG_BINARY_MAGIC) - 1);
+	size += sizeof(LOG_BINARY_MAGIC) - 1;
+	u32 = LOG_BINARY_ORDER;
+	memcpy(g_log_cb->dict_buf + size, &u32, 4);
+	size += 4;
+    }
+    for (i = g_log_cb->dict_written; i < g_log_cb->n_dict; i++) {
+	d = g_log_cb->dict[i];
+	len = strlen(d->str);
+	u32 = LOG_REC_HDR_SIZE + 5 + len;
+	memcpy(g_log_cb->dict_buf + size, &u32, 4);
+	g_log_cb->dict_buf[size + 4] = LOG_REC_DICT;
+	g_log_cb->dict_buf[size + 5] = d->kind;
+	memcpy(g_log_cb->dict_buf + size + 6, &d->id, 4);
+	memcpy(g_log_cb->dict_buf + size + 10, d->str, len);
+	size += u32;
+    }
+
+    return size;
+} 
+
+
+/*
+ *============================================================================
+ *                        rings_drain
+ *============================================================================
+ * Description:     Write the lines in all rings to the log file, batching
+ *     up to LOG_IOV_MAX buffers in each write, and free the rings of
+ *     exited threads
+ * Parameters:    
+ * Returns:  
+ */
+static void rings_drain(void) {
+    struct iovec iov[LOG_IOV_MAX];
+    struct log_ring_s *rings[(LOG_IOV_MAX - 1)/2], *r, **pr;
+    bitd_uint32 used[(LOG_IOV_MAX - 1)/2], head, idx;
+    int n_iov, n_rings, nbytes, dict_size, n_dict, i;
+    bitd_boolean more_p = TRUE;
+
+    while (more_p) {
+	more_p = FALSE;
+	n_iov = 1;  /* The first iovec is reserved for the dictionary */
+	n_rings = 0;
+	nbytes = 0;
+
+	/* Collect the ring contents. Only the ring list needs the lock:
+	   the ring space stays put until the tail is released below, and
+	   rings are only freed by this thread. */
+	bitd_mutex_lock(g_log_cb->lock);
+	for (r = g_log_cb->rings; r; r = r->next) {
+	    head = LOG_LOAD_ACQUIRE(&r->head);
+	    if (head == r->tail) {
+		continue;
+	    }
+	    if (n_rings == (LOG_IOV_MAX - 1)/2) {
+		/* Collect the remaining rings in the next batch */
+		more_p = TRUE;
+		break;
+	    }
+
+	    rings[n_rings] = r;
+	    used[n_rings++] = head - r->tail;
+	    nbytes += head - r->tail;
+
+	    idx = r->tail & (LOG_RING_SIZE - 1);
+	    if (idx + (head - r->tail) <= LOG_RING_SIZE) {
+		iov[n_iov].iov_base = r->buf + idx;
+		iov[n_iov++].iov_len = head - r->tail;
+	    } else {
+		iov[n_iov].iov_base = r->buf + idx;
+		iov[n_iov++].iov_len = LOG_RING_SIZE - idx;
+		iov[n_iov].iov_base = r->buf;
+		iov[n_iov++].iov_len = (head - r->tail) - (LOG_RING_SIZE - idx);
+	    }
+	}
+	bitd_mutex_unlock(g_log_cb->lock);
+
+	if (!n_rings) {
+	    break;
+	}
+
+	/* Ensure file is open and archive is rotated */
+	ensure_log_file(nbytes);
+
+	/* The binary records refer to dictionary entries, which are 
+	   written first. The entries were added before the records were
+	   logged. */
+	dict_size = 0;
+	n_dict = 0;
+	if (g_log_cb->f) {
+	    bitd_mutex_lock(g_log_cb->lock);
+	    if (g_log_cb->binary_p) {
+		dict_size = log_dict_records();
+		n_dict = g_log_cb->n_dict;
+	    }
+	    bitd_mutex_unlock(g_log_cb->lock);
+	}
+	iov[0].iov_base = g_log_cb->dict_buf;
+	iov[0].iov_len = dict_size;
+
+	/* Write the lines */
+	if (dict_size) {
+	    nbytes = write_log_iov(iov, n_iov);
+	} else {
+	    nbytes = write_log_iov(iov + 1, n_iov - 1);
+	}
+	if (nbytes < 0) {
+	    /* Error writing to file - need to reopen file */
+	    bitd_mutex_lock(g_log_cb->lock);
+	    g_log_cb->reopen_log_file_p = TRUE;
+	    bitd_mutex_unlock(g_log_cb->lock);
+	} else {
+	    g_log_cb->log_size += nbytes;
+	    if (dict_size) {
+		g_log_cb->header_written_p = TRUE;
+		g_log_cb->dict_written = n_dict;
+	    }
+	}
+
+	/* Release the ring space */
+	for (i = 0; i < n_rings; i++) {
+	    r = rings[i];
+	    LOG_STORE_RELEASE(&r->tail, r->tail + used[i]);
+	    LOG_FENCE();
+	    if (LOG_LOAD_ACQUIRE(&r->waiting_p)) {
+		LOG_STORE_RELEASE(&r->waiting_p, FALSE);
+		bitd_event_set(r->space_ev);
+	    }
+	}
+    }
+
+    /* Free the drained rings of exited threads */
+    bitd_mutex_lock(g_log_cb->lock);
+    pr = &g_log_cb->rings;
+    while ((r = *pr)) {
+	if (LOG_LOAD_ACQUIRE(&r->orphaned_p) && 
+	    LOG_LOAD_ACQUIRE(&r->head) == r->tail) {
+	    *pr = r->next;
+	    bitd_event_destroy(r->space_ev);
+	    free(r);
+	} else {
+	    pr = &r->next;
+	}
+    }
+    bitd_mutex_unlock(g_log_cb->lock);
+} 
+
+
+/*
+ *============================================================================
+ *                        logger_event_loop
+ *============================================================================
+ * Description:     Drain the rings when woken up by a thread, or when
+ *     the flush interval expires. If the rings are empty, wait for the 
+ *     next line without a timeout.
+ * Parameters:    
+ * Returns:  
+ */
+static void logger_event_loop(void *thread_arg) {
+    bitd_queue q;
+    bitd_msg m;
+    bitd_boolean stop_p = FALSE;
+    
+    while (!stop_p) {
+
+	bitd_event_wait(g_log_cb->wake_ev, 
+			LOG_LOAD_ACQUIRE(&g_log_cb->idle_p) ? 
+			BITD_FOREVER : 
+			MAX(g_log_cb->flush_interval, LOG_FLUSH_INTERVAL_MIN));
+
+	rings_drain();
+
+	/* Handle the control messages */
+	while ((m = bitd_msg_receive_w_tmo(g_log_cb->q, 0))) {
+	    switch (bitd_msg_get_opcode(m)) {
+	    case ttlog_opcode_flush:
+		/* Write the lines logged before the flush, and send 
+		   the flush complete message */
+		rings_drain();
+		q = *(bitd_queue *)m;
+		bitd_msg_send(m, q);
+		continue;
+	    case ttlog_opcode_exit:
+		/* We're exiting */
+		if (!g_log_cb->force_stop_p) {
+		    rings_drain();
 		}
-		sprintf(fname2, "%s.%u", g_log_cb->log_name, i);
+		stop_p = TRUE;
+		break;
+	    default:
+		bitd_assert(0);
+	    }
+
+	    bitd_msg_free(m);
+	}
+
+	/* Go idle if the rings are empty */
+	if (!rings_pending()) {
+	    LOG_STORE_RELEASE(&g_log_cb->idle_p, TRUE);
+	    LOG_FENCE();
+	    if (rings_pending()) {
+		LOG_STORE_RELEASE(&g_log_cb->idle_p, FALSE);
+	    }
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        log_format_time
+ *============================================================================
+ * Description:     Format the timestamp of a log line. The date and time,
+ *     up to the seconds, are cached per thread, so only the msecs are 
+ *     rendered on most lines.
+ * Parameters:    
+ *     buf - the output buffer, at least 48 bytes long
+ * Returns:         The timestamp length
+ */
+static int log_format_time(struct log_ring_s *r, char *buf) {
+    struct tm t, *it;
+    bitd_uint64 now_nsec;
+    time_t sec;
+    int msec, idx;
+    
+    now_nsec = bitd_get_time_nsec();
+    sec = (time_t)(now_nsec / 1000000000ULL);
+    msec = (int)((now_nsec / 1000000ULL) % 1000);
+
+    if (sec != r->ts_sec || !r->ts_len) {
+#if defined(_WIN32)
+	it = localtime_s(&t, &sec) ? NULL : &t;
+#else
+	it = localtime_r(&sec, &t);
+#endif
+	if (!it) {
+	    return 0;
+	}
+	r->ts_len = snprintf(r->ts, sizeof(r->ts),
+			     "%02d-%02d-%4d %02d:%02d:%02d.",
+			     it->tm_mon+1,it->tm_mday,it->tm_year + 1900,
+			     it->tm_hour,it->tm_min,it->tm_sec);
+	r->ts_sec = sec;
+    }
+
+    idx = r->ts_len;
+    memcpy(buf, r->ts, idx);
+    buf[idx++] = '0' + (msec / 100) % 10;
+    buf[idx++] = '0' + (msec / 10) % 10;
+    buf[idx++] = '0' + msec % 10;
+    memcpy(buf + idx, " : ", 3);
+
+    return idx + 3;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_vwrite
+ *============================================================================
+ * Description:     Format a log line, prefixed with the timestamp, and 
+ *     copy it into the current thread ring
+ * Parameters:    
+ *     prefix - the level and key prefix, or NULL for raw lines
+ *     wake_p - wake up the logger right away
+ * Returns:         The formatted line length
+ */
+static int log_vwrite(char *prefix, char *format_string, va_list args,
+		      bitd_boolean wake_p) {
+    char line[LOG_LINE_SIZE];
+    char *buf = line;
+    int buf_size = sizeof(line);
+    int size, idx, hdr_len, ret;
+    struct log_ring_s *r;
+    va_list args_copy;
+
+    r = ring_get();
+
+    /* The timestamp and prefix */
+    hdr_len = log_format_time(r, line);
+    if (prefix) {
+	hdr_len += snprintf(line + hdr_len, 
+			    sizeof(line) - hdr_len - 1, "%s", prefix);
+    }
+
+    for (;;) {
+	/* We might pad with "\n" so leave 1 byte at the end */
+	size = buf_size - 1;
+	idx = hdr_len;
+
+	if (idx < size) {
+	    va_copy(args_copy, args);
+	    ret = vsnprintf(buf + idx, size - idx, format_string, args_copy);
+	    va_end(args_copy);
+	    if (ret < 0) {
+		ret = 0;
+	    }
+	    idx += ret;
+	}
+
+	if (idx < size) {
+	    break;
+	}
+
+	/* Grow the line buffer */
+	if (buf != line) {
+	    free(buf);
+	}
+	buf_size = idx + 2;
+	buf = malloc(buf_size);
+	memcpy(buf, line, hdr_len);
+    }
+
+    /* Ensure newline termination */
+    if (!idx || buf[idx-1] != '\n') {
+	buf[idx++] = '\n';
+    }
+
+    bitd_printf("%.*s", idx, buf);
+
+    ring_write(r, buf, idx, wake_p);
+
+    if (buf != line) {
+	free(buf);
+    }
+
+    return idx;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_parse_spec
+ *============================================================================
+ * Description:     Parse a conversion specification of a format string,
+ *     and append the types of the args it consumes
+ * Parameters:    
+ *     s - points to the '%' that starts the specification
+ *     arg_types - the arg type array, LOG_ARGS_MAX long
+ *     n_args - the number of arg types in the array
+ * Returns:         Points past the specification, or NULL if the
+ *     specification args can't be recorded
+ */
+static const char *log_parse_spec(const char *s, bitd_uint8 *arg_types, 
+				  int *n_args) {
+    int len = log_arg_int;
+
+    if (*n_args + 3 > LOG_ARGS_MAX) {
+	return NULL;
+    }
+
+    s++;
+    if (*s == '%') {
+	return s + 1;
+    }
+
+    /* Flags */
+    while (*s && strchr("-+ #0'", *s)) {
+	s++;
+    }
+
+    /* Width */
+    if (*s == '*') {
+	arg_types[(*n_args)++] = log_arg_int;
+	s++;
+    } else {
+	while (isdigit((int)*s)) {
+	    s++;
+	}
+    }
+
+    /* Precision */
+    if (*s == '.') {
+	s++;
+	if (*s == '*') {
+	    arg_types[(*n_args)++] = log_arg_int;
+	    s++;
+	} else {
+	    while (isdigit((int)*s)) {
+		s++;
+	    }
+	}
+    }
+
+    /* Length modifier */
+    switch (*s) {
+    case 'h':
+	s++;
+	if (*s == 'h') {
+	    s++;
+	}
+	break;
+    case 'l':
+	s++;
+	len = log_arg_long;
+	if (*s == 'l') {
+	    s++;
+	    len = log_arg_llong;
+	}
+	break;
+    case 'q':
+	s++;
+	len = log_arg_llong;
+	break;
+    case 'j':
+	s++;
+	len = log_arg_intmax;
+	break;
+    case 'z':
+	s++;
+	len = log_arg_size;
+	break;
+    case 't':
+	s++;
+	len = log_arg_ptrdiff;
+	break;
+    case 'L':
+	/* Long doubles are not recorded */
+	return NULL;
+    }
+
+    /* Conversion */
+    switch (*s) {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+	arg_types[(*n_args)++] = len;
+	break;
+    case 'c':
+	if (len != log_arg_int) {
+	    return NULL;
+	}
+	arg_types[(*n_args)++] = log_arg_int;
+	break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+	arg_types[(*n_args)++] = log_arg_double;
+	break;
+    case 's':
+	if (len != log_arg_int) {
+	    return NULL;
+	}
+	arg_types[(*n_args)++] = log_arg_string;
+	break;
+    case 'p':
+	arg_types[(*n_args)++] = log_arg_ptr;
+	break;
+    default:
+	return NULL;
+    }
+    
+    return s + 1;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_dict_add
+ *============================================================================
+ * Description:     Add a dictionary entry. Called with the lock taken.
+ * Parameters:    
+ *     ptr - the format string address, or NULL for key names
+ * Returns:  
+ */
+static struct log_dict_s *log_dict_add(bitd_uint8 kind, const char *ptr,
+				       char *str) {
+    struct log_dict_s *d;
+    const char *s;
+
+    d = calloc(1, sizeof(*d));
+    d->kind = kind;
+    d->ptr = ptr;
+    d->str = strdup(str);
+
+    if (kind == LOG_DICT_FMT) {
+	/* Get the arg types */
+	for (s = str; s && *s; ) {
+	    if (*s == '%') {
+		s = log_parse_spec(s, d->arg_types, &d->n_args);
+	    } else {
+		s++;
+	    }
+	}
+	if (!s) {
+	    d->n_args = -1;
+	}
+
+	/* Chain the entry to the hash */
+	d->next = g_log_cb->dict_hash[LOG_DICT_HASH(ptr)];
+	g_log_cb->dict_hash[LOG_DICT_HASH(ptr)] = d;
+	g_log_cb->n_dict_fmt++;
+    }
+
+    /* Add the entry to the dictionary */
+    if (g_log_cb->n_dict == g_log_cb->dict_size) {
+	g_log_cb->dict_size = g_log_cb->dict_size ? 
+	    2 * g_log_cb->dict_size : 64;
+	g_log_cb->dict = realloc(g_log_cb->dict, 
+				 g_log_cb->dict_size * sizeof(*g_log_cb->dict));
+    }
+    g_log_cb->dict[g_log_cb->n_dict++] = d;
+    d->id = g_log_cb->n_dict;
+
+    return d;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_dict_fmt
+ *============================================================================
+ * Description:     Get the dictionary entry of a format string. Most
+ *     lookups hit the per-thread cache, without taking the lock. The 
+ *     string is compared, in case a module was reloaded at the same 
+ *     address. Entries are never evicted, since the log file refers to
+ *     them by id, so the dictionary is capped at LOG_DICT_FMT_MAX format
+ *     strings. Formats built at run time, at changing addresses, would 
+ *     otherwise grow it without bound.
+ * Parameters:    
+ * Returns:         The entry, or NULL if the dictionary is full
+ */
+static struct log_dict_s *log_dict_fmt(struct log_ring_s *r, 
+				       const char *fmt) {
+    struct log_dict_s *d;
 
-		unlink(fname2);
-		rename(fname1, fname2);
-	    }
+    d = r->fmt_cache[LOG_FMT_CACHE_HASH(fmt)];
+    if (d && d->ptr == fmt && !strcmp(d->str, fmt)) {
+	return d;
+    }
 
-	    free(fname1);
-	    free(fname2);
-	}
+    bitd_mutex_lock(g_log_cb->lock);
 
-	/* Reopen the log file */
-	g_log_cb->f = fopen(g_log_cb->log_name, "a");
-	if (!g_log_cb->f) {
-	    /* Could not open the log file */
-	    fprintf(stderr, "Failed to open %s, %s (errno %d)\n",
-		    g_log_cb->log_name, strerror(errno), errno);
+    for (d = g_log_cb->dict_hash[LOG_DICT_HASH(fmt)]; d; d = d->next) {
+	if (d->ptr == fmt && !strcmp(d->str, fmt)) {
+	    break;
 	}
     }
+    if (!d && (g_log_cb->n_dict_fmt < LOG_DICT_FMT_MAX ||
+	       fmt == s_log_text_fmt)) {
+	d = log_dict_add(LOG_DICT_FMT, fmt, (char *)fmt);
+    }
 
     bitd_mutex_unlock(g_log_cb->lock);
+
+    if (d) {
+	r->fmt_cache[LOG_FMT_CACHE_HASH(fmt)] = d;
+    }
+
+    return d;
 } 
 
 
 /*
  *============================================================================
- *                        handle_log_msg
+ *                        log_dict_key
  *============================================================================
- * Description:     
+ * Description:     Get the dictionary id of a key name
  * Parameters:    
  * Returns:  
  */
-static void handle_log_msg(ttlog_msg_buffer *log_msg_buf) {
-    int nbytes;
+static bitd_uint32 log_dict_key(ttlog_keyid keyid) {
+    bitd_uint32 id;
 
-    /* Ensure file is open and archive is rotated */
-    ensure_log_file();
-    
-    /* Log the message */
-    nbytes = write_log_msg(log_msg_buf->buf);
-    if (nbytes < 0) {
-	/* Error writing to file - need to reopen file */
-	g_log_cb->reopen_log_file_p = FALSE;
+    id = LOG_LOAD_ACQUIRE(&keyid->dict_id);
+    if (id) {
+	return id;
     }
-    g_log_cb->log_size += nbytes;
+
+    bitd_mutex_lock(g_log_cb->lock);
+    if (!keyid->dict_id) {
+	LOG_STORE_RELEASE(&keyid->dict_id, 
+			  log_dict_add(LOG_DICT_KEY, NULL, keyid->name)->id);
+    }
+    id = keyid->dict_id;
+    bitd_mutex_unlock(g_log_cb->lock);
+
+    return id;
 } 
 
+
 /*
  *============================================================================
- *                        logger_event_loop
+ *                        log_vwrite_binary
  *============================================================================
- * Description:     
+ * Description:     Record a log message, without formatting it. The
+ *     record holds the format string and key name dictionary ids, the
+ *     timestamp, and the raw args.
  * Parameters:    
- * Returns:  
+ *     keyid - the key, or NULL for raw lines
+ *     wake_p - wake up the logger right away
+ * Returns:         The record length
  */
-static void logger_event_loop(void *thread_arg) {
-    bitd_queue q;
-    bitd_msg m;
+static int log_vwrite_binary(ttlog_level level, ttlog_keyid keyid,
+			     char *format_string, va_list args,
+			     bitd_boolean wake_p) {
+    struct log_ring_s *r;
+    struct log_dict_s *d;
+    bitd_uint32 u32;
+    bitd_uint64 u64;
+    double dbl;
+    char *s, *rec;
+    int idx, i, len, len_max;
+
+    /* The record is encoded in the ring, rather than on the stack, 
+       which might be small */
+    r = ring_get();
+    rec = r->rec;
+    d = log_dict_fmt(r, format_string);
     
-    while (!g_log_cb->force_stop_p) {
-	
-	m = bitd_msg_receive(g_log_cb->q);
-	bitd_assert(m);
+    if (!d || d->n_args < 0) {
+	/* The dictionary is full, or the args can't be recorded. 
+	   Format the line here. */
+	vsnprintf(r->text, sizeof(r->text), format_string, args);
+	return log_write_binary(level, keyid, wake_p, 
+				(char *)s_log_text_fmt, r->text);
+    }
 
-	switch (bitd_msg_get_opcode(m)) {
-	case ttlog_opcode_log_msg:
-	    /* A log message */
-	    handle_log_msg((ttlog_msg_buffer *)m);
+    /* The message header */
+    idx = 4;
+    rec[idx++] = LOG_REC_MSG;
+    rec[idx++] = level;
+    u32 = keyid ? log_dict_key(keyid) : 0;
+    memcpy(rec + idx, &u32, 4);
+    idx += 4;
+    memcpy(rec + idx, &d->id, 4);
+    idx += 4;
+    u64 = bitd_get_time_nsec() / 1000000ULL;
+    memcpy(rec + idx, &u64, 8);
+    idx += 8;
+
+    /* The args */
+    for (i = 0; i < d->n_args; i++) {
+	switch (d->arg_types[i]) {
+	case log_arg_int:
+	    u64 = (bitd_int64)va_arg(args, int);
 	    break;
-	case ttlog_opcode_flush:
-	    /* Send the flush complete message */
-	    q = *(bitd_queue *)m;
-	    bitd_msg_send(m, q);
-	    continue;
-	case ttlog_opcode_exit:
-	    /* We're exiting */
-	    g_log_cb->force_stop_p = TRUE;
+	case log_arg_long:
+	    u64 = (bitd_int64)va_arg(args, long);
+	    break;
+	case log_arg_llong:
+	    u64 = (bitd_int64)va_arg(args, long long);
 	    break;
-	default:
-	    bitd_assert(0);
+	case log_arg_intmax:
+	    u64 = (bitd_int64)va_arg(args, intmax_t);
+	    break;
+	case log_arg_size:
+	    u64 = (bitd_uint64)va_arg(args, size_t);
+	    break;
+	case log_arg_ptrdiff:
+	    u64 = (bitd_int64)va_arg(args, ptrdiff_t);
+	    break;
+	case log_arg_double:
+	    dbl = va_arg(args, double);
+	    memcpy(&u64, &dbl, 8);
+	    break;
+	case log_arg_ptr:
+	    u64 = (uintptr_t)va_arg(args, void *);
+	    break;
+	case log_arg_string:
+	    /* The string length, then the string. Leave room for the 
+	       remaining args. */
+	    s = va_arg(args, char *);
+	    if (!s) {
+		u32 = 0xffffffff;
+		memcpy(rec + idx, &u32, 4);
+		idx += 4;
+		continue;
+	    }
+	    len = strlen(s);
+	    len_max = LOG_REC_SIZE_MAX - idx - 4 - 8 * (d->n_args - i - 1);
+	    if (len > len_max) {
+		len = len_max;
+	    }
+	    u32 = len;
+	    memcpy(rec + idx, &u32, 4);
+	    memcpy(rec + idx + 4, s, len);
+	    idx += 4 + len;
+	    continue;
 	}
-
-	bitd_msg_free(m);
+	memcpy(rec + idx, &u64, 8);
+	idx += 8;
     }
-}
+
+    /* The record length */
+    u32 = idx;
+    memcpy(rec, &u32, 4);
+
+    ring_write(r, rec, idx, wake_p);
+
+    return idx;
+} 
+
+
+/*
+ *============================================================================
+ *                        log_write_binary
+ *============================================================================
+ * Description:     Record a log message, without formatting it
+ * Parameters:    
+ * Returns:         The record length
+ */
+static int log_write_binary(ttlog_level level, ttlog_keyid keyid,
+			    bitd_boolean wake_p, char *format_string, ...) {
+    va_list args;
+    int ret;
+
+    va_start(args, format_string);
+    ret = log_vwrite_binary(level, keyid, format_string, args, wake_p);
+    va_end(args);
+
+    return ret;
+} 
 
 
 /*
@@ -320,6 +1318,8 @@ bitd_boolean ttlog_init(void) {
 
 	g_log_cb->log_size_max = LOG_SIZE_MAX_DEF;
 	g_log_cb->log_count = LOG_COUNT_DEF;
+	g_log_cb->flush_size = LOG_FLUSH_SIZE_DEF;
+	g_log_cb->flush_interval = LOG_FLUSH_INTERVAL_DEF;
 
 	/* The default level */
 	g_log_cb->level = log_level_info;
@@ -327,8 +1327,13 @@ bitd_boolean ttlog_init(void) {
 	/* Create the mutex */
 	g_log_cb->lock = bitd_mutex_create();
 
-	/* Create the logger queue, with a quota of 4M  */
-	g_log_cb->q = bitd_queue_create("logger", 0, 4*1024*1024);
+	/* Create the logger control queue */
+	g_log_cb->q = bitd_queue_create("logger", 0, 0);
+
+	/* Create the per-thread rings slot, and the wake up event */
+	g_log_cb->ring_tls = bitd_tls_create(ring_release);
+	g_log_cb->wake_ev = bitd_event_create(0);
+	g_log_cb->idle_p = TRUE;
 
 	/* Create the event loop */
 	g_log_cb->th = bitd_create_thread("logger", logger_event_loop, 
@@ -350,6 +1355,8 @@ bitd_boolean ttlog_init(void) {
 void ttlog_deinit(bitd_boolean force_stop) {
     bitd_msg m;
     ttlog_keyid key;
+    struct log_ring_s *r;
+    int i;
 
     if (g_log_cb) {
 	/* We're about to stop the logger */
@@ -358,6 +1365,7 @@ void ttlog_deinit(bitd_boolean force_stop) {
 	/* Send a stop message to the queue */
 	m = bitd_msg_alloc(ttlog_opcode_exit, 0);
         bitd_msg_send(m, g_log_cb->q);
+	bitd_event_set(g_log_cb->wake_ev);
 	
 	/* Wait for the event loop to exit */
         bitd_join_thread(g_log_cb->th);
@@ -365,6 +1373,16 @@ void ttlog_deinit(bitd_boolean force_stop) {
 	/* Close the queue */
 	bitd_queue_destroy(g_log_cb->q);
 
+	/* Release the rings. Threads that are still running will not 
+	   log, and will not release their rings. */
+	bitd_tls_destroy(g_log_cb->ring_tls);
+	while ((r = g_log_cb->rings)) {
+	    g_log_cb->rings = r->next;
+	    bitd_event_destroy(r->space_ev);
+	    free(r);
+	}
+	bitd_event_destroy(g_log_cb->wake_ev);
+
 	/* Release the file name */
 	if (g_log_cb->log_name) {
 	    free(g_log_cb->log_name);
@@ -391,18 +1409,34 @@ void ttlog_deinit(bitd_boolean force_stop) {
 	    }
 	    free(key);
 	}
+	while ((key = g_log_cb->retired_keys)) {
+	    g_log_cb->retired_keys = key->next;
+	    free(key->name);
+	    free(key);
+	}
+
+	/* Release the binary log dictionary */
+	for (i = 0; i < g_log_cb->n_dict; i++) {
+	    free(g_log_cb->dict[i]->str);
+	    free(g_log_cb->dict[i]);
+	}
+	free(g_log_cb->dict);
+	free(g_log_cb->dict_buf);
 
 	bitd_mutex_destroy(g_log_cb->lock);
 	free(g_log_cb);
+	g_log_cb = NULL;
     }
 }
 
 
+
 /*
  *============================================================================
  *                        ttlog_set_log_file_name
  *============================================================================
- * Description:     
+ * Description:     Set the log file. The records already buffered by
+ *     the threads are written to the old file.
  * Parameters:    
  * Returns:  
  */
@@ -412,6 +1446,9 @@ bitd_boolean ttlog_set_log_file_name(char *log_name) {
 	return FALSE;
     }
 
+    /* Write the buffered records before the file changes */
+    ttlog_flush();
+
     /* Do this inside the mutex */
     bitd_mutex_lock(g_log_cb->lock);
     
@@ -474,6 +1511,90 @@ bitd_boolean ttlog_set_log_file_count(int log_count) {
 } 
 
 
+/*
+ *============================================================================
+ *                        ttlog_set_log_file_binary
+ *============================================================================
+ * Description:     Log binary records instead of text lines. Binary logs
+ *     are rendered as text by ttlog_decode(). The log file is reopened,
+ *     and should be a new file. The records already buffered by the 
+ *     threads are written in the old format first, so that the two 
+ *     formats are not mixed in a file.
+ * Parameters:    
+ * Returns:  
+ */
+bitd_boolean ttlog_set_log_file_binary(bitd_boolean binary_p) {
+
+    if (!g_log_cb) {
+	return FALSE;
+    }
+
+    /* Write the buffered records before the format changes */
+    if (!g_log_cb->binary_p != !binary_p) {
+	ttlog_flush();
+    }
+
+    /* Do this inside the mutex */
+    bitd_mutex_lock(g_log_cb->lock);
+
+    g_log_cb->binary_p = binary_p;
+    if (g_log_cb->log_name) {
+	g_log_cb->reopen_log_file_p = TRUE;
+    }
+
+    bitd_mutex_unlock(g_log_cb->lock);
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        ttlog_set_flush_size
+ *============================================================================
+ * Description:     Set the number of bytes a thread may log before the 
+ *     logger is woken up to write them
+ * Parameters:    
+ * Returns:  
+ */
+bitd_boolean ttlog_set_flush_size(int flush_size) {
+
+    /* Parameter check */
+    if (flush_size <= 0 || flush_size > LOG_RING_SIZE || !g_log_cb) {
+	return FALSE;
+    }
+
+    g_log_cb->flush_size = flush_size;
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        ttlog_set_flush_interval
+ *============================================================================
+ * Description:     Set the max msecs a logged line waits before it is 
+ *     written. With a zero interval, every line wakes up the logger. 
+ *     The logger timeout is still at least LOG_FLUSH_INTERVAL_MIN msecs,
+ *     so the logger doesn't spin while lines are pending.
+ * Parameters:    
+ * Returns:  
+ */
+bitd_boolean ttlog_set_flush_interval(int flush_interval) {
+
+    /* Parameter check */
+    if (flush_interval < 0 || !g_log_cb) {
+	return FALSE;
+    }
+
+    g_log_cb->flush_interval = flush_interval;
+
+    /* Let the logger pick up the new interval */
+    bitd_event_set(g_log_cb->wake_ev);
+    return TRUE;
+} 
+
+
 /*
  *============================================================================
  *                        ttlog_register
@@ -507,6 +1628,8 @@ ttlog_keyid ttlog_register(char *key_name) {
     keyid->name = strdup(key_name);
     keyid->level = log_level_none;
     keyid->refcount = 1;
+    keyid->dict_id = 0;
+    keyid->hdr.level_max = g_log_cb->level;
     keyid->magic = KEYID_MAGIC;
 
     /* Chain the new key to tail of list */
@@ -557,10 +1680,12 @@ void ttlog_unregister(ttlog_keyid keyid) {
 	
 	/* Clear the magic */
 	keyid->magic = 0;
+	keyid->hdr.level_max = log_level_none;
 
-	/* Release key */
-	free(keyid->name);
-	free(keyid);
+	/* Retire the key. Other threads might still be logging with it. */
+	keyid->next = g_log_cb->retired_keys;
+	keyid->prev = NULL;
+	g_log_cb->retired_keys = keyid;
     }
 
     bitd_mutex_unlock(g_log_cb->lock);
@@ -645,15 +1770,27 @@ bitd_boolean ttlog_set_level(char *key_name, ttlog_level level) {
 	return FALSE;
     }
 
+    /* Do this inside the mutex */
+    bitd_mutex_lock(g_log_cb->lock);
+
+    /* Also update the cached max level of the keys */
     if (!key_name) {
 	g_log_cb->level = level;
+	for (keyid = g_log_cb->key_head;
+	     keyid != KEY_LIST_HEAD(g_log_cb);
+	     keyid = keyid->next) {
+	    keyid->hdr.level_max = MAX(keyid->level, level);
+	}
     } else {
 	keyid = ttlog_get_keyid(key_name);
 	if (keyid) {
 	    keyid->level = level;
+	    keyid->hdr.level_max = MAX(level, g_log_cb->level);
 	}
     }
 
+    bitd_mutex_unlock(g_log_cb->lock);
+
     return TRUE;
 }
 
@@ -678,6 +1815,7 @@ void ttlog_flush(void) {
 
     /* Send the flush message */
     bitd_msg_send(m, g_log_cb->q);
+    bitd_event_set(g_log_cb->wake_ev);
 
     /* Wait for the flush complete message */
     m = bitd_msg_receive(q);
@@ -718,86 +1856,31 @@ int ttlog(ttlog_level level, ttlog_keyid keyid, char *format_string, ...) {
  */
 int ttvlog(ttlog_level level, ttlog_keyid keyid, char *format_string, 
 	   va_list args) {
-    bitd_msg m = NULL;
-    int msg_size = sizeof(ttlog_msg_buffer);
-    ttlog_msg_buffer *log_msg_buf;
-    int size, idx;
-    bitd_boolean opcode_set = FALSE;
+    char prefix[128];
 
     if (!g_log_cb || !keyid || keyid->magic != KEYID_MAGIC) {
 	return -1;
     }
 
-    /* Filter the message at the global level */
-    if (!level) {
+    /* Filter the message at the global and key level */
+    if (!ttlog_enabled(level, keyid)) {
 	/* Drop message without returning error */
 	return 0;
     }
 
-    if (level > g_log_cb->level) {
-	if (!keyid) {
-	    /* Drop message without returning error */
-	    return 0;
-	}
-	/* Filter the message at the key level */
-	if (level > keyid->level) {
-	    /* Drop message without returning error */
-	    return 0;
-	}
-    }
-    
- again:
-    /* (Re)allocate and send the message */
-    m = bitd_msg_realloc(m, msg_size);
-    if (!opcode_set) {
-	bitd_msg_set_opcode(m, ttlog_opcode_log_msg);
-	opcode_set = TRUE;
-    }
-    log_msg_buf = (ttlog_msg_buffer *)m;
-
-    /* We might pad with "\n\0" so leave 2 bytes at the end */
-    size = msg_size - 2;
-    idx = 0;
-    
-    /* Inside the lock, because we access the key name */
-    bitd_mutex_lock(g_log_cb->lock);
-    idx += snprintf(log_msg_buf->buf + idx, size - idx,
-		    "%s: %s: ", 
-		    ttlog_get_level_name(level),
-		    keyid->magic == KEYID_MAGIC ? keyid->name : "");
-    bitd_mutex_unlock(g_log_cb->lock);
-    
-    if (idx < 0 || idx > size) {
-	if (msg_size < 1024*1024) {
-	    msg_size *= 2;
-	} else {
-	    msg_size += 1024*1024;
-	}
-	goto again;
-    }
-
-    /* Do this inside the mutex */
-    idx += vsnprintf(log_msg_buf->buf + idx, size - idx,
-		     format_string, args);
-    if (idx > size) {
-	msg_size *= 2;
-	goto again;
-    }
-    
-    /* Ensure newline termination */
-    if (log_msg_buf->buf[idx-1] != '\n') {
-	log_msg_buf->buf[idx++] = '\n';
+    if (g_log_cb->binary_p) {
+	return log_vwrite_binary(level, keyid, format_string, args,
+				 level <= log_level_warn);
     }
-    
-    /* Ensure NULL termination */
-    log_msg_buf->buf[idx++] = 0;
 
-    bitd_printf("%s", log_msg_buf->buf);
-
-    /* Send the message */
-    bitd_msg_send(m, g_log_cb->q);
+    /* The key name is immutable, and unregistered keys are retired 
+       rather than freed, so the name is read without the lock */
+    snprintf(prefix, sizeof(prefix), "%s: %s: ", 
+	     ttlog_get_level_name(level), keyid->name);
 
-    return idx;
+    /* Wake up the logger right away on warnings and errors */
+    return log_vwrite(prefix, format_string, args, 
+		      level <= log_level_warn);
 } 
 
 
@@ -830,39 +1913,17 @@ int ttlog_raw(char *format_string, ...) {
  * Returns:  
  */
 int ttvlog_raw(char *format_string, va_list args) {
-    bitd_msg m;
-    ttlog_msg_buffer *log_msg_buf;
-    int size, idx;
 
     if (!g_log_cb) {
 	return -1;
     }
 
-    /* Allocate and send the message */
-    m = bitd_msg_alloc(ttlog_opcode_log_msg, sizeof(ttlog_msg_buffer));
-    log_msg_buf = (ttlog_msg_buffer *)m;
-
-    /* We might pad with "\n\0" so leave 2 bytes at the end */
-    size = sizeof(log_msg_buf->buf) - 2;
-    idx = 0;
-    
-    idx += vsnprintf(log_msg_buf->buf + idx, size - idx,
-		     format_string, args);
-    
-    /* Ensure newline termination */
-    if (log_msg_buf->buf[idx-1] != '\n') {
-	log_msg_buf->buf[idx++] = '\n';
+    if (g_log_cb->binary_p) {
+	return log_vwrite_binary(log_level_none, NULL, format_string, args, 
+				 FALSE);
     }
-    
-    /* Ensure NULL termination */
-    log_msg_buf->buf[idx++] = 0;
-
-    bitd_printf("%s", log_msg_buf->buf);
 
-    /* Send the message */
-    bitd_msg_send(m, g_log_cb->q);
-
-    return idx;
+    return log_vwrite(NULL, format_string, args, FALSE);
 } 
 
 
@@ -1008,3 +2069,293 @@ void ttlog_free_keys(char **key_names, int n_keys) {
 
     free(key_names);
 }
+
+
+/*
+ *============================================================================
+ *                        log_decode_spec
+ *============================================================================
+ * Description:     Render one conversion specification of a binary record
+ * Parameters:    
+ *     spec - the specification, starting with '%'
+ *     stars - the width and precision args
+ *     n_stars - the number of width and precision args
+ *     arg_type - the arg type
+ *     u64 - the arg, unless a string
+ *     s - the string arg
+ * Returns:  
+ */
+static void log_decode_spec(FILE *out, char *spec, int *stars, int n_stars,
+			    int arg_type, bitd_uint64 u64, char *s) {
+    double dbl;
+
+#define LOG_DECODE_SPEC(v)					\
+    (n_stars == 0 ? fprintf(out, spec, v) :			\
+     n_stars == 1 ? fprintf(out, spec, stars[0], v) :		\
+     fprintf(out, spec, stars[0], stars[1], v))
+
+    switch (arg_type) {
+    case log_arg_int:
+	LOG_DECODE_SPEC((int)u64);
+	break;
+    case log_arg_long:
+	LOG_DECODE_SPEC((long)u64);
+	break;
+    case log_arg_llong:
+	LOG_DECODE_SPEC((long long)u64);
+	break;
+    case log_arg_intmax:
+	LOG_DECODE_SPEC((intmax_t)u64);
+	break;
+    case log_arg_size:
+	LOG_DECODE_SPEC((size_t)u64);
+	break;
+    case log_arg_ptrdiff:
+	LOG_DECODE_SPEC((ptrdiff_t)u64);
+	break;
+    case log_arg_double:
+	memcpy(&dbl, &u64, 8);
+	LOG_DECODE_SPEC(dbl);
+	break;
+    case log_arg_string:
+	LOG_DECODE_SPEC(s ? s : "(null)");
+	break;
+    case log_arg_ptr:
+	LOG_DECODE_SPEC((void *)(uintptr_t)u64);
+	break;
+    }
+
+#undef LOG_DECODE_SPEC
+} 
+
+
+/*
+ *============================================================================
+ *                        log_decode_msg
+ *============================================================================
+ * Description:     Render a binary log message record as a text line
+ * Parameters:    
+ *     dict - the dictionary strings, indexed by id
+ *     rec, size - the record, past the record header
+ * Returns:         0 on success, -1 if the record is invalid
+ */
+static int log_decode_msg(FILE *out, char **dict, int n_dict, 
+			  char *rec, int size) {
+    bitd_uint8 level, arg_types[LOG_ARGS_MAX];
+    bitd_uint32 key_id, fmt_id, u32;
+    bitd_uint64 msec, u64 = 0;
+    time_t sec;
+    struct tm t, *it;
+    char *fmt, *spec, *s;
+    const char *p, *end;
+    int idx, n_args, n_args_prev, stars[2], n_stars, i, spec_size = 0;
+    bitd_boolean nl_p = FALSE;
+
+    if (size < LOG_REC_MSG_SIZE - LOG_REC_HDR_SIZE) {
+	return -1;
+    }
+
+    level = rec[0];
+    if (level >= log_level_max) {
+	return -1;
+    }
+    memcpy(&key_id, rec + 1, 4);
+    memcpy(&fmt_id, rec + 5, 4);
+    memcpy(&msec, rec + 9, 8);
+    idx = 17;
+
+    if (key_id > (bitd_uint32)n_dict || 
+	!fmt_id || fmt_id > (bitd_uint32)n_dict || 
+	!dict[fmt_id - 1] || (key_id && !dict[key_id - 1])) {
+	return -1;
+    }
+    fmt = dict[fmt_id - 1];
+
+    /* The timestamp */
+    sec = (time_t)(msec / 1000);
+#if defined(_WIN32)
+    it = localtime_s(&t, &sec) ? NULL : &t;
+#else
+    it = localtime_r(&sec, &t);
+#endif
+    if (it) {
+	fprintf(out, "%02d-%02d-%4d %02d:%02d:%02d.%03d : ",
+		it->tm_mon+1,it->tm_mday,it->tm_year + 1900,
+		it->tm_hour,it->tm_min,it->tm_sec, (int)(msec % 1000));
+    }
+
+    /* The level and key prefix */
+    if (level) {
+	fprintf(out, "%s: %s: ", ttlog_get_level_name(level), 
+		key_id ? dict[key_id - 1] : "");
+    }
+
+    /* The message */
+    spec = NULL;
+    n_args = 0;
+    for (p = fmt; *p; ) {
+	if (*p != '%') {
+	    fputc(*p, out);
+	    nl_p = (*p == '\n');
+	    p++;
+	    continue;
+	}
+
+	n_args_prev = n_args;
+	end = log_parse_spec(p, arg_types, &n_args);
+	if (!end) {
+	    /* Not recorded as binary */
+	    free(spec);
+	    return -1;
+	}
+	nl_p = FALSE;
+	if (n_args == n_args_prev) {
+	    /* A "%%" */
+	    fputc('%', out);
+	    p = end;
+	    continue;
+	}
+
+	/* Copy the specification */
+	if (end - p + 1 > spec_size) {
+	    spec_size = end - p + 1;
+	    spec = realloc(spec, spec_size);
+	}
+	memcpy(spec, p, end - p);
+	spec[end - p] = 0;
+	p = end;
+
+	/* Get the args */
+	n_stars = 0;
+	s = NULL;
+	for (i = n_args_prev; i < n_args; i++) {
+	    if (arg_types[i] == log_arg_string) {
+		if (idx + 4 > size) {
+		    free(spec);
+		    return -1;
+		}
+		memcpy(&u32, rec + idx, 4);
+		idx += 4;
+		if (u32 == 0xffffffff) {
+		    s = NULL;
+		    continue;
+		}
+		if (idx + (int)u32 > size) {
+		    free(spec);
+		    return -1;
+		}
+		s = malloc(u32 + 1);
+		memcpy(s, rec + idx, u32);
+		s[u32] = 0;
+		idx += u32;
+		continue;
+	    }
+	    if (idx + 8 > size) {
+		free(spec);
+		return -1;
+	    }
+	    memcpy(&u64, rec + idx, 8);
+	    idx += 8;
+	    if (i < n_args - 1) {
+		/* A width or precision arg */
+		stars[n_stars++] = (int)u64;
+	    }
+	}
+
+	log_decode_spec(out, spec, stars, n_stars, 
+			arg_types[n_args - 1], u64, s);
+	free(s);
+    }
+    free(spec);
+
+    /* Ensure newline termination */
+    if (!nl_p) {
+	fputc('\n', out);
+    }
+
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        ttlog_decode
+ *============================================================================
+ * Description:     Render a binary log file as text
+ * Parameters:    
+ *     in - the binary log file
+ *     out - the text output
+ * Returns:         The number of rendered lines, or -1 on error
+ */
+int ttlog_decode(FILE *in, FILE *out) {
+    char magic[sizeof(LOG_BINARY_MAGIC) - 1];
+    char **dict = NULL, *rec = NULL;
+    int n_dict = 0, rec_size = 0, n_lines = 0, i;
+    bitd_uint32 u32, id;
+
+    /* The header */
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+	memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) ||
+	fread(&u32, 1, 4, in) != 4) {
+	return -1;
+    }
+    if (u32 != LOG_BINARY_ORDER) {
+	/* Written on a host with a different byte order */
+	return -1;
+    }
+
+    while (fread(&u32, 1, 4, in) == 4) {
+	if (u32 < LOG_REC_HDR_SIZE || u32 > 16*1024*1024) {
+	    n_lines = -1;
+	    break;
+	}
+	if ((int)u32 > rec_size) {
+	    rec_size = u32;
+	    rec = realloc(rec, rec_size);
+	}
+	if (fread(rec, 1, u32 - 4, in) != u32 - 4) {
+	    n_lines = -1;
+	    break;
+	}
+
+	if (rec[0] == LOG_REC_DICT) {
+	    if (u32 < LOG_REC_HDR_SIZE + 5) {
+		n_lines = -1;
+		break;
+	    }
+	    memcpy(&id, rec + 2, 4);
+	    if (!id || id > 16*1024*1024) {
+		n_lines = -1;
+		break;
+	    }
+	    if ((int)id > n_dict) {
+		dict = realloc(dict, id * sizeof(*dict));
+		memset(dict + n_dict, 0, (id - n_dict) * sizeof(*dict));
+		n_dict = id;
+	    }
+	    /* Entries are redefined when a new process appends */
+	    free(dict[id - 1]);
+	    dict[id - 1] = malloc(u32 - LOG_REC_HDR_SIZE - 5 + 1);
+	    memcpy(dict[id - 1], rec + 6, u32 - LOG_REC_HDR_SIZE - 5);
+	    dict[id - 1][u32 - LOG_REC_HDR_SIZE - 5] = 0;
+	} else if (rec[0] == LOG_REC_MSG) {
+	    if (log_decode_msg(out, dict, n_dict, rec + 1, 
+			       u32 - LOG_REC_HDR_SIZE)) {
+		n_lines = -1;
+		break;
+	    }
+	    n_lines++;
+	} else {
+	    n_lines = -1;
+	    break;
+	}
+    }
+
+    for (i = 0; i < n_dict; i++) {
+	free(dict[i]);
+    }
+    free(dict);
+    free(rec);
+
+    return n_lines;
+} 
@@ -110,8 +110,14 @@ mmr_err_t mmr_init(void) {
 	g_mmr_cb->event_loop_ev = bitd_event_create(BITD_EVENT_FLAG_POLL);
 	g_mmr_cb->task_inst_stopped_ev = bitd_event_create(0);
 
-	/* Initialize the worker thread pool */
-	g_mmr_cb->lambda = bitd_lambda_init("mmr-worker-thread-pool");
+	/* The parallel run executing on a worker thread */
+	g_mmr_cb->run_tls = bitd_tls_create(NULL);
+
+	/* The triggered runs chained inline on a worker thread */
+	g_mmr_cb->inline_tls = bitd_tls_create(NULL);
+
+	/* Initialize the worker thread pools */
+	mmr_pools_init();
 
 	/* Start the event loop thread */
 	g_mmr_cb->event_loop_th = bitd_create_thread("mmr-event-loop",
@@ -152,7 +158,7 @@ void mmr_deinit(void) {
 	    mmr_module_release(g_mmr_cb->module_head);
 	}
 	
-	mmr_log(log_level_trace, "Module manager deinitialized");
+	MMR_LOG(log_level_trace, "Module manager deinitialized");
 
 	mmr_api_unlock();
 
@@ -163,12 +169,14 @@ void mmr_deinit(void) {
 	/* Wait for event loop to exit */
 	bitd_join_thread(g_mmr_cb->event_loop_th);
 
-	/* Deinitialize the worker thread pool */
-	bitd_lambda_deinit(g_mmr_cb->lambda);
+	/* Deinitialize the worker thread pools */
+	mmr_pools_deinit();
 	
 	/* Destroy the events */
 	bitd_event_destroy(g_mmr_cb->event_loop_ev);
 	bitd_event_destroy(g_mmr_cb->task_inst_stopped_ev);
+	bitd_tls_destroy(g_mmr_cb->run_tls);
+	bitd_tls_destroy(g_mmr_cb->inline_tls);
 
 	bitd_nvp_free(g_mmr_cb->tags);
 	bitd_nvp_free(g_mmr_cb->config);
@@ -228,8 +236,10 @@ char *mmr_get_error_name(mmr_err_t err) {
  */
 mmr_err_t mmr_set_config(bitd_nvp_t config) {
     /* List of supported config options */
-    char *elem_names[] = {"n-worker-threads"};
+    char *elem_names[] = {"n-worker-threads", "timer-slack-nsec"};
     int n_elem_names = sizeof(elem_names)/sizeof(elem_names[0]);
+    int idx;
+    bitd_uint64 timer_slack_nsec = 0;
 
     if (!g_mmr_cb) {
 	return mmr_err_not_initialized;
@@ -239,6 +249,29 @@ mmr_err_t mmr_set_config(bitd_nvp_t config) {
     mmr_api_lock();
     bitd_nvp_free(g_mmr_cb->config);
     g_mmr_cb->config = bitd_nvp_trim(config, elem_names, n_elem_names);
+
+    /* Pass the timer slack to the event loop */
+    if (bitd_nvp_lookup_elem(g_mmr_cb->config, "timer-slack-nsec", &idx) &&
+	g_mmr_cb->config->e[idx].type == bitd_type_int64 &&
+	g_mmr_cb->config->e[idx].v.value_int64 > 0) {
+	timer_slack_nsec = g_mmr_cb->config->e[idx].v.value_int64;
+    }
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    /* Size the default worker thread pool */
+    if (bitd_nvp_lookup_elem(g_mmr_cb->config, "n-worker-threads", &idx) &&
+	g_mmr_cb->config->e[idx].type == bitd_type_int64 &&
+	g_mmr_cb->config->e[idx].v.value_int64 > 0) {
+	bitd_lambda_set_thread_max(g_mmr_cb->pool_head->lambda,
+			   (int)g_mmr_cb->config->e[idx].v.value_int64);
+    }
+
+    if (g_mmr_cb->timer_slack_nsec != timer_slack_nsec) {
+	g_mmr_cb->timer_slack_nsec = timer_slack_nsec;
+	bitd_event_set(g_mmr_cb->event_loop_ev);
+    }
+    bitd_mutex_unlock(g_mmr_cb->lock);
     mmr_api_unlock();
 
     return mmr_err_ok;    
@@ -273,6 +306,54 @@ mmr_err_t mmr_get_config(bitd_nvp_t *config) {
 } 
 
 
+/*
+ *============================================================================
+ *                        mmr_set_worker_pools
+ *============================================================================
+ * Description:     Declare the named worker pools
+ * Parameters:    
+ *     pools_nvp - nvp of pool declarations
+ * Returns:  
+ */
+mmr_err_t mmr_set_worker_pools(bitd_nvp_t pools_nvp) {
+
+    if (!g_mmr_cb) {
+	return mmr_err_not_initialized;
+    }
+
+    mmr_api_lock();
+    mmr_pools_set(pools_nvp);
+    mmr_api_unlock();
+
+    return mmr_err_ok;    
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_get_worker_pool_stats
+ *============================================================================
+ * Description:     Get the worker pool statistics
+ * Parameters:    
+ *     stats_nvp [OUT] - nvp with an element per pool
+ * Returns:  
+ */
+mmr_err_t mmr_get_worker_pool_stats(bitd_nvp_t *stats_nvp) {
+
+    if (!stats_nvp) {
+	return mmr_err_invalid_param;
+    }
+
+    if (!g_mmr_cb) {
+	return mmr_err_not_initialized;
+    }
+
+    *stats_nvp = mmr_pools_get_stats();
+
+    return mmr_err_ok;    
+} 
+
+
 /*
  *============================================================================
  *                        mmr_set_vlog_func
@@ -293,6 +374,27 @@ mmr_err_t mmr_set_vlog_func(mmr_vlog_func_t *f) {
 } 
 
 
+/*
+ *============================================================================
+ *                        mmr_set_log_keyid
+ *============================================================================
+ * Description:     Set the key the log function logs under. Messages 
+ *     not enabled under the key are dropped without being formatted.
+ * Parameters:    
+ * Returns:  
+ */
+mmr_err_t mmr_set_log_keyid(ttlog_keyid keyid) {
+
+    if (!g_mmr_cb) {
+	return mmr_err_not_initialized;
+    }
+
+    g_mmr_cb->log_keyid = keyid;
+
+    return mmr_err_ok;    
+} 
+
+
 /*
  *============================================================================
  *                        mmr_set_tags
@@ -396,13 +498,13 @@ mmr_err_t mmr_load_module(char *module_name) {
     mmr_api_lock();
     module = mmr_module_get(module_name, &ret);
     if (!module) {
-	mmr_log(log_level_err, "Failed to load module %s: %s", 
+	MMR_LOG(log_level_err, "Failed to load module %s: %s", 
 		module_name, mmr_get_error_name(ret));
 	ret = mmr_err_module_load_failed;
 	goto end;
     }
 
-    mmr_log(log_level_debug, "Loaded module %s refcount %d", 
+    MMR_LOG(log_level_debug, "Loaded module %s refcount %d", 
 	    module_name, module->refcount);
  end:
     mmr_api_unlock();
@@ -431,13 +533,13 @@ mmr_err_t mmr_unload_module(char *module_name) {
     mmr_api_lock();
     module = mmr_module_find(module_name);
     if (!module) {
-	mmr_log(log_level_debug, 
+	MMR_LOG(log_level_debug, 
 		"Failed to unload module %s, module not found", 
 		module_name);
     } else {
 	refcount = module->refcount - 1;
 	mmr_module_release(module);
-	mmr_log(log_level_debug, "Unloaded module %s, refcount %d", 
+	MMR_LOG(log_level_debug, "Unloaded module %s, refcount %d", 
 		module_name, refcount);
     }
     mmr_api_unlock();
@@ -468,11 +570,11 @@ mmr_task_t mmr_task_register(mmr_module_t module,
 
     task = mmr_task_get(module, task_name, task_api);
     if (!task) {
-	mmr_log(log_level_err, "Module %s: failed to register task %s",
+	MMR_LOG(log_level_err, "Module %s: failed to register task %s",
 		module->name, 
 		task_name);
     } else {
-	mmr_log(log_level_debug, 
+	MMR_LOG(log_level_debug, 
 		"Module %s: task %s registered, refcount %d",
 		module->name, 
 		task_name,
@@ -501,7 +603,7 @@ void mmr_task_unregister(mmr_task_t task) {
 
     mmr_api_lock();
 
-    mmr_log(log_level_debug, 
+    MMR_LOG(log_level_debug, 
 	    "Module %s: task %s unregistered, refcount %d",
 	    task->module->name,
 	    task->name,
@@ -545,7 +647,7 @@ mmr_err_t mmr_task_inst_create(char *task_name,
 
     task = mmr_task_find(task_name);
     if (!task) {
-	mmr_log(log_level_err, 
+	MMR_LOG(log_level_err, 
 		"Could not create task inst %s: %s: task does not exist",
 		task_name, task_inst_name);
 	ret = mmr_err_no_task;
@@ -554,7 +656,7 @@ mmr_err_t mmr_task_inst_create(char *task_name,
     
     task_inst = mmr_task_inst_get(task, task_inst_name);
     if (!task_inst) {
-	mmr_log(log_level_err, 
+	MMR_LOG(log_level_err, 
 		"Failed to create task inst %s: %s",
 		task_name, task_inst_name);
 	ret = mmr_err_task_inst_create_failed;
@@ -638,7 +740,7 @@ mmr_err_t mmr_task_inst_create(char *task_name,
     /* Schedule the next run */
     mmr_schedule_task_inst(task_inst);
     
-    mmr_log(log_level_debug, 
+    MMR_LOG(log_level_debug, 
 	    "Task inst %s: %s created, refcount %d",
 	    task_name, task_inst_name, task_inst->refcount);
 
@@ -685,7 +787,7 @@ mmr_err_t mmr_task_inst_prepare_destroy(char *task_name,
     
     task = mmr_task_find(task_name);
     if (!task) {
-	mmr_log(log_level_err, 
+	MMR_LOG(log_level_err, 
 		"Could not find task inst %s: %s: task does not exist",
 		task_name, task_inst_name);
 	ret = mmr_err_no_task;
@@ -694,7 +796,7 @@ mmr_err_t mmr_task_inst_prepare_destroy(char *task_name,
     
     task_inst = mmr_task_inst_find(task, task_inst_name);
     if (task_inst && task_inst->refcount <= 1) {
-	mmr_log(log_level_debug, 
+	MMR_LOG(log_level_debug, 
 		"Task inst %s: %s stopping",
 		task_name, task_inst_name);
 	mmr_task_inst_stop(task_inst);
@@ -733,7 +835,7 @@ mmr_err_t mmr_task_inst_destroy(char *task_name,
     
     task = mmr_task_find(task_name);
     if (!task) {
-	mmr_log(log_level_err, 
+	MMR_LOG(log_level_err, 
 		"Could not find task inst %s: %s: task does not exist",
 		task_name, task_inst_name);
 	ret = mmr_err_no_task;
@@ -742,7 +844,7 @@ mmr_err_t mmr_task_inst_destroy(char *task_name,
     
     task_inst = mmr_task_inst_find(task, task_inst_name);
     if (task_inst) {
-	mmr_log(log_level_debug, 
+	MMR_LOG(log_level_debug, 
 		"Task inst %s: %s destroyed, refcount %d",
 		task_name, task_inst_name, task_inst->refcount - 1);
 	mmr_task_inst_release(task_inst);
@@ -788,19 +890,62 @@ mmr_err_t mmr_results_register(mmr_report_results_t *f) {
  */
 void mmr_task_inst_report_results(mmr_task_inst_t task_inst,
 				  mmr_task_inst_results_t *r) {
-    bitd_boolean ret;
+    struct mmr_run_s *run;
+    struct run_results_s *rr;
 
-    mmr_log(log_level_trace, "%s: %s: Results",
+    MMR_LOG(log_level_trace, "%s: %s: Results",
 	    task_inst->task->name,
 	    task_inst->name);
 
+    /* Is this a parallel run of the task instance? */
+    run = (struct mmr_run_s *)bitd_tls_get(g_mmr_cb->run_tls);
+    if (run && run->task_inst == task_inst) {
+	if (run->ordered_p) {
+	    /* Buffer the results until the preceding runs have reported */
+	    rr = calloc(1, sizeof(*rr));
+	    mmr_task_inst_results_clone(&rr->r, r);
+	    rr->tstamp_ns = bitd_get_time_nsec_fast();
+	    if (run->results_tail) {
+		run->results_tail->next = rr;
+	    } else {
+		run->results_head = rr;
+	    }
+	    run->results_tail = rr;
+	} else {
+	    mmr_task_inst_report_run_results(task_inst, r, run->run_id,
+					     bitd_get_time_nsec_fast());
+	}
+	return;
+    }
+
     /* Get the result timestamp */
-    task_inst->run_tstamp_ns = bitd_get_time_nsec();
+    task_inst->run_tstamp_ns = bitd_get_time_nsec_fast();
+
+    mmr_task_inst_report_run_results(task_inst, r, 
+				     task_inst->run_id,
+				     task_inst->run_tstamp_ns);
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_task_inst_report_run_results
+ *============================================================================
+ * Description:     Pass the results of a run to the triggered task 
+ *     instances, or else to the results report callback
+ * Parameters:    
+ * Returns:  
+ */
+void mmr_task_inst_report_run_results(struct mmr_task_inst_s *task_inst,
+				      mmr_task_inst_results_t *r,
+				      bitd_uint64 run_id,
+				      bitd_uint64 tstamp_ns) {
+    bitd_boolean ret;
 
     /* Trigger task instances that wait for these results */
-    ret = mmr_schedule_triggers(task_inst, r);
+    ret = mmr_schedule_triggers(task_inst, r, run_id, tstamp_ns);
     if (ret) {
-	mmr_log(log_level_trace, "%s: %s: Results consumed by triggers",
+	MMR_LOG(log_level_trace, "%s: %s: Results consumed by triggers",
 		task_inst->task->name,
 		task_inst->name);
 	return;
@@ -811,8 +956,8 @@ void mmr_task_inst_report_results(mmr_task_inst_t task_inst,
 	g_mmr_cb->report_results(task_inst->task->name,
 				 task_inst->name,
 				 task_inst->params.tags,
-				 task_inst->run_id,
-				 task_inst->run_tstamp_ns,
+				 run_id,
+				 tstamp_ns,
 				 r);
     }
     bitd_mutex_unlock(g_mmr_cb->results_lock);
@@ -14,6 +14,14 @@
  *****************************************************************************/
 #include "mmr.h"
 
+#if defined(BITD_HAVE_TIMERFD)
+# include <sys/timerfd.h>
+#endif
+
+#if defined(BITD_HAVE_PRCTL)
+# include <sys/prctl.h>
+#endif
+
 
 /*****************************************************************************
  *                             MANIFEST CONSTANTS
@@ -50,49 +58,180 @@
  *****************************************************************************/
 
 
+/*
+ *============================================================================
+ *                        event_loop_set_timer_slack
+ *============================================================================
+ * Description:      Set the timer slack of the event loop thread. This
+ *     applies to the poll() timeout when the timerfd is not available.
+ * Parameters:    
+ *     timer_slack_nsec - the timer slack, or zero for the system default
+ * Returns:  
+ */
+static void event_loop_set_timer_slack(bitd_uint64 timer_slack_nsec) {
+#if defined(BITD_HAVE_PRCTL) && defined(PR_SET_TIMERSLACK)
+    if (prctl(PR_SET_TIMERSLACK, (unsigned long)timer_slack_nsec, 0, 0, 0)) {
+	MMR_LOG(log_level_warn, "Event loop timer slack %llu nsec: %s", 
+		timer_slack_nsec, strerror(errno));
+    }
+#endif
+} 
+
+
+#if defined(BITD_HAVE_TIMERFD)
+/*
+ *============================================================================
+ *                        event_loop_arm_timer
+ *============================================================================
+ * Description:      Arm the timerfd to the absolute monotonic time of the 
+ *     next timer expiration, or disarm it if there is no next expiration. 
+ *     With a timer slack, the expiration is rounded up to a multiple of 
+ *     the slack, so expirations close together share one wakeup.
+ * Parameters:    
+ *     timer_fd - the timerfd
+ *     tmo_nsec - time until the next expiration, or BITD_FOREVER_NSEC
+ *     timer_slack_nsec - the timer slack, or zero
+ * Returns:  
+ */
+static void event_loop_arm_timer(int timer_fd, 
+				 bitd_uint64 tmo_nsec,
+				 bitd_uint64 timer_slack_nsec) {
+    struct itimerspec its;
+    struct timespec now;
+    bitd_uint64 deadline_nsec;
+
+    memset(&its, 0, sizeof(its));
+
+    if (tmo_nsec != BITD_FOREVER_NSEC) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline_nsec = (bitd_uint64)now.tv_sec * 1000000000ULL + 
+	    now.tv_nsec + tmo_nsec;
+	
+	if (timer_slack_nsec) {
+	    deadline_nsec += timer_slack_nsec - 1;
+	    deadline_nsec -= deadline_nsec % timer_slack_nsec;
+	}
+
+	its.it_value.tv_sec = deadline_nsec / 1000000000ULL;
+	its.it_value.tv_nsec = deadline_nsec % 1000000000ULL;
+    }
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+	MMR_LOG(log_level_err, "Event loop timerfd_settime(): %s", 
+		strerror(errno));
+    }
+} 
+#endif
+
+
 /*
  *============================================================================
  *                        mmr_event_loop
  *============================================================================
- * Description:      The module manager event loop
+ * Description:      The module manager event loop. Sleeps until the next
+ *     timer expiration, using an absolute monotonic timerfd where 
+ *     available, and msec poll() timeouts otherwise.
  * Parameters:    
  * Returns:  
  */
 void mmr_event_loop(void *thread_arg) {
-    struct bitd_pollfd p;
-    int ret;
-    bitd_uint32 tmo;
+    struct bitd_pollfd p[2];
+    int ret, n_p;
+    bitd_uint64 tmo_nsec;
+    bitd_uint64 timer_slack_nsec = 0;
+    int tmo = 0;
+#if defined(BITD_HAVE_TIMERFD)
+    int timer_fd;
+    bitd_uint64 expirations;
+#endif
     
-    mmr_log(log_level_trace, "Event loop started");
+    MMR_LOG(log_level_trace, "Event loop started");
+
+#if defined(BITD_HAVE_TIMERFD)
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+	MMR_LOG(log_level_warn, "Event loop timerfd_create(): %s, "
+		"using msec timeouts", strerror(errno));
+    }
+#endif
 
     while (!g_mmr_cb->stopping_p) {
 
 	bitd_mutex_lock(g_mmr_cb->lock);
 
-	/* Tick the timers */
+	/* Pick up a timer slack change */
+	if (timer_slack_nsec != g_mmr_cb->timer_slack_nsec) {
+	    timer_slack_nsec = g_mmr_cb->timer_slack_nsec;
+	    event_loop_set_timer_slack(timer_slack_nsec);
+	}
+
+	/* Tick the timers. The timer callbacks and the scheduler
+	   share one current time for the tick. */
+	bitd_time_cache_begin();
 	bitd_timer_list_tick(g_mmr_cb->timers);
+	bitd_time_cache_end();
 
-	/* Get the list timer expiration */
-	tmo = bitd_timer_list_get_timeout_msec(g_mmr_cb->timers);
+	/* Dispatch the task instances left on the ready queue */
+	mmr_schedule_run_ready();
+
+	/* Get the time to the next timer expiration */
+	tmo_nsec = bitd_timer_list_get_timeout_nsec(g_mmr_cb->timers);
+	if (g_mmr_cb->ready_head) {
+	    tmo_nsec = 0;
+	}
 
-	/* Normalize it */
-	tmo = MAX(tmo, 1);
-	
 	bitd_mutex_unlock(g_mmr_cb->lock);
 
-	mmr_log(log_level_trace, "Event loop, timer list count %ld, min tmo %d", bitd_timer_list_count(g_mmr_cb->timers), tmo);
+	if (!tmo_nsec) {
+	    /* A timer is already due, the tick limit was reached, or task
+	       instances are ready */
+	    continue;
+	}
+
+	MMR_LOG(log_level_trace, "Event loop, timer list count %ld, min tmo %llu nsec", bitd_timer_list_count(g_mmr_cb->timers), tmo_nsec);
+
+	/* Wait on the wake up event, and on the timer */
+	memset(p, 0, sizeof(p));
+	p[0].fd = bitd_event_to_fd(g_mmr_cb->event_loop_ev);
+	p[0].events = BITD_POLLIN;
+	n_p = 1;
 
-	/* Wait on the stop event */
-	memset(&p, 0, sizeof(p));
-	p.fd = bitd_event_to_fd(g_mmr_cb->event_loop_ev);
-	p.events = BITD_POLLIN;
+#if defined(BITD_HAVE_TIMERFD)
+	if (timer_fd >= 0) {
+	    event_loop_arm_timer(timer_fd, tmo_nsec, timer_slack_nsec);
+
+	    p[1].fd = timer_fd;
+	    p[1].events = BITD_POLLIN;
+	    n_p = 2;
+	    tmo = -1;
+	}
+#endif
+
+	if (n_p == 1) {
+	    /* Round the timeout up to msecs, so we don't wake up early */
+	    if (tmo_nsec == BITD_FOREVER_NSEC) {
+		tmo = -1;
+	    } else {
+		tmo = (int)MIN((tmo_nsec + 999999ULL) / 1000000ULL, 
+			       0x7fffffffULL);
+	    }
+	}
 
-	mmr_log(log_level_trace, "Event loop poll, tmo %u, stopping %d", tmo, g_mmr_cb->stopping_p);
+	MMR_LOG(log_level_trace, "Event loop poll, tmo %d, stopping %d", tmo, g_mmr_cb->stopping_p);
 
-	ret = bitd_poll(&p, 1, tmo);
+	ret = bitd_poll(p, n_p, tmo);
 	if (ret > 0) {
-	    if (p.revents & BITD_POLLIN) {
-		mmr_log(log_level_trace, "Wake up event detected");
+#if defined(BITD_HAVE_TIMERFD)
+	    if (n_p == 2 && (p[1].revents & BITD_POLLIN)) {
+		/* Clear the timer expiration count */
+		if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+		    MMR_LOG(log_level_trace, "Event loop timerfd read(): %s", 
+			    strerror(errno));
+		}
+	    }
+#endif
+	    if (p[0].revents & BITD_POLLIN) {
+		MMR_LOG(log_level_trace, "Wake up event detected");
 		
 		/* Clear the event */
 		bitd_event_clear(g_mmr_cb->event_loop_ev);
@@ -103,5 +242,11 @@ void mmr_event_loop(void *thread_arg) {
 	}
     }
 
-    mmr_log(log_level_trace, "Event loop stopped");
+#if defined(BITD_HAVE_TIMERFD)
+    if (timer_fd >= 0) {
+	close(timer_fd);
+    }
+#endif
+
+    MMR_LOG(log_level_trace, "Event loop stopped");
 }
@@ -112,7 +112,7 @@ struct mmr_module_s *mmr_module_get(char *module_name,
 					    module->dll_name, 
 					    S_IREAD);
     if (!module->dll_full_name) {
-	mmr_log(log_level_err, "Could not find dll %s in path %s",
+	MMR_LOG(log_level_err, "Could not find dll %s in path %s",
 		module->dll_name, 
 		g_mmr_cb->module_path ? g_mmr_cb->module_path : "NULL");
 	if (err) {
@@ -128,7 +128,7 @@ struct mmr_module_s *mmr_module_get(char *module_name,
 	int bufsize = 256;
 
 	buf = malloc(bufsize);
-	mmr_log(log_level_err, "Could not load %s: %s.",
+	MMR_LOG(log_level_err, "Could not load %s: %s.",
 		module->dll_full_name, bitd_dll_error(buf, bufsize));
 
 	if (err) {
@@ -141,7 +141,7 @@ struct mmr_module_s *mmr_module_get(char *module_name,
     /* Look up the module entrypoint */
     module->load = bitd_dll_sym(module->dll_hdl, "bitd_module_load");
     if (!module->load) {
-	mmr_log(log_level_err, "Could not find bitd_module_load symbol in %s.",
+	MMR_LOG(log_level_err, "Could not find bitd_module_load symbol in %s.",
 		module->dll_full_name);
 	if (err) {
 	    *err = mmr_err_module_invalid_symbol;
@@ -152,7 +152,7 @@ struct mmr_module_s *mmr_module_get(char *module_name,
     /* Look up the module exitpoint */
     module->unload = bitd_dll_sym(module->dll_hdl, "bitd_module_unload");
     if (!module->unload) {
-	mmr_log(log_level_err, "Could not find bitd_module_unload symbol in %s.",
+	MMR_LOG(log_level_err, "Could not find bitd_module_unload symbol in %s.",
 		module->dll_full_name);
 	if (err) {
 	    *err = mmr_err_module_invalid_symbol;
@@ -165,7 +165,7 @@ struct mmr_module_s *mmr_module_get(char *module_name,
 
     /* Call the module entrypoint */
     if (!module->load(module, g_mmr_cb->tags, module->dll_dir)) {
-	mmr_log(log_level_err, "bitd_module_load() returns FALSE in %s.",
+	MMR_LOG(log_level_err, "bitd_module_load() returns FALSE in %s.",
 		module->dll_full_name);
 	if (err) {
 	    *err = mmr_err_module_load_failed;
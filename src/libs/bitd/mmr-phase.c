@@ -0,0 +1,255 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Phase planner for periodic task instances
+ *
+ * Copyright (C) 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "mmr.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* FNV-1a 64 bit hash constants */
+#define PHASE_HASH_BASIS 14695981039346656037ULL
+#define PHASE_HASH_PRIME 1099511628211ULL
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+static bitd_uint64 phase_hash(bitd_uint64 h, char *s);
+static int phase_compare(struct mmr_task_inst_s *ti1,
+			 struct mmr_task_inst_s *ti2);
+static void phase_plan(struct mmr_phase_group_s *group);
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        phase_hash
+ *============================================================================
+ * Description:     Hash a string. The hash does not depend on the process,
+ *     so phases are the same across restarts.
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint64 phase_hash(bitd_uint64 h, char *s) {
+
+    for (; s && *s; s++) {
+	h ^= (unsigned char)*s;
+	h *= PHASE_HASH_PRIME;
+    }
+
+    return h;
+}
+
+
+/*
+ *============================================================================
+ *                        phase_compare
+ *============================================================================
+ * Description:     Order task instances by their name hash, then by name
+ * Parameters:
+ * Returns:
+ */
+static int phase_compare(struct mmr_task_inst_s *ti1,
+			 struct mmr_task_inst_s *ti2) {
+    int ret;
+
+    if (ti1->phase_hash != ti2->phase_hash) {
+	return ti1->phase_hash < ti2->phase_hash ? -1 : 1;
+    }
+
+    ret = strcmp(ti1->task->name, ti2->task->name);
+    if (!ret) {
+	ret = strcmp(ti1->name, ti2->name);
+    }
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        phase_plan
+ *============================================================================
+ * Description:     Give each task instance of the group a slot of the
+ *     interval. The slots are a power of two, at least twice the number of
+ *     task instances. Each task instance takes the slot its hash points 
+ *     at, or the next free one. Collisions are resolved in hash order, so
+ *     the plan only depends on the membership. A joining task instance
+ *     only moves the task instances in the run of taken slots it lands 
+ *     in, and the others keep their phase until the slot count doubles.
+ * Parameters:
+ * Returns:
+ */
+static void phase_plan(struct mmr_phase_group_s *group) {
+    bitd_uint64 n_slots, step, rem, slot;
+    bitd_boolean *taken;
+    int i;
+
+    for (n_slots = 2; n_slots < 2 * (bitd_uint64)group->n_task_insts; 
+	 n_slots <<= 1);
+    step = group->interval_nsec / n_slots;
+    rem = group->interval_nsec % n_slots;
+    taken = calloc(n_slots, sizeof(*taken));
+
+    for (i = 0; i < group->n_task_insts; i++) {
+	slot = ((group->task_insts[i]->phase_hash >> 32) * n_slots) >> 32;
+	while (taken[slot]) {
+	    slot = (slot + 1) & (n_slots - 1);
+	}
+	taken[slot] = TRUE;
+
+	group->task_insts[i]->phase_nsec = slot * step + slot * rem / n_slots;
+	group->task_insts[i]->phase_gen = group->gen;
+    }
+
+    free(taken);
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_phase_join
+ *============================================================================
+ * Description:     Add a periodic task instance to the phase group of its
+ *     interval. Called with the mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+void mmr_phase_join(struct mmr_task_inst_s *ti) {
+    struct mmr_phase_group_s *group;
+    int i;
+
+    mmr_phase_leave(ti);
+
+    for (group = g_mmr_cb->phase_head; group; group = group->next) {
+	if (group->interval_nsec == ti->run_interval_nsec) {
+	    break;
+	}
+    }
+    if (!group) {
+	group = calloc(1, sizeof(*group));
+	group->interval_nsec = ti->run_interval_nsec;
+	group->next = g_mmr_cb->phase_head;
+	g_mmr_cb->phase_head = group;
+    }
+
+    if (group->n_task_insts == group->n_task_insts_max) {
+	group->n_task_insts_max = MAX(2 * group->n_task_insts_max, 16);
+	group->task_insts = realloc(group->task_insts,
+				    group->n_task_insts_max * 
+				    sizeof(*group->task_insts));
+    }
+
+    ti->phase_hash = phase_hash(phase_hash(PHASE_HASH_BASIS, 
+					   ti->task->name), 
+				ti->name);
+
+    /* Insert in hash order */
+    for (i = group->n_task_insts; i > 0; i--) {
+	if (phase_compare(group->task_insts[i - 1], ti) < 0) {
+	    break;
+	}
+	group->task_insts[i] = group->task_insts[i - 1];
+    }
+    group->task_insts[i] = ti;
+    group->n_task_insts++;
+    group->gen++;
+
+    ti->phase_group = group;
+    ti->phase_gen = group->gen - 1;
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_phase_leave
+ *============================================================================
+ * Description:     Remove a task instance from its phase group. Called 
+ *     with the mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+void mmr_phase_leave(struct mmr_task_inst_s *ti) {
+    struct mmr_phase_group_s *group = ti->phase_group, **p;
+    int i;
+
+    if (!group) {
+	return;
+    }
+
+    for (i = 0; i < group->n_task_insts; i++) {
+	if (group->task_insts[i] == ti) {
+	    memmove(&group->task_insts[i], &group->task_insts[i + 1],
+		    (group->n_task_insts - i - 1) * 
+		    sizeof(*group->task_insts));
+	    group->n_task_insts--;
+	    group->gen++;
+	    break;
+	}
+    }
+
+    ti->phase_group = NULL;
+
+    /* Free the group when it becomes empty */
+    if (!group->n_task_insts) {
+	for (p = &g_mmr_cb->phase_head; *p != group; p = &(*p)->next);
+	*p = group->next;
+	free(group->task_insts);
+	free(group);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_phase_get
+ *============================================================================
+ * Description:     Get the phase of a periodic task instance - its run
+ *     time slots are the times equal to the phase modulo the interval. 
+ *     The group is replanned if its membership changed. Called with the 
+ *     mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+bitd_uint64 mmr_phase_get(struct mmr_task_inst_s *ti) {
+
+    if (ti->phase_group && ti->phase_gen != ti->phase_group->gen) {
+	phase_plan(ti->phase_group);
+    }
+
+    return ti->phase_nsec;
+}
@@ -0,0 +1,462 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Named worker thread pools
+ *
+ * Copyright (C) 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "mmr.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The thread pool name of the default pool */
+#define POOL_DEFAULT_LAMBDA_NAME "mmr-worker-thread-pool"
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+static struct mmr_pool_s *pool_create(char *name);
+static void pool_configure(struct mmr_pool_s *pool, bitd_nvp_t config);
+static struct mmr_pool_s *pool_lookup(char *name);
+static struct mmr_pool_s *pool_lookup_binding(char *key, char *value);
+static struct mmr_pool_s *pool_resolve(struct mmr_task_inst_s *task_inst);
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The class names, as in the priority schedule option */
+static char *s_class_names[bitd_lambda_class_count] = {
+    "high", "normal", "bulk"
+};
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        pool_create
+ *============================================================================
+ * Description:     Create a pool, and chain it at the end of the pool list
+ * Parameters:
+ * Returns:
+ */
+static struct mmr_pool_s *pool_create(char *name) {
+    struct mmr_pool_s *pool, **p;
+    char *lambda_name;
+
+    pool = calloc(1, sizeof(*pool));
+    pool->name = strdup(name);
+
+    if (!strcmp(name, MMR_POOL_DEFAULT)) {
+	pool->lambda = bitd_lambda_init(POOL_DEFAULT_LAMBDA_NAME);
+    } else {
+	lambda_name = malloc(strlen(name) + 16);
+	sprintf(lambda_name, "mmr-pool-%s", name);
+	pool->lambda = bitd_lambda_init(lambda_name);
+	free(lambda_name);
+    }
+
+    for (p = &g_mmr_cb->pool_head; *p; p = &(*p)->next);
+    *p = pool;
+
+    return pool;
+}
+
+
+/*
+ *============================================================================
+ *                        pool_configure
+ *============================================================================
+ * Description:     Apply the pool declaration. Settings that are not
+ *     declared keep their current value.
+ * Parameters:
+ * Returns:
+ */
+static void pool_configure(struct mmr_pool_s *pool, bitd_nvp_t config) {
+    int idx;
+
+    pool->config = bitd_nvp_clone(config);
+
+    if (bitd_nvp_lookup_elem(config, "thread-min", &idx) &&
+	config->e[idx].type == bitd_type_int64 &&
+	config->e[idx].v.value_int64 >= 0) {
+	bitd_lambda_set_thread_min(pool->lambda,
+				   (int)config->e[idx].v.value_int64);
+    }
+    if (bitd_nvp_lookup_elem(config, "thread-max", &idx) &&
+	config->e[idx].type == bitd_type_int64 &&
+	config->e[idx].v.value_int64 >= 0) {
+	bitd_lambda_set_thread_max(pool->lambda,
+				   (int)config->e[idx].v.value_int64);
+    }
+    if (bitd_nvp_lookup_elem(config, "thread-idle-tmo", &idx) &&
+	config->e[idx].type == bitd_type_int64 &&
+	config->e[idx].v.value_int64 > 0) {
+	bitd_lambda_set_thread_idle_tmo(pool->lambda,
+				(bitd_uint32)config->e[idx].v.value_int64);
+    }
+    if (bitd_nvp_lookup_elem(config, "task-max", &idx) &&
+	config->e[idx].type == bitd_type_int64 &&
+	config->e[idx].v.value_int64 >= 0) {
+	bitd_lambda_set_task_max(pool->lambda,
+				 (int)config->e[idx].v.value_int64);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        pool_lookup
+ *============================================================================
+ * Description:     Find a declared pool by name. The default pool is
+ *     always declared.
+ * Parameters:
+ * Returns:
+ */
+static struct mmr_pool_s *pool_lookup(char *name) {
+    struct mmr_pool_s *pool;
+
+    for (pool = g_mmr_cb->pool_head; pool; pool = pool->next) {
+	if (!strcmp(pool->name, name) &&
+	    (pool->config || pool == g_mmr_cb->pool_head)) {
+	    return pool;
+	}
+    }
+
+    return NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        pool_lookup_binding
+ *============================================================================
+ * Description:     Find the declared pool with a key: value binding
+ * Parameters:
+ *     key - module-name or task-name
+ * Returns:
+ */
+static struct mmr_pool_s *pool_lookup_binding(char *key, char *value) {
+    struct mmr_pool_s *pool;
+    int i;
+
+    for (pool = g_mmr_cb->pool_head; pool; pool = pool->next) {
+	if (!pool->config) {
+	    continue;
+	}
+	for (i = 0; i < pool->config->n_elts; i++) {
+	    if (pool->config->e[i].type == bitd_type_string &&
+		pool->config->e[i].name &&
+		pool->config->e[i].v.value_string &&
+		!strcmp(pool->config->e[i].name, key) &&
+		!strcmp(pool->config->e[i].v.value_string, value)) {
+		return pool;
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        pool_resolve
+ *============================================================================
+ * Description:     Find the pool of a task instance. The worker-pool
+ *     schedule option takes precedence over a task-name binding, which
+ *     takes precedence over a module-name binding.
+ * Parameters:
+ * Returns:
+ */
+static struct mmr_pool_s *pool_resolve(struct mmr_task_inst_s *task_inst) {
+    struct mmr_pool_s *pool;
+    int idx;
+
+    if (bitd_nvp_lookup_elem(task_inst->sched, "worker-pool", &idx) &&
+	task_inst->sched->e[idx].type == bitd_type_string &&
+	task_inst->sched->e[idx].v.value_string) {
+	pool = pool_lookup(task_inst->sched->e[idx].v.value_string);
+	if (pool) {
+	    return pool;
+	}
+
+	MMR_LOG(log_level_warn,
+		"%s: %s: Worker pool %s not declared, using the %s pool",
+		task_inst->task->name, task_inst->name,
+		task_inst->sched->e[idx].v.value_string,
+		MMR_POOL_DEFAULT);
+    }
+
+    pool = pool_lookup_binding("task-name", task_inst->task->name);
+    if (pool) {
+	return pool;
+    }
+
+    pool = pool_lookup_binding("module-name", task_inst->task->module->name);
+    if (pool) {
+	return pool;
+    }
+
+    return g_mmr_cb->pool_head;
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pools_init
+ *============================================================================
+ * Description:     Create the default pool
+ * Parameters:
+ * Returns:
+ */
+void mmr_pools_init(void) {
+
+    pool_create(MMR_POOL_DEFAULT);
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pools_deinit
+ *============================================================================
+ * Description:     Stop and free all pools
+ * Parameters:
+ * Returns:
+ */
+void mmr_pools_deinit(void) {
+    struct mmr_pool_s *pool;
+
+    while ((pool = g_mmr_cb->pool_head)) {
+	g_mmr_cb->pool_head = pool->next;
+
+	bitd_lambda_deinit(pool->lambda);
+	bitd_nvp_free(pool->config);
+	free(pool->name);
+	free(pool);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pools_set
+ *============================================================================
+ * Description:     Declare the worker pools. Pools that are no longer
+ *     declared keep their threads, so runs in progress complete, but
+ *     lose their bindings.
+ * Parameters:
+ *     pools - nvp of pool declarations, each an nvp with a name
+ * Returns:
+ */
+void mmr_pools_set(bitd_nvp_t pools) {
+    struct mmr_pool_s *pool;
+    bitd_nvp_t config;
+    int i, idx;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    for (pool = g_mmr_cb->pool_head; pool; pool = pool->next) {
+	bitd_nvp_free(pool->config);
+	pool->config = NULL;
+    }
+
+    for (i = 0; pools && i < pools->n_elts; i++) {
+	if (pools->e[i].type != bitd_type_nvp) {
+	    continue;
+	}
+	config = pools->e[i].v.value_nvp;
+
+	if (!bitd_nvp_lookup_elem(config, "name", &idx) ||
+	    config->e[idx].type != bitd_type_string ||
+	    !config->e[idx].v.value_string ||
+	    !config->e[idx].v.value_string[0]) {
+	    MMR_LOG(log_level_warn, "Worker pool without a name, ignored");
+	    continue;
+	}
+
+	pool = pool_lookup(config->e[idx].v.value_string);
+	if (pool && pool->config) {
+	    MMR_LOG(log_level_warn, "Worker pool %s declared twice, ignored",
+		    pool->name);
+	    continue;
+	}
+	if (!pool) {
+	    pool = pool_create(config->e[idx].v.value_string);
+	}
+
+	pool_configure(pool, config);
+
+	MMR_LOG(log_level_trace, "Worker pool %s declared", pool->name);
+    }
+
+    /* Task instances resolve their pool again */
+    g_mmr_cb->pool_gen++;
+
+    bitd_mutex_unlock(g_mmr_cb->lock);
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pools_get_stats
+ *============================================================================
+ * Description:     Get the counters of each pool, and of its classes
+ * Parameters:
+ * Returns:
+ *     nvp with an element per pool
+ */
+bitd_nvp_t mmr_pools_get_stats(void) {
+    struct mmr_pool_s *pool;
+    bitd_nvp_t nvp = NULL, pool_nvp, class_nvp;
+    bitd_lambda_stats_t s;
+    bitd_lambda_class_stats_t cs;
+    bitd_value_t v;
+    int c;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    for (pool = g_mmr_cb->pool_head; pool; pool = pool->next) {
+	pool_nvp = NULL;
+
+	bitd_lambda_get_stats(pool->lambda, &s);
+	v.value_int64 = s.thread_count;
+	bitd_nvp_add_elem(&pool_nvp, "thread-count", &v, bitd_type_int64);
+	v.value_int64 = s.thread_idle;
+	bitd_nvp_add_elem(&pool_nvp, "thread-idle", &v, bitd_type_int64);
+	v.value_int64 = s.n_queued;
+	bitd_nvp_add_elem(&pool_nvp, "queued", &v, bitd_type_int64);
+	v.value_int64 = s.n_running;
+	bitd_nvp_add_elem(&pool_nvp, "running", &v, bitd_type_int64);
+	v.value_uint64 = pool->n_dispatched;
+	bitd_nvp_add_elem(&pool_nvp, "dispatched", &v, bitd_type_uint64);
+	v.value_uint64 = pool->n_rejected;
+	bitd_nvp_add_elem(&pool_nvp, "rejected", &v, bitd_type_uint64);
+	v.value_uint64 = pool->n_inlined;
+	bitd_nvp_add_elem(&pool_nvp, "inlined", &v, bitd_type_uint64);
+
+	for (c = 0; c < bitd_lambda_class_count; c++) {
+	    class_nvp = NULL;
+
+	    bitd_lambda_get_class_stats(pool->lambda, c, &cs);
+	    v.value_int64 = cs.n_queued;
+	    bitd_nvp_add_elem(&class_nvp, "queued", &v, bitd_type_int64);
+	    v.value_int64 = cs.max_queued;
+	    bitd_nvp_add_elem(&class_nvp, "max-queued", &v, bitd_type_int64);
+	    v.value_int64 = cs.n_running;
+	    bitd_nvp_add_elem(&class_nvp, "running", &v, bitd_type_int64);
+	    v.value_uint64 = cs.n_executed;
+	    bitd_nvp_add_elem(&class_nvp, "executed", &v, bitd_type_uint64);
+	    v.value_uint64 = cs.wait_nsec;
+	    bitd_nvp_add_elem(&class_nvp, "wait-nsec", &v, bitd_type_uint64);
+	    v.value_uint64 = cs.max_wait_nsec;
+	    bitd_nvp_add_elem(&class_nvp, "max-wait-nsec", &v,
+			      bitd_type_uint64);
+	    v.value_uint64 = cs.n_deadline_missed;
+	    bitd_nvp_add_elem(&class_nvp, "deadline-missed", &v,
+			      bitd_type_uint64);
+
+	    v.value_nvp = class_nvp;
+	    bitd_nvp_add_elem(&pool_nvp, s_class_names[c], &v, bitd_type_nvp);
+	    bitd_nvp_free(class_nvp);
+	}
+
+	v.value_nvp = pool_nvp;
+	bitd_nvp_add_elem(&nvp, pool->name, &v, bitd_type_nvp);
+	bitd_nvp_free(pool_nvp);
+    }
+
+    bitd_mutex_unlock(g_mmr_cb->lock);
+
+    return nvp;
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pool_get
+ *============================================================================
+ * Description:     Get the worker pool of the task instance, resolving it
+ *     again if the pool bindings changed. Called with the mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+struct mmr_pool_s *mmr_pool_get(struct mmr_task_inst_s *task_inst) {
+
+    if (!task_inst->pool || task_inst->pool_gen != g_mmr_cb->pool_gen) {
+	task_inst->pool = pool_resolve(task_inst);
+	task_inst->pool_gen = g_mmr_cb->pool_gen;
+    }
+
+    return task_inst->pool;
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_pool_exec_task
+ *============================================================================
+ * Description:     Execute a run of the task instance in its worker pool.
+ *     Periodic runs are due by their slot plus the deadline, other runs
+ *     by their dispatch time plus the deadline. Called with the mmr lock
+ *     held.
+ * Parameters:
+ * Returns:
+ *     FALSE if the pool refused the run
+ */
+bitd_boolean mmr_pool_exec_task(struct mmr_task_inst_s *task_inst,
+				bitd_lambda_task_func_t f) {
+    bitd_boolean ret;
+    bitd_uint64 deadline_nsec;
+
+    mmr_pool_get(task_inst);
+
+    if (task_inst->sched_type == task_inst_sched_periodic_t &&
+	task_inst->next_run_nsec) {
+	deadline_nsec = task_inst->next_run_nsec;
+    } else {
+	deadline_nsec = bitd_get_time_nsec_cached();
+    }
+    deadline_nsec += task_inst->deadline_nsec;
+
+    ret = bitd_lambda_exec_task_deadline(task_inst->pool->lambda,
+					 task_inst->lambda_class,
+					 task_inst->lambda_weight,
+					 deadline_nsec,
+					 f,
+					 task_inst);
+    if (ret) {
+	task_inst->pool->n_dispatched++;
+    } else {
+	task_inst->pool->n_rejected++;
+    }
+
+    return ret;
+}
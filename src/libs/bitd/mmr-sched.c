@@ -36,7 +36,9 @@
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-
+static bitd_uint64 sched_parse_time(char *time_str);
+static bitd_int64 sched_periodic_tmo(struct mmr_task_inst_s *ti,
+				     bitd_uint64 current_time);
 
 
 /*****************************************************************************
@@ -50,6 +52,111 @@
  *****************************************************************************/
 
 
+/*
+ *============================================================================
+ *                        sched_parse_time
+ *============================================================================
+ * Description:     Parse a schedule time such as 100ms, 5s or 1h
+ * Parameters:    
+ * Returns:  
+ *     The time in nsecs
+ */
+static bitd_uint64 sched_parse_time(char *time_str) {
+    bitd_uint64 ret = atoll(time_str);
+
+    if (strstr(time_str, "ns")) {
+	/* No-op */
+    } else if (strstr(time_str, "us")) {
+	ret *= 1000ULL;
+    } else if (strstr(time_str, "ms")) {
+	ret *= 1000000ULL;
+    } else if (strchr(time_str, 's')) {
+	ret *= 1000000000ULL;
+    } else if (strchr(time_str, 'm')) {
+	ret *= (1000000000ULL*60);
+    } else if (strchr(time_str, 'h')) {
+	ret *= (1000000000ULL*3600);
+    } else if (strchr(time_str, 'd')) {
+	ret *= (1000000000ULL*3600*24);
+    }
+
+    return ret;
+} 
+
+
+/*
+ *============================================================================
+ *                        sched_periodic_tmo
+ *============================================================================
+ * Description:     Pick the next run time slot of a periodic task instance.
+ *     Slots are the times equal to the phase modulo the run interval, so
+ *     they don't drift, and don't change across reloads and restarts.
+ * Parameters:    
+ * Returns:  
+ *     The timeout until the next run
+ */
+static bitd_int64 sched_periodic_tmo(struct mmr_task_inst_s *ti,
+				     bitd_uint64 current_time) {
+    bitd_uint64 phase = mmr_phase_get(ti);
+    bitd_uint64 interval = ti->run_interval_nsec;
+    bitd_uint64 slot, last_slot, n_due;
+
+    /* The last slot at or before the current time */
+    last_slot = current_time - (current_time - phase) % interval;
+
+    if (!ti->next_run_nsec) {
+	/* The first run is at the next slot. Long intervals are
+	   compressed so that the first run is not too far away. */
+	slot = last_slot == current_time ? last_slot : last_slot + interval;
+	if (slot - current_time > MMR_PHASE_SPAN_MAX) {
+	    slot = current_time + 
+		(bitd_uint64)((double)(slot - current_time) * 
+			      MMR_PHASE_SPAN_MAX / interval);
+	}
+	ti->next_run_nsec = slot;
+
+	return slot - current_time;
+    }
+
+    /* The slot after the previous run slot */
+    slot = ti->next_run_nsec - (ti->next_run_nsec - phase) % interval + 
+	interval;
+    if (slot <= current_time) {
+	/* We are falling behind. The slots up to the current time are
+	   due. */
+	n_due = (last_slot - slot) / interval + 1;
+
+	switch (ti->catch_up) {
+	case task_inst_catch_up_skip_t:
+	    /* Miss the due slots, and run in the next one */
+	    ti->n_missed_slots += n_due;
+	    ti->next_run_nsec = last_slot + interval;
+	    return ti->next_run_nsec - current_time;
+
+	case task_inst_catch_up_burst_t:
+	    /* Run rightaway, once per due slot, and miss the oldest
+	       slots past catch-up-max */
+	    if (n_due > (bitd_uint64)ti->catch_up_max) {
+		ti->n_missed_slots += n_due - ti->catch_up_max;
+		slot = last_slot - (ti->catch_up_max - 1) * interval;
+	    }
+	    ti->next_run_nsec = slot;
+	    return 0;
+
+	default:
+	    /* Run rightaway, once for all due slots */
+	    ti->n_missed_slots += n_due - 1;
+	    ti->next_run_nsec = last_slot;
+	    return 0;
+	}
+    }
+
+    ti->next_run_nsec = slot;
+
+    return slot - current_time;
+} 
+
+
 /*
  *============================================================================
  *                        mmr_schedule_task_inst
@@ -66,7 +173,8 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
     bitd_boolean timer_add_p = FALSE;
     bitd_boolean wake_up_event_loop_p = FALSE;
     bitd_uint64 current_time;
-    bitd_int64 tmo = 0, tmo_min = 0, tmo_list = 0;
+    bitd_int64 tmo = 0, tmo_min = 0;
+    bitd_uint64 tmo_list;
 
     /* If task instance is already scheduled, don't double schedule it.
        This is an issue for triggered tasks, which can be triggered
@@ -127,28 +235,57 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
 		
 		/* Parse the run-interval*/
 		time_str = ti->sched->e[idx].v.value_string;
-		ti->run_interval_nsec = atoll(time_str);
-
-		if (strstr(time_str, "ns")) {
-		    /* No-op */
-		} else if (strstr(time_str, "us")) {
-		    ti->run_interval_nsec *= 1000ULL;
-		} else if (strstr(time_str, "ms")) {
-		    ti->run_interval_nsec *= 1000000ULL;
-		} else if (strchr(time_str, 's')) {
-		    ti->run_interval_nsec *= 1000000000ULL;
-		} else if (strchr(time_str, 'm')) {
-		    ti->run_interval_nsec *= (1000000000ULL*60);
-		} else if (strchr(time_str, 'h')) {
-		    ti->run_interval_nsec *= (1000000000ULL*3600);
-		} else if (strchr(time_str, 'd')) {
-		    ti->run_interval_nsec *= (1000000000ULL*3600*24);
-		}
+		ti->run_interval_nsec = sched_parse_time(time_str);
 	    } else {
 		/* Change schedule type to none */
 		ti->sched_type = task_inst_sched_none_t;
 	    }
+	}
+
+	/* Plan the phase of periodic task instances. The phase option
+	   pins the phase. Otherwise, task instances with the same interval
+	   are spread over it by their name hashes. */
+	mmr_phase_leave(ti);
+	if (ti->sched_type == task_inst_sched_periodic_t &&
+	    ti->run_interval_nsec) {
+	    ti->next_run_nsec = 0;
+	    if (bitd_nvp_lookup_elem(ti->sched, "phase", &idx) &&
+		ti->sched->e[idx].type == bitd_type_string) {
+		ti->phase_nsec = 
+		    sched_parse_time(ti->sched->e[idx].v.value_string) % 
+		    ti->run_interval_nsec;
+	    } else {
+		mmr_phase_join(ti);
+	    }
+
+	    /* Parse the overrun catch-up policy */
+	    ti->catch_up = task_inst_catch_up_coalesce_t;
+	    ti->catch_up_max = MMR_CATCH_UP_MAX_DEF;
+	    if (bitd_nvp_lookup_elem(ti->sched, "catch-up", &idx) &&
+		ti->sched->e[idx].type == bitd_type_string &&
+		ti->sched->e[idx].v.value_string) {
+		if (!strcmp(ti->sched->e[idx].v.value_string, "skip")) {
+		    ti->catch_up = task_inst_catch_up_skip_t;
+		} else if (!strcmp(ti->sched->e[idx].v.value_string, 
+				   "burst")) {
+		    ti->catch_up = task_inst_catch_up_burst_t;
+		} else if (strcmp(ti->sched->e[idx].v.value_string, 
+				  "coalesce")) {
+		    MMR_LOG(log_level_warn, 
+			    "%s: %s: Unknown catch-up %s, using coalesce",
+			    ti->task->name, ti->name,
+			    ti->sched->e[idx].v.value_string);
+		}
+	    }
+	    if (bitd_nvp_lookup_elem(ti->sched, "catch-up-max", &idx) &&
+		ti->sched->e[idx].type == bitd_type_int64 &&
+		ti->sched->e[idx].v.value_int64 > 0) {
+		ti->catch_up_max = (int)MIN(ti->sched->e[idx].v.value_int64,
+					    MMR_CATCH_UP_MAX);
+	    }
+	}
 
+	if (ti->sched_type == task_inst_sched_random_t) {
 	    /* Compute the next run time */
 	    if (ti->run_interval_nsec) {
 		/* Pick a random time less than run_interval but not
@@ -179,6 +316,103 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
 		ti->triggered_prev = NULL;
 	    }
 	}
+
+	/* The worker pool is resolved again at the next run */
+	ti->pool = NULL;
+
+	/* Parse the worker thread scheduling class and weight */
+	ti->lambda_class = bitd_lambda_class_normal;
+	ti->lambda_weight = 1;
+	if (bitd_nvp_lookup_elem(ti->sched, "priority", &idx) &&
+	    ti->sched->e[idx].type == bitd_type_string &&
+	    ti->sched->e[idx].v.value_string) {
+	    if (!strcmp(ti->sched->e[idx].v.value_string, "high")) {
+		ti->lambda_class = bitd_lambda_class_high;
+	    } else if (!strcmp(ti->sched->e[idx].v.value_string, "bulk")) {
+		ti->lambda_class = bitd_lambda_class_bulk;
+	    } else if (strcmp(ti->sched->e[idx].v.value_string, "normal")) {
+		MMR_LOG(log_level_warn, 
+			"%s: %s: Unknown priority %s, using normal",
+			ti->task->name, ti->name,
+			ti->sched->e[idx].v.value_string);
+	    }
+	}
+	if (bitd_nvp_lookup_elem(ti->sched, "weight", &idx) &&
+	    ti->sched->e[idx].type == bitd_type_int64 &&
+	    ti->sched->e[idx].v.value_int64 > 0) {
+	    ti->lambda_weight = (int)MIN(ti->sched->e[idx].v.value_int64, 
+					 MMR_WEIGHT_MAX);
+	}
+
+	/* Parse the run deadline. Runs are dispatched to worker threads
+	   earliest deadline first. A periodic run is due within its 
+	   interval, but no later than the default deadline, so slow 
+	   periodic task instances don't sort behind triggered runs. */
+	if (ti->sched_type == task_inst_sched_periodic_t &&
+	    ti->run_interval_nsec) {
+	    ti->deadline_nsec = MIN(ti->run_interval_nsec, MMR_DEADLINE_DEF);
+	} else {
+	    ti->deadline_nsec = MMR_DEADLINE_DEF;
+	}
+	if (bitd_nvp_lookup_elem(ti->sched, "deadline", &idx) &&
+	    ti->sched->e[idx].type == bitd_type_string &&
+	    sched_parse_time(ti->sched->e[idx].v.value_string)) {
+	    ti->deadline_nsec = 
+		sched_parse_time(ti->sched->e[idx].v.value_string);
+	}
+
+	/* Parse the run concurrency of triggered task instances */
+	ti->max_concurrency = 1;
+	ti->ordered_p = FALSE;
+	ti->max_batch_size = 1;
+	ti->inline_p = FALSE;
+	if (ti->triggered_next) {
+	    if (bitd_nvp_lookup_elem(ti->sched, "max-concurrency", &idx) &&
+		ti->sched->e[idx].type == bitd_type_int64 &&
+		ti->sched->e[idx].v.value_int64 > 1) {
+		if (IS_SET(ti->task->api.flags, 
+			   BITD_TASK_FLAG_CONCURRENT_RUN) &&
+		    !ti->task->api.task_inst_run_async) {
+		    ti->max_concurrency = 
+			(int)MIN(ti->sched->e[idx].v.value_int64, 
+				 MMR_MAX_CONCURRENCY);
+		} else {
+		    MMR_LOG(log_level_warn, 
+			    "%s: %s: Task runs can't be concurrent, "
+			    "ignoring max-concurrency",
+			    ti->task->name, ti->name);
+		}
+	    }
+	    if (bitd_nvp_lookup_elem(ti->sched, "ordered", &idx) &&
+		ti->sched->e[idx].type == bitd_type_boolean) {
+		ti->ordered_p = ti->sched->e[idx].v.value_boolean;
+	    }
+
+	    /* Cheap tasks may run inline on the worker that reported the
+	       triggering results, unless the schedule opts out */
+	    if (IS_SET(ti->task->api.flags, BITD_TASK_FLAG_INLINE_RUN) &&
+		!ti->task->api.task_inst_run_async) {
+		ti->inline_p = TRUE;
+		if (bitd_nvp_lookup_elem(ti->sched, "inline", &idx) &&
+		    ti->sched->e[idx].type == bitd_type_boolean) {
+		    ti->inline_p = ti->sched->e[idx].v.value_boolean;
+		}
+	    }
+
+	    /* Tasks with a batch run method drain the input queue in
+	       batches. Async runs take one input at a time. */
+	    if (ti->task->api.task_inst_run_batch &&
+		!ti->task->api.task_inst_run_async) {
+		ti->max_batch_size = MMR_BATCH_SIZE_DEF;
+		if (bitd_nvp_lookup_elem(ti->sched, "max-batch-size", &idx) &&
+		    ti->sched->e[idx].type == bitd_type_int64 &&
+		    ti->sched->e[idx].v.value_int64 > 0) {
+		    ti->max_batch_size = 
+			(int)MIN(ti->sched->e[idx].v.value_int64, 
+				 MMR_BATCH_SIZE_MAX);
+		}
+	    }
+	}
     }
 
     switch (ti->sched_type) {
@@ -211,9 +445,12 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
 	if (!IS_SET(ti->state, TASK_INST_RUNNING) &&
 	    ti->run_interval_nsec) {
 	    
-	    current_time = bitd_get_time_nsec();
+	    current_time = bitd_get_time_nsec_cached();
 	    tmo = ti->next_run_nsec - current_time;
-	    if (tmo <= 0) {
+	    if (ti->sched_type == task_inst_sched_periodic_t) {
+		/* Run in the next time slot of the phase */
+		tmo = sched_periodic_tmo(ti, current_time);
+	    } else if (tmo <= 0) {
 		/* We are falling behind - need to execute rightaway. 
 		   Also reset the next_run based on the current time */
 		tmo = 0;
@@ -237,8 +474,8 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
 
 	    /* We should wake up the event loop if the timer is shorter than
 	       all other timers */
-	    tmo_list = bitd_timer_list_get_timeout_msec(g_mmr_cb->timers);
-	    if (tmo / 1000000ULL < tmo_list) {
+	    tmo_list = bitd_timer_list_get_timeout_nsec(g_mmr_cb->timers);
+	    if ((bitd_uint64)tmo < tmo_list) {
 		wake_up_event_loop_p = TRUE;
 	    }
 	}	
@@ -247,7 +484,14 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
     case task_inst_sched_triggered_t:
     case task_inst_sched_triggered_raw_t:
 	
-	if (ti->input_queue_head != INPUT_QUEUE_HEAD(ti)) {
+	/* Schedule if there is input, and a concurrent run slot. Serial
+	   task instances have no concurrent runs. */
+	if (ti->input_queue_head != INPUT_QUEUE_HEAD(ti) &&
+	    ti->n_runs < ti->max_concurrency) {
+	    if (mmr_task_inst_run_inline(ti)) {
+		/* Chained on the current worker thread */
+		return;
+	    }
 	    timer_add_p = TRUE;
 	    wake_up_event_loop_p = TRUE;
 	}
@@ -258,8 +502,28 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
     }
     
 
-    if (timer_add_p) {
-	mmr_log(log_level_trace,
+    if (timer_add_p && tmo <= 0) {
+	/* The run is due now. Dispatch it off the ready queue, without
+	   going through the timer list and the event loop. */
+	MMR_LOG(log_level_trace, "%s: %s: Ready, sched %d",
+		ti->task->name,
+		ti->name,
+		ti->sched_type);
+
+	SET_BIT(ti->state, TASK_INST_SCHEDULED);
+
+	ti->ready_next = NULL;
+	ti->ready_p = TRUE;
+	if (g_mmr_cb->ready_tail) {
+	    g_mmr_cb->ready_tail->ready_next = ti;
+	} else {
+	    g_mmr_cb->ready_head = ti;
+	}
+	g_mmr_cb->ready_tail = ti;
+
+	mmr_schedule_run_ready();
+    } else if (timer_add_p) {
+	MMR_LOG(log_level_trace,
 		"%s: %s: Timer add, tmo %u msecs, sched %d, run interval %llu msecs%s",
 		ti->task->name,
 		ti->name,
@@ -284,6 +548,78 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
 } 
 
 
+/*
+ *============================================================================
+ *                        mmr_schedule_run_ready
+ *============================================================================
+ * Description:     Dispatch the task instances on the ready queue to their
+ *     worker pools. Task instances queued again while dispatching, for 
+ *     instance after a worker pool refused their run, are left for the 
+ *     event loop. Called with the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+void mmr_schedule_run_ready(void) {
+    struct mmr_task_inst_s *ti, *ready;
+
+    if (g_mmr_cb->ready_draining_p) {
+	return;
+    }
+    g_mmr_cb->ready_draining_p = TRUE;
+
+    /* Take over the ready queue */
+    ready = g_mmr_cb->ready_head;
+    g_mmr_cb->ready_head = NULL;
+    g_mmr_cb->ready_tail = NULL;
+
+    while ((ti = ready)) {
+	ready = ti->ready_next;
+	ti->ready_next = NULL;
+	ti->ready_p = FALSE;
+
+	mmr_task_inst_dispatch(ti);
+    }
+
+    g_mmr_cb->ready_draining_p = FALSE;
+
+    if (g_mmr_cb->ready_head) {
+	bitd_event_set(g_mmr_cb->event_loop_ev);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_schedule_ready_remove
+ *============================================================================
+ * Description:     Take a task instance off the ready queue, if it's on it.
+ *     Called with the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+void mmr_schedule_ready_remove(struct mmr_task_inst_s *task_inst) {
+    struct mmr_task_inst_s **prev, *last = NULL;
+
+    if (!task_inst->ready_p) {
+	return;
+    }
+
+    for (prev = &g_mmr_cb->ready_head; *prev; prev = &(*prev)->ready_next) {
+	if (*prev == task_inst) {
+	    *prev = task_inst->ready_next;
+	    if (g_mmr_cb->ready_tail == task_inst) {
+		g_mmr_cb->ready_tail = last;
+	    }
+	    break;
+	}
+	last = *prev;
+    }
+
+    task_inst->ready_next = NULL;
+    task_inst->ready_p = FALSE;
+} 
+
+
 /*
  *============================================================================
  *                        mmr_schedule_triggers
@@ -295,7 +631,9 @@ void mmr_schedule_task_inst(struct mmr_task_inst_s *ti) {
  *     FALSE if results are not consumed
  */
 bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
-				   mmr_task_inst_results_t *r) {
+				   mmr_task_inst_results_t *r,
+				   bitd_uint64 run_id,
+				   bitd_uint64 tstamp_ns) {
     bitd_boolean ret = FALSE;
     mmr_task_inst_t ti;
     int idx, i, j;
@@ -309,7 +647,7 @@ bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
 	ti_trigger->sched->e[idx].type == bitd_type_boolean &&
 	ti_trigger->sched->e[idx].v.value_boolean) {
 
-	mmr_log(log_level_err, "%s: %s: Non-zero exit code %d", 
+	MMR_LOG(log_level_err, "%s: %s: Non-zero exit code %d", 
 		ti_trigger->task->name, ti_trigger->name, r->exit_code);
 
 	/* Wait for existing log messages to be saved */
@@ -380,7 +718,7 @@ bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
 	    /* Queue full */
 	    g_mmr_cb->input_queue_dropped++;
 
-	    mmr_log(log_level_warn, "%s: %s: Dropping trigger for %s: %s, result queue size full (%d/%d)",
+	    MMR_LOG(log_level_warn, "%s: %s: Dropping trigger for %s: %s, result queue size full (%d/%d)",
 		    ti_trigger->task->name,
 		    ti_trigger->name,
 		    ti->task->name,
@@ -391,15 +729,16 @@ bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
 
 	/* Enqueue input for the triggered task instance */
 	iq = malloc(sizeof(*iq));
-	iq->next = ti->input_queue_tail;
-	iq->prev = ti->input_queue_tail->prev;
+	iq->next = INPUT_QUEUE_HEAD(ti);
+	iq->prev = ti->input_queue_tail;
 	iq->next->prev = iq;
 	iq->prev->next = iq;
 	iq->input.type = bitd_type_void;
+	ti->input_queue_len++;
 
 	g_mmr_cb->input_queue_size++;
 	if (g_mmr_cb->input_queue_size > g_mmr_cb->input_queue_max / 2) {
-	    mmr_log(log_level_warn, "Input queue size incremented to %d/%d, above half",
+	    MMR_LOG(log_level_warn, "Input queue size incremented to %d/%d, above half",
 		    g_mmr_cb->input_queue_size, g_mmr_cb->input_queue_max);
 	}
 
@@ -408,7 +747,7 @@ bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
 	       of this task instance */
 	    bitd_object_clone(&iq->input, &r->output);
 
-	    mmr_log(log_level_trace, "%s: %s: Triggering %s: %s",
+	    MMR_LOG(log_level_trace, "%s: %s: Triggering %s: %s",
 		    ti_trigger->task->name,
 		    ti_trigger->name,
 		    ti->task->name,
@@ -417,9 +756,11 @@ bitd_boolean mmr_schedule_triggers(mmr_task_inst_t ti_trigger,
 	    /* Copy the previous task instance tags, run-id, run-timestamp.
 	       exit-code, output and error */
 	    iq->input.type = bitd_type_nvp;
-	    iq->input.v.value_nvp = mmr_get_raw_results(ti_trigger, r);
+	    iq->input.v.value_nvp = mmr_get_run_raw_results(ti_trigger, r,
+							    run_id,
+							    tstamp_ns);
 
-	    mmr_log(log_level_trace, "%s: %s: Triggering-raw %s: %s ",
+	    MMR_LOG(log_level_trace, "%s: %s: Triggering-raw %s: %s ",
 		    ti_trigger->task->name,
 		    ti_trigger->name,
 		    ti->task->name,
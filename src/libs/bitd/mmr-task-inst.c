@@ -37,6 +37,18 @@
  *                           FUNCTION DECLARATION
  *****************************************************************************/
 
+static int task_inst_dequeue_inputs(struct mmr_task_inst_s *task_inst,
+				    bitd_object_t **inputs);
+static int task_inst_run_inputs(struct mmr_task_inst_s *task_inst,
+				bitd_object_t *inputs, int n_inputs);
+static void task_inst_start_parallel_runs(struct mmr_task_inst_s *task_inst);
+static void task_inst_dispatch_refused(struct mmr_task_inst_s *task_inst);
+static void task_inst_run(struct mmr_task_inst_s *task_inst);
+static void task_inst_run_end(struct mmr_task_inst_s *task_inst);
+static void task_inst_inline_begin(struct mmr_inline_runs_s *inline_runs,
+				   struct mmr_task_inst_s *task_inst);
+static void task_inst_inline_end(struct mmr_inline_runs_s *inline_runs);
+static void task_inst_report_ordered_runs(struct mmr_task_inst_s *task_inst);
 
 
 /*****************************************************************************
@@ -89,6 +101,10 @@ struct mmr_task_inst_s *mmr_task_inst_get(struct mmr_task_s *task,
 
     task_inst->input_queue_head = INPUT_QUEUE_HEAD(task_inst);
     task_inst->input_queue_tail = INPUT_QUEUE_HEAD(task_inst);
+    task_inst->max_concurrency = 1;
+    task_inst->max_batch_size = 1;
+    task_inst->lambda_class = bitd_lambda_class_normal;
+    task_inst->lambda_weight = 1;
 
     /* Chain this task to the end of the task-owned list */
     task_inst->prev = task->task_inst_tail;
@@ -203,7 +219,7 @@ mmr_err_t mmr_task_inst_update(struct mmr_task_inst_s *task_inst) {
 	
 	/* Was the task instance successfully created? */
 	if (!task_inst->user_task_inst) {
-	    mmr_log(log_level_trace, 
+	    MMR_LOG(log_level_trace, 
 		    "Task inst %s: %s create failed",
 		    task->name, task_inst->name);
 	    return mmr_err_task_inst_create_failed;
@@ -240,7 +256,7 @@ void mmr_task_inst_stop(struct mmr_task_inst_s *task_inst) {
 	task->api.task_inst_kill(task_inst->user_task_inst,
 				 BITD_TASK_SIGSTOP);
 
-	mmr_log(log_level_trace, 
+	MMR_LOG(log_level_trace, 
 		"%s: %s: task_inst_kill(BITD_TASK_SIGSTOP) called",
 		task->name, task_inst->name);
     }
@@ -358,10 +374,18 @@ void mmr_task_inst_release(struct mmr_task_inst_s *task_inst) {
 	    /* Release the memory */
 	    bitd_object_free(&iq->input);
 	    free(iq);
+
+	    task_inst->input_queue_len--;
+	    g_mmr_cb->input_queue_size--;
 	}
 
-	/* Destroy the run timer */
+	/* Leave the phase group */
+	mmr_phase_leave(task_inst);
+
+	/* Destroy the run timer, and take the task instance off the ready
+	   queue */
 	bitd_timer_destroy(task_inst->run_timer);
+	mmr_schedule_ready_remove(task_inst);
 	
 	/* Free the task instance */
 	free(task_inst->name);
@@ -386,12 +410,28 @@ void mmr_task_inst_release(struct mmr_task_inst_s *task_inst) {
 void mmr_task_inst_run_timer_expired(bitd_timer t,
 				     void *cookie) {
     struct mmr_task_inst_s *task_inst = (struct mmr_task_inst_s *)cookie;
-    bitd_boolean ret;
     
-    mmr_log(log_level_trace, "%s: %s: Run timer expired",
+    MMR_LOG(log_level_trace, "%s: %s: Run timer expired",
 	    task_inst->task->name,
 	    task_inst->name);
 
+    mmr_task_inst_dispatch(task_inst);
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_task_inst_dispatch
+ *============================================================================
+ * Description:     Hand a scheduled run of the task instance to its worker
+ *     pool - when its run timer expires, or off the ready queue. Called 
+ *     with the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+void mmr_task_inst_dispatch(struct mmr_task_inst_s *task_inst) {
+    bitd_boolean ret;
+
     SET_BIT(task_inst->state, TASK_INST_PENDING_RUN);
 
     /* Bear trap */
@@ -402,19 +442,79 @@ void mmr_task_inst_run_timer_expired(bitd_timer t,
 	if (task_inst->input_queue_head == INPUT_QUEUE_HEAD(task_inst)) {
 	    return;
 	}
+
+	if (task_inst->max_concurrency > 1) {
+	    task_inst_start_parallel_runs(task_inst);
+	    return;
+	}
     }
 
-    ret = bitd_lambda_exec_task(g_mmr_cb->lambda,
-			      mmr_task_inst_run,
-			      task_inst);
+    ret = mmr_pool_exec_task(task_inst, mmr_task_inst_run);
     if (!ret) {
-	mmr_log(log_level_err, "%s: %s: bitd_lambda_task_exec() returned FALSE",
+	task_inst_dispatch_refused(task_inst);
+	return;
+    }
+    task_inst->pool_refused_p = FALSE;
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_dispatch_refused
+ *============================================================================
+ * Description:     The worker pool is at its task-max, and refused the run.
+ *     A periodic or random task instance misses the run, and is scheduled
+ *     for its next one. Other task instances stay scheduled, and retry
+ *     after MMR_POOL_RETRY_NSEC, so that queued input isn't stranded, and
+ *     a 'once' run doesn't spin through the ready queue. Called with the
+ *     mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_dispatch_refused(struct mmr_task_inst_s *task_inst) {
+
+    if (!task_inst->pool_refused_p) {
+	MMR_LOG(log_level_warn, "%s: %s: Worker pool %s full, run %s",
 		task_inst->task->name,
-		task_inst->name);
+		task_inst->name,
+		task_inst->pool->name,
+		(task_inst->sched_type == task_inst_sched_periodic_t ||
+		 task_inst->sched_type == task_inst_sched_random_t) ?
+		"skipped" : "deferred");
+	task_inst->pool_refused_p = TRUE;
+    }
 
-	/* Should never happen */
-	bitd_assert(0);
+    CLR_BIT(task_inst->state, TASK_INST_PENDING_RUN);
+
+    if (task_inst->sched_type == task_inst_sched_periodic_t ||
+	task_inst->sched_type == task_inst_sched_random_t) {
+	if (task_inst->sched_type == task_inst_sched_periodic_t) {
+	    task_inst->n_missed_slots++;
+	}
+	CLR_BIT(task_inst->state, TASK_INST_SCHEDULED);
+	mmr_schedule_task_inst(task_inst);
+	return;
     }
+
+    if (task_inst->stopping_p) {
+	/* Don't retry for a task instance being destroyed */
+	CLR_BIT(task_inst->state, TASK_INST_SCHEDULED);
+	bitd_event_set(g_mmr_cb->task_inst_stopped_ev);
+	return;
+    }
+
+    MMR_LOG(log_level_trace, "%s: %s: Run retry in %llu msecs",
+	    task_inst->task->name,
+	    task_inst->name,
+	    MMR_POOL_RETRY_NSEC / 1000000ULL);
+
+    SET_BIT(task_inst->state, TASK_INST_SCHEDULED);
+    bitd_timer_list_add_nsec(g_mmr_cb->timers,
+			     task_inst->run_timer,
+			     MMR_POOL_RETRY_NSEC,
+			     mmr_task_inst_run_timer_expired,
+			     task_inst);
+    bitd_event_set(g_mmr_cb->event_loop_ev);
 } 
 
 
@@ -422,16 +522,36 @@ void mmr_task_inst_run_timer_expired(bitd_timer t,
  *============================================================================
  *                        mmr_task_inst_run
  *============================================================================
- * Description:     
+ * Description:     A serial run of the task instance on a worker thread,
+ *     followed by the triggered runs chained inline
  * Parameters:    
  * Returns:  
  */
 void mmr_task_inst_run(void *cookie, bitd_boolean *stopping_p) {
     struct mmr_task_inst_s *task_inst = (struct mmr_task_inst_s *)cookie;
-    mmr_err_t ret = mmr_err_ok;
+    struct mmr_inline_runs_s inline_runs;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+    task_inst_inline_begin(&inline_runs, task_inst);
+    bitd_mutex_unlock(g_mmr_cb->lock);
+
+    task_inst_run(task_inst);
+    task_inst_inline_end(&inline_runs);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run
+ *============================================================================
+ * Description:     A serial run of the task instance
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_run(struct mmr_task_inst_s *task_inst) {
     int task_inst_ret;
-    struct input_queue_s *iq = NULL;
-    bitd_object_t *input = NULL;
+    bitd_object_t *inputs = NULL;
+    int n_inputs = 1;
 
     /* Set the run flag. This ensures that the config can't change past
        this point. */
@@ -451,67 +571,251 @@ void mmr_task_inst_run(void *cookie, bitd_boolean *stopping_p) {
     switch (task_inst->sched_type) {
     case task_inst_sched_triggered_t:
     case task_inst_sched_triggered_raw_t:
-	iq = task_inst->input_queue_head;
-	if (iq != INPUT_QUEUE_HEAD(task_inst)) {
-	    /* Dequeue the element */
-	    iq->prev->next = iq->next;
-	    iq->next->prev = iq->prev;
-	    
-	    /* Use enqueued input */
-	    input = &iq->input;
-
-	    g_mmr_cb->input_queue_size--;
-	    
-	    if (g_mmr_cb->input_queue_size > g_mmr_cb->input_queue_max/2 - 1) {
-		mmr_log(log_level_warn, "Input queue size decremented to %d/%d",
-			g_mmr_cb->input_queue_size, g_mmr_cb->input_queue_max);
-	    }
-	    
-	} else {
+	/* Use enqueued input */
+	n_inputs = task_inst_dequeue_inputs(task_inst, &inputs);
+	if (!n_inputs) {
 	    /* All input has been processed */
 	    goto end;
 	}
 	break;
+    case task_inst_sched_periodic_t:
+	/* How late the run starts, compared to its slot */
+	task_inst->sched_lag_nsec = bitd_get_time_nsec_fast();
+	if (task_inst->sched_lag_nsec > task_inst->next_run_nsec) {
+	    task_inst->sched_lag_nsec -= task_inst->next_run_nsec;
+	} else {
+	    task_inst->sched_lag_nsec = 0;
+	}
+	break;
     default:
-	/* Use params input */
-	input = &task_inst->params.input;
 	break;
     }
 
-    mmr_log(log_level_trace, "%s: %s: Run %llu begin",
+    MMR_LOG(log_level_trace, "%s: %s: Run %llu begin, %d inputs",
 	    task_inst->task->name,
 	    task_inst->name,
-	    task_inst->run_id);
+	    task_inst->run_id,
+	    n_inputs);
 
     SET_BIT(task_inst->state, TASK_INST_RUNNING);
 
+    if (task_inst->task->api.task_inst_run_async) {
+	/* The run ends in mmr_task_inst_run_complete(), and the worker
+	   thread is not held while it is in progress */
+	task_inst->async_inputs = inputs;
+	task_inst->n_async_inputs = inputs ? n_inputs : 0;
+
+	bitd_mutex_unlock(g_mmr_cb->lock);
+
+	/* The run may complete before the call returns */
+	task_inst->task->api.task_inst_run_async(
+	    task_inst->user_task_inst,
+	    inputs ? inputs : &task_inst->params.input);
+	return;
+    }
+
     bitd_mutex_unlock(g_mmr_cb->lock);    
     
 
     /* Execute the task instance run. This will typically block, but
        we are in a worker thread context, outside the mmr lock - and the mmr 
        will not be blocked. */
-    task_inst_ret = task_inst->task->api.task_inst_run(task_inst->user_task_inst,
-						       input);
+    if (inputs) {
+	task_inst_ret = task_inst_run_inputs(task_inst, inputs, n_inputs);
+    } else {
+	/* Use params input */
+	task_inst_ret = 
+	    task_inst->task->api.task_inst_run(task_inst->user_task_inst,
+					       &task_inst->params.input);
+    }
 
-    mmr_log(log_level_trace, "%s: %s: Run %llu end, ret %d",
+    MMR_LOG(log_level_trace, "%s: %s: Run %llu end, ret %d",
 	    task_inst->task->name,
 	    task_inst->name,
 	    task_inst->run_id,
 	    task_inst_ret);
 
-    if (iq) {
-	/* Release memory */
-	bitd_object_free(&iq->input);
-	free(iq);
-    }
-
     bitd_mutex_lock(g_mmr_cb->lock);
 
     /* Bump up the run_id */
     task_inst->run_id++;
 
  update:
+    task_inst_run_end(task_inst);
+
+ end:
+    bitd_mutex_unlock(g_mmr_cb->lock);
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_task_inst_run_complete
+ *============================================================================
+ * Description:     Complete a run started by task_inst_run_async(). May be
+ *     called from any thread, including from within task_inst_run_async().
+ * Parameters:    
+ *     task_inst - the task instance handle
+ *     task_inst_ret - the run return code
+ * Returns:  
+ */
+void mmr_task_inst_run_complete(mmr_task_inst_t task_inst, 
+				int task_inst_ret) {
+    int i;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    if (task_inst->magic != TASK_INST_MAGIC ||
+	!IS_SET(task_inst->state, TASK_INST_RUNNING)) {
+	bitd_assert(0);
+	bitd_mutex_unlock(g_mmr_cb->lock);
+	return;
+    }
+
+    MMR_LOG(log_level_trace, "%s: %s: Run %llu end, ret %d",
+	    task_inst->task->name,
+	    task_inst->name,
+	    task_inst->run_id,
+	    task_inst_ret);
+
+    /* Release the input of the run */
+    for (i = 0; i < task_inst->n_async_inputs; i++) {
+	bitd_object_free(&task_inst->async_inputs[i]);
+    }
+    free(task_inst->async_inputs);
+    task_inst->async_inputs = NULL;
+    task_inst->n_async_inputs = 0;
+
+    /* Bump up the run_id */
+    task_inst->run_id++;
+
+    task_inst_run_end(task_inst);
+
+    bitd_mutex_unlock(g_mmr_cb->lock);
+} 
+
+
+/*
+ *============================================================================
+ *                        mmr_task_inst_run_inline
+ *============================================================================
+ * Description:     Chain a run of a triggered task instance inline, on the
+ *     current worker thread, after the run the worker is executing. The 
+ *     task instance should be inline-safe, in the same worker pool, and 
+ *     within the chain depth and run limits. Called with the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ *     TRUE if the run was chained, FALSE if it should be scheduled
+ */
+bitd_boolean mmr_task_inst_run_inline(struct mmr_task_inst_s *task_inst) {
+    struct mmr_inline_runs_s *inline_runs;
+
+    if (!task_inst->inline_p || task_inst->max_concurrency > 1) {
+	return FALSE;
+    }
+
+    /* Is this a worker thread reporting results? */
+    inline_runs = 
+	(struct mmr_inline_runs_s *)bitd_tls_get(g_mmr_cb->inline_tls);
+    if (!inline_runs ||
+	inline_runs->depth >= MMR_INLINE_DEPTH_MAX ||
+	inline_runs->n_runs >= MMR_INLINE_RUNS_MAX ||
+	mmr_pool_get(task_inst) != inline_runs->pool) {
+	return FALSE;
+    }
+
+    MMR_LOG(log_level_trace, "%s: %s: Run inline, depth %d",
+	    task_inst->task->name,
+	    task_inst->name,
+	    inline_runs->depth + 1);
+
+    SET_BIT(task_inst->state, TASK_INST_SCHEDULED|TASK_INST_PENDING_RUN);
+
+    /* Chain the run */
+    task_inst->inline_next = NULL;
+    task_inst->inline_depth = inline_runs->depth + 1;
+    if (inline_runs->tail) {
+	inline_runs->tail->inline_next = task_inst;
+    } else {
+	inline_runs->head = task_inst;
+    }
+    inline_runs->tail = task_inst;
+    inline_runs->n_runs++;
+
+    task_inst->pool->n_inlined++;
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_inline_begin
+ *============================================================================
+ * Description:     Let the triggers of the worker thread run chain inline
+ *     runs. Called with the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_inline_begin(struct mmr_inline_runs_s *inline_runs,
+				   struct mmr_task_inst_s *task_inst) {
+
+    memset(inline_runs, 0, sizeof(*inline_runs));
+    inline_runs->pool = task_inst->pool;
+
+    bitd_tls_set(g_mmr_cb->inline_tls, inline_runs);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_inline_end
+ *============================================================================
+ * Description:     Execute the inline runs chained by the worker thread run,
+ *     and by the inline runs themselves, in trigger order. Called outside
+ *     the mmr lock.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_inline_end(struct mmr_inline_runs_s *inline_runs) {
+    struct mmr_task_inst_s *task_inst;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    while ((task_inst = inline_runs->head)) {
+	inline_runs->head = task_inst->inline_next;
+	if (!inline_runs->head) {
+	    inline_runs->tail = NULL;
+	}
+	task_inst->inline_next = NULL;
+
+	/* The triggers of this run are one level deeper */
+	inline_runs->depth = task_inst->inline_depth;
+
+	bitd_mutex_unlock(g_mmr_cb->lock);
+	task_inst_run(task_inst);
+	bitd_mutex_lock(g_mmr_cb->lock);
+    }
+
+    bitd_tls_set(g_mmr_cb->inline_tls, NULL);
+
+    bitd_mutex_unlock(g_mmr_cb->lock);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_end
+ *============================================================================
+ * Description:     End a serial run of the task instance - clear the run
+ *     flags, apply config changes and reschedule the next run. Called with
+ *     the mmr lock held.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_run_end(struct mmr_task_inst_s *task_inst) {
+    mmr_err_t ret;
+
     /* Clear the scheduled and run flags */
     CLR_BIT(task_inst->state, 
 	    TASK_INST_SCHEDULED|TASK_INST_PENDING_RUN|TASK_INST_RUNNING);
@@ -519,15 +823,292 @@ void mmr_task_inst_run(void *cookie, bitd_boolean *stopping_p) {
     /* Update the task instance, in case the config changed */
     ret = mmr_task_inst_update(task_inst);
     if (ret != mmr_err_ok) {
-	mmr_log(log_level_info, 
+	MMR_LOG(log_level_info, 
 		"Task inst %s: %s update failed, stopping task instance",
 		task_inst->task->name, task_inst->name);
     } else {
 	/* Reschedule the task instance run */
 	mmr_schedule_task_inst(task_inst);
     }
+} 
 
- end:
-    bitd_mutex_unlock(g_mmr_cb->lock);
+
+/*
+ *============================================================================
+ *                        task_inst_dequeue_inputs
+ *============================================================================
+ * Description:     Dequeue the input of the next run of a triggered task 
+ *     instance - a batch of up to max-batch-size inputs, if the task has
+ *     a batch run method. Called with the mmr lock held.
+ * Parameters:    
+ *     inputs [OUT] - the dequeued inputs, freed by task_inst_run_inputs()
+ * Returns:  
+ *     The number of dequeued inputs
+ */
+static int task_inst_dequeue_inputs(struct mmr_task_inst_s *task_inst,
+				    bitd_object_t **inputs) {
+    struct input_queue_s *iq;
+    int n, i;
+
+    n = (int)MIN(task_inst->input_queue_len, task_inst->max_batch_size);
+    if (!n) {
+	*inputs = NULL;
+	return 0;
+    }
+
+    *inputs = malloc(n * sizeof(**inputs));
+    for (i = 0; i < n; i++) {
+	iq = task_inst->input_queue_head;
+	bitd_assert(iq != INPUT_QUEUE_HEAD(task_inst));
+
+	/* Dequeue the element */
+	iq->prev->next = iq->next;
+	iq->next->prev = iq->prev;
+
+	/* Take over the input */
+	(*inputs)[i] = iq->input;
+	free(iq);
+    }
+
+    task_inst->input_queue_len -= n;
+    g_mmr_cb->input_queue_size -= n;
+	    
+    if (g_mmr_cb->input_queue_size > g_mmr_cb->input_queue_max/2 - 1) {
+	MMR_LOG(log_level_warn, "Input queue size decremented to %d/%d",
+		g_mmr_cb->input_queue_size, g_mmr_cb->input_queue_max);
+    }
+
+    return n;
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_inputs
+ *============================================================================
+ * Description:     Run the task instance on dequeued inputs, then free 
+ *     the inputs. Called outside the mmr lock.
+ * Parameters:    
+ * Returns:  
+ *     The task instance run return code
+ */
+static int task_inst_run_inputs(struct mmr_task_inst_s *task_inst,
+				bitd_object_t *inputs, int n_inputs) {
+    int ret, i;
+
+    if (n_inputs > 1) {
+	ret = task_inst->task->api.task_inst_run_batch(
+	    task_inst->user_task_inst, inputs, n_inputs);
+    } else {
+	ret = task_inst->task->api.task_inst_run(task_inst->user_task_inst,
+						 inputs);
+    }
+
+    /* Release memory */
+    for (i = 0; i < n_inputs; i++) {
+	bitd_object_free(&inputs[i]);
+    }
+    free(inputs);
+
+    return ret;
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_start_parallel_runs
+ *============================================================================
+ * Description:     Start enough parallel runs to drain the input queue,
+ *     up to the max-concurrency of the task instance. Called with the mmr
+ *     lock held.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_start_parallel_runs(struct mmr_task_inst_s *task_inst) {
+    long n;
+
+    /* New input can schedule more runs from now on */
+    CLR_BIT(task_inst->state, TASK_INST_SCHEDULED);
+
+    /* Each run drains batches of up to max-batch-size inputs */
+    n = MIN((task_inst->input_queue_len + task_inst->max_batch_size - 1) / 
+	    task_inst->max_batch_size, 
+	    task_inst->max_concurrency) - task_inst->n_runs;
+    for (; n > 0; n--) {
+	if (!mmr_pool_exec_task(task_inst, mmr_task_inst_run_parallel)) {
+	    /* The worker pool is at its task-max, the inputs wait for the
+	       runs in progress */
+	    MMR_LOG(log_level_trace, "%s: %s: Worker pool %s full",
+		    task_inst->task->name,
+		    task_inst->name,
+		    task_inst->pool->name);
+	    break;
+	}
+	task_inst->n_runs++;
+	task_inst->pool_refused_p = FALSE;
+    }
+
+    if (!task_inst->n_runs) {
+	if (task_inst->input_queue_len) {
+	    /* No run drains the inputs, retry later */
+	    task_inst_dispatch_refused(task_inst);
+	} else {
+	    CLR_BIT(task_inst->state, TASK_INST_PENDING_RUN);
+	}
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_report_ordered_runs
+ *============================================================================
+ * Description:     Report the buffered results of the ordered runs that 
+ *     completed, in input order. Only one thread reports at a time - the 
+ *     others leave their completed runs for it. Called with the mmr lock 
+ *     held, but reports the results outside the lock.
+ * Parameters:    
+ * Returns:  
+ */
+static void task_inst_report_ordered_runs(struct mmr_task_inst_s *task_inst) {
+    struct mmr_run_s *run;
+    struct run_results_s *rr;
+
+    if (task_inst->reporting_p) {
+	return;
+    }
+    task_inst->reporting_p = TRUE;
+
+    while ((run = task_inst->run_head) && run->done_p) {
+	/* Unchain the run */
+	task_inst->run_head = run->next;
+	if (!task_inst->run_head) {
+	    task_inst->run_tail = NULL;
+	}
+
+	bitd_mutex_unlock(g_mmr_cb->lock);
+
+	while ((rr = run->results_head)) {
+	    run->results_head = rr->next;
+
+	    mmr_task_inst_report_run_results(task_inst, &rr->r,
+					     run->run_id, rr->tstamp_ns);
+	    mmr_task_inst_results_deinit(&rr->r);
+	    free(rr);
+	}
+	free(run);
+
+	bitd_mutex_lock(g_mmr_cb->lock);
+    }
+
+    task_inst->reporting_p = FALSE;
 } 
 
+
+/*
+ *============================================================================
+ *                        mmr_task_inst_run_parallel
+ *============================================================================
+ * Description:     A parallel run of a triggered task instance with a 
+ *     max-concurrency. Takes input off the queue until the queue is empty,
+ *     while other parallel runs of the same task instance do the same.
+ * Parameters:    
+ * Returns:  
+ */
+void mmr_task_inst_run_parallel(void *cookie, bitd_boolean *stopping_p) {
+    struct mmr_task_inst_s *task_inst = (struct mmr_task_inst_s *)cookie;
+    mmr_err_t ret;
+    int task_inst_ret;
+    bitd_object_t *inputs;
+    int n_inputs;
+    struct mmr_run_s *run;
+    struct mmr_inline_runs_s inline_runs;
+
+    bitd_mutex_lock(g_mmr_cb->lock);
+
+    if (task_inst->magic != TASK_INST_MAGIC) {
+	bitd_assert(0);
+	bitd_mutex_unlock(g_mmr_cb->lock);
+	return;
+    }
+
+    task_inst_inline_begin(&inline_runs, task_inst);
+
+    while (!task_inst->stopping_p && task_inst->max_concurrency > 1 &&
+	   (n_inputs = task_inst_dequeue_inputs(task_inst, &inputs))) {
+
+	run = calloc(1, sizeof(*run));
+	run->task_inst = task_inst;
+	run->run_id = task_inst->run_id++;
+	run->ordered_p = task_inst->ordered_p;
+	if (run->ordered_p) {
+	    /* Chain the run at the end of the ordered runs */
+	    if (task_inst->run_tail) {
+		task_inst->run_tail->next = run;
+	    } else {
+		task_inst->run_head = run;
+	    }
+	    task_inst->run_tail = run;
+	}
+
+	task_inst->n_running++;
+	SET_BIT(task_inst->state, TASK_INST_RUNNING);
+
+	MMR_LOG(log_level_trace, "%s: %s: Run %llu begin, %d inputs, "
+		"%d running",
+		task_inst->task->name,
+		task_inst->name,
+		run->run_id,
+		n_inputs,
+		task_inst->n_running);
+
+	bitd_mutex_unlock(g_mmr_cb->lock);
+
+	/* Results reported from this thread belong to this run */
+	bitd_tls_set(g_mmr_cb->run_tls, run);
+	task_inst_ret = task_inst_run_inputs(task_inst, inputs, n_inputs);
+	bitd_tls_set(g_mmr_cb->run_tls, NULL);
+
+	MMR_LOG(log_level_trace, "%s: %s: Run %llu end, ret %d",
+		task_inst->task->name,
+		task_inst->name,
+		run->run_id,
+		task_inst_ret);
+
+	bitd_mutex_lock(g_mmr_cb->lock);
+
+	task_inst->n_running--;
+	if (!task_inst->n_running) {
+	    CLR_BIT(task_inst->state, TASK_INST_RUNNING);
+	}
+
+	if (run->ordered_p) {
+	    run->done_p = TRUE;
+	    task_inst_report_ordered_runs(task_inst);
+	} else {
+	    free(run);
+	}
+    }
+
+    task_inst->n_runs--;
+    if (!task_inst->n_runs) {
+	/* The last parallel run clears the run flags */
+	CLR_BIT(task_inst->state, 
+		TASK_INST_PENDING_RUN|TASK_INST_RUNNING);
+
+	/* Update the task instance, in case the config changed */
+	ret = mmr_task_inst_update(task_inst);
+	if (ret != mmr_err_ok) {
+	    MMR_LOG(log_level_info, 
+		    "Task inst %s: %s update failed, stopping task instance",
+		    task_inst->task->name, task_inst->name);
+	} else {
+	    /* Reschedule the task instance run */
+	    mmr_schedule_task_inst(task_inst);
+	}
+    }
+
+    bitd_mutex_unlock(g_mmr_cb->lock);
+
+    task_inst_inline_end(&inline_runs);
+}
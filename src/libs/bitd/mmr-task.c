@@ -82,6 +82,7 @@ struct mmr_task_s *mmr_task_get(mmr_module_t module,
 	    task->api.task_inst_create == task_api->task_inst_create &&
 	    task->api.task_inst_destroy == task_api->task_inst_destroy &&
 	    task->api.task_inst_run == task_api->task_inst_run &&
+	    task->api.task_inst_run_async == task_api->task_inst_run_async &&
 	    task->api.task_inst_kill == task_api->task_inst_kill) {
 	    /* Bump up the refcount, and return it */
 	    task->refcount++;
@@ -89,12 +90,12 @@ struct mmr_task_s *mmr_task_get(mmr_module_t module,
 	} else {
 	    /* A module implementation bug */
 	    if (task->module != module) {
-		mmr_log(log_level_err, "Duplicate task %s in modules %s and %s",
+		MMR_LOG(log_level_err, "Duplicate task %s in modules %s and %s",
 			task_name,
 			task->module->dll_name, 
 			module->dll_name);
 	    } else {
-		mmr_log(log_level_err, "Task %s in module %s has duplicate APIs",
+		MMR_LOG(log_level_err, "Task %s in module %s has duplicate APIs",
 			task_name,
 			module->dll_name);
 	    }
@@ -155,13 +155,13 @@ void mmr_task_inst_results_init(mmr_task_inst_results_t *r) {
 
 /*
  *============================================================================
- *                        mmr_task_inst_results_free
+ *                        mmr_task_inst_results_deinit
  *============================================================================
  * Description:     Deinitialize the task inst results structure
  * Parameters:    
  * Returns:  
  */
-void mmr_task_inst_results_free(mmr_task_inst_results_t *r) {
+void mmr_task_inst_results_deinit(mmr_task_inst_results_t *r) {
 
     if (r) {
 	bitd_object_free(&r->output);
@@ -243,6 +243,25 @@ int mmr_task_inst_results_compare(mmr_task_inst_results_t *r1,
  */
 bitd_nvp_t mmr_get_raw_results(mmr_task_inst_t task_inst,
 			     mmr_task_inst_results_t *r) {
+
+    return mmr_get_run_raw_results(task_inst, r, 
+				   task_inst->run_id, 
+				   task_inst->run_tstamp_ns);
+}
+
+
+/*
+ *============================================================================
+ *                        mmr_get_run_raw_results
+ *============================================================================
+ * Description:     Get the raw results of a given run
+ * Parameters:    
+ * Returns:  
+ */
+bitd_nvp_t mmr_get_run_raw_results(struct mmr_task_inst_s *task_inst,
+				   mmr_task_inst_results_t *r,
+				   bitd_uint64 run_id,
+				   bitd_uint64 tstamp_ns) {
     bitd_nvp_t nvp;
 
     nvp = bitd_nvp_alloc(10);
@@ -254,12 +273,12 @@ bitd_nvp_t mmr_get_raw_results(mmr_task_inst_t task_inst,
 
     /* Copy the run id */
     nvp->e[nvp->n_elts].name = strdup("run-id");
-    nvp->e[nvp->n_elts].v.value_uint64 = task_inst->run_id;
+    nvp->e[nvp->n_elts].v.value_uint64 = run_id;
     nvp->e[nvp->n_elts++].type = bitd_type_uint64;
 
     /* Copy the timestamp */
     nvp->e[nvp->n_elts].name = strdup("run-timestamp");
-    nvp->e[nvp->n_elts].v.value_uint64 = task_inst->run_tstamp_ns;
+    nvp->e[nvp->n_elts].v.value_uint64 = tstamp_ns;
     nvp->e[nvp->n_elts++].type = bitd_type_uint64;
 
     /* Exit code */
@@ -267,6 +286,18 @@ bitd_nvp_t mmr_get_raw_results(mmr_task_inst_t task_inst,
     nvp->e[nvp->n_elts].v.value_int64 = r->exit_code;
     nvp->e[nvp->n_elts++].type = bitd_type_int64;
 
+    if (task_inst->sched_type == task_inst_sched_periodic_t) {
+	/* Slots missed so far */
+	nvp->e[nvp->n_elts].name = strdup("missed-slots");
+	nvp->e[nvp->n_elts].v.value_uint64 = task_inst->n_missed_slots;
+	nvp->e[nvp->n_elts++].type = bitd_type_uint64;
+
+	/* How late the run started */
+	nvp->e[nvp->n_elts].name = strdup("sched-lag-nsec");
+	nvp->e[nvp->n_elts].v.value_uint64 = task_inst->sched_lag_nsec;
+	nvp->e[nvp->n_elts++].type = bitd_type_uint64;
+    }
+
     if (r->output.type != bitd_type_void) {
 	/* Output */
 	nvp->e[nvp->n_elts].name = strdup("output");
@@ -48,6 +48,46 @@ extern "C"
 
 #define TASK_INST_MAGIC 0xabbacddc
 
+/* Upper bound of the max-concurrency schedule option */
+#define MMR_MAX_CONCURRENCY 256
+
+/* Upper bound of the weight schedule option */
+#define MMR_WEIGHT_MAX 1024
+
+/* Default and upper bound of the max-batch-size schedule option */
+#define MMR_BATCH_SIZE_DEF 64
+#define MMR_BATCH_SIZE_MAX 1024
+
+/* Default deadline of runs that are not periodic, relative to their 
+   dispatch. Periodic runs default to the smaller of this and their 
+   interval, past their slot. */
+#define MMR_DEADLINE_DEF 1000000000ULL
+
+/* Retry interval of a run refused by a worker pool at its task-max */
+#define MMR_POOL_RETRY_NSEC 10000000ULL
+
+/* Default and upper bound of the catch-up-max schedule option */
+#define MMR_CATCH_UP_MAX_DEF 10
+#define MMR_CATCH_UP_MAX 1000
+
+/* Upper bounds of the triggered runs chained inline on a worker thread:
+   the length of a trigger chain, and the runs per worker run */
+#define MMR_INLINE_DEPTH_MAX 8
+#define MMR_INLINE_RUNS_MAX 64
+
+/* Is a message at this level logged? */
+#define mmr_log_enabled(level)						\
+    (g_mmr_cb && g_mmr_cb->vlog &&					\
+     (!g_mmr_cb->log_keyid || ttlog_enabled(level, g_mmr_cb->log_keyid)))
+
+/* Log a message only if enabled. Otherwise, the args are not evaluated. */
+#define MMR_LOG(level, ...)						\
+    do {								\
+	if (mmr_log_enabled(level)) {					\
+	    mmr_log(level, __VA_ARGS__);				\
+	}								\
+    } while (0)
+
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
@@ -70,6 +110,7 @@ struct mmr_cb {
     bitd_nvp_t config;  /* The mmr configuration vector */
     bitd_nvp_t tags;    /* The global tags */
     mmr_vlog_func_t *vlog; /* The mmr logger */
+    ttlog_keyid log_keyid; /* The key the mmr logger logs under */
     char *module_path;
     struct mmr_module_s *module_head; /* List of modules */
     struct mmr_module_s *module_tail;
@@ -81,12 +122,51 @@ struct mmr_cb {
     bitd_boolean stopping_p;            /* The module manager is stopping */
     bitd_thread event_loop_th;          /* The event loop thread */
     bitd_event event_loop_ev;           /* Wakes up the event loop */
+    bitd_uint64 timer_slack_nsec;       /* Event loop wakeups may be delayed
+					   by this much, to coalesce them */
     bitd_event task_inst_stopped_ev;    /* Set when a task instance has stopped */
     bitd_timer_list timers;
-    bitd_lambda_handle lambda;
+    struct mmr_task_inst_s *ready_head; /* Task insts due to run now */
+    struct mmr_task_inst_s *ready_tail;
+    bitd_boolean ready_draining_p;      /* The ready queue is being run */
+    struct mmr_pool_s *pool_head;       /* Worker pools, default pool first */
+    bitd_uint32 pool_gen;               /* Bumped when pool bindings change */
+    struct mmr_phase_group_s *phase_head; /* Periodic task insts by interval */
+    bitd_tls run_tls;                   /* The concurrent run of the thread */
+    bitd_tls inline_tls;                /* The inline runs of the thread */
     mmr_report_results_t *report_results; /* Results reporting callback */
 };
 
+/* The name of the pool used by unbound task instances */
+#define MMR_POOL_DEFAULT "default"
+
+/* A named worker thread pool. Modules, tasks and task instances are bound
+   to the pool by its config. */
+struct mmr_pool_s {
+    struct mmr_pool_s *next;
+    char *name;
+    bitd_lambda_handle lambda;
+    bitd_nvp_t config;           /* The pool declaration and bindings */
+    bitd_uint64 n_dispatched;    /* Runs accepted by the pool */
+    bitd_uint64 n_rejected;      /* Runs refused past the pool task-max */
+    bitd_uint64 n_inlined;       /* Triggered runs chained inline */
+};
+
+/* The first run of periodic task instances with longer intervals is
+   spread over this span */
+#define MMR_PHASE_SPAN_MAX 30000000000ULL
+
+/* The periodic task instances sharing a run interval. Their phases are
+   slots of the interval, picked by their name hashes. */
+struct mmr_phase_group_s {
+    struct mmr_phase_group_s *next;
+    bitd_uint64 interval_nsec;
+    struct mmr_task_inst_s **task_insts; /* Sorted by phase hash */
+    int n_task_insts;
+    int n_task_insts_max;
+    bitd_uint32 gen;             /* Bumped when the membership changes */
+};
+
 #define MMR_MODULE_HEAD(m) \
     ((struct mmr_module_s *)&(m)->module_head)
     
@@ -138,6 +218,35 @@ struct input_queue_s {
 #define TRIGGERED_HEAD(t) \
     ((struct mmr_task_inst_s *)((char *)&(t)->triggered_head - offsetof(struct mmr_task_inst_s, triggered_next)))
 
+/* Results of an ordered concurrent run, buffered until the runs of the
+   preceding inputs have reported */
+struct run_results_s {
+    struct run_results_s *next;
+    mmr_task_inst_results_t r;
+    bitd_uint64 tstamp_ns;
+};
+
+/* A concurrent run of a triggered task instance, on one input */
+struct mmr_run_s {
+    struct mmr_run_s *next;          /* Ordered runs, in input order */
+    struct mmr_task_inst_s *task_inst;
+    bitd_uint64 run_id;
+    bitd_boolean ordered_p;          /* Results are buffered */
+    bitd_boolean done_p;             /* The run method returned */
+    struct run_results_s *results_head;
+    struct run_results_s *results_tail;
+};
+
+/* The triggered runs chained inline on a worker thread, after the run
+   the worker was dispatched for */
+struct mmr_inline_runs_s {
+    struct mmr_task_inst_s *head;
+    struct mmr_task_inst_s *tail;
+    struct mmr_pool_s *pool;         /* The pool of the worker thread */
+    int depth;                       /* Trigger chain depth of the run */
+    int n_runs;                      /* Runs chained so far */
+};
+
 #define INPUT_QUEUE_HEAD(t) \
     ((struct input_queue_s *)&(t)->input_queue_head)
 
@@ -157,6 +266,14 @@ typedef enum {
     task_inst_sched_triggered_raw_t
 } mmr_task_inst_sched_type;
 
+/* How a periodic task instance catches up with the slots missed while 
+   a run overran */
+typedef enum {
+    task_inst_catch_up_coalesce_t, /* Run once right away, for all slots */
+    task_inst_catch_up_skip_t,     /* Wait for the next slot */
+    task_inst_catch_up_burst_t     /* Run once per slot, up to a max */
+} mmr_task_inst_catch_up_type;
+
 /* Task inst control structure */
 struct mmr_task_inst_s {
     struct mmr_task_inst_s *next; /* The list of task types for a module */
@@ -170,13 +287,43 @@ struct mmr_task_inst_s {
     int refcount;
     int state;
     bitd_timer run_timer;
+    struct mmr_task_inst_s *ready_next; /* The ready queue */
+    bitd_boolean ready_p;        /* On the ready queue */
     bitd_uint64 run_interval_nsec;
     bitd_uint64 next_run_nsec;      /* Next run time slot (non-randomized) */
+    struct mmr_phase_group_s *phase_group; /* Periodic, without phase option */
+    bitd_uint64 phase_hash;      /* Picks the task inst slot in its group */
+    bitd_uint64 phase_nsec;      /* Run time slot offset within the interval */
+    bitd_uint32 phase_gen;       /* The phase group gen it was planned for */
+    mmr_task_inst_catch_up_type catch_up; /* Overrun policy */
+    int catch_up_max;            /* Max slots run back to back in a burst */
+    bitd_uint64 n_missed_slots;  /* Slots that got no run */
+    bitd_uint64 sched_lag_nsec;  /* How late the last run started */
     mmr_task_inst_sched_type sched_type; /* Periodic, random, once, ... */
     struct mmr_task_inst_s *triggered_next; /* List of triggered task inst */
     struct mmr_task_inst_s *triggered_prev;
     struct input_queue_s *input_queue_head; /* Serialized input for */
     struct input_queue_s *input_queue_tail; /* triggered task instances */
+    long input_queue_len;        /* Inputs on the input queue */
+    int max_concurrency;         /* Max parallel runs on queued input */
+    bitd_boolean ordered_p;      /* Report parallel runs in input order */
+    int max_batch_size;          /* Max queued inputs per batch run */
+    bitd_boolean inline_p;       /* May run inline on the reporting worker */
+    struct mmr_task_inst_s *inline_next; /* Chained inline runs */
+    int inline_depth;            /* Trigger chain depth of the inline run */
+    struct mmr_pool_s *pool;     /* The resolved worker pool */
+    bitd_uint32 pool_gen;        /* The pool bindings it was resolved for */
+    bitd_boolean pool_refused_p; /* The pool refused the last run */
+    bitd_lambda_class_t lambda_class; /* Worker thread scheduling class */
+    int lambda_weight;           /* Weight within the scheduling class */
+    bitd_uint64 deadline_nsec;   /* Relative deadline of the runs */
+    int n_runs;                  /* Parallel runs, pending or running */
+    int n_running;               /* Parallel runs in the run method */
+    struct mmr_run_s *run_head;  /* Ordered runs not yet reported */
+    struct mmr_run_s *run_tail;
+    bitd_boolean reporting_p;    /* A thread reports the ordered runs */
+    bitd_object_t *async_inputs; /* Inputs of the async run in progress */
+    int n_async_inputs;
     bitd_uint64 run_id;          /* Counter for task instance runs */
     bitd_uint64 run_tstamp_ns;   /* Result timestamp for last results */
     bitd_boolean stopping_p;     /* The task instance is destroyed */
@@ -220,10 +367,39 @@ bitd_boolean mmr_task_inst_is_stopped(struct mmr_task_inst_s *task_inst);
 void mmr_task_inst_release(struct mmr_task_inst_s *task_inst);
 
 void mmr_schedule_task_inst(struct mmr_task_inst_s *task_inst);
+void mmr_schedule_run_ready(void);
+void mmr_schedule_ready_remove(struct mmr_task_inst_s *task_inst);
+void mmr_phase_join(struct mmr_task_inst_s *task_inst);
+void mmr_phase_leave(struct mmr_task_inst_s *task_inst);
+bitd_uint64 mmr_phase_get(struct mmr_task_inst_s *task_inst);
 bitd_boolean mmr_schedule_triggers(mmr_task_inst_t task_inst,
-				   mmr_task_inst_results_t *r);
+				   mmr_task_inst_results_t *r,
+				   bitd_uint64 run_id,
+				   bitd_uint64 tstamp_ns);
 void mmr_task_inst_run_timer_expired(bitd_timer t, void *cookie);
+void mmr_task_inst_dispatch(struct mmr_task_inst_s *task_inst);
 void mmr_task_inst_run(void *cookie, bitd_boolean *stopping_p);
+void mmr_task_inst_run_parallel(void *cookie, bitd_boolean *stopping_p);
+bitd_boolean mmr_task_inst_run_inline(struct mmr_task_inst_s *task_inst);
+
+/* Report the results of a given run */
+void mmr_task_inst_report_run_results(struct mmr_task_inst_s *task_inst,
+				      mmr_task_inst_results_t *r,
+				      bitd_uint64 run_id,
+				      bitd_uint64 tstamp_ns);
+bitd_nvp_t mmr_get_run_raw_results(struct mmr_task_inst_s *task_inst,
+				   mmr_task_inst_results_t *r,
+				   bitd_uint64 run_id,
+				   bitd_uint64 tstamp_ns);
+
+/* Worker pools */
+void mmr_pools_init(void);
+void mmr_pools_deinit(void);
+void mmr_pools_set(bitd_nvp_t pools);
+bitd_nvp_t mmr_pools_get_stats(void);
+struct mmr_pool_s *mmr_pool_get(struct mmr_task_inst_s *task_inst);
+bitd_boolean mmr_pool_exec_task(struct mmr_task_inst_s *task_inst,
+				bitd_lambda_task_func_t f);
 
 int mmr_log(ttlog_level level, char *format_string, ...);
 int mmr_vlog(ttlog_level level, char *format_string, va_list args);
@@ -20,23 +20,75 @@
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
-
+/* Compact encoding name references. Names seen for the first time are 
+   encoded inline, later occurrences refer to the name table. */
+#define NAME_REF_NULL 0
+#define NAME_REF_INLINE 1
+#define NAME_REF_TABLE 2 /* First name table reference */
+
+/* Size of the name table index kept in the encoder control block. Larger
+   name tables are heap-allocated. */
+#define NAME_SLOTS_INLINE 64
+
+/* LZ4 block format parameters */
+#define LZ4_MINMATCH 4
+#define LZ4_LASTLITERALS 5  /* The last 5 bytes are always literals */
+#define LZ4_MFLIMIT 12      /* No match starts in the last 12 bytes */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 12
+#define LZ4_MAX_RATIO 255   /* Max decompressed to compressed size ratio */
 
 /*****************************************************************************
  *                                  MACROS 
  *****************************************************************************/
 
+/* Zigzag encoding maps small negative integers to small unsigned ones */
+#define ZIGZAG_ENCODE(v) (((bitd_uint64)(v) << 1) ^ (bitd_uint64)((v) >> 63))
+#define ZIGZAG_DECODE(u) ((bitd_int64)((u) >> 1) ^ -(bitd_int64)((u) & 1))
 
+#define LZ4_READ32(p) \
+    ((bitd_uint32)(p)[0] | ((bitd_uint32)(p)[1] << 8) | \
+     ((bitd_uint32)(p)[2] << 16) | ((bitd_uint32)(p)[3] << 24))
+#define LZ4_HASH(v) (((v) * 2654435761U) >> (32 - LZ4_HASH_LOG))
 
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
 
-
+/* Compact encoder control block. If buf is NULL, the encoder only 
+   measures the encoding size. */
+struct compact_enc {
+    char *buf;
+    int size;
+    int idx;
+    char **names;        /* Names, in order of first appearance */
+    int n_names;
+    int n_names_allocated;
+    int *slots;          /* Open addressing index into names, -1 if empty */
+    int n_slots;         /* Always a power of 2 */
+    char *names_inline[NAME_SLOTS_INLINE/2];
+    int slots_inline[NAME_SLOTS_INLINE];
+};
+
+/* Compact decoder control block */
+struct compact_dec {
+    char *buf;
+    int size;
+    int idx;
+    char **names;        /* Points into the names of the unpacked nvps */
+    int n_names;
+    int n_names_allocated;
+};
 
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
+static bitd_boolean unpack_object_compact(char *buf, int size, int *idx, 
+					  bitd_object_t *a);
+static bitd_boolean enc_value(struct compact_enc *e,
+			      bitd_type_t t, bitd_value_t *v);
+static bitd_boolean dec_value(struct compact_dec *d,
+			      bitd_type_t t, bitd_value_t *v);
 
 
 
@@ -112,6 +164,11 @@ bitd_boolean bitd_unpack_object(char *buf, int size, int *idx,
     /* Initialize the OUT parameter */
     a->type = bitd_type_void;
 
+    /* Auto-detect the compact encoding */
+    if (*idx < size && (bitd_uint8)buf[*idx] == BITD_PACK_COMPACT_MAGIC) {
+	return unpack_object_compact(buf, size, idx, a);
+    }
+
     if (!bitd_unpack_uint8(buf, size, idx, &type) ||
 	(int)type >= (int)bitd_type_max ||
 	!bitd_unpack_value(buf, size, idx, type, &a->v)) {
@@ -762,6 +819,21 @@ bitd_boolean bitd_unpack_nvp(char *buf, int size, int *idx,
     /* Initialize the OUT parameter */
     *nvp = NULL;
 
+    /* Auto-detect the compact encoding */
+    if (*idx < size && (bitd_uint8)buf[*idx] == BITD_PACK_COMPACT_MAGIC) {
+	bitd_object_t a;
+
+	if (!unpack_object_compact(buf, size, idx, &a)) {
+	    return FALSE;
+	}
+	if (a.type != bitd_type_nvp) {
+	    bitd_object_free(&a);
+	    return FALSE;
+	}
+	*nvp = a.v.value_nvp;
+	return TRUE;
+    }
+
     /* Is the nvp empty? */
     if (!bitd_unpack_boolean(buf, size, idx, &is_empty)) {
 	return FALSE;
@@ -819,3 +891,970 @@ bitd_boolean bitd_unpack_nvp(char *buf, int size, int *idx,
 
 
 
+
+
+/*
+ *============================================================================
+ *                        varint_size
+ *============================================================================
+ * Description:     Number of bytes in the varint encoding of a value
+ * Parameters:    
+ * Returns:  
+ */
+static int varint_size(bitd_uint64 value) {
+    int n = 1;
+
+    while (value >= 0x80) {
+	value >>= 7;
+	n++;
+    }
+
+    return n;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_bytes
+ *============================================================================
+ * Description:     Encode a byte array. Only the size is counted if the
+ *     encoder has no buffer.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_bytes(struct compact_enc *e, char *p, int len) {
+
+    if (e->buf) {
+	if (e->idx + len > e->size) {
+	    return FALSE;
+	}
+	memcpy(e->buf + e->idx, p, len);
+    }
+    e->idx += len;
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_byte
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_byte(struct compact_enc *e, bitd_uint8 value) {
+
+    if (e->buf) {
+	if (e->idx + 1 > e->size) {
+	    return FALSE;
+	}
+	e->buf[e->idx] = value;
+    }
+    e->idx++;
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_varint
+ *============================================================================
+ * Description:     Encode an unsigned integer as a little-endian base 128 
+ *     varint: 7 bits per byte, high bit set on all bytes but the last.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_varint(struct compact_enc *e, bitd_uint64 value) {
+    register int idx1 = e->idx;
+
+    if (!e->buf) {
+	e->idx += varint_size(value);
+	return TRUE;
+    }
+
+    if (idx1 + varint_size(value) > e->size) {
+	return FALSE;
+    }
+
+    while (value >= 0x80) {
+	e->buf[idx1++] = (char)(value | 0x80);
+	value >>= 7;
+    }
+    e->buf[idx1++] = (char)value;
+
+    e->idx = idx1;
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        name_hash
+ *============================================================================
+ * Description:     FNV-1a hash of a name
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_uint32 name_hash(char *name) {
+    register bitd_uint32 h = 2166136261U;
+
+    while (*name) {
+	h ^= (bitd_uint8)*name++;
+	h *= 16777619U;
+    }
+
+    return h;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_init
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static void enc_init(struct compact_enc *e, char *buf, int size, int idx) {
+
+    e->buf = buf;
+    e->size = size;
+    e->idx = idx;
+    e->names = e->names_inline;
+    e->n_names = 0;
+    e->n_names_allocated = NAME_SLOTS_INLINE/2;
+    e->slots = e->slots_inline;
+    e->n_slots = NAME_SLOTS_INLINE;
+
+    /* Mark all slots empty (-1) */
+    memset(e->slots, 0xff, sizeof(e->slots_inline));
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_deinit
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static void enc_deinit(struct compact_enc *e) {
+
+    if (e->names != e->names_inline) {
+	free(e->names);
+    }
+    if (e->slots != e->slots_inline) {
+	free(e->slots);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_names_grow
+ *============================================================================
+ * Description:     Double the name table, and rehash its index
+ * Parameters:    
+ * Returns:  
+ */
+static void enc_names_grow(struct compact_enc *e) {
+    int i, n_slots = 2 * e->n_slots;
+    bitd_uint32 h, mask = n_slots - 1;
+    int *slots;
+    char **names;
+
+    names = malloc(n_slots/2 * sizeof(char *));
+    memcpy(names, e->names, e->n_names * sizeof(char *));
+    if (e->names != e->names_inline) {
+	free(e->names);
+    }
+    e->names = names;
+    e->n_names_allocated = n_slots/2;
+
+    slots = malloc(n_slots * sizeof(int));
+    for (i = 0; i < n_slots; i++) {
+	slots[i] = -1;
+    }
+    for (i = 0; i < e->n_names; i++) {
+	for (h = name_hash(e->names[i]) & mask; 
+	     slots[h] >= 0; 
+	     h = (h + 1) & mask);
+	slots[h] = i;
+    }
+    if (e->slots != e->slots_inline) {
+	free(e->slots);
+    }
+    e->slots = slots;
+    e->n_slots = n_slots;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_name
+ *============================================================================
+ * Description:     Encode an nvp element name. The first occurrence of
+ *     a name is encoded inline, and is added to the name table. Further
+ *     occurrences are encoded as name table references.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_name(struct compact_enc *e, char *name) {
+    bitd_uint32 h, mask;
+    int len;
+
+    if (!name) {
+	return enc_varint(e, NAME_REF_NULL);
+    }
+
+    /* Keep the index at most half full */
+    if (2 * (e->n_names + 1) > e->n_slots) {
+	enc_names_grow(e);
+    }
+
+    mask = e->n_slots - 1;
+    for (h = name_hash(name) & mask; e->slots[h] >= 0; h = (h + 1) & mask) {
+	if (!strcmp(e->names[e->slots[h]], name)) {
+	    /* Name already in the table */
+	    return enc_varint(e, NAME_REF_TABLE + e->slots[h]);
+	}
+    }
+
+    /* Add the name to the table */
+    e->slots[h] = e->n_names;
+    e->names[e->n_names++] = name;
+
+    len = strlen(name);
+
+    return enc_varint(e, NAME_REF_INLINE) && 
+	enc_varint(e, len) &&
+	enc_bytes(e, name, len);
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_nvp
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_nvp(struct compact_enc *e, bitd_nvp_t nvp) {
+    int i;
+
+    /* The element count is offset by one, so zero encodes the NULL nvp */
+    if (!nvp) {
+	return enc_varint(e, 0);
+    }
+
+    if (!enc_varint(e, (bitd_uint64)nvp->n_elts + 1)) {
+	return FALSE;
+    }
+
+    for (i = 0; i < nvp->n_elts; i++) {
+	if (!enc_name(e, nvp->e[i].name) ||
+	    !enc_byte(e, (bitd_uint8)nvp->e[i].type) ||
+	    !enc_value(e, nvp->e[i].type, &nvp->e[i].v)) {
+	    return FALSE;
+	}
+    }
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        enc_value
+ *============================================================================
+ * Description:     Encode a value in the compact encoding
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean enc_value(struct compact_enc *e,
+			      bitd_type_t t, bitd_value_t *v) {
+    bitd_uint64 u;
+    char d[8];
+    int i, len;
+
+    switch (t) {
+    case bitd_type_void:
+	return TRUE;
+    case bitd_type_boolean:
+	return enc_byte(e, v->value_boolean ? 1 : 0);
+    case bitd_type_int64:
+	return enc_varint(e, ZIGZAG_ENCODE(v->value_int64));
+    case bitd_type_uint64:
+	return enc_varint(e, v->value_uint64);
+    case bitd_type_double:
+	/* Doubles are encoded exactly, as little-endian IEEE 754 bits */
+	memcpy(&u, &v->value_double, sizeof(u));
+	for (i = 0; i < 8; i++) {
+	    d[i] = (char)(u >> (8 * i));
+	}
+	return enc_bytes(e, d, 8);
+    case bitd_type_string:
+	/* The length is offset by one, so zero encodes the NULL string */
+	if (!v->value_string) {
+	    return enc_varint(e, 0);
+	}
+	len = strlen(v->value_string);
+	return enc_varint(e, (bitd_uint64)len + 1) &&
+	    enc_bytes(e, v->value_string, len);
+    case bitd_type_blob:
+	len = bitd_blob_size(v->value_blob);
+	return enc_varint(e, len) &&
+	    enc_bytes(e, bitd_blob_payload(v->value_blob), len);
+    case bitd_type_nvp:
+	return enc_nvp(e, v->value_nvp);
+    default:
+	break;
+    }
+
+    return FALSE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_byte
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_byte(struct compact_dec *d, bitd_uint8 *value) {
+
+    if (d->idx + 1 > d->size) {
+	return FALSE;
+    }
+    *value = (bitd_uint8)d->buf[d->idx++];
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_varint
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_varint(struct compact_dec *d, bitd_uint64 *value) {
+    register int idx1 = d->idx;
+    register bitd_uint64 a = 0;
+    register bitd_uint8 c;
+    int shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+	if (idx1 >= d->size) {
+	    return FALSE;
+	}
+	c = (bitd_uint8)d->buf[idx1++];
+	a |= (bitd_uint64)(c & 0x7f) << shift;
+	if (!(c & 0x80)) {
+	    *value = a;
+	    d->idx = idx1;
+	    return TRUE;
+	}
+    }
+
+    /* Varint too long */
+    return FALSE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_length
+ *============================================================================
+ * Description:     Decode a varint length, and check that the buffer
+ *     holds at least that many more bytes past the length.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_length(struct compact_dec *d, bitd_uint64 *len) {
+    
+    if (!dec_varint(d, len) || 
+	*len > (bitd_uint64)(d->size - d->idx)) {
+	return FALSE;
+    }
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_name
+ *============================================================================
+ * Description:     Decode an nvp element name. The returned name is 
+ *     heap-allocated.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_name(struct compact_dec *d, char **name) {
+    bitd_uint64 ref, len;
+    char *s;
+
+    *name = NULL;
+
+    if (!dec_varint(d, &ref)) {
+	return FALSE;
+    }
+
+    if (ref == NAME_REF_NULL) {
+	return TRUE;
+    }
+
+    if (ref >= NAME_REF_TABLE) {
+	/* A name table reference */
+	if (ref - NAME_REF_TABLE >= (bitd_uint64)d->n_names) {
+	    return FALSE;
+	}
+	*name = strdup(d->names[ref - NAME_REF_TABLE]);
+	return TRUE;
+    }
+
+    /* An inline name */
+    if (!dec_length(d, &len)) {
+	return FALSE;
+    }
+
+    s = malloc(len + 1);
+    memcpy(s, d->buf + d->idx, len);
+    s[len] = 0;
+    d->idx += len;
+
+    /* Add the name to the name table. The table points to the name owned
+       by the nvp element, which outlives the decoder. */
+    if (d->n_names == d->n_names_allocated) {
+	d->n_names_allocated = d->n_names_allocated ? 
+	    2 * d->n_names_allocated : NAME_SLOTS_INLINE/2;
+	d->names = realloc(d->names, d->n_names_allocated * sizeof(char *));
+    }
+    d->names[d->n_names++] = s;
+
+    *name = s;
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_nvp
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_nvp(struct compact_dec *d, bitd_nvp_t *nvp) {
+    bitd_uint64 n_elts;
+    bitd_nvp_element_t *e;
+    bitd_uint8 type;
+
+    /* Initialize the OUT parameter */
+    *nvp = NULL;
+
+    if (!dec_varint(d, &n_elts)) {
+	return FALSE;
+    }
+
+    if (!n_elts) {
+	/* The NULL nvp */
+	return TRUE;
+    }
+    n_elts--;
+
+    /* Each element takes at least two bytes */
+    if (n_elts > (bitd_uint64)(d->size - d->idx) / 2) {
+	return FALSE;
+    }
+    
+    /* Decode the elements in place */
+    *nvp = bitd_nvp_alloc((int)n_elts);
+
+    while ((bitd_uint64)(*nvp)->n_elts < n_elts) {
+	e = &(*nvp)->e[(*nvp)->n_elts];
+
+	if (!dec_name(d, &e->name)) {
+	    goto err;
+	}
+
+	if (!dec_byte(d, &type) || (int)type >= (int)bitd_type_max) {
+	    if (e->name) {
+		free(e->name);
+	    }
+	    goto err;
+	}
+
+	e->type = type;
+	bitd_value_init(&e->v);
+	
+	if (!dec_value(d, e->type, &e->v)) {
+	    if (e->name) {
+		free(e->name);
+	    }
+	    goto err;
+	}
+
+	(*nvp)->n_elts++;
+    }
+
+    return TRUE;
+
+ err:
+    bitd_nvp_free(*nvp);
+    *nvp = NULL;
+    return FALSE;
+} 
+
+
+/*
+ *============================================================================
+ *                        dec_value
+ *============================================================================
+ * Description:     Decode a value in the compact encoding. On failure,
+ *     no memory is held in the value.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean dec_value(struct compact_dec *d,
+			      bitd_type_t t, bitd_value_t *v) {
+    bitd_uint64 u, len;
+    bitd_uint8 c;
+    int i;
+
+    switch (t) {
+    case bitd_type_void:
+	return TRUE;
+    case bitd_type_boolean:
+	if (!dec_byte(d, &c)) {
+	    return FALSE;
+	}
+	v->value_boolean = c ? TRUE : FALSE;
+	return TRUE;
+    case bitd_type_int64:
+	if (!dec_varint(d, &u)) {
+	    return FALSE;
+	}
+	v->value_int64 = ZIGZAG_DECODE(u);
+	return TRUE;
+    case bitd_type_uint64:
+	return dec_varint(d, &v->value_uint64);
+    case bitd_type_double:
+	if (d->idx + 8 > d->size) {
+	    return FALSE;
+	}
+	for (u = 0, i = 7; i >= 0; i--) {
+	    u = (u << 8) | (bitd_uint8)d->buf[d->idx + i];
+	}
+	memcpy(&v->value_double, &u, sizeof(u));
+	d->idx += 8;
+	return TRUE;
+    case bitd_type_string:
+	v->value_string = NULL;
+	if (!dec_varint(d, &len)) {
+	    return FALSE;
+	}
+	if (!len) {
+	    /* The NULL string */
+	    return TRUE;
+	}
+	len--;
+	if (len > (bitd_uint64)(d->size - d->idx)) {
+	    return FALSE;
+	}
+	v->value_string = malloc(len + 1);
+	memcpy(v->value_string, d->buf + d->idx, len);
+	v->value_string[len] = 0;
+	d->idx += len;
+	return TRUE;
+    case bitd_type_blob:
+	v->value_blob = NULL;
+	if (!dec_length(d, &len)) {
+	    return FALSE;
+	}
+	v->value_blob = bitd_blob_alloc((int)len);
+	memcpy(bitd_blob_payload(v->value_blob), d->buf + d->idx, len);
+	d->idx += len;
+	return TRUE;
+    case bitd_type_nvp:
+	return dec_nvp(d, &v->value_nvp);
+    default:
+	break;
+    }
+
+    return FALSE;
+} 
+
+
+/*
+ *============================================================================
+ *                        lz4_compress
+ *============================================================================
+ * Description:     Compress a buffer into the LZ4 block format, using a
+ *     greedy single-pass match finder.
+ * Parameters:    
+ * Returns:     The compressed size, or 0 if it does not fit in dst_size
+ */
+static int lz4_compress(char *src, int src_len, char *dst, int dst_size) {
+    bitd_uint8 *base = (bitd_uint8 *)src;
+    bitd_uint8 *ip = base, *anchor = base, *iend = base + src_len;
+    bitd_uint8 *mflimit = iend - LZ4_MFLIMIT;
+    bitd_uint8 *matchlimit = iend - LZ4_LASTLITERALS;
+    bitd_uint8 *op = (bitd_uint8 *)dst, *oend = op + dst_size;
+    bitd_uint8 *match, *token;
+    bitd_uint32 seq, h;
+    int *htab = NULL;
+    int lit_len, match_len, n;
+
+    if (src_len > LZ4_MFLIMIT) {
+	/* Positions are stored off by one, so zero means empty */
+	htab = calloc(1 << LZ4_HASH_LOG, sizeof(int));
+
+	while (ip < mflimit) {
+	    seq = LZ4_READ32(ip);
+	    h = LZ4_HASH(seq);
+	    match = htab[h] ? base + htab[h] - 1 : NULL;
+	    htab[h] = (int)(ip - base) + 1;
+
+	    if (!match || 
+		ip - match > LZ4_MAX_OFFSET ||
+		LZ4_READ32(match) != seq) {
+		ip++;
+		continue;
+	    }
+
+	    /* Extend the match, stopping short of the last literals */
+	    match_len = LZ4_MINMATCH;
+	    while (ip + match_len < matchlimit && 
+		   ip[match_len] == match[match_len]) {
+		match_len++;
+	    }
+
+	    /* Worst case size of the sequence */
+	    lit_len = (int)(ip - anchor);
+	    if (op + 1 + lit_len/255 + 1 + lit_len + 2 + 
+		(match_len - LZ4_MINMATCH)/255 + 1 > oend) {
+		goto err;
+	    }
+
+	    /* Encode the literals */
+	    token = op++;
+	    if (lit_len >= 15) {
+		*token = 15 << 4;
+		for (n = lit_len - 15; n >= 255; n -= 255) {
+		    *op++ = 255;
+		}
+		*op++ = (bitd_uint8)n;
+	    } else {
+		*token = (bitd_uint8)(lit_len << 4);
+	    }
+	    memcpy(op, anchor, lit_len);
+	    op += lit_len;
+
+	    /* Encode the match offset and length */
+	    n = (int)(ip - match);
+	    *op++ = (bitd_uint8)(n & 0xff);
+	    *op++ = (bitd_uint8)(n >> 8);
+
+	    n = match_len - LZ4_MINMATCH;
+	    if (n >= 15) {
+		*token |= 15;
+		for (n -= 15; n >= 255; n -= 255) {
+		    *op++ = 255;
+		}
+		*op++ = (bitd_uint8)n;
+	    } else {
+		*token |= (bitd_uint8)n;
+	    }
+
+	    ip += match_len;
+	    anchor = ip;
+	}
+
+	free(htab);
+	htab = NULL;
+    }
+
+    /* The last sequence holds only literals */
+    lit_len = (int)(iend - anchor);
+    if (op + 1 + lit_len/255 + 1 + lit_len > oend) {
+	goto err;
+    }
+    if (lit_len >= 15) {
+	*op++ = 15 << 4;
+	for (n = lit_len - 15; n >= 255; n -= 255) {
+	    *op++ = 255;
+	}
+	*op++ = (bitd_uint8)n;
+    } else {
+	*op++ = (bitd_uint8)(lit_len << 4);
+    }
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return (int)(op - (bitd_uint8 *)dst);
+
+ err:
+    if (htab) {
+	free(htab);
+    }
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        lz4_decompress
+ *============================================================================
+ * Description:     Decompress an LZ4 block
+ * Parameters:    
+ * Returns:     The decompressed size, or -1 on malformed input
+ */
+static int lz4_decompress(char *src, int src_len, char *dst, int dst_size) {
+    bitd_uint8 *ip = (bitd_uint8 *)src, *iend = ip + src_len;
+    bitd_uint8 *op = (bitd_uint8 *)dst, *oend = op + dst_size;
+    bitd_uint8 *match;
+    bitd_uint8 token, c;
+    int len, offset;
+
+    while (ip < iend) {
+	token = *ip++;
+
+	/* Copy the literals */
+	len = token >> 4;
+	if (len == 15) {
+	    do {
+		if (ip >= iend || len > src_len) {
+		    return -1;
+		}
+		c = *ip++;
+		len += c;
+	    } while (c == 255);
+	}
+	if (len > iend - ip || len > oend - op) {
+	    return -1;
+	}
+	memcpy(op, ip, len);
+	op += len;
+	ip += len;
+
+	if (ip == iend) {
+	    /* The last sequence has no match */
+	    break;
+	}
+
+	/* Copy the match */
+	if (iend - ip < 2) {
+	    return -1;
+	}
+	offset = ip[0] | (ip[1] << 8);
+	ip += 2;
+	if (!offset || offset > op - (bitd_uint8 *)dst) {
+	    return -1;
+	}
+
+	len = token & 15;
+	if (len == 15) {
+	    do {
+		if (ip >= iend || len > dst_size) {
+		    return -1;
+		}
+		c = *ip++;
+		len += c;
+	    } while (c == 255);
+	}
+	len += LZ4_MINMATCH;
+	if (len > oend - op) {
+	    return -1;
+	}
+
+	/* Byte by byte, since the match may overlap the output */
+	match = op - offset;
+	while (len--) {
+	    *op++ = *match++;
+	}
+    }
+
+    return (int)(op - (bitd_uint8 *)dst);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_packed_size_object_compact
+ *============================================================================
+ * Description:     Size of the uncompressed compact encoding of an object.
+ *     This is an upper bound on the compressed encoding size.
+ * Parameters:    
+ * Returns:  
+ */
+int bitd_get_packed_size_object_compact(bitd_object_t *a) {
+    struct compact_enc e;
+
+    /* Measure the encoding: header, type and value */
+    enc_init(&e, NULL, 0, 3);
+    enc_byte(&e, (bitd_uint8)a->type);
+    enc_value(&e, a->type, &a->v);
+    enc_deinit(&e);
+
+    return e.idx;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_pack_object_compact
+ *============================================================================
+ * Description:     Pack an object in the compact encoding. The encoding 
+ *     header is the magic byte, the version and the flags. With the LZ4
+ *     flag set, the header is followed by the varint payload size, the
+ *     varint compressed size, and the compressed payload. Otherwise, the 
+ *     header is followed by the payload: the object type and value.
+ * Parameters:    
+ *     lz4_threshold - Compress payloads of at least this many bytes. 
+ *         Set to 0 to disable compression.
+ * Returns:  
+ */
+bitd_boolean bitd_pack_object_compact(char *buf, int size, int *idx, 
+				      bitd_object_t *a, int lz4_threshold) {
+    struct compact_enc e;
+    int payload_idx, payload_len, comp_len;
+    char *comp;
+    bitd_boolean ret = FALSE;
+
+    if (!a || !buf) {
+	return FALSE;
+    }
+
+    enc_init(&e, buf, size, *idx);
+
+    /* Pack the header, and the uncompressed payload */
+    if (!enc_byte(&e, BITD_PACK_COMPACT_MAGIC) ||
+	!enc_byte(&e, BITD_PACK_COMPACT_VERSION) ||
+	!enc_byte(&e, 0)) {
+	goto end;
+    }
+
+    payload_idx = e.idx;
+
+    if (!enc_byte(&e, (bitd_uint8)a->type) ||
+	!enc_value(&e, a->type, &a->v)) {
+	goto end;
+    }
+
+    payload_len = e.idx - payload_idx;
+
+    if (lz4_threshold > 0 && payload_len >= lz4_threshold) {
+	/* Compress the payload. Keep the result only if the compressed
+	   payload, with its size fields, is smaller. */
+	comp = malloc(payload_len);
+	comp_len = lz4_compress(buf + payload_idx, payload_len, 
+				comp, payload_len);
+	if (comp_len && 
+	    comp_len + varint_size(payload_len) + varint_size(comp_len) < 
+	    payload_len) {
+	    buf[payload_idx - 1] = BITD_PACK_COMPACT_FLAG_LZ4;
+	    e.idx = payload_idx;
+	    enc_varint(&e, payload_len);
+	    enc_varint(&e, comp_len);
+	    enc_bytes(&e, comp, comp_len);
+	}
+	free(comp);
+    }
+
+    *idx = e.idx;
+    ret = TRUE;
+
+ end:
+    enc_deinit(&e);
+
+    return ret;
+} 
+
+
+/*
+ *============================================================================
+ *                        unpack_object_compact
+ *============================================================================
+ * Description:     Unpack an object packed in the compact encoding
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean unpack_object_compact(char *buf, int size, int *idx,
+					  bitd_object_t *a) { 
+    struct compact_dec d;
+    bitd_uint8 magic, version, flags, type;
+    bitd_uint64 payload_len, comp_len;
+    int end_idx = -1;
+    bitd_boolean ret = FALSE;
+
+    memset(&d, 0, sizeof(d));
+    d.buf = buf;
+    d.size = size;
+    d.idx = *idx;
+
+    if (!dec_byte(&d, &magic) || magic != BITD_PACK_COMPACT_MAGIC ||
+	!dec_byte(&d, &version) || version != BITD_PACK_COMPACT_VERSION ||
+	!dec_byte(&d, &flags)) {
+	goto end;
+    }
+
+    if (flags & BITD_PACK_COMPACT_FLAG_LZ4) {
+	/* Decompress the payload, then decode from the decompressed copy */
+	if (!dec_varint(&d, &payload_len) ||
+	    !dec_length(&d, &comp_len) ||
+	    payload_len > comp_len * LZ4_MAX_RATIO ||
+	    payload_len > INT_MAX) {
+	    goto end;
+	}
+
+	end_idx = d.idx + (int)comp_len;
+
+	d.buf = malloc(payload_len);
+	if (lz4_decompress(buf + d.idx, (int)comp_len, 
+			   d.buf, (int)payload_len) != (int)payload_len) {
+	    goto end;
+	}
+	d.size = (int)payload_len;
+	d.idx = 0;
+    }
+
+    if (!dec_byte(&d, &type) || (int)type >= (int)bitd_type_max) {
+	goto end;
+    }
+
+    bitd_value_init(&a->v);
+    if (!dec_value(&d, type, &a->v)) {
+	goto end;
+    }
+    a->type = type;
+
+    if (end_idx < 0) {
+	end_idx = d.idx;
+    }
+    *idx = end_idx;
+    
+    ret = TRUE;
+
+ end:
+    if (d.buf != buf) {
+	free(d.buf);
+    }
+    if (d.names) {
+	free(d.names);
+    }
+
+    return ret;
+}
@@ -15,6 +15,10 @@
 #include "bitd/common.h"
 #include "bitd/platform-poll-event.h"
 
+#if defined(BITD_HAVE_EVENTFD)
+# include <sys/eventfd.h>
+#endif
+
 
 /*****************************************************************************
  *                             MANIFEST CONSTANTS
@@ -45,12 +49,20 @@
  *                                  TYPES
  *****************************************************************************/
 
+#if defined(BITD_HAVE_EVENTFD)
+/* The poll event control block. The event is set while the eventfd
+   counter is non-zero. */
+struct bitd_poll_event_s {
+    int fd;
+};
+#else
 /* The poll event control block */
 struct bitd_poll_event_s {
     bitd_mutex m;
     bitd_socket_t s;
     bitd_boolean event_set;
 };
+#endif
 
 
 
@@ -58,7 +70,9 @@ struct bitd_poll_event_s {
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
+#if !defined(BITD_HAVE_EVENTFD)
 static bitd_boolean sock_recv(bitd_poll_event e);
+#endif
 
 
 
@@ -72,6 +86,149 @@ static bitd_boolean sock_recv(bitd_poll_event e);
  *                          FUNCTION IMPLEMENTATION
  *****************************************************************************/
 
+#if defined(BITD_HAVE_EVENTFD)
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_to_fd
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_socket_t bitd_poll_event_to_fd(bitd_poll_event e) {
+    return e ? e->fd : 0;
+} 
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_create
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_poll_event bitd_poll_event_create(void) {
+    bitd_poll_event e;
+
+    e = (bitd_poll_event)calloc(1, sizeof(*e));
+    if (e) {
+        e->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (e->fd < 0) {
+            lcl_printf("eventfd() error (%s %d) %s:%d\n", 
+                       strerror(errno), errno, __FILE__, __LINE__);
+            free(e);
+            e = NULL;
+        }
+    }
+
+    return e;
+} 
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_destroy
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_poll_event_destroy(bitd_poll_event e) {
+    if (e) {
+        close(e->fd);
+        free(e);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_set
+ *============================================================================
+ * Description:     Increment the eventfd counter. Setting an event that
+ *     is already set leaves it set.
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_poll_event_set(bitd_poll_event e) {
+    bitd_uint64 v = 1;
+
+    if (e) {
+        while (write(e->fd, &v, sizeof(v)) < 0 && errno == EINTR);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_clear
+ *============================================================================
+ * Description:     Reset the eventfd counter. The read fails with EAGAIN
+ *     if the event is not set.
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_poll_event_clear(bitd_poll_event e) {
+    bitd_uint64 v;
+
+    if (e) {
+        while (read(e->fd, &v, sizeof(v)) < 0 && errno == EINTR);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_poll_event_wait
+ *============================================================================
+ * Description:     Wait for the event to be set, and clear it
+ * Parameters:    
+ * Returns:         TRUE if the event was set
+ */
+bitd_boolean bitd_poll_event_wait(bitd_poll_event e, bitd_uint32 tmo) {
+    bitd_boolean ret = FALSE;
+    bitd_uint32 start_time;
+    bitd_uint32 current_time;
+    struct bitd_pollfd pfd;
+    bitd_uint64 v;
+    int n;
+
+    if (e) {        
+        start_time = bitd_get_time_msec();
+        
+        for (;;) {
+            /* Try to consume the event */
+            if (read(e->fd, &v, sizeof(v)) == sizeof(v)) {
+                ret = TRUE;
+                break;
+            }
+
+            if (!tmo) {
+                break;
+            }
+
+            pfd.fd = e->fd;
+            pfd.events = BITD_POLLIN;
+            pfd.revents = 0;
+            n = bitd_poll(&pfd, 1, tmo == BITD_FOREVER ? -1 : (int)tmo);
+            if (n < 0 && errno != EINTR) {
+                break;
+            }
+            
+            if (tmo != BITD_FOREVER) {
+                /* Compute the remaining time */
+                current_time = bitd_get_time_msec();
+                tmo -= MIN(tmo, current_time - start_time);
+                start_time = current_time;
+            }
+        }
+    }
+
+    return ret;
+} 
+
+#else /* BITD_HAVE_EVENTFD */
+
 /*
  *============================================================================
  *                        sock_receive
@@ -292,4 +449,4 @@ bitd_boolean bitd_poll_event_wait(bitd_poll_event e, bitd_uint32 tmo) {
     return ret;
 } 
 
-
+#endif /* BITD_HAVE_EVENTFD */
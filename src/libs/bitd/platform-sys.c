@@ -68,7 +68,8 @@ bitd_boolean bitd_sys_init(void) {
 #endif
 
     return bitd_sys_thread_init() &&
-        bitd_sys_socket_init();
+        bitd_sys_socket_init() &&
+        bitd_sys_time_init();
 } 
 
 
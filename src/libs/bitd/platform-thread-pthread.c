@@ -55,6 +55,11 @@ struct bitd_arch_event_s {
     bitd_boolean is_set;
 };
 
+/* The thread-local slot control block */
+struct bitd_arch_tls_s {
+    pthread_key_t key;
+};
+
 
 /*****************************************************************************
  *                           FUNCTION DECLARATION
@@ -501,3 +506,70 @@ bitd_boolean bitd_arch_event_wait(bitd_arch_event e, bitd_uint32 tmo) {
 
     return result;
 }
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_create
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_arch_tls bitd_arch_tls_create(void (*destructor)(void *value)) {
+    bitd_arch_tls t;
+
+    t = malloc(sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+
+    if (pthread_key_create(&t->key, destructor)) {
+        free(t);
+        return NULL;
+    }
+
+    return t;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_destroy
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_arch_tls_destroy(bitd_arch_tls t) {
+    if (t) {
+        pthread_key_delete(t->key);
+        free(t);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_get
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void *bitd_arch_tls_get(bitd_arch_tls t) {
+    return pthread_getspecific(t->key);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_set
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_arch_tls_set(bitd_arch_tls t, void *value) {
+    pthread_setspecific(t->key, value);
+} 
@@ -51,6 +51,23 @@ struct bitd_arch_event_s {
     HANDLE e;
 };
 
+/* The thread-local slot control block. Fiber-local storage is used
+   because, unlike TlsAlloc(), it calls back when the thread exits. 
+   FlsFree() also calls back, for every thread, so the slot holds a 
+   per-thread value record, and the callback skips the destructor once 
+   the slot is being destroyed. */
+struct bitd_arch_tls_s {
+    DWORD key;
+    void (*destructor)(void *value);
+    volatile bitd_boolean destroyed_p;
+};
+
+/* The per-thread slot value */
+struct tls_value_s {
+    bitd_arch_tls t;
+    void *value;
+};
+
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
@@ -404,3 +421,113 @@ bitd_boolean bitd_arch_event_wait(bitd_arch_event e, bitd_uint32 timeout) {
     return FALSE;
 } 
 
+
+/*
+ *============================================================================
+ *                        tls_value_free
+ *============================================================================
+ * Description:     Fiber-local storage callback, when a thread exits or
+ *     when the slot is freed
+ * Parameters:    
+ * Returns:  
+ */
+static void WINAPI tls_value_free(void *data) {
+    struct tls_value_s *v = (struct tls_value_s *)data;
+
+    if (!v) {
+        return;
+    }
+
+    if (v->value && v->t->destructor && !v->t->destroyed_p) {
+        v->t->destructor(v->value);
+    }
+    free(v);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_create
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_arch_tls bitd_arch_tls_create(void (*destructor)(void *value)) {
+    bitd_arch_tls t;
+
+    t = malloc(sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+
+    t->destructor = destructor;
+    t->destroyed_p = FALSE;
+    t->key = FlsAlloc(tls_value_free);
+    if (t->key == FLS_OUT_OF_INDEXES) {
+        free(t);
+        return NULL;
+    }
+
+    return t;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_destroy
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_arch_tls_destroy(bitd_arch_tls t) {
+    if (t) {
+        /* FlsFree() calls back with the value of each thread. Only 
+           the value records are freed, not the values. */
+        t->destroyed_p = TRUE;
+        FlsFree(t->key);
+        free(t);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_get
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void *bitd_arch_tls_get(bitd_arch_tls t) {
+    struct tls_value_s *v = FlsGetValue(t->key);
+
+    return v ? v->value : NULL;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_arch_tls_set
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_arch_tls_set(bitd_arch_tls t, void *value) {
+    struct tls_value_s *v = FlsGetValue(t->key);
+
+    if (!v) {
+        if (!value) {
+            return;
+        }
+        v = malloc(sizeof(*v));
+        if (!v) {
+            return;
+        }
+        v->t = t;
+        FlsSetValue(t->key, v);
+    }
+    v->value = value;
+} 
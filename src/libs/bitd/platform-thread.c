@@ -268,6 +268,58 @@ void* bitd_get_thread_arg(bitd_thread th) {
 }
 
 
+/*
+ *============================================================================
+ *                        bitd_tls_create
+ *============================================================================
+ * Description:     Create a thread-local slot
+ * Parameters:    
+ * Returns:  
+ */
+bitd_tls bitd_tls_create(void (*destructor)(void *value)) {
+    return (bitd_tls)bitd_arch_tls_create(destructor);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_tls_destroy
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_tls_destroy(bitd_tls t) {
+    bitd_arch_tls_destroy((bitd_arch_tls)t);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_tls_get
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void *bitd_tls_get(bitd_tls t) {
+    return bitd_arch_tls_get((bitd_arch_tls)t);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_tls_set
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_tls_set(bitd_tls t, void *value) {
+    bitd_arch_tls_set((bitd_arch_tls)t, value);
+}
+
+
 /*
  *============================================================================
  *                        bitd_sleep
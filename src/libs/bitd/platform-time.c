@@ -30,23 +30,58 @@
 # include <time.h>
 #endif
 
+/* The timestamp counter is used on x86 linux, with gcc or clang */
+#if defined(__linux__) && defined(__GNUC__) &&				\
+    (defined(__x86_64__) || defined(__i386__)) &&			\
+    defined(BITD_HAVE_X86INTRIN_H) && defined(BITD_HAVE_CPUID_H) &&	\
+    defined(BITD_HAVE_CLOCK_GETTIME)
+# define BITD_TIME_TSC 1
+# include <x86intrin.h>
+# include <cpuid.h>
+#endif
+
 
 /*****************************************************************************
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* The tsc calibration interval, and number of calibration samples */
+#define TIME_TSC_CALIBRATE_MSEC 10
+#define TIME_TSC_CALIBRATE_SAMPLES 5
+
+/* Re-anchor the tsc to the system time every 100 msecs. This bounds the
+   extrapolation error, and keeps the cycle delta under 2^32. */
+#define TIME_TSC_ANCHOR_NSEC 100000000ULL
+
+/* A re-anchor back step smaller than this is smoothed over */
+#define TIME_TSC_MAX_BACK_STEP_NSEC 1000000ULL
 
+/* The kernel clock source file */
+#define TIME_CLOCKSOURCE_FILE						\
+    "/sys/devices/system/clocksource/clocksource0/current_clocksource"
 
 /*****************************************************************************
  *                                  MACROS 
  *****************************************************************************/
 
+#if defined(__GNUC__)
+/* Initial-exec avoids a __tls_get_addr() call per clock read */
+# define TIME_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#elif defined(_MSC_VER)
+# define TIME_THREAD_LOCAL __declspec(thread)
+#endif
 
 
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
 
+/* Per-thread tsc anchor */
+typedef struct {
+    bitd_uint64 tsc;          /* Timestamp counter at anchor time */
+    bitd_uint64 nsec;         /* System time at anchor time */
+    bitd_uint64 last_nsec;    /* Last returned time */
+} time_tsc_anchor_t;
 
 
 /*****************************************************************************
@@ -59,6 +94,23 @@
  *                                VARIABLES
  *****************************************************************************/
 
+#if defined(BITD_TIME_TSC)
+/* Nsecs per cycle, in 32.32 fixed point. Zero if the tsc is not used. */
+static bitd_uint64 g_time_tsc_mult;
+
+/* Cycles between re-anchors */
+static bitd_uint64 g_time_tsc_anchor_cycles;
+#endif
+
+#if defined(TIME_THREAD_LOCAL)
+# if defined(BITD_TIME_TSC)
+static TIME_THREAD_LOCAL time_tsc_anchor_t t_time_anchor;
+# endif
+
+/* The cached time, or zero */
+static TIME_THREAD_LOCAL bitd_uint64 t_time_cached_nsec;
+#endif
+
 
 
 /*****************************************************************************
@@ -136,3 +188,253 @@ bitd_uint32 bitd_get_time_msec(void) {
 } 
 
 
+#if defined(BITD_TIME_TSC)
+/*
+ *============================================================================
+ *                        time_tsc_usable
+ *============================================================================
+ * Description:     Check that the tsc is invariant, and that the kernel
+ *     also uses it as clock source - otherwise the tsc may not be in
+ *     sync across cpus.
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean time_tsc_usable(void) {
+    unsigned int eax, ebx, ecx, edx;
+    char buf[32];
+    FILE *f;
+    bitd_boolean ret = FALSE;
+
+    /* Invariant tsc */
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+	!(edx & (1 << 8))) {
+	return FALSE;
+    }
+
+    f = fopen(TIME_CLOCKSOURCE_FILE, "r");
+    if (f) {
+	if (fgets(buf, sizeof(buf), f) && !strncmp(buf, "tsc", 3) &&
+	    (buf[3] == '\n' || buf[3] == 0)) {
+	    ret = TRUE;
+	}
+	fclose(f);
+    }
+
+    return ret;
+} 
+
+
+/*
+ *============================================================================
+ *                        time_tsc_sample
+ *============================================================================
+ * Description:     Read the system time and the tsc as close together as
+ *     possible.
+ * Parameters:    
+ * Returns:  
+ */
+static void time_tsc_sample(bitd_uint64 *nsec, bitd_uint64 *tsc) {
+    bitd_uint64 c0, c1, best = (bitd_uint64)-1, t;
+    int i;
+
+    for (i = 0; i < TIME_TSC_CALIBRATE_SAMPLES; i++) {
+	c0 = __rdtsc();
+	t = bitd_get_time_nsec();
+	c1 = __rdtsc();
+
+	if (c1 - c0 < best) {
+	    best = c1 - c0;
+	    *nsec = t;
+	    *tsc = c0 + (c1 - c0) / 2;
+	}
+    }
+} 
+#endif
+
+
+/*
+ *============================================================================
+ *                        bitd_sys_time_init
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_boolean bitd_sys_time_init(void) {
+#if defined(BITD_TIME_TSC)
+    bitd_uint64 t0, t1, c0, c1;
+
+    if (g_time_tsc_mult || getenv("BITD_SKIP_TSC") || !time_tsc_usable()) {
+	return TRUE;
+    }
+
+    time_tsc_sample(&t0, &c0);
+    bitd_sleep(TIME_TSC_CALIBRATE_MSEC);
+    time_tsc_sample(&t1, &c1);
+
+    if (t1 <= t0 || c1 <= c0) {
+	/* The system time stepped back, or the tsc is not ticking */
+	return TRUE;
+    }
+
+    g_time_tsc_anchor_cycles = 
+	(c1 - c0) * TIME_TSC_ANCHOR_NSEC / (t1 - t0);
+    g_time_tsc_mult = ((t1 - t0) << 32) / (c1 - c0);
+#endif
+
+    return TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_time_nsec_fast
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_uint64 bitd_get_time_nsec_fast(void) {
+#if defined(BITD_TIME_TSC)
+    time_tsc_anchor_t *a = &t_time_anchor;
+    bitd_uint64 delta, nsec;
+
+    if (!g_time_tsc_mult) {
+	return bitd_get_time_nsec();
+    }
+
+    /* An unsigned delta also re-anchors if the tsc went back */
+    delta = __rdtsc() - a->tsc;
+    if (!a->tsc || delta >= g_time_tsc_anchor_cycles) {
+	time_tsc_sample(&nsec, &a->tsc);
+
+	/* Always anchor on the system time, so extrapolation errors
+	   don't add up across anchors */
+	a->nsec = nsec;
+
+	if (nsec < a->last_nsec &&
+	    a->last_nsec - nsec < TIME_TSC_MAX_BACK_STEP_NSEC) {
+	    /* Extrapolation ran ahead - hold the time until caught up */
+	    nsec = a->last_nsec;
+	}
+    } else {
+	nsec = a->nsec + ((delta * g_time_tsc_mult) >> 32);
+	if (nsec < a->last_nsec) {
+	    nsec = a->last_nsec;
+	}
+    }
+
+    a->last_nsec = nsec;
+
+    return nsec;
+#else
+    return bitd_get_time_nsec();
+#endif
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_time_fast_source
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+const char *bitd_get_time_fast_source(void) {
+#if defined(BITD_TIME_TSC)
+    if (g_time_tsc_mult) {
+	return "tsc";
+    }
+#endif
+
+    return "clock_gettime";
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_time_nsec_coarse
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_uint64 bitd_get_time_nsec_coarse(void) {
+#if defined(BITD_HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+    struct timespec spec;
+    
+    clock_gettime(CLOCK_REALTIME_COARSE, &spec);
+
+    return ((bitd_uint64)spec.tv_sec)*1000000000ULL + (bitd_uint64)spec.tv_nsec;
+#else
+    return bitd_get_time_nsec();
+#endif
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_time_msec_coarse
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_uint32 bitd_get_time_msec_coarse(void) {
+
+    return (bitd_uint32)(bitd_get_time_nsec_coarse() / 1000000);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_time_cache_begin
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_uint64 bitd_time_cache_begin(void) {
+#if defined(TIME_THREAD_LOCAL)
+    t_time_cached_nsec = bitd_get_time_nsec_fast();
+    
+    return t_time_cached_nsec;
+#else
+    return bitd_get_time_nsec_fast();
+#endif
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_time_cache_end
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_time_cache_end(void) {
+#if defined(TIME_THREAD_LOCAL)
+    t_time_cached_nsec = 0;
+#endif
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_get_time_nsec_cached
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+bitd_uint64 bitd_get_time_nsec_cached(void) {
+#if defined(TIME_THREAD_LOCAL)
+    if (t_time_cached_nsec) {
+	return t_time_cached_nsec;
+    }
+#endif
+
+    return bitd_get_time_nsec_fast();
+} 
@@ -0,0 +1,766 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Shared I/O reactor
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/reactor.h"
+#include "bitd/timer-list.h"
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+# include <sys/epoll.h>
+#endif
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+#define REACTOR_EVENTS_MAX 64  /* Max events returned by one epoll_wait() */
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+#define rct_printf if (0) printf
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+typedef enum {
+    reactor_handle_fd,
+    reactor_handle_timer
+} reactor_handle_type;
+
+struct bitd_reactor_handle_s {
+    struct bitd_reactor_handle_s *next;  /* Loop handle or zombie list */
+    struct bitd_reactor_handle_s *prev;
+    bitd_reactor_loop loop;
+    reactor_handle_type type;
+    bitd_socket_t fd;
+    bitd_uint32 events;
+    bitd_timer timer;
+    bitd_reactor_callback_t *cb;
+    void *cookie;
+    bitd_boolean removed_p;
+};
+
+/* A function call pending on the loop thread */
+struct reactor_call {
+    struct reactor_call *next;
+    bitd_reactor_call_t *fn;
+    void *cookie;
+    bitd_event done_ev;                 /* Set if the caller waits */
+};
+
+struct bitd_reactor_loop_s {
+    bitd_mutex lock;                    /* Protects the call list */
+    struct reactor_call *calls;
+    struct reactor_call *calls_tail;
+    bitd_event wake_ev;                 /* Wakes up the loop */
+    bitd_thread th;                     /* The loop thread */
+    bitd_boolean stopping_p;
+    bitd_timer_list timers;
+    struct bitd_reactor_handle_s handles; /* Handle list head */
+    bitd_uint32 n_handles;
+    struct bitd_reactor_handle_s *zombies; /* Removed, not yet freed */
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+    int epfd;
+#else
+    struct bitd_pollfd *pfds;           /* Poll array, rebuilt each loop */
+    bitd_reactor_handle *pfd_handles;
+    bitd_uint32 pfds_allocated;
+#endif
+};
+
+struct reactor_s {
+    bitd_uint32 n_loops;
+    struct bitd_reactor_loop_s *loops;
+};
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+/* The global reactor control block pointer */
+static struct reactor_s *g_reactor;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        loop_thread_p
+ *============================================================================
+ * Description:     Are we running on the loop thread?
+ * Parameters:
+ * Returns:
+ */
+static bitd_boolean loop_thread_p(bitd_reactor_loop l) {
+    return l->th && l->th == bitd_get_current_thread();
+}
+
+
+/*
+ *============================================================================
+ *                        loop_run_calls
+ *============================================================================
+ * Description:     Run the pending function calls
+ * Parameters:
+ * Returns:
+ */
+static void loop_run_calls(bitd_reactor_loop l) {
+    struct reactor_call *c, *calls;
+
+    bitd_mutex_lock(l->lock);
+    calls = l->calls;
+    l->calls = NULL;
+    l->calls_tail = NULL;
+    bitd_mutex_unlock(l->lock);
+
+    while ((c = calls)) {
+	calls = c->next;
+
+	c->fn(c->cookie);
+
+	if (c->done_ev) {
+	    /* The caller frees the call */
+	    bitd_event_set(c->done_ev);
+	} else {
+	    free(c);
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        loop_free_zombies
+ *============================================================================
+ * Description:     Free the handles removed during the last loop iteration
+ * Parameters:
+ * Returns:
+ */
+static void loop_free_zombies(bitd_reactor_loop l) {
+    bitd_reactor_handle h;
+
+    while ((h = l->zombies)) {
+	l->zombies = h->next;
+	if (h->timer) {
+	    bitd_timer_destroy(h->timer);
+	}
+	free(h);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        loop_dispatch
+ *============================================================================
+ * Description:     Call the handle callback, unless the handle was removed
+ * Parameters:
+ * Returns:
+ */
+static void loop_dispatch(bitd_reactor_handle h, bitd_uint32 events) {
+
+    if (!h->removed_p) {
+	h->cb(h, events, h->cookie);
+    }
+}
+
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+/*
+ *============================================================================
+ *                        loop_wait
+ *============================================================================
+ * Description:     Wait for events with epoll(), and dispatch them
+ * Parameters:
+ * Returns:
+ */
+static void loop_wait(bitd_reactor_loop l, int tmo) {
+    struct epoll_event evs[REACTOR_EVENTS_MAX];
+    bitd_uint32 events;
+    int n, i;
+
+    n = epoll_wait(l->epfd, evs, REACTOR_EVENTS_MAX, tmo);
+
+    for (i = 0; i < n; i++) {
+	if (!evs[i].data.ptr) {
+	    /* The wake up event */
+	    bitd_event_clear(l->wake_ev);
+	    continue;
+	}
+
+	events = 0;
+	if (evs[i].events & EPOLLIN) {
+	    events |= BITD_REACTOR_EV_READ;
+	}
+	if (evs[i].events & EPOLLOUT) {
+	    events |= BITD_REACTOR_EV_WRITE;
+	}
+	if (evs[i].events & (EPOLLERR | EPOLLHUP)) {
+	    events |= BITD_REACTOR_EV_ERROR;
+	}
+
+	loop_dispatch((bitd_reactor_handle)evs[i].data.ptr, events);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        loop_fd_ctl
+ *============================================================================
+ * Description:     Add, modify or delete a file descriptor in the epoll set
+ * Parameters:
+ * Returns:
+ */
+static void loop_fd_ctl(bitd_reactor_handle h, int op) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (h->events & BITD_REACTOR_EV_READ) {
+	ev.events |= EPOLLIN;
+    }
+    if (h->events & BITD_REACTOR_EV_WRITE) {
+	ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = h;
+
+    if (epoll_ctl(h->loop->epfd, op, h->fd, &ev) < 0) {
+	rct_printf("epoll_ctl(%d, %d) error %s\n", op, h->fd, strerror(errno));
+    }
+}
+
+#else /* BITD_HAVE_SYS_EPOLL_H */
+
+/*
+ *============================================================================
+ *                        loop_wait
+ *============================================================================
+ * Description:     Wait for events with bitd_poll(), and dispatch them
+ * Parameters:
+ * Returns:
+ */
+static void loop_wait(bitd_reactor_loop l, int tmo) {
+    bitd_reactor_handle h;
+    bitd_uint32 n_pfds = 0, events, i;
+    int n;
+
+    /* Rebuild the poll array */
+    if (l->pfds_allocated < l->n_handles + 1) {
+	l->pfds_allocated = l->n_handles + 16;
+	l->pfds = realloc(l->pfds, l->pfds_allocated * sizeof(*l->pfds));
+	l->pfd_handles = realloc(l->pfd_handles,
+				 l->pfds_allocated * sizeof(*l->pfd_handles));
+    }
+
+    l->pfds[n_pfds].fd = bitd_event_to_fd(l->wake_ev);
+    l->pfds[n_pfds].events = BITD_POLLIN;
+    l->pfds[n_pfds].revents = 0;
+    l->pfd_handles[n_pfds++] = NULL;
+
+    for (h = l->handles.next; h != &l->handles; h = h->next) {
+	if (h->type != reactor_handle_fd) {
+	    continue;
+	}
+	l->pfds[n_pfds].fd = h->fd;
+	l->pfds[n_pfds].events = 0;
+	if (h->events & BITD_REACTOR_EV_READ) {
+	    l->pfds[n_pfds].events |= BITD_POLLIN;
+	}
+	if (h->events & BITD_REACTOR_EV_WRITE) {
+	    l->pfds[n_pfds].events |= BITD_POLLOUT;
+	}
+	l->pfds[n_pfds].revents = 0;
+	l->pfd_handles[n_pfds++] = h;
+    }
+
+    n = bitd_poll(l->pfds, n_pfds, tmo);
+    if (n <= 0) {
+	return;
+    }
+
+    if (l->pfds[0].revents) {
+	bitd_event_clear(l->wake_ev);
+    }
+
+    for (i = 1; i < n_pfds; i++) {
+	if (!l->pfds[i].revents) {
+	    continue;
+	}
+
+	events = 0;
+	if (l->pfds[i].revents & BITD_POLLIN) {
+	    events |= BITD_REACTOR_EV_READ;
+	}
+	if (l->pfds[i].revents & BITD_POLLOUT) {
+	    events |= BITD_REACTOR_EV_WRITE;
+	}
+	if (l->pfds[i].revents & ~(BITD_POLLIN | BITD_POLLOUT)) {
+	    events |= BITD_REACTOR_EV_ERROR;
+	}
+
+	loop_dispatch(l->pfd_handles[i], events);
+    }
+}
+
+#endif /* BITD_HAVE_SYS_EPOLL_H */
+
+
+/*
+ *============================================================================
+ *                        reactor_event_loop
+ *============================================================================
+ * Description:     The reactor loop thread
+ * Parameters:
+ * Returns:
+ */
+static void reactor_event_loop(void *thread_arg) {
+    bitd_reactor_loop l = (bitd_reactor_loop)thread_arg;
+    bitd_uint32 tmo;
+
+    rct_printf("Reactor loop started\n");
+
+    while (!l->stopping_p) {
+	/* Get the timer list expiration */
+	tmo = bitd_timer_list_get_timeout_msec(l->timers);
+
+	/* Wait for events, and dispatch them */
+	loop_wait(l, tmo == BITD_FOREVER ? -1 : (int)tmo);
+
+	/* Tick the timers, with one current time for the tick */
+	bitd_time_cache_begin();
+	bitd_timer_list_tick(l->timers);
+	bitd_time_cache_end();
+
+	/* Run the function calls */
+	loop_run_calls(l);
+
+	loop_free_zombies(l);
+    }
+
+    rct_printf("Reactor loop stopped\n");
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_init
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_boolean bitd_reactor_init(bitd_uint32 n_loops) {
+    bitd_reactor_loop l;
+    bitd_uint32 i;
+
+    if (g_reactor) {
+	return TRUE;
+    }
+
+    if (!n_loops) {
+	n_loops = BITD_REACTOR_LOOPS_DEF;
+    }
+
+    g_reactor = calloc(1, sizeof(*g_reactor));
+    g_reactor->n_loops = n_loops;
+    g_reactor->loops = calloc(n_loops, sizeof(*g_reactor->loops));
+
+    for (i = 0; i < n_loops; i++) {
+	l = &g_reactor->loops[i];
+
+	l->lock = bitd_mutex_create();
+	l->wake_ev = bitd_event_create(BITD_EVENT_FLAG_POLL);
+	l->timers = bitd_timer_list_create();
+	bitd_timer_list_set_ticks_max(l->timers, 250);
+	l->handles.next = &l->handles;
+	l->handles.prev = &l->handles;
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+	{
+	    struct epoll_event ev;
+
+	    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+	    bitd_assert(l->epfd >= 0);
+
+	    /* The wake up event is the handle with NULL data */
+	    memset(&ev, 0, sizeof(ev));
+	    ev.events = EPOLLIN;
+	    epoll_ctl(l->epfd, EPOLL_CTL_ADD, bitd_event_to_fd(l->wake_ev), &ev);
+	}
+#endif
+
+	l->th = bitd_create_thread("reactor-loop",
+				   reactor_event_loop,
+				   BITD_DEFAULT_PRIORITY,
+				   65536, /* Larger stack, for the curl transfers. Stack size must be multiple of 4096 on OSX. */
+				   l);
+    }
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_deinit
+ *============================================================================
+ * Description:     Stop the loops, and free the handles still registered
+ * Parameters:
+ * Returns:
+ */
+void bitd_reactor_deinit(void) {
+    bitd_reactor_loop l;
+    bitd_reactor_handle h;
+    struct reactor_call *c;
+    bitd_uint32 i;
+
+    if (!g_reactor) {
+	return;
+    }
+
+    for (i = 0; i < g_reactor->n_loops; i++) {
+	l = &g_reactor->loops[i];
+
+	/* Stop the loop, and wait for it to exit */
+	l->stopping_p = TRUE;
+	bitd_event_set(l->wake_ev);
+	bitd_join_thread(l->th);
+
+	while ((h = l->handles.next) != &l->handles) {
+	    h->next->prev = h->prev;
+	    h->prev->next = h->next;
+	    if (h->timer) {
+		bitd_timer_list_remove(h->timer);
+		bitd_timer_destroy(h->timer);
+	    }
+	    free(h);
+	}
+	loop_free_zombies(l);
+
+	while ((c = l->calls)) {
+	    l->calls = c->next;
+	    if (c->done_ev) {
+		bitd_event_set(c->done_ev);
+	    } else {
+		free(c);
+	    }
+	}
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+	close(l->epfd);
+#else
+	if (l->pfds) {
+	    free(l->pfds);
+	    free(l->pfd_handles);
+	}
+#endif
+	bitd_timer_list_destroy(l->timers);
+	bitd_event_destroy(l->wake_ev);
+	bitd_mutex_destroy(l->lock);
+    }
+
+    free(g_reactor->loops);
+    free(g_reactor);
+    g_reactor = NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_loop_get
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_reactor_loop bitd_reactor_loop_get(void) {
+    bitd_reactor_loop l = NULL;
+    bitd_uint32 i;
+
+    if (!g_reactor) {
+	return NULL;
+    }
+
+    for (i = 0; i < g_reactor->n_loops; i++) {
+	if (!l || g_reactor->loops[i].n_handles < l->n_handles) {
+	    l = &g_reactor->loops[i];
+	}
+    }
+
+    return l;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_call
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void bitd_reactor_call(bitd_reactor_loop l,
+		       bitd_reactor_call_t *fn, void *cookie,
+		       bitd_boolean wait_p) {
+    struct reactor_call *c;
+
+    if (loop_thread_p(l)) {
+	fn(cookie);
+	return;
+    }
+
+    c = calloc(1, sizeof(*c));
+    c->fn = fn;
+    c->cookie = cookie;
+    if (wait_p) {
+	c->done_ev = bitd_event_create(0);
+    }
+
+    bitd_mutex_lock(l->lock);
+    if (l->calls_tail) {
+	l->calls_tail->next = c;
+    } else {
+	l->calls = c;
+    }
+    l->calls_tail = c;
+    bitd_mutex_unlock(l->lock);
+
+    /* Wake up the loop */
+    bitd_event_set(l->wake_ev);
+
+    if (wait_p) {
+	bitd_event_wait(c->done_ev, BITD_FOREVER);
+	bitd_event_destroy(c->done_ev);
+	free(c);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        handle_create
+ *============================================================================
+ * Description:     Create a handle, and link it on the loop handle list
+ * Parameters:
+ * Returns:
+ */
+static bitd_reactor_handle handle_create(bitd_reactor_loop l,
+					 reactor_handle_type type,
+					 bitd_reactor_callback_t *cb,
+					 void *cookie) {
+    bitd_reactor_handle h;
+
+    bitd_assert(loop_thread_p(l));
+
+    h = calloc(1, sizeof(*h));
+    h->loop = l;
+    h->type = type;
+    h->fd = BITD_INVALID_SOCKID;
+    h->cb = cb;
+    h->cookie = cookie;
+
+    h->next = &l->handles;
+    h->prev = l->handles.prev;
+    h->prev->next = h;
+    l->handles.prev = h;
+    l->n_handles++;
+
+    return h;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_fd_add
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_reactor_handle bitd_reactor_fd_add(bitd_reactor_loop l,
+					bitd_socket_t fd,
+					bitd_uint32 events,
+					bitd_reactor_callback_t *cb,
+					void *cookie) {
+    bitd_reactor_handle h;
+
+    h = handle_create(l, reactor_handle_fd, cb, cookie);
+    h->fd = fd;
+    h->events = events;
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+    loop_fd_ctl(h, EPOLL_CTL_ADD);
+#endif
+
+    return h;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_queue_add
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_reactor_handle bitd_reactor_queue_add(bitd_reactor_loop l,
+					   bitd_queue q,
+					   bitd_reactor_callback_t *cb,
+					   void *cookie) {
+    return bitd_reactor_fd_add(l, bitd_queue_fd(q),
+			       BITD_REACTOR_EV_READ, cb, cookie);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_set_events
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void bitd_reactor_set_events(bitd_reactor_handle h, bitd_uint32 events) {
+
+    if (!h || h->type != reactor_handle_fd || h->events == events) {
+	return;
+    }
+
+    bitd_assert(loop_thread_p(h->loop));
+
+    h->events = events;
+
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+    loop_fd_ctl(h, EPOLL_CTL_MOD);
+#endif
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_get_fd
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_socket_t bitd_reactor_get_fd(bitd_reactor_handle h) {
+    return h ? h->fd : BITD_INVALID_SOCKID;
+}
+
+
+/*
+ *============================================================================
+ *                        timer_expired
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void timer_expired(bitd_timer t, void *cookie) {
+    loop_dispatch((bitd_reactor_handle)cookie, 0);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_timer_add
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_reactor_handle bitd_reactor_timer_add(bitd_reactor_loop l,
+					   bitd_reactor_callback_t *cb,
+					   void *cookie) {
+    bitd_reactor_handle h;
+
+    h = handle_create(l, reactor_handle_timer, cb, cookie);
+    h->timer = bitd_timer_create();
+
+    return h;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_timer_set
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void bitd_reactor_timer_set(bitd_reactor_handle h, bitd_uint32 tmo_msec) {
+
+    if (!h || h->type != reactor_handle_timer) {
+	return;
+    }
+
+    bitd_assert(loop_thread_p(h->loop));
+
+    bitd_timer_list_remove(h->timer);
+    if (tmo_msec != BITD_FOREVER) {
+	bitd_timer_list_add_msec(h->loop->timers, h->timer, tmo_msec,
+				 timer_expired, h);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_reactor_remove
+ *============================================================================
+ * Description:     Unlink the handle, and put it on the zombie list. The
+ *     handle is freed at the end of the loop iteration, since events
+ *     may still be pending for it.
+ * Parameters:
+ * Returns:
+ */
+void bitd_reactor_remove(bitd_reactor_handle h) {
+    bitd_reactor_loop l;
+
+    if (!h) {
+	return;
+    }
+
+    l = h->loop;
+    bitd_assert(loop_thread_p(l));
+    bitd_assert(!h->removed_p);
+
+    h->removed_p = TRUE;
+
+    if (h->type == reactor_handle_fd) {
+#if defined(BITD_HAVE_SYS_EPOLL_H)
+	loop_fd_ctl(h, EPOLL_CTL_DEL);
+#endif
+    } else {
+	bitd_timer_list_remove(h->timer);
+    }
+
+    h->next->prev = h->prev;
+    h->prev->next = h->next;
+    l->n_handles--;
+
+    h->next = l->zombies;
+    h->prev = NULL;
+    l->zombies = h;
+}
@@ -0,0 +1,825 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Caching asynchronous name resolver
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/resolve.h"
+#include "bitd/lambda.h"
+
+#if defined(BITD_HAVE_NETDB_H)
+# include <netdb.h>
+#endif
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* Number of hash buckets. Must be a power of two. */
+#define RESOLVE_BUCKETS 256
+
+/* Resolved entries are refreshed after this percentage of their ttl */
+#define RESOLVE_REFRESH_PCT 80
+
+/* Returned for requests cancelled by the resolver deinit */
+#ifndef EAI_AGAIN
+# define EAI_AGAIN -1
+#endif
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* Request states */
+typedef enum {
+    resolve_req_pending,
+    resolve_req_completing,    /* Callback being called */
+    resolve_req_done
+} resolve_req_state_t;
+
+struct resolve_entry_s;
+
+struct bitd_resolve_req_s {
+    struct bitd_resolve_req_s *next;  /* Entry waiter list */
+    struct bitd_resolve_req_s *prev;
+    struct resolve_entry_s *e;        /* The entry, while pending */
+    bitd_resolve_callback_t *cb;
+    void *cookie;
+    bitd_event done_ev;               /* Completion event, or NULL */
+    resolve_req_state_t state;
+    bitd_boolean free_p;              /* Freed while completing */
+    int ret;
+    struct sockaddr_storage sa;
+};
+
+struct resolve_entry_s {
+    struct resolve_entry_s *next;     /* Bucket chain */
+    char *hostport;
+    bitd_uint32 hash;
+    bitd_boolean resolved_p;          /* The ret and sa are set */
+    bitd_boolean resolving_p;         /* A resolver thread owns the entry */
+    int ret;
+    struct sockaddr_storage sa;
+    bitd_uint64 expire_nsec;
+    bitd_uint64 refresh_nsec;
+    struct bitd_resolve_req_s *waiters;
+};
+
+struct resolve_s {
+    bitd_mutex lock;
+    bitd_lambda_handle lambda;
+    bitd_boolean stopping_p;
+    bitd_uint32 ttl_msec;
+    bitd_uint32 neg_ttl_msec;
+    bitd_resolve_stats_t stats;
+    struct resolve_entry_s *buckets[RESOLVE_BUCKETS];
+};
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+static void resolve_task(void *cookie, bitd_boolean *stopping_p);
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+/* The global resolver control block pointer */
+static struct resolve_s *g_resolve;
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        resolve_hash
+ *============================================================================
+ * Description:     FNV-1a hash of the hostport
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint32 resolve_hash(char *hostport) {
+    bitd_uint32 hash = 2166136261U;
+
+    while (*hostport) {
+	hash ^= (unsigned char)*hostport++;
+	hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+/*
+ *============================================================================
+ *                        entry_idle_p
+ *============================================================================
+ * Description:     Can the entry be freed? Called with the lock held.
+ * Parameters:
+ * Returns:
+ */
+static bitd_boolean entry_idle_p(struct resolve_entry_s *e) {
+    return !e->resolving_p && !e->waiters;
+}
+
+
+/*
+ *============================================================================
+ *                        entry_free
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void entry_free(struct resolve_entry_s *e) {
+    free(e->hostport);
+    free(e);
+}
+
+
+/*
+ *============================================================================
+ *                        entry_get
+ *============================================================================
+ * Description:     Find the entry, or create it. Expired idle entries in
+ *     the same bucket are evicted. Called with the lock held.
+ * Parameters:
+ * Returns:
+ */
+static struct resolve_entry_s *entry_get(char *hostport,
+					 bitd_uint64 now,
+					 bitd_boolean create_p) {
+    struct resolve_entry_s **pe, *e, *found = NULL;
+    bitd_uint32 hash;
+
+    hash = resolve_hash(hostport);
+
+    pe = &g_resolve->buckets[hash & (RESOLVE_BUCKETS - 1)];
+    while ((e = *pe)) {
+	if (e->hash == hash && !strcmp(e->hostport, hostport)) {
+	    found = e;
+	} else if ((!e->resolved_p || now >= e->expire_nsec) &&
+		   entry_idle_p(e)) {
+	    /* Evict */
+	    *pe = e->next;
+	    entry_free(e);
+	    g_resolve->stats.evictions++;
+	    g_resolve->stats.entries--;
+	    continue;
+	}
+	pe = &e->next;
+    }
+
+    if (!found && create_p) {
+	found = calloc(1, sizeof(*found));
+	found->hostport = strdup(hostport);
+	found->hash = hash;
+	found->next = g_resolve->buckets[hash & (RESOLVE_BUCKETS - 1)];
+	g_resolve->buckets[hash & (RESOLVE_BUCKETS - 1)] = found;
+	g_resolve->stats.entries++;
+    }
+
+    return found;
+}
+
+
+/*
+ *============================================================================
+ *                        entry_resolve
+ *============================================================================
+ * Description:     Start resolving the entry on a resolver thread.
+ *     Called with the lock held.
+ * Parameters:
+ * Returns:         FALSE if the resolution could not be started
+ */
+static bitd_boolean entry_resolve(struct resolve_entry_s *e) {
+
+    if (e->resolving_p) {
+	return TRUE;
+    }
+
+    e->resolving_p = TRUE;
+    if (g_resolve->stopping_p ||
+	!bitd_lambda_exec_task(g_resolve->lambda, &resolve_task, e)) {
+	e->resolving_p = FALSE;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        entry_lookup
+ *============================================================================
+ * Description:     Look up an unexpired entry, starting a background
+ *     refresh if the entry is due for one. Called with the lock held.
+ * Parameters:
+ * Returns:         TRUE if ret and sa are set from the cache
+ */
+static bitd_boolean entry_lookup(char *hostport, bitd_uint64 now,
+				 int *ret, struct sockaddr_storage *sa) {
+    struct resolve_entry_s *e;
+
+    g_resolve->stats.lookups++;
+
+    e = entry_get(hostport, now, FALSE);
+    if (!e || !e->resolved_p || now >= e->expire_nsec) {
+	return FALSE;
+    }
+
+    if (e->ret) {
+	g_resolve->stats.negative_hits++;
+    } else {
+	g_resolve->stats.hits++;
+
+	if (now >= e->refresh_nsec && !e->resolving_p &&
+	    entry_resolve(e)) {
+	    g_resolve->stats.prefetches++;
+	}
+    }
+
+    *ret = e->ret;
+    memcpy(sa, &e->sa, sizeof(*sa));
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        req_complete
+ *============================================================================
+ * Description:     Complete a list of requests, already unlinked from
+ *     their entry and marked as completing. Called without the lock.
+ * Parameters:
+ * Returns:
+ */
+static void req_complete(struct bitd_resolve_req_s *r) {
+    struct bitd_resolve_req_s *next;
+
+    for (; r; r = next) {
+	next = r->next;
+
+	if (r->cb) {
+	    r->cb(r, r->ret, &r->sa, r->cookie);
+	}
+
+	bitd_mutex_lock(g_resolve->lock);
+	r->state = resolve_req_done;
+	if (r->done_ev) {
+	    bitd_event_set(r->done_ev);
+	}
+	if (r->free_p) {
+	    if (r->done_ev) {
+		bitd_event_destroy(r->done_ev);
+	    }
+	    free(r);
+	}
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        req_detach_waiters
+ *============================================================================
+ * Description:     Unlink the entry waiters, copying the entry result into
+ *     them. Called with the lock held.
+ * Parameters:
+ * Returns:         The list of waiters to pass to req_complete()
+ */
+static struct bitd_resolve_req_s *req_detach_waiters(struct resolve_entry_s *e,
+						    int ret) {
+    struct bitd_resolve_req_s *waiters, *r;
+
+    waiters = e->waiters;
+    e->waiters = NULL;
+
+    for (r = waiters; r; r = r->next) {
+	r->e = NULL;
+	r->prev = NULL;
+	r->state = resolve_req_completing;
+	r->ret = ret;
+	if (!ret) {
+	    memcpy(&r->sa, &e->sa, sizeof(r->sa));
+	}
+    }
+
+    return waiters;
+}
+
+
+/*
+ *============================================================================
+ *                        resolve_task
+ *============================================================================
+ * Description:     Resolve an entry, on a resolver thread
+ * Parameters:
+ * Returns:
+ */
+static void resolve_task(void *cookie, bitd_boolean *stopping_p) {
+    struct resolve_entry_s *e = (struct resolve_entry_s *)cookie;
+    struct bitd_resolve_req_s *waiters;
+    struct sockaddr_storage sa;
+    bitd_uint64 now;
+    int ret = EAI_AGAIN;
+
+    memset(&sa, 0, sizeof(sa));
+
+    if (!*stopping_p) {
+	ret = bitd_resolve_hostport(&sa, sizeof(sa), e->hostport);
+    }
+
+    now = bitd_get_time_nsec_coarse();
+
+    bitd_mutex_lock(g_resolve->lock);
+
+    if (!*stopping_p) {
+	g_resolve->stats.resolves++;
+	if (ret) {
+	    g_resolve->stats.failures++;
+	}
+
+	if (!ret || !e->resolved_p || e->ret || now >= e->expire_nsec) {
+	    e->resolved_p = TRUE;
+	    e->ret = ret;
+	    memcpy(&e->sa, &sa, sizeof(e->sa));
+	    e->expire_nsec = now + 1000000ULL *
+		(ret ? g_resolve->neg_ttl_msec : g_resolve->ttl_msec);
+	    e->refresh_nsec = now + 1000000ULL *
+		g_resolve->ttl_msec / 100 * RESOLVE_REFRESH_PCT;
+	} else {
+	    /* A failed refresh. Keep the resolved address until it expires. */
+	}
+	ret = e->ret;
+    }
+
+    e->resolving_p = FALSE;
+    waiters = req_detach_waiters(e, ret);
+
+    bitd_mutex_unlock(g_resolve->lock);
+
+    req_complete(waiters);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_init
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_boolean bitd_resolve_init(void) {
+
+    if (g_resolve) {
+	return TRUE;
+    }
+
+    g_resolve = calloc(1, sizeof(*g_resolve));
+    g_resolve->lock = bitd_mutex_create();
+    g_resolve->ttl_msec = BITD_RESOLVE_TTL_DEF;
+    g_resolve->neg_ttl_msec = BITD_RESOLVE_NEG_TTL_DEF;
+
+    g_resolve->lambda = bitd_lambda_init("resolver");
+    bitd_lambda_set_thread_max(g_resolve->lambda, BITD_RESOLVE_THREADS_DEF);
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_deinit
+ *============================================================================
+ * Description:     Stop the resolver threads, and free the cache
+ * Parameters:
+ * Returns:
+ */
+void bitd_resolve_deinit(void) {
+    struct resolve_entry_s *e;
+    int i;
+
+    if (!g_resolve) {
+	return;
+    }
+
+    bitd_mutex_lock(g_resolve->lock);
+    g_resolve->stopping_p = TRUE;
+    bitd_mutex_unlock(g_resolve->lock);
+
+    /* Waits for the running resolutions. The queued ones complete
+       with EAI_AGAIN. */
+    bitd_lambda_deinit(g_resolve->lambda);
+
+    for (i = 0; i < RESOLVE_BUCKETS; i++) {
+	while ((e = g_resolve->buckets[i])) {
+	    g_resolve->buckets[i] = e->next;
+	    bitd_assert(entry_idle_p(e));
+	    entry_free(e);
+	}
+    }
+
+    bitd_mutex_destroy(g_resolve->lock);
+    free(g_resolve);
+    g_resolve = NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_set_ttl
+ *============================================================================
+ * Description:     Set the ttl of entries resolved from now on
+ * Parameters:
+ * Returns:
+ */
+void bitd_resolve_set_ttl(bitd_uint32 ttl_msec, bitd_uint32 neg_ttl_msec) {
+
+    if (g_resolve) {
+	bitd_mutex_lock(g_resolve->lock);
+	g_resolve->ttl_msec = ttl_msec;
+	g_resolve->neg_ttl_msec = neg_ttl_msec;
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        resolve_req_start
+ *============================================================================
+ * Description:     Start a request. On a cache hit, the request completes
+ *     before this function returns.
+ * Parameters:
+ *     hostport - the address & port in host:port or [host]:port format
+ *     cb - the completion callback, or NULL
+ *     cookie - passed to the callback
+ *     done_ev - the completion event, or NULL
+ *     missed_p - the caller already missed the cache
+ * Returns:  The request, or NULL if the callback freed the request
+ */
+static bitd_resolve_req resolve_req_start(char *hostport,
+					  bitd_resolve_callback_t *cb,
+					  void *cookie,
+					  bitd_event done_ev,
+					  bitd_boolean missed_p) {
+    struct bitd_resolve_req_s *r;
+    struct resolve_entry_s *e;
+    bitd_boolean done_p = FALSE;
+    bitd_uint64 now;
+
+    r = calloc(1, sizeof(*r));
+    r->cb = cb;
+    r->cookie = cookie;
+    r->done_ev = done_ev;
+
+    now = bitd_get_time_nsec_coarse();
+
+    bitd_mutex_lock(g_resolve->lock);
+
+    if (!missed_p && entry_lookup(hostport, now, &r->ret, &r->sa)) {
+	/* Complete from the cache */
+	r->state = resolve_req_completing;
+	done_p = TRUE;
+    } else {
+	g_resolve->stats.misses++;
+
+	e = entry_get(hostport, now, TRUE);
+
+	/* Wait on the entry */
+	r->e = e;
+	r->state = resolve_req_pending;
+	r->next = e->waiters;
+	if (e->waiters) {
+	    e->waiters->prev = r;
+	}
+	e->waiters = r;
+
+	if (e->resolving_p) {
+	    g_resolve->stats.coalesced++;
+	} else if (!entry_resolve(e)) {
+	    /* The entry is not resolving, so r is the only waiter */
+	    req_detach_waiters(e, EAI_AGAIN);
+	    done_p = TRUE;
+	}
+    }
+
+    bitd_mutex_unlock(g_resolve->lock);
+
+    if (done_p) {
+	if (r->cb) {
+	    r->cb(r, r->ret, &r->sa, r->cookie);
+	}
+
+	bitd_mutex_lock(g_resolve->lock);
+	r->state = resolve_req_done;
+	if (r->done_ev) {
+	    bitd_event_set(r->done_ev);
+	}
+	if (r->free_p) {
+	    /* The callback freed the request */
+	    if (r->done_ev) {
+		bitd_event_destroy(r->done_ev);
+	    }
+	    free(r);
+	    r = NULL;
+	}
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+
+    return r;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_hostport_async
+ *============================================================================
+ * Description:     Resolve hostport asynchronously. On a cache hit, the
+ *     callback is called before this function returns.
+ * Parameters:
+ *     hostport - the address & port in host:port or [host]:port format
+ *     cb - the completion callback, or NULL
+ *     cookie - passed to the callback
+ * Returns:  The request, or NULL if the resolver is not initialized or
+ *     the callback freed the request
+ */
+bitd_resolve_req bitd_resolve_hostport_async(char *hostport,
+					     bitd_resolve_callback_t *cb,
+					     void *cookie) {
+
+    if (!g_resolve || !hostport) {
+	return NULL;
+    }
+
+    return resolve_req_start(hostport, cb, cookie, NULL, FALSE);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_req_fd
+ *============================================================================
+ * Description:     Get the request pollable file descriptor
+ * Parameters:
+ * Returns:
+ */
+bitd_socket_t bitd_resolve_req_fd(bitd_resolve_req r) {
+    bitd_socket_t fd = BITD_INVALID_SOCKID;
+
+    if (!r) {
+	return fd;
+    }
+
+    if (g_resolve) {
+	bitd_mutex_lock(g_resolve->lock);
+    }
+    if (!r->done_ev) {
+	r->done_ev = bitd_event_create(BITD_EVENT_FLAG_POLL);
+	if (r->state == resolve_req_done) {
+	    bitd_event_set(r->done_ev);
+	}
+    }
+    fd = bitd_event_to_fd(r->done_ev);
+    if (g_resolve) {
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+
+    return fd;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_req_result
+ *============================================================================
+ * Description:     Get the request result
+ * Parameters:
+ *     r - the request
+ *     ret [OUT] - 0 on success, else the error as returned by
+ *         bitd_resolve_hostport()
+ *     sa [OUT] - the resolved address, if ret is 0. May be NULL.
+ *     salen - the size of sa
+ * Returns:  FALSE if the request is still pending
+ */
+bitd_boolean bitd_resolve_req_result(bitd_resolve_req r, int *ret,
+				     struct sockaddr_storage *sa, int salen) {
+    bitd_boolean done_p;
+
+    if (!r) {
+	return FALSE;
+    }
+
+    if (g_resolve) {
+	bitd_mutex_lock(g_resolve->lock);
+    }
+    done_p = (r->state != resolve_req_pending);
+    if (g_resolve) {
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+
+    if (!done_p) {
+	return FALSE;
+    }
+
+    if (ret) {
+	*ret = r->ret;
+    }
+    if (sa && !r->ret) {
+	if (salen < bitd_sockaddrlen(&r->sa)) {
+	    /* Passed-in address is too short */
+	    if (ret) {
+		*ret = -1;
+	    }
+	} else {
+	    memcpy(sa, &r->sa, bitd_sockaddrlen(&r->sa));
+	}
+    }
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_req_free
+ *============================================================================
+ * Description:     Free or cancel a request
+ * Parameters:
+ * Returns:
+ */
+void bitd_resolve_req_free(bitd_resolve_req r) {
+    struct resolve_entry_s *e;
+
+    if (!r) {
+	return;
+    }
+
+    if (g_resolve) {
+	bitd_mutex_lock(g_resolve->lock);
+
+	switch (r->state) {
+	case resolve_req_pending:
+	    /* Cancel - unlink from the entry waiters */
+	    e = r->e;
+	    if (r->prev) {
+		r->prev->next = r->next;
+	    } else {
+		e->waiters = r->next;
+	    }
+	    if (r->next) {
+		r->next->prev = r->prev;
+	    }
+	    break;
+	case resolve_req_completing:
+	    /* Freed by req_complete() once the callback returns */
+	    r->free_p = TRUE;
+	    bitd_mutex_unlock(g_resolve->lock);
+	    return;
+	default:
+	    break;
+	}
+
+	bitd_mutex_unlock(g_resolve->lock);
+    }
+
+    if (r->done_ev) {
+	bitd_event_destroy(r->done_ev);
+    }
+    free(r);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_hostport_cached
+ *============================================================================
+ * Description:     Resolve hostport in host:port or [host]:port format
+ *     through the resolver cache, blocking until resolution completes
+ * Parameters:
+ *     sa [OUT] - the resolved address
+ *     salen - the size of the allocate sa structure
+ *     hostport - the input address & port in host:port or [host]:port format
+ * Returns:
+ *     0 on success, non-zero on error. Use bitd_gai_strerror() to get a string
+ *         explanation of the return code error.
+ */
+int bitd_resolve_hostport_cached(struct sockaddr_storage *sa, int salen,
+				 char *hostport) {
+    struct sockaddr_storage sa1;
+    bitd_resolve_req r;
+    bitd_boolean hit_p;
+    int ret = -1;
+
+    if (!sa || !salen || !hostport) {
+	return -1;
+    }
+
+    if (!g_resolve) {
+	return bitd_resolve_hostport(sa, salen, hostport);
+    }
+
+    /* Fast path - no request allocation on a cache hit */
+    bitd_mutex_lock(g_resolve->lock);
+    hit_p = entry_lookup(hostport, bitd_get_time_nsec_coarse(), &ret, &sa1);
+    bitd_mutex_unlock(g_resolve->lock);
+
+    if (!hit_p) {
+	/* The request owns the event, and destroys it when freed */
+	r = resolve_req_start(hostport, NULL, NULL,
+			      bitd_event_create(0), TRUE);
+	while (!bitd_resolve_req_result(r, &ret, &sa1, sizeof(sa1))) {
+	    bitd_event_wait(r->done_ev, BITD_FOREVER);
+	}
+	bitd_resolve_req_free(r);
+    }
+
+    if (!ret) {
+	if (salen < bitd_sockaddrlen(&sa1)) {
+	    /* Passed-in address is too short */
+	    ret = -1;
+	} else {
+	    memcpy(sa, &sa1, bitd_sockaddrlen(&sa1));
+	}
+    }
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_get_stats
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void bitd_resolve_get_stats(bitd_resolve_stats_t *stats) {
+
+    if (!stats) {
+	return;
+    }
+
+    if (!g_resolve) {
+	memset(stats, 0, sizeof(*stats));
+	return;
+    }
+
+    bitd_mutex_lock(g_resolve->lock);
+    memcpy(stats, &g_resolve->stats, sizeof(*stats));
+    bitd_mutex_unlock(g_resolve->lock);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_resolve_flush
+ *============================================================================
+ * Description:     Drop the cache entries not being resolved
+ * Parameters:
+ * Returns:
+ */
+void bitd_resolve_flush(void) {
+    struct resolve_entry_s **pe, *e;
+    int i;
+
+    if (!g_resolve) {
+	return;
+    }
+
+    bitd_mutex_lock(g_resolve->lock);
+    for (i = 0; i < RESOLVE_BUCKETS; i++) {
+	pe = &g_resolve->buckets[i];
+	while ((e = *pe)) {
+	    if (entry_idle_p(e)) {
+		*pe = e->next;
+		entry_free(e);
+		g_resolve->stats.entries--;
+	    } else {
+		pe = &e->next;
+	    }
+	}
+    }
+    bitd_mutex_unlock(g_resolve->lock);
+}
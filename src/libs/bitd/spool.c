@@ -0,0 +1,881 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Durable on-disk message spool
+ *
+ * Copyright (C) 2018 Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/spool.h"
+#include "bitd/log.h"
+
+#if !defined(_WIN32)
+# include <fcntl.h>
+# include <dirent.h>
+# include <sys/mman.h>
+#endif
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+#define SPOOL_SEG_MAGIC 0x53504f4c   /* Segment header magic */
+#define SPOOL_SEG_VERSION 1
+#define SPOOL_REC_COMMIT 0x52454321  /* Marks a completely written record */
+#define SPOOL_SEG_SUFFIX ".seg"
+#define SPOOL_SEGMENT_SIZE_MIN 4096
+#define SPOOL_FREE_SEGS_MAX 2        /* Recycled segments kept for reuse */
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+#define SPOOL_ALIGN(x) (((x) + 7) & ~7)
+
+#define SEG_HDR(seg) ((struct spool_seg_hdr *)(seg)->base)
+#define SEG_REC(seg, off) ((struct spool_rec_hdr *)((seg)->base + (off)))
+#define SEG_HDR_SIZE SPOOL_ALIGN(sizeof(struct spool_seg_hdr))
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* The segment file header */
+struct spool_seg_hdr {
+    bitd_uint32 magic;
+    bitd_uint32 version;
+    bitd_uint32 seq;          /* Segment sequence number */
+    bitd_uint32 read_off;     /* Persistent read cursor */
+};
+
+/* The record header. A segment is recycled without being cleared, so
+   records left over from its previous use are told apart by their
+   sequence number. */
+struct spool_rec_hdr {
+    bitd_uint32 size;         /* Payload size */
+    bitd_uint32 seq;          /* Sequence number of the owning segment */
+    bitd_uint32 crc;          /* Payload crc32 */
+    bitd_uint32 commit;       /* SPOOL_REC_COMMIT, written last */
+};
+
+/* The segment control block */
+struct spool_seg {
+    struct spool_seg *next;
+    bitd_uint32 seq;
+    bitd_uint32 size;         /* Segment file size */
+    bitd_uint32 write_off;    /* End of the committed records */
+    int fd;
+    char *base;               /* The mapped segment file */
+};
+
+/* The spool control block */
+struct bitd_spool_s {
+    bitd_mutex lock;
+    char *dir;
+    bitd_uint32 segment_size;
+    bitd_uint32 segments_max;
+    bitd_uint32 flags;
+    struct spool_seg *head;      /* Oldest segment, read side */
+    struct spool_seg *tail;      /* Newest segment, write side */
+    bitd_uint32 n_segs;
+    struct spool_seg *free_segs; /* Recycled segments */
+    bitd_uint32 n_free_segs;
+    bitd_uint32 next_seq;
+    bitd_uint32 count;           /* Unconsumed record count */
+    bitd_uint64 size;            /* Unconsumed payload size */
+    struct spool_seg *pending_seg; /* End of the last read, pending commit */
+    bitd_uint32 pending_off;
+    bitd_uint32 pending_count;
+    bitd_uint64 pending_size;
+    ttlog_keyid log_keyid;
+};
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+#if !defined(_WIN32)
+static bitd_uint32 s_crc_table[256];
+static bitd_boolean s_crc_table_init_p;
+#endif
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+#if !defined(_WIN32)
+
+/*
+ *============================================================================
+ *                        crc_table_init
+ *============================================================================
+ * Description:     Initialize the crc32 lookup table
+ * Parameters:
+ * Returns:
+ */
+static void crc_table_init(void) {
+    bitd_uint32 c;
+    int i, j;
+
+    if (s_crc_table_init_p) {
+	return;
+    }
+
+    for (i = 0; i < 256; i++) {
+	c = i;
+	for (j = 0; j < 8; j++) {
+	    c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+	}
+	s_crc_table[i] = c;
+    }
+
+    s_crc_table_init_p = TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        spool_crc32
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint32 spool_crc32(char *buf, bitd_uint32 size) {
+    register bitd_uint32 c = 0xffffffff;
+    register bitd_uint8 *p = (bitd_uint8 *)buf;
+
+    while (size--) {
+	c = s_crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+
+    return c ^ 0xffffffff;
+}
+
+
+/*
+ *============================================================================
+ *                        spool_mkdir
+ *============================================================================
+ * Description:     Create a directory and its parents
+ * Parameters:
+ * Returns:     0 on success, -1 on failure
+ */
+static int spool_mkdir(char *dir) {
+    char *path = strdup(dir), *c;
+    int ret = 0;
+
+    for (c = path + 1; ; c++) {
+	if (*c == '/' || !*c) {
+	    char sep = *c;
+
+	    *c = 0;
+	    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		ret = -1;
+		break;
+	    }
+	    *c = sep;
+	}
+	if (!*c) {
+	    break;
+	}
+    }
+
+    free(path);
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        seg_path
+ *============================================================================
+ * Description:     Returns the heap-allocated segment file path
+ * Parameters:
+ * Returns:
+ */
+static char *seg_path(bitd_spool s, bitd_uint32 seq) {
+    char *path;
+
+    path = malloc(strlen(s->dir) + 32);
+    sprintf(path, "%s/%08x%s", s->dir, seq, SPOOL_SEG_SUFFIX);
+
+    return path;
+}
+
+
+/*
+ *============================================================================
+ *                        seg_sync
+ *============================================================================
+ * Description:     Sync a byte range of the segment to disk
+ * Parameters:
+ * Returns:
+ */
+static void seg_sync(struct spool_seg *seg, bitd_uint32 off, bitd_uint32 len,
+		     int flags) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    bitd_uint32 start = off - (off % page_size);
+
+    msync(seg->base + start, off + len - start, flags);
+}
+
+
+/*
+ *============================================================================
+ *                        seg_free
+ *============================================================================
+ * Description:     Unmap and close a segment, and optionally remove its file
+ * Parameters:
+ * Returns:
+ */
+static void seg_free(bitd_spool s, struct spool_seg *seg,
+		     bitd_boolean unlink_p) {
+    char *path;
+
+    if (seg->base) {
+	munmap(seg->base, seg->size);
+    }
+    if (seg->fd >= 0) {
+	close(seg->fd);
+    }
+    if (unlink_p) {
+	path = seg_path(s, seg->seq);
+	unlink(path);
+	free(path);
+    }
+    free(seg);
+}
+
+
+/*
+ *============================================================================
+ *                        seg_init
+ *============================================================================
+ * Description:     Initialize the segment header for a new sequence number
+ * Parameters:
+ * Returns:
+ */
+static void seg_init(bitd_spool s, struct spool_seg *seg, bitd_uint32 seq) {
+
+    seg->seq = seq;
+    seg->write_off = SEG_HDR_SIZE;
+
+    SEG_HDR(seg)->magic = SPOOL_SEG_MAGIC;
+    SEG_HDR(seg)->version = SPOOL_SEG_VERSION;
+    SEG_HDR(seg)->seq = seq;
+    SEG_HDR(seg)->read_off = SEG_HDR_SIZE;
+
+    if (s->flags & BITD_SPOOL_FLAG_SYNC) {
+	seg_sync(seg, 0, SEG_HDR_SIZE, MS_SYNC);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        seg_create
+ *============================================================================
+ * Description:     Create a new segment, reusing a recycled segment if
+ *     possible
+ * Parameters:
+ * Returns:
+ */
+static struct spool_seg *seg_create(bitd_spool s) {
+    struct spool_seg *seg;
+    char *path, *old_path;
+    bitd_uint32 seq = s->next_seq++;
+
+    path = seg_path(s, seq);
+
+    /* Reuse a recycled segment of the right size */
+    while ((seg = s->free_segs)) {
+	s->free_segs = seg->next;
+	s->n_free_segs--;
+	seg->next = NULL;
+
+	if (seg->size == s->segment_size) {
+	    old_path = seg_path(s, seg->seq);
+	    if (!rename(old_path, path)) {
+		free(old_path);
+		seg_init(s, seg, seq);
+		goto end;
+	    }
+	    free(old_path);
+	}
+	seg_free(s, seg, TRUE);
+    }
+
+    /* Create a new segment file */
+    seg = calloc(1, sizeof(*seg));
+    seg->size = s->segment_size;
+    seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (seg->fd < 0 || ftruncate(seg->fd, seg->size) < 0) {
+	goto err;
+    }
+
+    seg->base = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     seg->fd, 0);
+    if (seg->base == MAP_FAILED) {
+	seg->base = NULL;
+	goto err;
+    }
+
+    seg_init(s, seg, seq);
+
+ end:
+    free(path);
+    return seg;
+
+ err:
+    seg->seq = seq;
+    seg_free(s, seg, TRUE);
+    free(path);
+    return NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        seg_release
+ *============================================================================
+ * Description:     Release a consumed segment, keeping a few for reuse
+ * Parameters:
+ * Returns:
+ */
+static void seg_release(bitd_spool s, struct spool_seg *seg) {
+
+    if (s->n_free_segs < SPOOL_FREE_SEGS_MAX) {
+	seg->next = s->free_segs;
+	s->free_segs = seg;
+	s->n_free_segs++;
+    } else {
+	seg_free(s, seg, TRUE);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        seg_recover
+ *============================================================================
+ * Description:     Map a segment file left over by a previous spool owner,
+ *     and find its committed records. Scanning stops at the first record
+ *     that is incompletely written, corrupted, or left over from a
+ *     previous use of the segment.
+ * Parameters:
+ * Returns:     The segment, or NULL if the file isn't a valid segment
+ */
+static struct spool_seg *seg_recover(bitd_spool s, bitd_uint32 seq) {
+    struct spool_seg *seg;
+    struct spool_rec_hdr *r;
+    struct stat st;
+    char *path;
+    bitd_uint32 off, read_off;
+
+    path = seg_path(s, seq);
+
+    seg = calloc(1, sizeof(*seg));
+    seg->seq = seq;
+    seg->fd = open(path, O_RDWR);
+
+    if (seg->fd < 0 || fstat(seg->fd, &st) < 0) {
+	/* Possibly transient (EMFILE, EACCES): keep the file */
+	ttlog(log_level_warn, s->log_keyid,
+	      "Spool segment %s skipped: %s", path, strerror(errno));
+	goto err_skip;
+    }
+
+    if (st.st_size < SPOOL_SEGMENT_SIZE_MIN || st.st_size > 0x7fffffff) {
+	ttlog(log_level_warn, s->log_keyid,
+	      "Spool segment %s removed: bad size %lld", path,
+	      (long long)st.st_size);
+	goto err_unlink;
+    }
+
+    seg->size = (bitd_uint32)st.st_size;
+    seg->base = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     seg->fd, 0);
+    if (seg->base == MAP_FAILED) {
+	seg->base = NULL;
+	ttlog(log_level_warn, s->log_keyid,
+	      "Spool segment %s skipped: %s", path, strerror(errno));
+	goto err_skip;
+    }
+
+    if (SEG_HDR(seg)->magic != SPOOL_SEG_MAGIC ||
+	SEG_HDR(seg)->version != SPOOL_SEG_VERSION ||
+	SEG_HDR(seg)->seq != seq) {
+	ttlog(log_level_warn, s->log_keyid,
+	      "Spool segment %s removed: bad header", path);
+	goto err_unlink;
+    }
+    free(path);
+
+    /* Scan the committed records */
+    read_off = SEG_HDR(seg)->read_off;
+    off = SEG_HDR_SIZE;
+    while (off + sizeof(*r) <= seg->size) {
+	r = SEG_REC(seg, off);
+	if (r->commit != SPOOL_REC_COMMIT ||
+	    r->seq != seq ||
+	    r->size > seg->size - off - sizeof(*r) ||
+	    r->crc != spool_crc32((char *)(r + 1), r->size)) {
+	    break;
+	}
+
+	if (off >= read_off) {
+	    s->count++;
+	    s->size += r->size;
+	}
+	off += sizeof(*r) + SPOOL_ALIGN(r->size);
+    }
+    seg->write_off = off;
+
+    /* Sanitize the read cursor */
+    if (read_off < SEG_HDR_SIZE || read_off > seg->write_off) {
+	SEG_HDR(seg)->read_off = seg->write_off;
+    }
+
+    return seg;
+
+ err_unlink:
+    /* The segment was read, and is not a valid segment */
+    free(path);
+    seg_free(s, seg, TRUE);
+    return NULL;
+
+ err_skip:
+    free(path);
+    seg_free(s, seg, FALSE);
+    return NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        seq_compare
+ *============================================================================
+ * Description:     qsort() comparator for segment sequence numbers
+ * Parameters:
+ * Returns:
+ */
+static int seq_compare(const void *a, const void *b) {
+    bitd_uint32 seq_a = *(bitd_uint32 *)a, seq_b = *(bitd_uint32 *)b;
+
+    return seq_a < seq_b ? -1 : (seq_a > seq_b ? 1 : 0);
+}
+
+
+/*
+ *============================================================================
+ *                        spool_recover
+ *============================================================================
+ * Description:     Recover the segments found in the spool directory, in
+ *     sequence order
+ * Parameters:
+ * Returns:
+ */
+static void spool_recover(bitd_spool s) {
+    DIR *d;
+    struct dirent *de;
+    bitd_uint32 *seqs = NULL, seq;
+    int n_seqs = 0, n_seqs_allocated = 0, i;
+    char suffix[8];
+    struct spool_seg *seg;
+
+    d = opendir(s->dir);
+    if (!d) {
+	return;
+    }
+
+    while ((de = readdir(d))) {
+	if (strlen(de->d_name) != 8 + strlen(SPOOL_SEG_SUFFIX) ||
+	    sscanf(de->d_name, "%8x%7s", &seq, suffix) != 2 ||
+	    strcmp(suffix, SPOOL_SEG_SUFFIX)) {
+	    continue;
+	}
+	if (n_seqs == n_seqs_allocated) {
+	    n_seqs_allocated = n_seqs_allocated ? 2 * n_seqs_allocated : 16;
+	    seqs = realloc(seqs, n_seqs_allocated * sizeof(*seqs));
+	}
+	seqs[n_seqs++] = seq;
+    }
+    closedir(d);
+
+    if (!n_seqs) {
+	return;
+    }
+
+    qsort(seqs, n_seqs, sizeof(*seqs), seq_compare);
+
+    for (i = 0; i < n_seqs; i++) {
+	seg = seg_recover(s, seqs[i]);
+	if (!seg) {
+	    continue;
+	}
+
+	if (SEG_HDR(seg)->read_off == seg->write_off && i < n_seqs - 1) {
+	    /* Consumed, and not the last segment */
+	    seg_release(s, seg);
+	    continue;
+	}
+
+	if (s->tail) {
+	    s->tail->next = seg;
+	} else {
+	    s->head = seg;
+	}
+	s->tail = seg;
+	s->n_segs++;
+    }
+
+    /* New segments don't reuse the sequence of a skipped segment file */
+    s->next_seq = seqs[n_seqs - 1] + 1;
+
+    free(seqs);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_open
+ *============================================================================
+ * Description:     Open a spool in a directory, and recover its records
+ * Parameters:
+ *     dir - The spool directory. Created if it does not exist.
+ *     segment_size - The size of the segment files. If 0, the
+ *         default BITD_SPOOL_SEGMENT_SIZE_DEF is used.
+ *     size_quota - The max total size of the segment files
+ *     flags - BITD_SPOOL_FLAG_SYNC
+ * Returns:
+ */
+bitd_spool bitd_spool_open(char *dir,
+			   bitd_uint32 segment_size,
+			   bitd_uint64 size_quota,
+			   bitd_uint32 flags) {
+    bitd_spool s;
+
+    if (!dir || !dir[0] || spool_mkdir(dir) < 0) {
+	return NULL;
+    }
+
+    crc_table_init();
+
+    if (!segment_size) {
+	segment_size = BITD_SPOOL_SEGMENT_SIZE_DEF;
+    }
+    segment_size = MAX(segment_size, SPOOL_SEGMENT_SIZE_MIN);
+    segment_size = SPOOL_ALIGN(segment_size);
+
+    s = calloc(1, sizeof(*s));
+    s->lock = bitd_mutex_create();
+    s->dir = strdup(dir);
+    s->segment_size = segment_size;
+    s->segments_max = (bitd_uint32)MAX(size_quota / segment_size, 1);
+    s->flags = flags;
+    s->log_keyid = ttlog_register("bitd-spool");
+
+    spool_recover(s);
+
+    return s;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_close
+ *============================================================================
+ * Description:     Close the spool. Unconsumed records stay on disk.
+ * Parameters:
+ * Returns:
+ */
+void bitd_spool_close(bitd_spool s) {
+    struct spool_seg *seg;
+
+    if (!s) {
+	return;
+    }
+
+    while ((seg = s->head)) {
+	s->head = seg->next;
+	if (s->flags & BITD_SPOOL_FLAG_SYNC) {
+	    seg_sync(seg, 0, seg->write_off, MS_SYNC);
+	}
+	seg_free(s, seg, FALSE);
+    }
+    while ((seg = s->free_segs)) {
+	s->free_segs = seg->next;
+	seg_free(s, seg, FALSE);
+    }
+
+    ttlog_unregister(s->log_keyid);
+    bitd_mutex_destroy(s->lock);
+    free(s->dir);
+    free(s);
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_append
+ *============================================================================
+ * Description:     Append a record. The payload and the record header are
+ *     written before the commit word, so a crash can't leave behind a
+ *     record that looks committed but is incompletely written.
+ * Parameters:
+ * Returns:     FALSE if the record does not fit in a segment, or if the
+ *     spool is full
+ */
+bitd_boolean bitd_spool_append(bitd_spool s, char *buf, bitd_uint32 size) {
+    struct spool_seg *seg;
+    struct spool_rec_hdr *r;
+    bitd_uint32 rec_size = sizeof(*r) + SPOOL_ALIGN(size);
+    bitd_boolean ret = FALSE;
+
+    if (!s || rec_size > s->segment_size - SEG_HDR_SIZE) {
+	return FALSE;
+    }
+
+    bitd_mutex_lock(s->lock);
+
+    seg = s->tail;
+    if (!seg || seg->write_off + rec_size > seg->size) {
+	/* Need a new segment */
+	if (s->n_segs >= s->segments_max) {
+	    goto end;
+	}
+
+	seg = seg_create(s);
+	if (!seg) {
+	    goto end;
+	}
+
+	if (s->tail) {
+	    /* Start writing back the full segment */
+	    seg_sync(s->tail, 0, s->tail->write_off, MS_ASYNC);
+	    s->tail->next = seg;
+	} else {
+	    s->head = seg;
+	}
+	s->tail = seg;
+	s->n_segs++;
+    }
+
+    r = SEG_REC(seg, seg->write_off);
+    r->commit = 0;
+    memcpy(r + 1, buf, size);
+    r->size = size;
+    r->seq = seg->seq;
+    r->crc = spool_crc32(buf, size);
+    __sync_synchronize();
+    r->commit = SPOOL_REC_COMMIT;
+
+    if (s->flags & BITD_SPOOL_FLAG_SYNC) {
+	seg_sync(seg, seg->write_off, rec_size, MS_SYNC);
+    }
+
+    seg->write_off += rec_size;
+    s->count++;
+    s->size += size;
+
+    ret = TRUE;
+ end:
+    bitd_mutex_unlock(s->lock);
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_read
+ *============================================================================
+ * Description:     Read the oldest records into a message, without
+ *     consuming them
+ * Parameters:
+ * Returns:
+ */
+bitd_msg bitd_spool_read(bitd_spool s, bitd_uint32 max_size) {
+    struct spool_seg *seg, *end_seg = NULL;
+    struct spool_rec_hdr *r;
+    bitd_uint32 off, end_off = 0, count = 0;
+    bitd_uint64 size = 0;
+    bitd_msg msg = NULL;
+    char *p;
+
+    if (!s) {
+	return NULL;
+    }
+
+    bitd_mutex_lock(s->lock);
+
+    s->pending_seg = NULL;
+    s->pending_count = 0;
+    s->pending_size = 0;
+
+    /* Find the end of the read */
+    for (seg = s->head; seg; seg = seg->next) {
+	for (off = SEG_HDR(seg)->read_off; off < seg->write_off;
+	     off += sizeof(*r) + SPOOL_ALIGN(r->size)) {
+	    r = SEG_REC(seg, off);
+	    if (count && size + r->size > max_size) {
+		goto found;
+	    }
+	    count++;
+	    size += r->size;
+	    end_seg = seg;
+	    end_off = off + sizeof(*r) + SPOOL_ALIGN(r->size);
+	}
+    }
+
+ found:
+    if (!count) {
+	goto end;
+    }
+
+    /* Copy the records */
+    msg = bitd_msg_alloc(0, (bitd_uint32)size);
+    p = (char *)msg;
+    for (seg = s->head; seg; seg = seg->next) {
+	for (off = SEG_HDR(seg)->read_off;
+	     off < (seg == end_seg ? end_off : seg->write_off);
+	     off += sizeof(*r) + SPOOL_ALIGN(r->size)) {
+	    r = SEG_REC(seg, off);
+	    memcpy(p, r + 1, r->size);
+	    p += r->size;
+	}
+	if (seg == end_seg) {
+	    break;
+	}
+    }
+
+    s->pending_seg = end_seg;
+    s->pending_off = end_off;
+    s->pending_count = count;
+    s->pending_size = size;
+
+ end:
+    bitd_mutex_unlock(s->lock);
+
+    return msg;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_commit
+ *============================================================================
+ * Description:     Consume the records returned by the last read
+ * Parameters:
+ * Returns:
+ */
+void bitd_spool_commit(bitd_spool s) {
+    struct spool_seg *seg;
+    bitd_boolean done_p = FALSE;
+
+    if (!s) {
+	return;
+    }
+
+    bitd_mutex_lock(s->lock);
+
+    if (!s->pending_count) {
+	goto end;
+    }
+
+    while (!done_p && (seg = s->head)) {
+	if (seg == s->pending_seg) {
+	    SEG_HDR(seg)->read_off = s->pending_off;
+	    done_p = TRUE;
+	} else {
+	    SEG_HDR(seg)->read_off = seg->write_off;
+	}
+
+	if (s->flags & BITD_SPOOL_FLAG_SYNC) {
+	    seg_sync(seg, 0, SEG_HDR_SIZE, MS_SYNC);
+	}
+
+	if (SEG_HDR(seg)->read_off < seg->write_off || seg == s->tail) {
+	    /* The write segment is never recycled */
+	    break;
+	}
+
+	/* Recycle the consumed segment */
+	s->head = seg->next;
+	s->n_segs--;
+	seg_release(s, seg);
+    }
+
+    s->count -= s->pending_count;
+    s->size -= s->pending_size;
+
+    s->pending_seg = NULL;
+    s->pending_count = 0;
+    s->pending_size = 0;
+
+ end:
+    bitd_mutex_unlock(s->lock);
+}
+
+#else /* _WIN32 */
+
+bitd_spool bitd_spool_open(char *dir,
+			   bitd_uint32 segment_size,
+			   bitd_uint64 size_quota,
+			   bitd_uint32 flags) {
+    /* Not supported */
+    return NULL;
+}
+
+void bitd_spool_close(bitd_spool s) {
+}
+
+bitd_boolean bitd_spool_append(bitd_spool s, char *buf, bitd_uint32 size) {
+    return FALSE;
+}
+
+bitd_msg bitd_spool_read(bitd_spool s, bitd_uint32 max_size) {
+    return NULL;
+}
+
+void bitd_spool_commit(bitd_spool s) {
+}
+
+#endif /* _WIN32 */
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_count
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_uint32 bitd_spool_count(bitd_spool s) {
+    return s ? s->count : 0;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_spool_size
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_uint64 bitd_spool_size(bitd_spool s) {
+    return s ? s->size : 0;
+}
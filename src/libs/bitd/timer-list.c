@@ -209,7 +209,7 @@ void bitd_timer_list_add_nsec(bitd_timer_list l,
 			      bitd_timer_expired_callback *expiration_callback,
 			      void *expiration_cookie) {
     bitd_timer t1;
-    bitd_uint64 current_time = bitd_get_time_nsec();
+    bitd_uint64 current_time = bitd_get_time_nsec_fast();
 
     bitd_printf("%s() tmo_nsec %llu\n", __FUNCTION__, tmo_nsec);
     
@@ -328,8 +328,8 @@ void bitd_timer_list_tick(bitd_timer_list l) {
     bitd_uint64 current_time;
     int ticks = 0;
     
-    /* Get current time */
-    current_time = bitd_get_time_nsec();
+    /* Get current time, cached for the event loop iteration */
+    current_time = bitd_get_time_nsec_cached();
 
     bitd_printf("%s() current_time %llu\n", __FUNCTION__, current_time);
 
@@ -382,7 +382,7 @@ bitd_uint32 bitd_timer_list_get_timeout_msec(bitd_timer_list l) {
     bitd_uint32 tmo_msec;
 
     /* Compute the current time */
-    current_time = bitd_get_time_nsec();
+    current_time = bitd_get_time_nsec_fast();
 
     bitd_printf("%s() current_time %llu\n", __FUNCTION__, current_time);
 
@@ -420,6 +420,48 @@ bitd_uint32 bitd_timer_list_get_timeout_msec(bitd_timer_list l) {
 } 
 
 
+/*
+ *============================================================================
+ *                        bitd_timer_list_get_timeout_nsec
+ *============================================================================
+ * Description:     Returns the time until the next expiration in nsecs, 
+ *     with no rounding. 
+ * Parameters:    
+ *     l - the timer list
+ * Returns:  
+ *    The next expiration time in nsecs, zero if a timer has expired, or
+ *    BITD_FOREVER_NSEC if no next expiration.
+ */
+bitd_uint64 bitd_timer_list_get_timeout_nsec(bitd_timer_list l) {
+    bitd_uint64 ret = BITD_FOREVER_NSEC;
+    bitd_timer t;
+    bitd_uint64 current_time;
+
+    /* Compute the current time */
+    current_time = bitd_get_time_nsec_fast();
+
+    bitd_mutex_lock(l->lock);    
+
+    /* Get the list head */
+    t = l->head;
+
+    /* Return the next expiration */
+    if (t != TIMER_LIST_HEAD(l)) {
+	bitd_assert(t->next && t->prev);
+
+        if (current_time >= t->tmo_nsec) {
+            ret = 0;
+        } else {
+            ret = t->tmo_nsec - current_time;
+        }
+    }
+
+    bitd_mutex_unlock(l->lock);
+
+    return ret;
+} 
+
+
 /*
  *============================================================================
  *                        bitd_timer_list_set_ticks_max
@@ -12,6 +12,7 @@
 /*****************************************************************************
  *                                INCLUDE FILES 
  *****************************************************************************/
+#define _GNU_SOURCE /* For sendmmsg() and recvmmsg() */
 #include "bitd/tstamp.h"
 
 #ifdef __linux__
@@ -68,6 +69,11 @@ struct scm_timestamping {
  *****************************************************************************/
 #define ts_printf if (0) printf
 
+/* Datagrams per sendmmsg()/recvmmsg() call. The message headers are on 
+   the stack, which is small on some threads. */
+#define TS_MMSG_BATCH 16
+#define TS_RX_CTRL_SIZE 128 /* Control buffer for a rx timestamp */
+#define TS_TX_CTRL_SIZE 256 /* Control buffer for a tx timestamp */
 
 /*****************************************************************************
  *                                  TYPES
@@ -956,6 +962,236 @@ int ts_recvfrom(ts_socket_t s, void *buf, int len, int flags,
     return ret;
 } 
 
+/*
+ *============================================================================
+ *                        ts_sendmmsg
+ *============================================================================
+ * Description:     Send the datagrams in batches of up to TS_MMSG_BATCH
+ *     per system call
+ * Parameters:
+ * Returns:
+ */
+int ts_sendmmsg(ts_socket_t s, ts_mmsg_t *msgs, int n, int flags) {
+    int ret, n_sent = 0, batch, i;
+    int len[TS_MMSG_BATCH];
+    bitd_uint64 current_time;
+    ts_mmsg_t *m;
+#ifdef BITD_HAVE_SENDMMSG
+    struct mmsghdr mmsg[TS_MMSG_BATCH];
+    struct iovec entry[TS_MMSG_BATCH];
+#endif
+
+    if (!s || s->sock == BITD_INVALID_SOCKID || !msgs || n < 0) {
+        return -1;
+    }
+
+    while (n_sent < n) {
+        batch = MIN(n - n_sent, TS_MMSG_BATCH);
+
+        /* Remember the current time */
+        current_time = bitd_get_time_nsec();
+
+#ifdef BITD_HAVE_SENDMMSG
+        memset(mmsg, 0, batch*sizeof(mmsg[0]));
+        for (i = 0; i < batch; i++) {
+            m = &msgs[n_sent + i];
+            entry[i].iov_base = m->buf;
+            entry[i].iov_len = m->len;
+            mmsg[i].msg_hdr.msg_iov = &entry[i];
+            mmsg[i].msg_hdr.msg_iovlen = 1;
+            mmsg[i].msg_hdr.msg_name = m->addr;
+            mmsg[i].msg_hdr.msg_namelen = m->addr ? m->addrlen : 0;
+        }
+
+        ret = sendmmsg(s->sock, mmsg, batch, flags);
+        for (i = 0; i < ret; i++) {
+            len[i] = mmsg[i].msg_len;
+        }
+#else
+        for (ret = 0; ret < batch; ret++) {
+            m = &msgs[n_sent + ret];
+            if (m->addr) {
+                len[ret] = bitd_sendto(s->sock, m->buf, m->len, flags,
+                                       m->addr, m->addrlen);
+            } else {
+                len[ret] = bitd_send(s->sock, m->buf, m->len, flags);
+            }
+            if (len[ret] < 0) {
+                break;
+            }
+        }
+        if (!ret) {
+            ret = -1;
+        }
+#endif
+        if (ret <= 0) {
+            break;
+        }
+
+        for (i = 0; i < ret; i++) {
+            m = &msgs[n_sent + i];
+
+            /* The software send timestamp, and the tx timestamp key */
+            m->ts.flags = TS_FLAG_SW|TS_FLAG_SND;
+            m->ts.tstamp = current_time;
+            if (s->sock_type == SOCK_STREAM) {
+                m->ts.seq = s->tx_nbytes + len[i] - 1;
+            } else {
+                m->ts.seq = s->tx_count;
+            }
+
+            if (s->timestamp_type == ts_timestamp_type_software &&
+                send_software_tstamp(s, len[i], current_time) < 0) {
+                return -1;
+            }
+
+            /* Remember actual number of transmits and transmit bytes */
+            s->tx_count++;
+            s->tx_nbytes += len[i];
+        }
+
+        n_sent += ret;
+        if (ret < batch) {
+            break;
+        }
+    }
+
+    if (!n_sent && n) {
+        return -1;
+    }
+
+    return n_sent;
+}
+
+
+/*
+ *============================================================================
+ *                        ts_recvmmsg
+ *============================================================================
+ * Description:     Receive the datagrams in batches of up to TS_MMSG_BATCH
+ *     per system call. Only the first batch may wait.
+ * Parameters:
+ * Returns:
+ */
+int ts_recvmmsg(ts_socket_t s, ts_mmsg_t *msgs, int n, int flags) {
+    int ret, n_recvd = 0, batch, i;
+    bitd_uint64 current_time;
+    ts_mmsg_t *m;
+#ifdef BITD_HAVE_RECVMMSG
+    struct mmsghdr mmsg[TS_MMSG_BATCH];
+    struct iovec entry[TS_MMSG_BATCH];
+    union {
+        struct cmsghdr cm;
+        char control[TS_RX_CTRL_SIZE];
+    } control[TS_MMSG_BATCH];
+    struct cmsghdr *cmsg;
+    struct timespec *stamp;
+#endif
+
+    if (!s || s->sock == BITD_INVALID_SOCKID || !msgs || n < 0) {
+        return -1;
+    }
+
+    while (n_recvd < n) {
+        batch = MIN(n - n_recvd, TS_MMSG_BATCH);
+
+#ifdef BITD_HAVE_RECVMMSG
+        memset(mmsg, 0, batch*sizeof(mmsg[0]));
+        for (i = 0; i < batch; i++) {
+            m = &msgs[n_recvd + i];
+            entry[i].iov_base = m->buf;
+            entry[i].iov_len = m->len;
+            mmsg[i].msg_hdr.msg_iov = &entry[i];
+            mmsg[i].msg_hdr.msg_iovlen = 1;
+            mmsg[i].msg_hdr.msg_name = m->addr;
+            mmsg[i].msg_hdr.msg_namelen = m->addr ? m->addrlen : 0;
+            if (s->timestamp_type == ts_timestamp_type_kernel) {
+                mmsg[i].msg_hdr.msg_control = &control[i];
+                mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+        }
+
+        /* Wait for the first datagram only */
+        ret = recvmmsg(s->sock, mmsg, batch,
+                       n_recvd ? flags|MSG_DONTWAIT : flags|MSG_WAITFORONE,
+                       NULL);
+#else
+        for (ret = 0; ret < batch; ret++) {
+            m = &msgs[n_recvd + ret];
+            if (m->addr) {
+                i = bitd_recvfrom(s->sock, m->buf, m->len, flags, m->addr,
+                                  (bitd_socklen_t *)&m->addrlen);
+            } else {
+                i = bitd_recv(s->sock, m->buf, m->len, flags);
+            }
+            if (i < 0) {
+                break;
+            }
+            m->len = i;
+# ifdef MSG_DONTWAIT
+            /* Wait for the first datagram only */
+            flags |= MSG_DONTWAIT;
+# else
+            /* Don't wait for more than one datagram */
+            n = n_recvd + (++ret);
+            break;
+# endif
+        }
+        if (!ret) {
+            ret = -1;
+        }
+#endif
+        if (ret <= 0) {
+            break;
+        }
+
+        /* The software timestamp, if there is no kernel timestamp */
+        current_time = bitd_get_time_nsec();
+
+        for (i = 0; i < ret; i++) {
+            m = &msgs[n_recvd + i];
+            memset(&m->ts, 0, sizeof(m->ts));
+
+#ifdef BITD_HAVE_RECVMMSG
+            m->len = mmsg[i].msg_len;
+            if (m->addr) {
+                m->addrlen = mmsg[i].msg_hdr.msg_namelen;
+            }
+
+            /* Read the timestamp from the cmsghdr */
+            for (cmsg = CMSG_FIRSTHDR(&mmsg[i].msg_hdr);
+                 cmsg;
+                 cmsg = CMSG_NXTHDR(&mmsg[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SO_TIMESTAMPNS) {
+                    stamp = (struct timespec *)CMSG_DATA(cmsg);
+                    m->ts.tstamp = 1000000000ULL*stamp->tv_sec +
+                        stamp->tv_nsec;
+                    m->ts.flags = TS_FLAG_KERNEL;
+                }
+            }
+#endif
+
+            if (!m->ts.flags) {
+                m->ts.tstamp = current_time;
+                m->ts.flags = TS_FLAG_SW;
+            }
+        }
+
+        n_recvd += ret;
+        if (ret < batch) {
+            break;
+        }
+    }
+
+    if (!n_recvd && n) {
+        return -1;
+    }
+
+    return n_recvd;
+}
+
+
 #ifdef __linux__
 static void __print_timestamp(const char *name, struct timespec *cur,
 			      uint32_t key, int payload_len)
@@ -1053,6 +1289,95 @@ static void print_timestamp(struct scm_timestamping *tss, int tstype,
 }
 
 
+/*
+ *============================================================================
+ *                        get_tstamp_tx_cmsgs
+ *============================================================================
+ * Description:     Read the tx timestamps of an error queue message.
+ *     Timestamps beyond the first n are enqueued.
+ * Parameters:
+ *     s - the timestamp handle
+ *     msg - the error queue message
+ *     ts [OUT] - array of n timestamps
+ *     n - the array size
+ * Returns:  The number of timestamps read
+ */
+#ifdef __linux__
+static int get_tstamp_tx_cmsgs(ts_socket_t s, struct msghdr *msg,
+			       ts_timestamp_t *ts, int n) {
+    struct sock_extended_err *serr = NULL;
+    struct scm_timestamping *tss = NULL;
+    struct cmsghdr *cm;
+    int batch = 0;
+    bitd_uint64 tstamp;
+    unsigned int flags;
+
+    for (cm = CMSG_FIRSTHDR(msg);
+	 cm && cm->cmsg_len;
+	 cm = CMSG_NXTHDR(msg, cm)) {
+	if (cm->cmsg_level == SOL_SOCKET &&
+	    cm->cmsg_type == SCM_TIMESTAMPING) {
+	    tss = (void *) CMSG_DATA(cm);
+	} else if ((cm->cmsg_level == SOL_IP &&
+		    cm->cmsg_type == IP_RECVERR) ||
+		   (cm->cmsg_level == SOL_IPV6 &&
+		    cm->cmsg_type == IPV6_RECVERR)) {
+	    serr = (void *) CMSG_DATA(cm);
+	    if (serr->ee_errno != ENOMSG ||
+		serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+		fprintf(stderr, "unknown ip error %d %d\n",
+			serr->ee_errno,
+			serr->ee_origin);
+		serr = NULL;
+	    }
+	}
+
+	if (serr && tss) {
+	    /* Commented out unless we need to debug */
+	    if (0) print_timestamp(tss, serr->ee_info, serr->ee_data, 0);
+
+	    /* Compute the timestamp flags */
+	    flags = TS_FLAG_KERNEL;
+	    switch (serr->ee_info) {
+	    case SCM_TSTAMP_SCHED:
+		flags |= TS_FLAG_ENQ;
+		break;
+	    case SCM_TSTAMP_SND:
+		flags |= TS_FLAG_SND;
+		break;
+	    case SCM_TSTAMP_ACK:
+		flags |= TS_FLAG_ACK;
+		break;
+	    default:
+		bitd_assert(0);
+	    }
+
+	    /* Compute the timestamp time */
+	    tstamp = tss->ts[0].tv_nsec + 1000000000ULL*tss->ts[0].tv_sec;
+
+	    if (batch >= n) {
+		/* OUT parameters are all set. Enqueue timestamp */
+		enqueue_ts(s,
+			   flags,
+			   serr->ee_data,
+			   tstamp);
+	    } else {
+		/* Copy timestamp to OUT parameter */
+		ts[batch].flags = flags;
+		ts[batch].seq = serr->ee_data;
+		ts[batch].tstamp = tstamp;
+	    }
+	    serr = NULL;
+	    tss = NULL;
+	    batch++;
+	}
+    }
+
+    return batch;
+}
+#endif /* __linux__ */
+
+
 /*
  *============================================================================
  *                        ts_get_tstamp_tx
@@ -1086,12 +1411,7 @@ static void print_timestamp(struct scm_timestamping *tss, int tstype,
 	     struct msghdr msg;
 	     struct iovec entry;
 	     char data[10];
-	     struct sock_extended_err *serr = NULL;
-	     struct scm_timestamping *tss = NULL;
-	     struct cmsghdr *cm;
-	     int batch = 0;
-	     bitd_uint64 tstamp;
-	     unsigned int flags;
+	     int batch;
 
 	     memset(&msg, 0, sizeof(msg));
 	     memset(&entry, 0, sizeof(entry));
@@ -1117,68 +1437,7 @@ static void print_timestamp(struct scm_timestamping *tss, int tstype,
 	     /* Clear the errno */
 	     errno = 0;
 
-	     for (cm = CMSG_FIRSTHDR(&msg);
-		  cm && cm->cmsg_len;
-		  cm = CMSG_NXTHDR(&msg, cm)) {
-		 if (cm->cmsg_level == SOL_SOCKET &&
-		     cm->cmsg_type == SCM_TIMESTAMPING) {
-		     tss = (void *) CMSG_DATA(cm);
-		 } else if ((cm->cmsg_level == SOL_IP &&
-			     cm->cmsg_type == IP_RECVERR) ||
-			    (cm->cmsg_level == SOL_IPV6 &&
-			     cm->cmsg_type == IPV6_RECVERR)) {
-		     serr = (void *) CMSG_DATA(cm);
-		     if (serr->ee_errno != ENOMSG ||
-			 serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
-			 fprintf(stderr, "unknown ip error %d %d\n",
-				 serr->ee_errno,
-				 serr->ee_origin);
-			 serr = NULL;
-		     }
-		 }
-            
-		 if (serr && tss) {
-		     /* Commented out unless we need to debug */
-		     if (0) print_timestamp(tss, serr->ee_info, serr->ee_data, 
-					    sizeof(data));
-
-		     /* Compute the timestamp flags */
-		     flags = TS_FLAG_KERNEL;
-		     switch (serr->ee_info) {
-		     case SCM_TSTAMP_SCHED:
-			 flags |= TS_FLAG_ENQ;
-			 break;
-		     case SCM_TSTAMP_SND:
-			 flags |= TS_FLAG_SND;
-			 break;
-		     case SCM_TSTAMP_ACK:
-			 flags |= TS_FLAG_ACK;
-			 break;
-		     default:
-			 bitd_assert(0);
-		     }
-
-		     /* Compute the timestamp time */
-		     tstamp = tss->ts[0].tv_nsec + 1000000000ULL*tss->ts[0].tv_sec;
-
-		     if (ts->flags) {
-			 /* Timestamp already copied to OUT parameter.
-			    Enqueue timestamp */
-			 enqueue_ts(s,
-				    flags,
-				    serr->ee_data,
-				    tstamp);
-		     } else {
-			 /* Copy timestamp to OUT parameter */
-			 ts->flags = flags;
-			 ts->seq = serr->ee_data;
-			 ts->tstamp = tstamp;
-		     }
-		     serr = NULL;
-		     tss = NULL;
-		     batch++;
-		 }
-	     }
+	     batch = get_tstamp_tx_cmsgs(s, &msg, ts, 1);
         
 	     if (batch > 1) {
 		 ts_printf("Batched %d timestamps\n", batch);
@@ -1200,7 +1459,121 @@ static void print_timestamp(struct scm_timestamping *tss, int tstype,
      }
 
      return ret;
- } 
+ }
+
+
+ /*
+  *============================================================================
+  *                        ts_get_tstamp_tx_batch
+  *============================================================================
+  * Description:     Get up to n tx timestamps, reading the kernel error
+  *     queue in batches of TS_MMSG_BATCH messages per system call
+  * Parameters:
+  *     s - the timestamp handle
+  *     ts [OUT] - array of n timestamps
+  *     n - the array size
+  * Returns:  The number of timestamps read, or -1 on error
+  */
+ int ts_get_tstamp_tx_batch(ts_socket_t s, ts_timestamp_t *ts, int n) {
+     int ret, count = 0;
+
+     if (!s || s->sock == BITD_INVALID_SOCKID || !ts || n < 0) {
+	 return -1;
+     }
+
+     /* Return the enqueued timestamps first */
+     while (count < n) {
+	 memset(&ts[count], 0, sizeof(ts[count]));
+	 dequeue_ts(s, &ts[count]);
+	 if (!ts[count].flags) {
+	     break;
+	 }
+	 count++;
+     }
+
+     switch (s->timestamp_type) {
+     case ts_timestamp_type_kernel:
+#if defined(__linux__) && defined(BITD_HAVE_RECVMMSG)
+	 {
+	     struct mmsghdr mmsg[TS_MMSG_BATCH];
+	     struct iovec entry[TS_MMSG_BATCH];
+	     char data[TS_MMSG_BATCH][16];
+	     union {
+		 struct cmsghdr cm;
+		 char control[TS_TX_CTRL_SIZE];
+	     } control[TS_MMSG_BATCH];
+	     int batch, i;
+
+	     while (count < n) {
+		 batch = MIN(n - count, TS_MMSG_BATCH);
+
+		 memset(mmsg, 0, batch*sizeof(mmsg[0]));
+		 for (i = 0; i < batch; i++) {
+		     entry[i].iov_base = data[i];
+		     entry[i].iov_len = sizeof(data[i]);
+		     mmsg[i].msg_hdr.msg_iov = &entry[i];
+		     mmsg[i].msg_hdr.msg_iovlen = 1;
+		     mmsg[i].msg_hdr.msg_control = &control[i];
+		     mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		 }
+
+		 ret = recvmmsg(s->tspipe, mmsg, batch,
+				MSG_ERRQUEUE|MSG_DONTWAIT, NULL);
+		 if (ret <= 0) {
+		     if (ret < 0 && errno != EAGAIN && !count) {
+			 ts_printf("%s:%d: recvmmsg(s->tspipe): %s (errno %d)\n",
+				   __FILE__, __LINE__,
+				   strerror(bitd_socket_errno),
+				   bitd_socket_errno);
+			 return -1;
+		     }
+
+		     /* Clear the errno */
+		     errno = 0;
+		     break;
+		 }
+
+		 for (i = 0; i < ret; i++) {
+		     count += get_tstamp_tx_cmsgs(s, &mmsg[i].msg_hdr,
+						  &ts[MIN(count, n)],
+						  MAX(n - count, 0));
+		 }
+		 count = MIN(count, n);
+
+		 if (ret < batch) {
+		     break;
+		 }
+	     }
+	 }
+#else
+	 while (count < n) {
+	     if (ts_get_tstamp_tx(s, &ts[count]) < 0 || !ts[count].flags) {
+		 /* Clear the errno */
+		 errno = 0;
+		 break;
+	     }
+	     count++;
+	 }
+#endif
+	 break;
+     case ts_timestamp_type_software:
+	 while (count < n) {
+	     ret = bitd_recv(s->tspipe, (void *)&ts[count],
+			     sizeof(ts[count]), 0);
+	     if (ret != sizeof(ts[count])) {
+		 /* Clear the errno */
+		 errno = 0;
+		 break;
+	     }
+	     count++;
+	 }
+	 break;
+     default:
+	 bitd_assert(0);
+     }
+
+     return count;
+ }
 
 
  /*
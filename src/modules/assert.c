@@ -48,6 +48,8 @@ struct bitd_task_inst_s {
     char *task_inst_name;
     mmr_task_inst_t mmr_task_inst_hdl;
     bitd_nvp_t args;     /* Task instance arguments at creation */
+    bitd_nvp_t min;      /* Lower bounds of numeric input values */
+    bitd_nvp_t max;      /* Upper bounds of numeric input values */
     bitd_boolean stopped_p;
 };
 
@@ -85,10 +87,10 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-assert");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "Module dir: %s", module_dir);
 
     /* Initialize the task API structure to zero, in case we're not 
@@ -101,6 +103,10 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
     task_api.task_inst_run = task_inst_run;
     task_api.task_inst_kill = task_inst_kill;
 
+    /* Task instance runs can execute in parallel, and are cheap enough
+       to run inline */
+    task_api.flags = BITD_TASK_FLAG_CONCURRENT_RUN|BITD_TASK_FLAG_INLINE_RUN;
+
     /* Register the task */
     s_task = mmr_task_register(mmr_module, "assert", &task_api);
 
@@ -117,7 +123,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -127,6 +133,94 @@ void bitd_module_unload(void) {
 } 
 
 
+/*
+ *============================================================================
+ *                        get_bounds
+ *============================================================================
+ * Description:     Take the named bounds out of the args
+ * Parameters:    
+ * Returns:         The bounds, or NULL if there are none
+ */
+static bitd_nvp_t get_bounds(bitd_nvp_t args, char *name) {
+    bitd_nvp_t bounds = NULL;
+    int idx;
+
+    if (bitd_nvp_lookup_elem(args, name, &idx) &&
+	args->e[idx].type == bitd_type_nvp) {
+	bounds = bitd_nvp_clone(args->e[idx].v.value_nvp);
+    }
+    bitd_nvp_delete_elem(args, name);
+
+    return bounds;
+} 
+
+
+/*
+ *============================================================================
+ *                        get_number
+ *============================================================================
+ * Description:     Get a numeric value as a double
+ * Parameters:    
+ * Returns:         TRUE if the value is numeric
+ */
+static bitd_boolean get_number(bitd_nvp_element_t *e, double *d) {
+
+    switch (e->type) {
+    case bitd_type_int64:
+	*d = (double)e->v.value_int64;
+	return TRUE;
+    case bitd_type_uint64:
+	*d = (double)e->v.value_uint64;
+	return TRUE;
+    case bitd_type_double:
+	*d = e->v.value_double;
+	return TRUE;
+    default:
+	return FALSE;
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        check_bounds
+ *============================================================================
+ * Description:     Check the input values against the bounds, which follow
+ *     the layout of the input. A bounded value missing from the input 
+ *     fails the check.
+ * Parameters:    
+ *     min_p - TRUE for lower bounds, FALSE for upper bounds
+ * Returns:         TRUE if the values are within the bounds
+ */
+static bitd_boolean check_bounds(bitd_nvp_t input_nvp, bitd_nvp_t bounds,
+				 bitd_boolean min_p) {
+    bitd_nvp_element_t *b, *e;
+    double bound, value;
+    int i, idx;
+
+    for (i = 0; i < bounds->n_elts; i++) {
+	b = &bounds->e[i];
+	if (!bitd_nvp_lookup_elem(input_nvp, b->name, &idx)) {
+	    return FALSE;
+	}
+	e = &input_nvp->e[idx];
+
+	if (b->type == bitd_type_nvp) {
+	    if (e->type != bitd_type_nvp || 
+		!check_bounds(e->v.value_nvp, b->v.value_nvp, min_p)) {
+		return FALSE;
+	    }
+	} else if (!get_number(b, &bound) || 
+		   !get_number(e, &value) ||
+		   (min_p ? value < bound : value > bound)) {
+	    return FALSE;
+	}
+    }
+
+    return TRUE;
+} 
+
+
 /*
  *============================================================================
  *                        task_inst_create
@@ -142,7 +236,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 				  bitd_nvp_t tags) {
     bitd_task_inst_t p;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -151,8 +245,11 @@ bitd_task_inst_t task_inst_create(char *task_name,
     p->task_inst_name = task_inst_name;
     p->mmr_task_inst_hdl = mmr_task_inst_hdl;
 
-    /* Save the args */
+    /* Save the args. The min and max bounds are checked apart from the
+       values that must match. */
     p->args = bitd_nvp_clone(args);
+    p->min = get_bounds(p->args, "min");
+    p->max = get_bounds(p->args, "max");
 
     return p;
 } 
@@ -168,10 +265,12 @@ bitd_task_inst_t task_inst_create(char *task_name,
  */
 void task_inst_destroy(bitd_task_inst_t p) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     bitd_nvp_free(p->args);
+    bitd_nvp_free(p->min);
+    bitd_nvp_free(p->max);
     free(p);
 } 
 
@@ -189,26 +288,30 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     mmr_task_inst_results_t results;
     char *buf;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     if (input->type != bitd_type_nvp) {
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Input not of nvp type, exiting", p->task_inst_name);
 	return 0;
     }
 
-    buf = bitd_object_to_string(input);
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: Input:\n%s", p->task_inst_name, buf);
-    free(buf);
+    if (ttlog_enabled(log_level_trace, s_log_keyid)) {
+	buf = bitd_object_to_string(input);
+	ttlog(log_level_trace, s_log_keyid,
+	      "%s: Input:\n%s", p->task_inst_name, buf);
+	free(buf);
+    }
 
     input_nvp = input->v.value_nvp;
     
     /* Is the input a superset of the args? */
     merged_nvp = bitd_nvp_merge(input_nvp, p->args, NULL);
-    if (bitd_nvp_compare(merged_nvp, input_nvp)) {
-	/* Args are not subset of input. */
+    if (bitd_nvp_compare(merged_nvp, input_nvp) ||
+	(p->min && !check_bounds(input_nvp, p->min, TRUE)) ||
+	(p->max && !check_bounds(input_nvp, p->max, FALSE))) {
+	/* Args are not subset of input, or values are out of bounds */
 	memset(&results, 0, sizeof(results));
 	results.exit_code = -1;
 	mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
@@ -229,7 +332,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->stopped_p = TRUE;
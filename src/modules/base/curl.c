@@ -15,6 +15,7 @@
 #include "bitd/common.h"
 #include "bitd/log.h"
 #include "bitd/module-api.h"
+#include "bitd/curl-multi.h"
 
 #include "curl/curl.h"
 
@@ -35,6 +36,23 @@
  *****************************************************************************/
 static ttlog_keyid s_log_keyid;
 
+/* A curl socket registered with the reactor */
+struct curl_sock_s {
+    bitd_reactor_handle h;
+    struct curl_sock_s *prev;
+    struct curl_sock_s *next;
+};
+
+struct bitd_curl_multi_s {
+    bitd_reactor_loop loop;      /* The reactor loop serving the transfers */
+    ttlog_keyid log_keyid;       /* The log key of the owner */
+    CURLM *multi_handle;
+    bitd_reactor_handle timer_h; /* Curl timer handle */
+    struct curl_sock_s socks;    /* List of curl socket handles */
+    bitd_curl_multi_callback_t *cb;
+    void *cookie;
+};
+
 
 /*****************************************************************************
  *                           FUNCTION DECLARATION
@@ -69,7 +87,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-curl");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Initialize libcurl */
@@ -88,7 +106,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     ttlog_unregister(s_log_keyid);
@@ -98,3 +116,230 @@ void bitd_module_unload(void) {
 } 
 
 
+/*
+ *============================================================================
+ *                        curl_sock_cb
+ *============================================================================
+ * Description:     Reactor callback for a curl socket
+ * Parameters:    
+ * Returns:  
+ */
+static void curl_sock_cb(bitd_reactor_handle h, bitd_uint32 events, 
+			 void *cookie) {
+    bitd_curl_multi m = (bitd_curl_multi)cookie;
+    int still_running, ev_bitmask = 0;
+    CURLMcode mc;
+
+    if (events & BITD_REACTOR_EV_READ) {
+	ev_bitmask |= CURL_CSELECT_IN;
+    }
+    if (events & BITD_REACTOR_EV_WRITE) {
+	ev_bitmask |= CURL_CSELECT_OUT;
+    }
+    if (events & BITD_REACTOR_EV_ERROR) {
+	ev_bitmask |= CURL_CSELECT_ERR;
+    }
+
+    mc = curl_multi_socket_action(m->multi_handle, bitd_reactor_get_fd(h),
+				  ev_bitmask, &still_running);
+    if (mc != CURLM_OK) {
+	TTLOG(log_level_err, m->log_keyid,
+	      "curl_multi_socket_action() failed: %s",
+	      curl_multi_strerror(mc));
+    }
+
+    m->cb(m->cookie);
+} 
+
+
+/*
+ *============================================================================
+ *                        curl_timer_cb
+ *============================================================================
+ * Description:     Reactor callback for the curl timer
+ * Parameters:    
+ * Returns:  
+ */
+static void curl_timer_cb(bitd_reactor_handle h, bitd_uint32 events, 
+			  void *cookie) {
+    bitd_curl_multi m = (bitd_curl_multi)cookie;
+    int still_running;
+    CURLMcode mc;
+
+    mc = curl_multi_socket_action(m->multi_handle, CURL_SOCKET_TIMEOUT,
+				  0, &still_running);
+    if (mc != CURLM_OK) {
+	TTLOG(log_level_err, m->log_keyid,
+	      "curl_multi_socket_action() failed: %s",
+	      curl_multi_strerror(mc));
+    }
+
+    m->cb(m->cookie);
+} 
+
+
+/*
+ *============================================================================
+ *                        curl_socket_func
+ *============================================================================
+ * Description:     Curl callback, registering socket interest with the 
+ *     reactor. Sockets stay open across transfers while their connection
+ *     is cached, so the registered sockets are kept on a list.
+ * Parameters:    
+ * Returns:  
+ */
+static int curl_socket_func(CURL *easy, curl_socket_t s, int what, 
+			    void *userp, void *socketp) {
+    bitd_curl_multi m = (bitd_curl_multi)userp;
+    struct curl_sock_s *sock = (struct curl_sock_s *)socketp;
+    bitd_uint32 events = 0;
+
+    if (what == CURL_POLL_REMOVE) {
+	if (sock) {
+	    sock->prev->next = sock->next;
+	    sock->next->prev = sock->prev;
+	    bitd_reactor_remove(sock->h);
+	    free(sock);
+	    curl_multi_assign(m->multi_handle, s, NULL);
+	}
+	return 0;
+    }
+
+    if (what & CURL_POLL_IN) {
+	events |= BITD_REACTOR_EV_READ;
+    }
+    if (what & CURL_POLL_OUT) {
+	events |= BITD_REACTOR_EV_WRITE;
+    }
+
+    if (sock) {
+	bitd_reactor_set_events(sock->h, events);
+	return 0;
+    }
+
+    sock = malloc(sizeof(*sock));
+    sock->h = bitd_reactor_fd_add(m->loop, s, events, curl_sock_cb, m);
+    sock->next = m->socks.next;
+    sock->prev = &m->socks;
+    sock->next->prev = sock;
+    m->socks.next = sock;
+    curl_multi_assign(m->multi_handle, s, sock);
+
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        curl_timer_func
+ *============================================================================
+ * Description:     Curl callback, arming the reactor timer
+ * Parameters:    
+ * Returns:  
+ */
+static int curl_timer_func(CURLM *multi, long timeout_ms, void *userp) {
+    bitd_curl_multi m = (bitd_curl_multi)userp;
+
+    bitd_reactor_timer_set(m->timer_h, 
+			   timeout_ms < 0 ? BITD_FOREVER : 
+			   (bitd_uint32)timeout_ms);
+
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_curl_multi_create
+ *============================================================================
+ * Description:     Create a multi handle driven by the reactor loop. Runs
+ *     on the reactor loop thread.
+ * Parameters:    
+ *     l - the reactor loop
+ *     log_keyid - the log key of the owner
+ *     cb - called after curl acts on a socket or on the timer
+ *     cookie - passed to cb
+ * Returns:         The multi handle, or NULL on error
+ */
+bitd_curl_multi bitd_curl_multi_create(bitd_reactor_loop l,
+				       ttlog_keyid log_keyid,
+				       bitd_curl_multi_callback_t *cb,
+				       void *cookie) {
+    bitd_curl_multi m;
+
+    m = calloc(1, sizeof(*m));
+    m->loop = l;
+    m->log_keyid = log_keyid;
+    m->cb = cb;
+    m->cookie = cookie;
+    m->socks.next = &m->socks;
+    m->socks.prev = &m->socks;
+
+    m->multi_handle = curl_multi_init();
+    if (!m->multi_handle) {
+	TTLOG(log_level_err, log_keyid,
+	      "Could not create curl multi object");
+	free(m);
+	return NULL;
+    }
+
+    /* Drive the transfers from the reactor */
+    curl_multi_setopt(m->multi_handle, CURLMOPT_SOCKETFUNCTION, 
+		      curl_socket_func);
+    curl_multi_setopt(m->multi_handle, CURLMOPT_SOCKETDATA, m);
+    curl_multi_setopt(m->multi_handle, CURLMOPT_TIMERFUNCTION, 
+		      curl_timer_func);
+    curl_multi_setopt(m->multi_handle, CURLMOPT_TIMERDATA, m);
+
+    m->timer_h = bitd_reactor_timer_add(l, curl_timer_cb, m);
+
+    return m;
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_curl_multi_destroy
+ *============================================================================
+ * Description:     Close the cached connections, and release the multi 
+ *     handle. Runs on the reactor loop thread, after the easy handles
+ *     are removed.
+ * Parameters:    
+ * Returns:  
+ */
+void bitd_curl_multi_destroy(bitd_curl_multi m) {
+    struct curl_sock_s *sock;
+
+    if (!m) {
+	return;
+    }
+
+    /* Don't let curl call back into the reactor while cleaning up */
+    curl_multi_setopt(m->multi_handle, CURLMOPT_SOCKETFUNCTION, NULL);
+    curl_multi_setopt(m->multi_handle, CURLMOPT_TIMERFUNCTION, NULL);
+
+    /* Remove the socket handles and the timer before curl closes 
+       the sockets */
+    while ((sock = m->socks.next) != &m->socks) {
+	m->socks.next = sock->next;
+	bitd_reactor_remove(sock->h);
+	free(sock);
+    }
+    bitd_reactor_remove(m->timer_h);
+
+    curl_multi_cleanup(m->multi_handle);
+    free(m);
+} 
+
+
+/*
+ *============================================================================
+ *                        bitd_curl_multi_get_handle
+ *============================================================================
+ * Description:     Get the curl multi handle
+ * Parameters:    
+ * Returns:  
+ */
+CURLM *bitd_curl_multi_get_handle(bitd_curl_multi m) {
+    return m->multi_handle;
+} 
@@ -73,7 +73,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-ssl");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     return TRUE;
@@ -89,7 +89,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     ttlog_unregister(s_log_keyid);
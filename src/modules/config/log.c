@@ -81,7 +81,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-config-log");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Initialize the task API structure to zero, in case we're not 
@@ -110,7 +110,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -135,7 +135,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 				  bitd_nvp_t tags) {
     bitd_task_inst_t p;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -159,7 +159,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
  */
 void task_inst_destroy(bitd_task_inst_t p) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     bitd_event_destroy(p->stop_ev);
@@ -184,11 +184,11 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     char *elem_names = "log-key";
     bitd_boolean found_p;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     if (input->type != bitd_type_nvp) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: Invalid input type %s (should be nvp)", 
 	      p->task_inst_name, bitd_get_type_name(input->type));
 	return -1;
@@ -197,7 +197,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     nvp = input->v.value_nvp;
     if (bitd_nvp_lookup_elem(nvp, "log-level", &idx)) {
 	if (nvp->e[idx].type != bitd_type_string) {
-	    ttlog(log_level_err, s_log_keyid,
+	    TTLOG(log_level_err, s_log_keyid,
 		  "%s: Invalid input: log-level not of type string", 
 		  p->task_inst_name);
 	    return -1;
@@ -207,13 +207,33 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	level = ttlog_get_level_from_name(nvp->e[idx].v.value_string);
 	if (!level && (nvp->e[idx].v.value_string &&
 		       strcasecmp(nvp->e[idx].v.value_string, "none"))) {
-	    ttlog(log_level_err, s_log_keyid,
+	    TTLOG(log_level_err, s_log_keyid,
 		  "%s: Invalid log level %s.", 
 		  p->task_inst_name, nvp->e[idx].v.value_string);
 	    return -1;
 	}
     }
 
+    /* The flush policy */
+    if (bitd_nvp_lookup_elem(nvp, "log-flush-size", &idx)) {
+	if (nvp->e[idx].type != bitd_type_int64 ||
+	    !ttlog_set_flush_size((int)nvp->e[idx].v.value_int64)) {
+	    TTLOG(log_level_err, s_log_keyid,
+		  "%s: Invalid input: log-flush-size not a valid int64", 
+		  p->task_inst_name);
+	    return -1;
+	}
+    }
+    if (bitd_nvp_lookup_elem(nvp, "log-flush-interval", &idx)) {
+	if (nvp->e[idx].type != bitd_type_int64 ||
+	    !ttlog_set_flush_interval((int)nvp->e[idx].v.value_int64)) {
+	    TTLOG(log_level_err, s_log_keyid,
+		  "%s: Invalid input: log-flush-interval not a valid int64", 
+		  p->task_inst_name);
+	    return -1;
+	}
+    }
+
     /* Get the actual log level */
     level_old = ttlog_get_level(NULL);
 
@@ -236,7 +256,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     if (nvp_keys) {
 	for (i = 0; i < nvp_keys->n_elts; i++) {
 	    if (nvp_keys->e[i].type != bitd_type_nvp) {
-		ttlog(log_level_err, s_log_keyid,
+		TTLOG(log_level_err, s_log_keyid,
 		      "%s: Invalid input: log-key not of type nvp", 
 		      p->task_inst_name);
 		continue;
@@ -244,21 +264,21 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	    nvp1 = nvp_keys->e[i].v.value_nvp;
 	    if (!bitd_nvp_lookup_elem(nvp1, "key-name", &idx) ||
 		nvp1->e[idx].type != bitd_type_string) {
-		ttlog(log_level_err, s_log_keyid,
+		TTLOG(log_level_err, s_log_keyid,
 		      "%s: Invalid input: log-key.key-name not of type string", 
 		      p->task_inst_name);
 		continue;
 	    }
 	    key_name = nvp1->e[idx].v.value_string;
 	    if (!key_name) {
-		ttlog(log_level_err, s_log_keyid,
+		TTLOG(log_level_err, s_log_keyid,
 		      "%s: Invalid input: log-key.key-name should not be NULL", 
 		      p->task_inst_name);
 		continue;
 	    }
 	    if (!bitd_nvp_lookup_elem(nvp1, "log-level", &idx) ||
 		nvp1->e[idx].type != bitd_type_string) {
-		ttlog(log_level_err, s_log_keyid,
+		TTLOG(log_level_err, s_log_keyid,
 		      "%s: Invalid input: log-key.log-level missing or of non-string type", 
 		      p->task_inst_name);
 		continue;
@@ -267,7 +287,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	    if (!level) {
 		if (nvp1->e[idx].v.value_string && 
 		    strcasecmp(nvp1->e[idx].v.value_string, "none")) {
-		    ttlog(log_level_err, s_log_keyid,
+		    TTLOG(log_level_err, s_log_keyid,
 			  "%s: Invalid input: log-key.log-level '%s' is invalid", 
 			  p->task_inst_name, nvp1->e[idx].v.value_string);
 		    continue;
@@ -353,7 +373,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->stopped_p = TRUE;
@@ -36,12 +36,27 @@
 static bitd_task_inst_create_t task_inst_create;
 static bitd_task_inst_destroy_t task_inst_destroy;
 static bitd_task_inst_run_t task_inst_run;
+static bitd_task_inst_run_batch_t task_inst_run_batch;
+static bitd_task_inst_run_async_t task_inst_run_async;
 static bitd_task_inst_kill_t task_inst_kill;
 static ttlog_keyid s_log_keyid;
 
+/* An echo-async run waiting for its task-inst-sleep to elapse */
+struct async_run_s {
+    struct async_run_s *next;
+    bitd_task_inst_t p;
+    bitd_object_t input;
+    bitd_uint64 due_nsec;   /* When the run completes */
+};
+
 /* The module control block */
 struct module_s {
     bitd_nvp_t tags;
+    bitd_mutex lock;              /* Protects the async runs */
+    bitd_event async_ev;          /* Wakes up the async thread */
+    bitd_thread async_th;         /* Completes the echo-async runs */
+    struct async_run_s *async_head;
+    bitd_boolean stopping_p;
 } g_module;
 
 struct bitd_task_inst_s {
@@ -57,13 +72,14 @@ struct bitd_task_inst_s {
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-
+static void async_thread(void *thread_arg);
 
 
 /*****************************************************************************
  *                                VARIABLES
  *****************************************************************************/
 static mmr_task_t s_task;
+static mmr_task_t s_async_task;
 
 
 /*****************************************************************************
@@ -89,19 +105,19 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-echo");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     tags_str = bitd_nvp_to_yaml(tags, FALSE, FALSE);
     if (tags_str) {
 	if (tags_str[0]) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "Module tags\n%s", tags_str);
 	}
 	free(tags_str);
     }
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "Module dir: %s", module_dir);
 
     g_module.tags = bitd_nvp_clone(tags);
@@ -114,11 +130,33 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
     task_api.task_inst_create = task_inst_create;
     task_api.task_inst_destroy = task_inst_destroy;
     task_api.task_inst_run = task_inst_run;
+    task_api.task_inst_run_batch = task_inst_run_batch;
     task_api.task_inst_kill = task_inst_kill;
 
+    /* Task instance runs can execute in parallel, and are cheap enough
+       to run inline. Triggered task instances with a task-inst-sleep 
+       tag should set the inline schedule option to false. */
+    task_api.flags = BITD_TASK_FLAG_CONCURRENT_RUN|BITD_TASK_FLAG_INLINE_RUN;
+
     /* Register the task */
     s_task = mmr_task_register(mmr_module, "echo", &task_api);
 
+    /* The echo-async task sleeps without holding a worker thread. A
+       single module thread completes all the sleeping runs. */
+    g_module.lock = bitd_mutex_create();
+    g_module.async_ev = bitd_event_create(0);
+    g_module.async_th = bitd_create_thread("echo-async",
+					   async_thread,
+					   BITD_DEFAULT_PRIORITY,
+					   BITD_DEFAULT_STACK_SIZE,
+					   NULL);
+
+    task_api.task_inst_run = NULL;
+    task_api.task_inst_run_batch = NULL;
+    task_api.task_inst_run_async = task_inst_run_async;
+    task_api.flags = 0;
+    s_async_task = mmr_task_register(mmr_module, "echo-async", &task_api);
+
     return TRUE;
 } 
 
@@ -132,11 +170,20 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
-    /* Unregister the task */
+    /* Unregister the tasks */
     mmr_task_unregister(s_task);
+    mmr_task_unregister(s_async_task);
+
+    /* Stop the async thread. The task instances have been destroyed,
+       and there are no async runs left. */
+    g_module.stopping_p = TRUE;
+    bitd_event_set(g_module.async_ev);
+    bitd_join_thread(g_module.async_th);
+    bitd_event_destroy(g_module.async_ev);
+    bitd_mutex_destroy(g_module.lock);
 
     /* Release the module tags */
     bitd_nvp_free(g_module.tags);
@@ -162,7 +209,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
     bitd_task_inst_t p;
     char *buf = NULL;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -179,14 +226,14 @@ bitd_task_inst_t task_inst_create(char *task_name,
     /* Log the args and tags */
     if (p->args) {
 	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Args:\n%s", task_inst_name, buf);
 	free(buf);
     }
 
     if (p->tags) {
 	buf = bitd_nvp_to_yaml(p->tags, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Tags:\n%s", task_inst_name, buf);
 	free(buf);
     }
@@ -205,7 +252,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
  */
 void task_inst_destroy(bitd_task_inst_t p) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     bitd_nvp_free(p->args);
@@ -217,36 +264,50 @@ void task_inst_destroy(bitd_task_inst_t p) {
 
 /*
  *============================================================================
- *                        task_inst_run
+ *                        echo_sleep
  *============================================================================
- * Description:     
+ * Description:     Sleep for the task-inst-sleep tag msecs, if set
  * Parameters:    
  * Returns:  
  */
-int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
-    mmr_task_inst_results_t results;
-    char *buf;
+static void echo_sleep(bitd_task_inst_t p) {
     int idx;
 
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
-
-    if (input->type != bitd_type_void) {
-	buf = bitd_object_to_string(input);
-	ttlog(log_level_trace, s_log_keyid,
-	      "%s: Input:\n%s", p->task_inst_name, buf);
-	free(buf);
-    }
-
     if (bitd_nvp_lookup_elem(p->tags, "task-inst-sleep", &idx) &&
 	p->tags->e[idx].type == bitd_type_int64) {
 	
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: %s(): sleeping %u msecs", 
 	      p->task_inst_name, __FUNCTION__, 
 	      p->tags->e[idx].v.value_int64);
 	bitd_event_wait(p->stop_ev, 
 		      (bitd_uint32)p->tags->e[idx].v.value_int64);
+	if (p->stopped_p) {
+	    /* Wake up the other parallel runs, if any */
+	    bitd_event_set(p->stop_ev);
+	}
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        echo_report
+ *============================================================================
+ * Description:     Report the args, or else the input, as results
+ * Parameters:    
+ * Returns:  
+ */
+static void echo_report(bitd_task_inst_t p, bitd_object_t *input) {
+    mmr_task_inst_results_t results;
+    char *buf;
+
+    if (input->type != bitd_type_void &&
+	ttlog_enabled(log_level_trace, s_log_keyid)) {
+	buf = bitd_object_to_string(input);
+	ttlog(log_level_trace, s_log_keyid,
+	      "%s: Input:\n%s", p->task_inst_name, buf);
+	free(buf);
     }
 
     memset(&results, 0, sizeof(results));
@@ -261,11 +322,152 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Simply report the input as output */
     mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    echo_sleep(p);
+    echo_report(p, input);
 
     return 0;
 } 
 
 
+/*
+ *============================================================================
+ *                        task_inst_run_batch
+ *============================================================================
+ * Description:     Echo a batch of inputs. The task-inst-sleep happens 
+ *     once per batch.
+ * Parameters:    
+ * Returns:  
+ */
+int task_inst_run_batch(bitd_task_inst_t p, bitd_object_t *inputs, int n) {
+    int i;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called, %d inputs", p->task_inst_name, __FUNCTION__, n);
+
+    echo_sleep(p);
+    for (i = 0; i < n; i++) {
+	echo_report(p, &inputs[i]);
+    }
+
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_async
+ *============================================================================
+ * Description:     Echo the input after the task-inst-sleep tag msecs, 
+ *     without blocking the calling worker thread
+ * Parameters:    
+ * Returns:  
+ */
+void task_inst_run_async(bitd_task_inst_t p, bitd_object_t *input) {
+    struct async_run_s *run, **prev;
+    int idx;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    if (!bitd_nvp_lookup_elem(p->tags, "task-inst-sleep", &idx) ||
+	p->tags->e[idx].type != bitd_type_int64) {
+	/* Complete the run rightaway */
+	echo_report(p, input);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, 0);
+	return;
+    }
+
+    bitd_mutex_lock(g_module.lock);
+
+    if (p->stopped_p) {
+	/* Killed before the run started */
+	bitd_mutex_unlock(g_module.lock);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    run = calloc(1, sizeof(*run));
+    run->p = p;
+    bitd_object_clone(&run->input, input);
+    run->due_nsec = bitd_get_time_nsec() + 
+	(bitd_uint64)p->tags->e[idx].v.value_int64 * 1000000;
+
+    /* Keep the runs sorted by due time */
+    for (prev = &g_module.async_head; 
+	 *prev && (*prev)->due_nsec <= run->due_nsec; 
+	 prev = &(*prev)->next);
+    run->next = *prev;
+    *prev = run;
+    bitd_mutex_unlock(g_module.lock);
+
+    bitd_event_set(g_module.async_ev);
+} 
+
+
+/*
+ *============================================================================
+ *                        async_thread
+ *============================================================================
+ * Description:     Complete the echo-async runs as they come due
+ * Parameters:    
+ * Returns:  
+ */
+static void async_thread(void *thread_arg) {
+    struct async_run_s *run;
+    bitd_uint64 now;
+    bitd_uint32 tmo;
+
+    bitd_mutex_lock(g_module.lock);
+
+    while (!g_module.stopping_p) {
+	now = bitd_get_time_nsec();
+
+	run = g_module.async_head;
+	if (run && run->due_nsec <= now) {
+	    g_module.async_head = run->next;
+	    bitd_mutex_unlock(g_module.lock);
+
+	    /* The task instance is not destroyed before the run completes */
+	    echo_report(run->p, &run->input);
+	    mmr_task_inst_run_complete(run->p->mmr_task_inst_hdl, 0);
+	    bitd_object_free(&run->input);
+	    free(run);
+
+	    bitd_mutex_lock(g_module.lock);
+	    continue;
+	}
+
+	if (run) {
+	    tmo = (bitd_uint32)((run->due_nsec - now + 999999) / 1000000);
+	} else {
+	    tmo = BITD_FOREVER;
+	}
+
+	bitd_mutex_unlock(g_module.lock);
+	bitd_event_wait(g_module.async_ev, tmo);
+	bitd_mutex_lock(g_module.lock);
+    }
+
+    bitd_mutex_unlock(g_module.lock);
+} 
+
+
 /*
  *============================================================================
  *                        task_inst_kill
@@ -275,10 +477,31 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  * Returns:  
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
+    struct async_run_s *run, **prev, *killed = NULL;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
+    /* Take the sleeping async runs of the task instance off the list */
+    bitd_mutex_lock(g_module.lock);
     p->stopped_p = TRUE;
     bitd_event_set(p->stop_ev);
+    for (prev = &g_module.async_head; (run = *prev); ) {
+	if (run->p == p) {
+	    *prev = run->next;
+	    run->next = killed;
+	    killed = run;
+	} else {
+	    prev = &run->next;
+	}
+    }
+    bitd_mutex_unlock(g_module.lock);
+
+    /* Complete them early, without results */
+    while ((run = killed)) {
+	killed = run->next;
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	bitd_object_free(&run->input);
+	free(run);
+    }
 } 
@@ -133,19 +133,21 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-exec");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
-    tags_str = bitd_nvp_to_string(tags, "  ");
-    if (tags_str) {
-	if (tags_str[0]) {
-	    ttlog(log_level_trace, s_log_keyid,
-		  "Module tags\n%s", tags_str);
+    if (ttlog_enabled(log_level_trace, s_log_keyid)) {
+	tags_str = bitd_nvp_to_string(tags, "  ");
+	if (tags_str) {
+	    if (tags_str[0]) {
+		ttlog(log_level_trace, s_log_keyid,
+		      "Module tags\n%s", tags_str);
+	    }
+	    free(tags_str);
 	}
-	free(tags_str);
     }
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "Module dir: %s", module_dir);
 
     g_module.tags = bitd_nvp_clone(tags);
@@ -176,7 +178,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -285,12 +287,12 @@ bitd_task_inst_t task_inst_create(char *task_name,
     char *child_cmd = NULL;
     int idx;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     if (!bitd_nvp_lookup_elem(args, "command", &idx) ||
 	args->e[idx].type != bitd_type_string) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: No command parameter of type 'string'", task_inst_name);
 	return NULL;
     }
@@ -313,14 +315,14 @@ bitd_task_inst_t task_inst_create(char *task_name,
     p->child_cmd = strdup(child_cmd);
 
     /* Log the args, tags, input parameters */
-    if (p->args) {
+    if (p->args && ttlog_enabled(log_level_trace, s_log_keyid)) {
 	buf = bitd_nvp_to_string(p->args, "  ");
 	ttlog(log_level_trace, s_log_keyid,
 	      "%s: Args:\n%s", task_inst_name, buf);
 	free(buf);
     }
 
-    if (p->tags) {
+    if (p->tags && ttlog_enabled(log_level_trace, s_log_keyid)) {
 	buf = bitd_nvp_to_string(p->tags, "  ");
 	ttlog(log_level_trace, s_log_keyid,
 	      "%s: Tags:\n%s", task_inst_name, buf);
@@ -413,7 +415,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 void task_inst_destroy(bitd_task_inst_t p) {
     int i;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     bitd_nvp_free(p->args);
@@ -525,7 +527,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
     if (pipe2(p_stdin, O_CLOEXEC) || 
         pipe2(p_stdout, O_CLOEXEC) || 
         pipe2(p_stderr, O_CLOEXEC)) {
-        ttlog(log_level_err, s_log_keyid, 
+        TTLOG(log_level_err, s_log_keyid, 
 	      "pipe2(): %s (errno %d)", 
 	      strerror(errno), errno);
         goto end;
@@ -543,7 +545,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
 					 STDOUT_FILENO) ||
         posix_spawn_file_actions_adddup2(&factions, p_stderr[WRITEFD], 
 					 STDERR_FILENO)) {
-        ttlog(log_level_err, s_log_keyid, 
+        TTLOG(log_level_err, s_log_keyid, 
 	      "Set spawn file actions: %s (errno %d)",
               strerror(errno), errno);
         goto end;
@@ -551,7 +553,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
 
     /* Set up the spawn attributes */    
     if (posix_spawnattr_setflags(&fattr, POSIX_SPAWN_SETPGROUP)) {
-	ttlog(log_level_err, s_log_keyid, 
+	TTLOG(log_level_err, s_log_keyid, 
 	      "spawnattr setflags: %s (errno %d)",
 	      strerror(errno), errno);
 	goto end;
@@ -562,7 +564,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
                     (char *[]){ "sh", "-c", cmd, 0 },
                     envp) ||
         pid <= 0) {
-        ttlog(log_level_err, s_log_keyid, 
+        TTLOG(log_level_err, s_log_keyid, 
 	      "Child process spawn: %s (errno %d)",
               strerror(errno), errno);
         goto end;
@@ -570,7 +572,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
 
     /* Parent process continues here */
     
-    ttlog(log_level_trace, s_log_keyid, "Spawned child pid %d", pid);
+    TTLOG(log_level_trace, s_log_keyid, "Spawned child pid %d", pid);
 
     /* Set up the parent end of the pipes */
     close(p_stdin[READFD]);
@@ -599,7 +601,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
         bitd_sleep(10);
         if (getpgid(pid) != getpid()) {
             if (i >= 1) {
-		ttlog(log_level_info, s_log_keyid, 
+		TTLOG(log_level_info, s_log_keyid, 
 		      "Process group ID changed after %d cycles", i);
             }
             break;
@@ -607,7 +609,7 @@ static pid_t cmd_spawn(char *cmd, FILE **infp, FILE **outfp, FILE **errfp,
     }
     
     if (getpgid(pid) == getpid()) {
-        ttlog(log_level_err, s_log_keyid, 
+        TTLOG(log_level_err, s_log_keyid, 
 	      "Process group ID still not changed after 100 millisecs");
         kill(pid, SIGKILL);
         pid = 0;
@@ -668,7 +670,7 @@ static void child_kill(bitd_task_inst_t p) {
     }
     
     if (!p->child_pid) {
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 		  "%s:%s(): Child pid is 0, giving up", 
 	      p->task_inst_name, __FUNCTION__);
 	return;
@@ -687,10 +689,10 @@ static void child_kill(bitd_task_inst_t p) {
 	    ret = kill(-pgrp, SIGKILL);
 	}
 	if (!ret) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "%s: Killed child %d", p->task_inst_name, p->child_pid);
 	} else {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "%s: Could not kill child %d, %s (errno %d)", 
 		  p->task_inst_name, p->child_pid, strerror(errno), errno);
 	}
@@ -762,7 +764,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     char *err_buf = malloc(err_buf_len);
 #endif
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     bitd_object_to_buffer(&input_buf, &input_buf_len,
@@ -782,10 +784,10 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	}
 
 	if (len == input_buf_len) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "%s: Input:\n%s", p->task_inst_name, input_buf);
 	} else {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "%s: Raw input", p->task_inst_name);
 	}
     }
@@ -818,7 +820,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 			     p->child_env_array);
 
     if (p->child_pid < 0) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "Failed to spawn child process");
 	goto end;
     }
@@ -850,7 +852,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     }
 
     if (p->child_stdout_len) {
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "child stdout len: %d",
 	      p->child_stdout_len);
     }
@@ -871,14 +873,14 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     }
 
     if (p->child_stderr_len) {
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "child stderr len: %d",
 	      p->child_stderr_len);
     }
 
     /* Wait for child to exit, and save the exit code of the child */
     ret = waitpid(p->child_pid, &child_exit_status, 0);
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "waitpid() return code %d, child exit status 0x%x, %sexit code %d",
 	  ret, child_exit_status, 
 	  (WIFSIGNALED(child_exit_status) ? "killed by signal, ": ""),
@@ -897,7 +899,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Create anonymous stdin pipe */
     if (!CreatePipe(&g_hChildStd_IN_Rd, &g_hChildStd_IN_Wr, &saAttr, 0))  {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "CreatePipe() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -905,7 +907,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Ensure the write handle to the pipe for STDIN is not inherited. */
     if (!SetHandleInformation(g_hChildStd_IN_Wr, HANDLE_FLAG_INHERIT, 0)) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "SetHandleInformation() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -913,7 +915,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Create anonymous stdout pipe */
     if (!CreatePipe(&g_hChildStd_OUT_Rd, &g_hChildStd_OUT_Wr, &saAttr, 0))  {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "CreatePipe() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -921,7 +923,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Ensure the read handle to the pipe for STDOUT is not inherited. */
     if (!SetHandleInformation(g_hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0)) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "SetHandleInformation() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -929,7 +931,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Create anonymous stderr pipe */
     if (!CreatePipe(&g_hChildStd_ERR_Rd, &g_hChildStd_ERR_Wr, &saAttr, 0))  {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "CreatePipe() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -937,7 +939,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Ensure the read handle to the pipe for STDERR is not inherited. */
     if (!SetHandleInformation(g_hChildStd_ERR_Rd, HANDLE_FLAG_INHERIT, 0)) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "SetHandleInformation() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -946,7 +948,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     /* Create child process job */
     p->child_job = CreateJobObject(&saAttr, NULL);
     if (!p->child_job) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "CreateJobObject() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -978,7 +980,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 			     &piProcInfo);  /* receives PROCESS_INFORMATION */
     
     if (!bSuccess) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "CreateProcess() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -993,7 +995,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Assign the child process to its job */
     if (!AssignProcessToJobObject(p->child_job, p->child_process)) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "AssignProcessToJobObject() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -1001,7 +1003,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 
     /* Start the child process thread */
     if (ResumeThread(p->child_thread) == -1) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "ResumeThread() error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end;
@@ -1021,11 +1023,11 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 			     input_buf, input_buf_len, 
 			     &dwWritten, NULL);
 	if (!bSuccess) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "WriteFile() returns %d (%s)", 
 		  GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	} else {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "WriteFile() wrote %d bytes", dwWritten);
 	}
     }
@@ -1039,13 +1041,13 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     for (;;) {
 	bSuccess = PeekNamedPipe(g_hChildStd_OUT_Rd, NULL, 0, NULL, &dwRead, NULL);
 	if (!bSuccess) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "PeekNamedPipe(g_hChildStd_OUT_Rd) last error %d (%s)", 
 		  GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	    break; 
 	}
 	
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "PeekNamedPipe(g_hChildStd_OUT_Rd) dwRead %d", 
 	      dwRead);
 
@@ -1061,7 +1063,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	    break; 
 	}
 
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "ReadFile(g_hChildStd_OUT_Rd) dwRead %d", 
 	      dwRead);
 
@@ -1079,13 +1081,13 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     for (;;) {
 	bSuccess = PeekNamedPipe(g_hChildStd_ERR_Rd, NULL, 0, NULL, &dwRead, NULL);
 	if (!bSuccess) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "PeekNamedPipe(g_hChildStd_ERR_Rd) last error %d (%s)", 
 		  GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	    break; 
 	}
 	
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "PeekNamedPipe(g_hChildStd_ERR_Rd) dwRead %d", 
 	      dwRead);
 
@@ -1101,7 +1103,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	    break; 
 	}
 
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "ReadFile(g_hChildStd_ERR_Rd) dwRead %d", 
 	      dwRead);
 
@@ -1120,7 +1122,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     /* Get the child process exit code */
     dwExitCode = 0;
     if (!GetExitCodeProcess(p->child_process, &dwExitCode)) {
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "GetExitCodeProcess() last error %d (%s)", 
 	      GetLastError(), strerror_last_error(err_buf, err_buf_len));
 	goto end; 
@@ -1149,7 +1151,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
 	results.exit_code = p->child_exit_code;
 
 	if (p->child_timeout) {
-	    ttlog(log_level_warn, s_log_keyid,
+	    TTLOG(log_level_warn, s_log_keyid,
 		  "%s: Child timed out after %*g second(s)", 
 		  p->task_inst_name, 
 		  bitd_double_precision(p->child_tmo),
@@ -1275,7 +1277,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->stopped_p = TRUE;
@@ -0,0 +1,735 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Http checks, sharing one curl multi handle
+ *
+ * Copyright (C) 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/types.h"
+#include "bitd/log.h"
+#include "bitd/reactor.h"
+#include "bitd/module-api.h"
+#include "bitd/curl-multi.h"
+
+#include "curl/curl.h"
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+#define CHECK_TMO_DEF 10000     /* msecs */
+#define CHECK_ERR_SIZE 256      /* At least CURL_ERROR_SIZE */
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+static bitd_task_inst_create_t task_inst_create;
+static bitd_task_inst_update_t task_inst_update;
+static bitd_task_inst_destroy_t task_inst_destroy;
+static bitd_task_inst_run_async_t task_inst_run_async;
+static bitd_task_inst_kill_t task_inst_kill;
+static ttlog_keyid s_log_keyid;
+
+/* The multi handle driving the transfers of all instances. Its
+   connection and dns caches are shared by all checks. */
+struct check_multi_s {
+    bitd_reactor_loop loop;      /* The reactor loop serving the transfers */
+    bitd_curl_multi multi;
+    CURLM *multi_handle;
+    int n_transfers;             /* Transfers in progress */
+};
+
+struct bitd_task_inst_s {
+    char *task_name;
+    char *task_inst_name;
+    mmr_task_inst_t mmr_task_inst_hdl;
+    bitd_nvp_t args;
+
+    /* Check arguments */
+    char *url;
+    bitd_boolean head_p;         /* Head, rather than get */
+    bitd_boolean follow_p;       /* Follow redirects */
+    bitd_boolean verify_p;       /* Verify the server certificate */
+    bitd_uint32 tmo;             /* Msecs allowed for the transfer */
+    long expect_status;          /* Expected status, or 0 for 2xx and 3xx */
+
+    /* Check state. The easy handle is reused across runs. The run
+       completes on the reactor loop thread. */
+    CURL *curl;
+    bitd_boolean busy_p;         /* Transfer added to the multi handle */
+    CURLcode result;
+    bitd_boolean stopped_p;
+    char err[CHECK_ERR_SIZE];
+};
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+static bitd_reactor_call_t check_multi_start;
+static bitd_reactor_call_t check_multi_stop;
+static bitd_reactor_call_t check_start;
+static bitd_reactor_call_t check_abort;
+static bitd_reactor_call_t check_free;
+static void check_report(bitd_task_inst_t p);
+static void check_report_error(bitd_task_inst_t p);
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static mmr_task_t s_task;
+static struct check_multi_s s_multi;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        bitd_module_load
+ *============================================================================
+ * Description:     Load the module.
+ * Parameters:
+ *     tags - the module tags
+ *
+ * Returns:      TRUE on success
+ */
+bitd_boolean bitd_module_load(mmr_module_t mmr_module,
+			      bitd_nvp_t tags,
+			      char *module_dir) {
+    bitd_task_api_t task_api;  /* The task image */
+
+    s_log_keyid = ttlog_register("bitd-http-check");
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    /* All checks are driven by one reactor I/O thread */
+    bitd_reactor_init(0);
+    s_multi.loop = bitd_reactor_loop_get();
+    bitd_reactor_call(s_multi.loop, check_multi_start, &s_multi, TRUE);
+    if (!s_multi.multi_handle) {
+	/* Unload is called next */
+	return FALSE;
+    }
+
+    /* Initialize the task API structure to zero, in case we're not
+       implementing some APIs */
+    memset(&task_api, 0, sizeof(task_api));
+
+    /* Set up the task API structure */
+    task_api.task_inst_create = task_inst_create;
+    task_api.task_inst_update = task_inst_update;
+    task_api.task_inst_destroy = task_inst_destroy;
+    task_api.task_inst_run_async = task_inst_run_async;
+    task_api.task_inst_kill = task_inst_kill;
+
+    /* Register the task */
+    s_task = mmr_task_register(mmr_module, "http-check", &task_api);
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_module_unload
+ *============================================================================
+ * Description:     Unload the module, freeing all allocated resources
+ * Parameters:
+ * Returns:
+ */
+void bitd_module_unload(void) {
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    /* Unregister the task */
+    mmr_task_unregister(s_task);
+
+    bitd_reactor_call(s_multi.loop, check_multi_stop, &s_multi, TRUE);
+
+    ttlog_unregister(s_log_keyid);
+}
+
+
+/*
+ *============================================================================
+ *                        get_msec_arg
+ *============================================================================
+ * Description:     Get an argument expressed in seconds, as msecs
+ * Parameters:
+ * Returns:         TRUE if the argument is present and valid
+ */
+static bitd_boolean get_msec_arg(bitd_nvp_t args, char *name,
+				 bitd_uint32 *msec) {
+    int idx;
+
+    if (!bitd_nvp_lookup_elem(args, name, &idx)) {
+	return FALSE;
+    }
+
+    switch (args->e[idx].type) {
+    case bitd_type_int64:
+	if (args->e[idx].v.value_int64 >= 0) {
+	    *msec = (bitd_uint32)(args->e[idx].v.value_int64 * 1000);
+	    return TRUE;
+	}
+	break;
+    case bitd_type_uint64:
+	*msec = (bitd_uint32)(args->e[idx].v.value_uint64 * 1000);
+	return TRUE;
+    case bitd_type_double:
+	if (args->e[idx].v.value_double >= 0) {
+	    *msec = (bitd_uint32)(args->e[idx].v.value_double * 1000);
+	    return TRUE;
+	}
+	break;
+    default:
+	break;
+    }
+
+    return FALSE;
+}
+
+
+/*
+ *============================================================================
+ *                        get_boolean_arg
+ *============================================================================
+ * Description:     Get a boolean argument, or its default if not present
+ * Parameters:
+ * Returns:
+ */
+static bitd_boolean get_boolean_arg(bitd_task_inst_t p, bitd_nvp_t args,
+				    char *name, bitd_boolean value_def) {
+    int idx;
+
+    if (!bitd_nvp_lookup_elem(args, name, &idx)) {
+	return value_def;
+    }
+
+    if (args->e[idx].type != bitd_type_boolean) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid %s, using default of %s",
+	      p->task_inst_name, name, value_def ? "TRUE" : "FALSE");
+	return value_def;
+    }
+
+    return args->e[idx].v.value_boolean;
+}
+
+
+/*
+ *============================================================================
+ *                        discardfunc
+ *============================================================================
+ * Description:     Curl write callback, discarding the response body
+ * Parameters:
+ * Returns:
+ */
+static size_t discardfunc(void *ptr, size_t size, size_t nmemb, void *userp) {
+    return size*nmemb;
+}
+
+
+/*
+ *============================================================================
+ *                        check_done
+ *============================================================================
+ * Description:     Report the results of the completed transfers, and
+ *     complete their runs
+ * Parameters:
+ * Returns:
+ */
+static void check_done(void *cookie) {
+    struct check_multi_s *m = (struct check_multi_s *)cookie;
+    CURLMsg *msg;
+    int n_msgs;
+    char *private_p = NULL;
+    bitd_task_inst_t p;
+
+    while ((msg = curl_multi_info_read(m->multi_handle, &n_msgs))) {
+	if (msg->msg != CURLMSG_DONE) {
+	    continue;
+	}
+
+	curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private_p);
+	p = (bitd_task_inst_t)private_p;
+
+	/* The result must be read before the handle is removed */
+	p->result = msg->data.result;
+	curl_multi_remove_handle(m->multi_handle, p->curl);
+	p->busy_p = FALSE;
+	m->n_transfers--;
+
+	/* The instance may be destroyed once its run completes */
+	check_report(p);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, 0);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        check_multi_start
+ *============================================================================
+ * Description:     Set up the shared multi handle. Runs on the reactor
+ *     loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void check_multi_start(void *cookie) {
+    struct check_multi_s *m = (struct check_multi_s *)cookie;
+
+    m->multi = bitd_curl_multi_create(m->loop, s_log_keyid, check_done, m);
+    if (m->multi) {
+	m->multi_handle = bitd_curl_multi_get_handle(m->multi);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        check_multi_stop
+ *============================================================================
+ * Description:     Close the cached connections, and release the multi
+ *     handle. Runs on the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void check_multi_stop(void *cookie) {
+    struct check_multi_s *m = (struct check_multi_s *)cookie;
+
+    bitd_curl_multi_destroy(m->multi);
+    m->multi = NULL;
+    m->multi_handle = NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        check_start
+ *============================================================================
+ * Description:     Add the instance transfer to the multi handle. Runs on
+ *     the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void check_start(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+    CURLMcode mc;
+
+    if (p->stopped_p) {
+	/* Killed before the transfer started */
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    mc = curl_multi_add_handle(s_multi.multi_handle, p->curl);
+    if (mc != CURLM_OK) {
+	snprintf(p->err, sizeof(p->err), "%s", curl_multi_strerror(mc));
+	check_report_error(p);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    p->busy_p = TRUE;
+    s_multi.n_transfers++;
+}
+
+
+/*
+ *============================================================================
+ *                        check_abort
+ *============================================================================
+ * Description:     Abort the instance transfer, and complete its run
+ *     without results. Runs on the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void check_abort(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    if (!p->busy_p) {
+	/* Not started yet, or already completed */
+	return;
+    }
+
+    curl_multi_remove_handle(s_multi.multi_handle, p->curl);
+    p->busy_p = FALSE;
+    s_multi.n_transfers--;
+
+    mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+}
+
+
+/*
+ *============================================================================
+ *                        check_free
+ *============================================================================
+ * Description:     Free the instance. Runs on the reactor loop thread,
+ *     after the calls queued for the instance before it.
+ * Parameters:
+ * Returns:
+ */
+static void check_free(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    /* Run has stopped, so the easy handle is not in the multi handle */
+    if (p->curl) {
+	curl_easy_cleanup(p->curl);
+    }
+
+    bitd_nvp_free(p->args);
+    free(p->url);
+    free(p);
+}
+
+
+/*
+ *============================================================================
+ *                        check_report
+ *============================================================================
+ * Description:     Report the http status, and the transfer phase times
+ *     in msecs. The phase times are cumulative from the start of the
+ *     transfer, as with curl -w.
+ * Parameters:
+ * Returns:
+ */
+static void check_report(bitd_task_inst_t p) {
+    mmr_task_inst_results_t results;
+    bitd_nvp_t nvp = NULL;
+    bitd_value_t v;
+    long status = 0, n_connects = 0;
+    curl_off_t t;
+    int exit_code = 0;
+    static const struct {
+	char *name;
+	CURLINFO info;
+    } times[] = {
+	{"time-namelookup", CURLINFO_NAMELOOKUP_TIME_T},
+	{"time-connect", CURLINFO_CONNECT_TIME_T},
+	{"time-appconnect", CURLINFO_APPCONNECT_TIME_T},
+	{"time-pretransfer", CURLINFO_PRETRANSFER_TIME_T},
+	{"time-starttransfer", CURLINFO_STARTTRANSFER_TIME_T},
+	{"time-total", CURLINFO_TOTAL_TIME_T},
+    };
+    int i;
+
+    curl_easy_getinfo(p->curl, CURLINFO_RESPONSE_CODE, &status);
+
+    if (p->result != CURLE_OK) {
+	if (!p->err[0]) {
+	    snprintf(p->err, sizeof(p->err), "%s",
+		     curl_easy_strerror(p->result));
+	}
+	exit_code = -1;
+    } else if (p->expect_status ?
+	       status != p->expect_status : (status < 200 || status >= 400)) {
+	snprintf(p->err, sizeof(p->err), "Unexpected http status %ld",
+		 status);
+	exit_code = -1;
+    }
+
+    v.value_int64 = status;
+    bitd_nvp_add_elem(&nvp, "status", &v, bitd_type_int64);
+
+    if (p->result == CURLE_OK) {
+	for (i = 0; i < (int)(sizeof(times)/sizeof(times[0])); i++) {
+	    t = 0;
+	    curl_easy_getinfo(p->curl, times[i].info, &t);
+	    v.value_double = t / 1e3;
+	    bitd_nvp_add_elem(&nvp, times[i].name, &v, bitd_type_double);
+	}
+
+	t = 0;
+	curl_easy_getinfo(p->curl, CURLINFO_SIZE_DOWNLOAD_T, &t);
+	v.value_int64 = t;
+	bitd_nvp_add_elem(&nvp, "size-download", &v, bitd_type_int64);
+
+	/* Zero when a cached connection was reused */
+	curl_easy_getinfo(p->curl, CURLINFO_NUM_CONNECTS, &n_connects);
+	v.value_int64 = n_connects;
+	bitd_nvp_add_elem(&nvp, "num-connects", &v, bitd_type_int64);
+    }
+
+    memset(&results, 0, sizeof(results));
+    results.output.type = bitd_type_nvp;
+    results.output.v.value_nvp = nvp;
+    if (p->err[0]) {
+	results.error.type = bitd_type_string;
+	results.error.v.value_string = p->err;
+
+	TTLOG(log_level_debug, s_log_keyid,
+	      "%s: %s: %s", p->task_inst_name, p->url, p->err);
+    }
+    results.exit_code = exit_code;
+
+    mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
+
+    bitd_nvp_free(nvp);
+}
+
+
+/*
+ *============================================================================
+ *                        check_report_error
+ *============================================================================
+ * Description:     Report the error of a run without a transfer
+ * Parameters:
+ * Returns:
+ */
+static void check_report_error(bitd_task_inst_t p) {
+    mmr_task_inst_results_t results;
+
+    TTLOG(log_level_debug, s_log_keyid,
+	  "%s: %s", p->task_inst_name, p->err);
+
+    memset(&results, 0, sizeof(results));
+    results.error.type = bitd_type_string;
+    results.error.v.value_string = p->err;
+    results.exit_code = -1;
+    mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
+}
+
+
+/*
+ *============================================================================
+ *                        check_setup
+ *============================================================================
+ * Description:     Set the easy handle options from the arguments
+ * Parameters:
+ * Returns:
+ */
+static void check_setup(bitd_task_inst_t p) {
+
+    curl_easy_reset(p->curl);
+
+    curl_easy_setopt(p->curl, CURLOPT_URL, p->url);
+    curl_easy_setopt(p->curl, CURLOPT_PRIVATE, (char *)p);
+    curl_easy_setopt(p->curl, CURLOPT_ERRORBUFFER, p->err);
+    curl_easy_setopt(p->curl, CURLOPT_WRITEFUNCTION, discardfunc);
+    curl_easy_setopt(p->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(p->curl, CURLOPT_TIMEOUT_MS, (long)p->tmo);
+    curl_easy_setopt(p->curl, CURLOPT_USERAGENT, "bitd-http-check");
+    if (p->head_p) {
+	curl_easy_setopt(p->curl, CURLOPT_NOBODY, 1L);
+    }
+    if (p->follow_p) {
+	curl_easy_setopt(p->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    }
+    if (!p->verify_p) {
+	curl_easy_setopt(p->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(p->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_create
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_task_inst_t task_inst_create(char *task_name,
+				  char *task_inst_name,
+				  mmr_task_inst_t mmr_task_inst_hdl,
+				  bitd_nvp_t args,
+				  bitd_nvp_t tags) {
+    bitd_task_inst_t p;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", task_inst_name, __FUNCTION__);
+
+    p = calloc(1, sizeof(*p));
+
+    p->task_name = task_name;
+    p->task_inst_name = task_inst_name;
+    p->mmr_task_inst_hdl = mmr_task_inst_hdl;
+
+    p->curl = curl_easy_init();
+    if (!p->curl) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: Could not create curl object", task_inst_name);
+    }
+
+    /* Call the update routine to set further configuration */
+    task_inst_update(p, args, tags);
+
+    return p;
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_update
+ *============================================================================
+ * Description:     Guaranteed to be called only when run() has stopped
+ * Parameters:
+ * Returns:
+ */
+void task_inst_update(bitd_task_inst_t p,
+		      bitd_nvp_t args,
+		      bitd_nvp_t tags) {
+    char *buf = NULL;
+    int idx;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    p->stopped_p = FALSE;
+
+    /* Save the args */
+    bitd_nvp_free(p->args);
+    p->args = bitd_nvp_clone(args);
+
+    /* Log the args */
+    if (p->args && ttlog_enabled(log_level_trace, s_log_keyid)) {
+	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
+	ttlog(log_level_trace, s_log_keyid,
+	      "%s: Args:\n%s", p->task_inst_name, buf);
+	free(buf);
+    }
+
+    /* Parse the args */
+    free(p->url);
+    p->url = NULL;
+    if (bitd_nvp_lookup_elem(args, "url", &idx) &&
+	args->e[idx].type == bitd_type_string &&
+	args->e[idx].v.value_string) {
+	p->url = strdup(args->e[idx].v.value_string);
+    }
+
+    p->head_p = FALSE;
+    if (bitd_nvp_lookup_elem(args, "method", &idx)) {
+	if (args->e[idx].type == bitd_type_string &&
+	    args->e[idx].v.value_string &&
+	    !strcasecmp(args->e[idx].v.value_string, "HEAD")) {
+	    p->head_p = TRUE;
+	} else if (args->e[idx].type != bitd_type_string ||
+		   !args->e[idx].v.value_string ||
+		   strcasecmp(args->e[idx].v.value_string, "GET")) {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid method, using GET", p->task_inst_name);
+	}
+    }
+
+    p->follow_p = get_boolean_arg(p, args, "follow-redirects", FALSE);
+    p->verify_p = get_boolean_arg(p, args, "verify-peer", TRUE);
+
+    p->tmo = CHECK_TMO_DEF;
+    if (bitd_nvp_lookup_elem(args, "timeout", &idx) &&
+	!get_msec_arg(args, "timeout", &p->tmo)) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid timeout, using default of %d msecs",
+	      p->task_inst_name, CHECK_TMO_DEF);
+    }
+
+    p->expect_status = 0;
+    if (bitd_nvp_lookup_elem(args, "expect-status", &idx)) {
+	if (args->e[idx].type == bitd_type_int64 &&
+	    args->e[idx].v.value_int64 >= 100 &&
+	    args->e[idx].v.value_int64 <= 999) {
+	    p->expect_status = (long)args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid expect-status, ignored", p->task_inst_name);
+	}
+    }
+
+    if (p->curl) {
+	check_setup(p);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_destroy
+ *============================================================================
+ * Description:     Free the instance on the reactor loop thread, once the
+ *     start or abort calls still queued for it are done. Called with the
+ *     module manager lock held, so it does not wait for the reactor.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_destroy(bitd_task_inst_t p) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    bitd_reactor_call(s_multi.loop, check_free, p, FALSE);
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_async
+ *============================================================================
+ * Description:     Hand the transfer to the reactor, without holding the
+ *     worker thread. All transfers share the reactor thread and the cached
+ *     connections of the multi handle. The run completes on the reactor
+ *     thread.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_run_async(bitd_task_inst_t p, bitd_object_t *input) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    if (p->stopped_p) {
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    p->err[0] = 0;
+    p->result = CURLE_OK;
+
+    if (!p->url || !p->curl) {
+	snprintf(p->err, sizeof(p->err), 
+		 !p->url ? "No url" : "No curl object");
+	check_report_error(p);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    bitd_reactor_call(s_multi.loop, check_start, p, FALSE);
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_kill
+ *============================================================================
+ * Description:     Abort the transfer in progress, which completes the run.
+ *     Called with the module manager lock held, so it does not wait for 
+ *     the reactor.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_kill(bitd_task_inst_t p, int signo) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    p->stopped_p = TRUE;
+    bitd_reactor_call(s_multi.loop, check_abort, p, FALSE);
+}
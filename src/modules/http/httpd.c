@@ -98,19 +98,19 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-httpd");
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     tags_str = bitd_nvp_to_yaml(tags, FALSE, FALSE);
     if (tags_str) {
 	if (tags_str[0]) {
-	    ttlog(log_level_trace, s_log_keyid,
+	    TTLOG(log_level_trace, s_log_keyid,
 		  "Module tags\n%s", tags_str);
 	}
 	free(tags_str);
     }
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "Module dir: %s", module_dir);
 
     g_module.tags = bitd_nvp_clone(tags);
@@ -141,7 +141,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -182,7 +182,7 @@ static int answer_to_connection(void *cls,
     int output_buf_len = 0;
     int output_buf_type = bitd_buffer_type_auto;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
     
     bitd_object_init(&output);
@@ -212,7 +212,7 @@ static int answer_to_connection(void *cls,
     /* Unpack output */
     idx = 0;
     if (!bitd_unpack_object((char *)m, bitd_msg_get_size(m), &idx, &output)) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: Failed to unpack object", p->task_inst_name);
 	goto end;
     }
@@ -287,7 +287,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
     int idx;
     int port = PORT_DEF;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -304,14 +304,14 @@ bitd_task_inst_t task_inst_create(char *task_name,
     /* Log the args and tags */
     if (p->args) {
 	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Args:\n%s", task_inst_name, buf);
 	free(buf);
     }
 
     if (p->tags) {
 	buf = bitd_nvp_to_yaml(p->tags, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Tags:\n%s", task_inst_name, buf);
 	free(buf);
     }
@@ -395,7 +395,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 void task_inst_destroy(bitd_task_inst_t p) {
     bitd_uint32 count;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     /* Stop the daemon */
@@ -405,7 +405,7 @@ void task_inst_destroy(bitd_task_inst_t p) {
 
     count = bitd_queue_count(p->queue);
     if (count) {
-	ttlog(log_level_warn, s_log_keyid,
+	TTLOG(log_level_warn, s_log_keyid,
 	      "%s: %s(): Dropping %u result(s)", 
 	      p->task_inst_name, __FUNCTION__, count);
     }
@@ -433,28 +433,37 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
     int idx, len;
     char *buf;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
-    if (input->type != bitd_type_void) {
+    if (input->type != bitd_type_void &&
+	ttlog_enabled(log_level_trace, s_log_keyid)) {
 	buf = bitd_object_to_string(input);
 	ttlog(log_level_trace, s_log_keyid,
 	      "%s: Input:\n%s", p->task_inst_name, buf);
 	free(buf);
     }
 
-    len = bitd_get_packed_size_object(input);    
+    /* Queued results use the compact encoding */
+    len = bitd_get_packed_size_object_compact(input);    
     m = bitd_msg_alloc(0, len);
     
     idx = 0;
-    if (!bitd_pack_object((char *)m, len, &idx, input)) {
-	ttlog(log_level_err, s_log_keyid,
+    if (!bitd_pack_object_compact((char *)m, len, &idx, input,
+				  BITD_PACK_LZ4_THRESHOLD_DEF)) {
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: Failed to pack object", p->task_inst_name);
+	bitd_msg_free(m);
 	goto end;
     }
 
+    /* Release the space saved by compression */
+    if (idx < len) {
+	m = bitd_msg_realloc(m, idx);
+    }
+
     if (bitd_msg_send(m, p->queue) != bitd_msgerr_ok) {
-	ttlog(log_level_warn, s_log_keyid,
+	TTLOG(log_level_warn, s_log_keyid,
 	      "%s: Queue full, dropping message", p->task_inst_name);
 	bitd_msg_free(m);
     }
@@ -474,7 +483,7 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->stopped_p = TRUE;
@@ -0,0 +1,1620 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Native icmp, udp and tcp latency probes
+ *
+ * Copyright (C) 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/types.h"
+#include "bitd/log.h"
+#include "bitd/reactor.h"
+#include "bitd/resolve.h"
+#include "bitd/tstamp.h"
+#include "bitd/module-api.h"
+
+#ifdef __linux__
+# include <netinet/tcp.h>
+#endif
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+#define PROBE_COUNT_DEF 1
+#define PROBE_COUNT_MAX 1000
+#define PROBE_TMO_DEF 1000      /* msecs */
+#define PROBE_ICMP_SIZE_DEF 56  /* Icmp payload bytes, as ping */
+#define PROBE_UDP_SIZE_DEF 64   /* Udp payload bytes */
+#define PROBE_SIZE_MAX 8192
+#define PROBE_BUF_SIZE (PROBE_SIZE_MAX + 128) /* Room for ip/icmp headers */
+#define PROBE_ERR_SIZE 128
+#define PROBE_HTTP_EOH "\r\n\r\n" /* End of http request headers */
+
+#define PROBE_MAGIC 0x62746470  /* Udp payload magic */
+#define PROBE_UDP_HDR_SIZE 12   /* Magic, run id, probe index */
+#define PROBE_ICMP_HDR_SIZE 8   /* Type, code, checksum, id, sequence */
+
+#define ICMP_ECHO_REQUEST 8
+#define ICMP_ECHO_REPLY 0
+#define ICMP6_ECHO_REQUEST 128
+#define ICMP6_ECHO_REPLY 129
+
+/* Big-endian packing of probe headers */
+#define PUT16(b, v) ((b)[0] = (bitd_uint8)((v) >> 8),	\
+		     (b)[1] = (bitd_uint8)(v))
+#define PUT32(b, v) (PUT16((b), (v) >> 16), PUT16((b) + 2, (v)))
+#define GET16(b) ((bitd_uint16)(((b)[0] << 8) | (b)[1]))
+#define GET32(b) (((bitd_uint32)GET16(b) << 16) | GET16((b) + 2))
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+static bitd_task_inst_create_t task_inst_create;
+static bitd_task_inst_update_t task_inst_update;
+static bitd_task_inst_destroy_t task_inst_destroy;
+static bitd_task_inst_run_async_t task_inst_run_async;
+static bitd_task_inst_kill_t task_inst_kill;
+static ttlog_keyid s_log_keyid;
+
+typedef enum {
+    probe_type_icmp,        /* icmp-ping */
+    probe_type_udp,         /* udp-echo */
+    probe_type_tcp,         /* tcp-connect */
+    probe_type_echo_server  /* echo-server */
+} probe_type_t;
+
+/* A single probe of a run */
+struct probe_s {
+    bitd_uint64 tx_nsec;      /* Send timestamp */
+    bitd_uint64 rx_nsec;      /* Receive timestamp */
+    bitd_uint32 tx_key;       /* Send timestamp key */
+    bitd_boolean tx_kernel_p; /* Send timestamp is from the kernel */
+    bitd_boolean done_p;      /* Probe answered */
+    ts_socket_t sock;         /* Connecting socket, tcp only */
+    bitd_reactor_handle h;    /* Connecting socket handle, tcp only */
+};
+
+/* An echo server http connection */
+struct echo_conn_s {
+    struct echo_server_s *s;
+    bitd_socket_t sock;
+    bitd_reactor_handle h;
+    int eoh;                  /* Characters of PROBE_HTTP_EOH matched */
+    struct echo_conn_s *prev;
+    struct echo_conn_s *next;
+};
+
+/* An echo server. Owned by the reactor loop thread once started, so that
+   the task instance is updated or destroyed without waiting for it. */
+struct echo_server_s {
+    char *task_inst_name;
+    struct sockaddr_storage addr;
+    bitd_socket_t udp_sock;
+    bitd_socket_t tcp_sock;
+    bitd_reactor_handle udp_h;
+    bitd_reactor_handle tcp_h;
+    int http_status;         /* If set, answer tcp connections as http */
+    bitd_uint8 *buf;
+    struct echo_conn_s conns; /* List of http connections */
+};
+
+struct bitd_task_inst_s {
+    char *task_name;
+    char *task_inst_name;
+    mmr_task_inst_t mmr_task_inst_hdl;
+    probe_type_t type;
+    bitd_nvp_t args;
+
+    /* Probe arguments */
+    char *host;              /* In host or host:port format */
+    int port;                /* Port, if not part of host */
+    int count;               /* Number of probes per run */
+    bitd_uint32 interval;    /* Msecs between probes */
+    bitd_uint32 tmo;         /* Msecs to wait for the last answer */
+    int size;                /* Payload size */
+
+    /* Probe state. Datagram sockets are reused across runs. */
+    struct sockaddr_storage addr;
+    bitd_boolean resolved_p;
+    ts_socket_t sock;
+    bitd_boolean raw_p;      /* Icmp over a raw socket */
+    bitd_uint16 icmp_id;     /* Icmp id, raw sockets only */
+    bitd_uint16 seq;         /* Icmp sequence of the first probe of a run */
+    bitd_uint32 tx_key;      /* Next send timestamp key */
+    bitd_uint32 run_id;
+    int n_sent;
+    int n_received;
+    struct probe_s *probes;
+    bitd_uint8 *buf;
+    char err[PROBE_ERR_SIZE];
+    bitd_boolean stopped_p;
+
+    /* Run state, on the reactor loop thread */
+    bitd_boolean busy_p;     /* Run in progress */
+    bitd_reactor_handle sock_h;  /* Datagram socket handle */
+    bitd_reactor_handle timer_h; /* Next probe, or last answer timeout */
+
+    /* Echo server state */
+    int http_status;         /* If set, answer tcp connections as http */
+    struct echo_server_s *server;
+};
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+static bitd_reactor_call_t probe_start;
+static bitd_reactor_call_t probe_abort;
+static bitd_reactor_call_t probe_free;
+static bitd_reactor_call_t probe_sync;
+static bitd_reactor_call_t echo_server_start;
+static bitd_reactor_call_t echo_server_stop;
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static mmr_task_t s_task_icmp, s_task_udp, s_task_tcp, s_task_echo_server;
+static bitd_uint16 s_icmp_id;
+static bitd_reactor_loop s_loop;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        bitd_module_load
+ *============================================================================
+ * Description:     Load the module.
+ * Parameters:
+ *     tags - the module tags
+ *
+ * Returns:      TRUE on success
+ */
+bitd_boolean bitd_module_load(mmr_module_t mmr_module,
+			      bitd_nvp_t tags,
+			      char *module_dir) {
+    bitd_task_api_t task_api;  /* The task image */
+
+    s_log_keyid = ttlog_register("bitd-probe");
+
+    /* The probe runs and the echo servers share a reactor loop */
+    bitd_reactor_init(0);
+    s_loop = bitd_reactor_loop_get();
+
+    /* The probe targets are resolved through the resolver cache */
+    bitd_resolve_init();
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    /* Raw icmp sockets see all echo replies. Tell ours apart by id. */
+    s_icmp_id = (bitd_uint16)bitd_random();
+
+    /* Initialize the task API structure to zero, in case we're not
+       implementing some APIs */
+    memset(&task_api, 0, sizeof(task_api));
+
+    /* Set up the task API structure */
+    task_api.task_inst_create = task_inst_create;
+    task_api.task_inst_update = task_inst_update;
+    task_api.task_inst_destroy = task_inst_destroy;
+    task_api.task_inst_run_async = task_inst_run_async;
+    task_api.task_inst_kill = task_inst_kill;
+
+    /* Register the tasks */
+    s_task_icmp = mmr_task_register(mmr_module, "icmp-ping", &task_api);
+    s_task_udp = mmr_task_register(mmr_module, "udp-echo", &task_api);
+    s_task_tcp = mmr_task_register(mmr_module, "tcp-connect", &task_api);
+    s_task_echo_server = mmr_task_register(mmr_module, "echo-server",
+					   &task_api);
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        bitd_module_unload
+ *============================================================================
+ * Description:     Unload the module, freeing all allocated resources
+ * Parameters:
+ * Returns:
+ */
+void bitd_module_unload(void) {
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    /* Unregister the tasks */
+    mmr_task_unregister(s_task_icmp);
+    mmr_task_unregister(s_task_udp);
+    mmr_task_unregister(s_task_tcp);
+    mmr_task_unregister(s_task_echo_server);
+
+    /* The destroyed task instances are freed on the reactor. Wait for
+       that, before the module code is unloaded. */
+    bitd_reactor_call(s_loop, probe_sync, NULL, TRUE);
+
+    ttlog_unregister(s_log_keyid);
+}
+
+
+/*
+ *============================================================================
+ *                        get_msec_arg
+ *============================================================================
+ * Description:     Get an argument expressed in seconds, as msecs
+ * Parameters:
+ * Returns:         TRUE if the argument is present and valid
+ */
+static bitd_boolean get_msec_arg(bitd_nvp_t args, char *name,
+				 bitd_uint32 *msec) {
+    int idx;
+
+    if (!bitd_nvp_lookup_elem(args, name, &idx)) {
+	return FALSE;
+    }
+
+    switch (args->e[idx].type) {
+    case bitd_type_int64:
+	if (args->e[idx].v.value_int64 >= 0) {
+	    *msec = (bitd_uint32)(args->e[idx].v.value_int64 * 1000);
+	    return TRUE;
+	}
+	break;
+    case bitd_type_uint64:
+	*msec = (bitd_uint32)(args->e[idx].v.value_uint64 * 1000);
+	return TRUE;
+    case bitd_type_double:
+	if (args->e[idx].v.value_double >= 0) {
+	    *msec = (bitd_uint32)(args->e[idx].v.value_double * 1000);
+	    return TRUE;
+	}
+	break;
+    default:
+	break;
+    }
+
+    return FALSE;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_close
+ *============================================================================
+ * Description:     Close the probe socket. The next run reopens it.
+ * Parameters:
+ * Returns:
+ */
+static void probe_close(bitd_task_inst_t p) {
+
+    if (p->sock) {
+	ts_close(p->sock);
+	p->sock = NULL;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        probe_resolve
+ *============================================================================
+ * Description:     Resolve the probe target address
+ * Parameters:
+ * Returns:         TRUE on success
+ */
+static bitd_boolean probe_resolve(bitd_task_inst_t p) {
+    int ret;
+    char addr_str[128];
+
+    if (!p->host) {
+	snprintf(p->err, sizeof(p->err), "No host configured");
+	return FALSE;
+    }
+
+    ret = bitd_resolve_hostport_cached(&p->addr, sizeof(p->addr), p->host);
+    if (ret) {
+	snprintf(p->err, sizeof(p->err), "Could not resolve %s: %s",
+		 p->host, bitd_gai_strerror(ret));
+	return FALSE;
+    }
+
+    if (p->port) {
+	*bitd_sin_port(&p->addr) = htons(p->port);
+    }
+    if (p->type != probe_type_icmp && !*bitd_sin_port(&p->addr)) {
+	snprintf(p->err, sizeof(p->err), "No port configured");
+	return FALSE;
+    }
+
+    if (ttlog_enabled(log_level_trace, s_log_keyid)) {
+	inet_ntop(bitd_sin_family(&p->addr),
+		  bitd_sin_addr(&p->addr),
+		  addr_str, sizeof(addr_str));
+	ttlog(log_level_trace, s_log_keyid,
+	      "%s: Resolved %s as [%s]:%d",
+	      p->task_inst_name, p->host, addr_str,
+	      ntohs(*bitd_sin_port(&p->addr)));
+    }
+
+    p->resolved_p = TRUE;
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_open
+ *============================================================================
+ * Description:     Open and connect the datagram socket of an icmp-ping
+ *     or udp-echo instance. Icmp uses unprivileged icmp datagram sockets,
+ *     and falls back to raw sockets when those are not permitted.
+ * Parameters:
+ * Returns:         TRUE on success
+ */
+static bitd_boolean probe_open(bitd_task_inst_t p) {
+    int family = bitd_sin_family(&p->addr);
+    int protocol;
+
+    p->raw_p = FALSE;
+    if (p->type == probe_type_icmp) {
+	protocol = (family == AF_INET6) ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+	p->sock = ts_socket(family, SOCK_DGRAM, protocol);
+	if (!p->sock) {
+	    p->sock = ts_socket(family, SOCK_RAW, protocol);
+	    p->raw_p = TRUE;
+	}
+    } else {
+	p->sock = ts_socket(family, SOCK_DGRAM, IPPROTO_UDP);
+    }
+    if (!p->sock) {
+	snprintf(p->err, sizeof(p->err), "Could not open socket: %s",
+		 strerror(bitd_socket_errno));
+	return FALSE;
+    }
+
+    /* Connect the socket, so it only sees traffic from the target */
+    if (ts_connect(p->sock, (struct sockaddr *)&p->addr,
+		   bitd_sockaddrlen(&p->addr)) < 0 ||
+	bitd_set_blocking(ts_get_sock_fd(p->sock), FALSE) < 0) {
+	snprintf(p->err, sizeof(p->err), "Could not connect socket: %s",
+		 strerror(bitd_socket_errno));
+	probe_close(p);
+	return FALSE;
+    }
+
+    /* Kernel send timestamp keys start from zero on a new socket */
+    p->tx_key = 0;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: Opened %s socket",
+	  p->task_inst_name, p->raw_p ? "raw" : "datagram");
+
+    return TRUE;
+}
+
+
+/*
+ *============================================================================
+ *                        icmp_cksum
+ *============================================================================
+ * Description:     Compute the internet checksum
+ * Parameters:
+ * Returns:         The checksum, in host order
+ */
+static bitd_uint16 icmp_cksum(bitd_uint8 *buf, int len) {
+    bitd_uint32 sum = 0;
+
+    for (; len > 1; len -= 2, buf += 2) {
+	sum += GET16(buf);
+    }
+    if (len) {
+	sum += buf[0] << 8;
+    }
+    while (sum >> 16) {
+	sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (bitd_uint16)~sum;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_send
+ *============================================================================
+ * Description:     Send probe idx. Tcp probes start a connection.
+ * Parameters:
+ * Returns:         0 on success, -1 on error
+ */
+static int probe_send(bitd_task_inst_t p, int idx) {
+    struct probe_s *pr = &p->probes[idx];
+    bitd_uint8 *b = p->buf;
+    int len, ret, i;
+
+    memset(pr, 0, sizeof(*pr));
+
+    switch (p->type) {
+    case probe_type_icmp:
+	len = PROBE_ICMP_HDR_SIZE + p->size;
+	b[0] = (bitd_sin_family(&p->addr) == AF_INET6) ?
+	    ICMP6_ECHO_REQUEST : ICMP_ECHO_REQUEST;
+	b[1] = 0;
+	PUT16(b + 2, 0);
+	PUT16(b + 4, p->icmp_id);
+	PUT16(b + 6, (bitd_uint16)(p->seq + idx));
+	if (p->size >= 4) {
+	    PUT32(b + 8, p->run_id);
+	}
+	for (i = 12; i < len; i++) {
+	    b[i] = (bitd_uint8)i;
+	}
+	if (bitd_sin_family(&p->addr) == AF_INET) {
+	    /* The kernel computes the icmpv6 and the datagram socket
+	       checksums, but not the raw icmp checksum */
+	    PUT16(b + 2, icmp_cksum(b, len));
+	}
+	break;
+    case probe_type_udp:
+	len = p->size;
+	PUT32(b, PROBE_MAGIC);
+	PUT32(b + 4, p->run_id);
+	PUT32(b + 8, (bitd_uint32)idx);
+	for (i = PROBE_UDP_HDR_SIZE; i < len; i++) {
+	    b[i] = (bitd_uint8)i;
+	}
+	break;
+    case probe_type_tcp:
+	pr->sock = ts_socket(bitd_sin_family(&p->addr),
+			     SOCK_STREAM, IPPROTO_TCP);
+	if (!pr->sock ||
+	    bitd_set_blocking(ts_get_sock_fd(pr->sock), FALSE) < 0) {
+	    snprintf(p->err, sizeof(p->err), "Could not open socket: %s",
+		     strerror(bitd_socket_errno));
+	    goto error;
+	}
+	pr->tx_nsec = bitd_get_time_nsec();
+	ret = ts_connect(pr->sock, (struct sockaddr *)&p->addr,
+			 bitd_sockaddrlen(&p->addr));
+	if (ret < 0 &&
+	    bitd_socket_errno != BITD_EINPROGRESS &&
+	    bitd_socket_errno != BITD_EWOULDBLOCK) {
+	    /* Refused right away. Count the probe as lost. */
+	    snprintf(p->err, sizeof(p->err), "Connect failed: %s",
+		     strerror(bitd_socket_errno));
+	    ts_close(pr->sock);
+	    pr->sock = NULL;
+	}
+	return 0;
+    default:
+	return -1;
+    }
+
+    /* The software timestamp is used if no kernel timestamp arrives */
+    pr->tx_nsec = bitd_get_time_nsec();
+    ret = ts_send(p->sock, b, len, 0);
+    if (ret < 0) {
+	if (bitd_socket_errno == BITD_EAGAIN ||
+	    bitd_socket_errno == BITD_EWOULDBLOCK ||
+	    bitd_socket_errno == BITD_ECONNREFUSED) {
+	    /* Count the probe as lost, but the timestamp keys are now
+	       out of step - reopen the socket on the next run */
+	    snprintf(p->err, sizeof(p->err), "Send failed: %s",
+		     strerror(bitd_socket_errno));
+	    p->resolved_p = FALSE;
+	    return 0;
+	}
+	snprintf(p->err, sizeof(p->err), "Send failed: %s",
+		 strerror(bitd_socket_errno));
+	goto error;
+    }
+    pr->tx_key = p->tx_key++;
+
+    return 0;
+
+ error:
+    /* Re-resolve and reopen on the next run */
+    p->resolved_p = FALSE;
+    return -1;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_tx_drain
+ *============================================================================
+ * Description:     Match the queued send timestamps to the probes
+ * Parameters:
+ * Returns:
+ */
+static void probe_tx_drain(bitd_task_inst_t p, int n_sent) {
+    ts_timestamp_t ts;
+    struct probe_s *pr;
+    int i;
+
+    while (p->sock && ts_get_tstamp_tx(p->sock, &ts) >= 0 && ts.flags) {
+	if (!(ts.flags & TS_FLAG_SND)) {
+	    continue;
+	}
+	for (i = 0; i < n_sent; i++) {
+	    pr = &p->probes[i];
+
+	    /* The timestamp should not predate the software timestamp,
+	       taken before the send */
+	    if (pr->tx_key == ts.seq && !pr->tx_kernel_p &&
+		ts.tstamp >= pr->tx_nsec) {
+		pr->tx_nsec = ts.tstamp;
+		pr->tx_kernel_p = TRUE;
+		break;
+	    }
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        probe_recv
+ *============================================================================
+ * Description:     Receive the answers to the icmp and udp probes
+ * Parameters:
+ * Returns:
+ */
+static void probe_recv(bitd_task_inst_t p, int n_sent) {
+    ts_timestamp_t ts;
+    bitd_uint8 *b;
+    int len, idx;
+    bitd_uint8 reply_type;
+
+    for (;;) {
+	len = ts_recv(p->sock, p->buf, PROBE_BUF_SIZE, 0, &ts);
+	if (len < 0) {
+	    if (bitd_socket_errno != BITD_EAGAIN &&
+		bitd_socket_errno != BITD_EWOULDBLOCK) {
+		/* E.g., port unreachable on udp */
+		snprintf(p->err, sizeof(p->err), "Receive failed: %s",
+			 strerror(bitd_socket_errno));
+	    }
+	    return;
+	}
+	b = p->buf;
+
+	if (p->type == probe_type_icmp) {
+	    if (p->raw_p && bitd_sin_family(&p->addr) == AF_INET) {
+		/* Skip the ip header */
+		if (len < 20 || len < (b[0] & 0x0f) * 4) {
+		    continue;
+		}
+		len -= (b[0] & 0x0f) * 4;
+		b += (b[0] & 0x0f) * 4;
+	    }
+	    if (len < PROBE_ICMP_HDR_SIZE) {
+		continue;
+	    }
+
+	    /* Raw sockets also see our own requests, on loopback, and
+	       the echo replies of other processes */
+	    reply_type = (bitd_sin_family(&p->addr) == AF_INET6) ?
+		ICMP6_ECHO_REPLY : ICMP_ECHO_REPLY;
+	    if (b[0] != reply_type ||
+		(p->raw_p && GET16(b + 4) != p->icmp_id)) {
+		continue;
+	    }
+	    if (p->size >= 4 &&
+		(len < PROBE_ICMP_HDR_SIZE + 4 || GET32(b + 8) != p->run_id)) {
+		/* Late reply to an earlier run */
+		continue;
+	    }
+	    idx = (bitd_uint16)(GET16(b + 6) - p->seq);
+	} else {
+	    if (len < PROBE_UDP_HDR_SIZE ||
+		GET32(b) != PROBE_MAGIC || GET32(b + 4) != p->run_id) {
+		continue;
+	    }
+	    idx = (int)GET32(b + 8);
+	}
+
+	if (idx < 0 || idx >= n_sent || p->probes[idx].done_p) {
+	    continue;
+	}
+	p->probes[idx].rx_nsec = ts.tstamp;
+	p->probes[idx].done_p = TRUE;
+	p->n_received++;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        probe_connected
+ *============================================================================
+ * Description:     Complete a tcp probe, whose socket became writable
+ * Parameters:
+ * Returns:
+ */
+static void probe_connected(bitd_task_inst_t p, int idx) {
+    struct probe_s *pr = &p->probes[idx];
+    int err = 0;
+    bitd_socklen_t len = sizeof(err);
+#ifdef TCP_INFO
+    struct tcp_info ti;
+#endif
+
+    pr->rx_nsec = bitd_get_time_nsec();
+
+    if (ts_getsockopt(pr->sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+	err = bitd_socket_errno;
+    }
+
+    if (err) {
+	snprintf(p->err, sizeof(p->err), "Connect failed: %s", strerror(err));
+    } else {
+#ifdef TCP_INFO
+	/* The kernel measures the handshake round-trip, without our
+	   scheduling delay */
+	len = sizeof(ti);
+	if (!ts_getsockopt(pr->sock, IPPROTO_TCP, TCP_INFO, &ti, &len) &&
+	    ti.tcpi_rtt && 1000ULL*ti.tcpi_rtt < pr->rx_nsec - pr->tx_nsec) {
+	    pr->tx_nsec = pr->rx_nsec - 1000ULL*ti.tcpi_rtt;
+	    pr->tx_kernel_p = TRUE;
+	}
+#endif
+	pr->done_p = TRUE;
+	p->n_received++;
+    }
+
+    ts_close(pr->sock);
+    pr->sock = NULL;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_report
+ *============================================================================
+ * Description:     Report the rtt min/avg/max/jitter in msecs, and the
+ *     loss percentage. Jitter is the mean rtt difference between
+ *     consecutive answers.
+ * Parameters:
+ * Returns:
+ */
+static void probe_report(bitd_task_inst_t p, int n_sent) {
+    mmr_task_inst_results_t results;
+    bitd_nvp_t nvp = NULL;
+    bitd_value_t v;
+    bitd_uint64 rtt, rtt_min = 0, rtt_max = 0, rtt_sum = 0, rtt_prev = 0;
+    bitd_uint64 jitter_sum = 0;
+    int i, n = 0;
+
+    for (i = 0; i < n_sent; i++) {
+	if (!p->probes[i].done_p) {
+	    continue;
+	}
+	rtt = 0;
+	if (p->probes[i].rx_nsec > p->probes[i].tx_nsec) {
+	    rtt = p->probes[i].rx_nsec - p->probes[i].tx_nsec;
+	}
+	if (!n || rtt < rtt_min) {
+	    rtt_min = rtt;
+	}
+	if (!n || rtt > rtt_max) {
+	    rtt_max = rtt;
+	}
+	if (n) {
+	    jitter_sum += (rtt > rtt_prev) ? rtt - rtt_prev : rtt_prev - rtt;
+	}
+	rtt_sum += rtt;
+	rtt_prev = rtt;
+	n++;
+    }
+
+    v.value_int64 = n_sent;
+    bitd_nvp_add_elem(&nvp, "sent", &v, bitd_type_int64);
+    v.value_int64 = n;
+    bitd_nvp_add_elem(&nvp, "received", &v, bitd_type_int64);
+    v.value_double = n_sent ? 100.0 * (n_sent - n) / n_sent : 0;
+    bitd_nvp_add_elem(&nvp, "loss", &v, bitd_type_double);
+
+    if (n) {
+	v.value_double = rtt_min / 1e6;
+	bitd_nvp_add_elem(&nvp, "rtt-min", &v, bitd_type_double);
+	v.value_double = rtt_sum / 1e6 / n;
+	bitd_nvp_add_elem(&nvp, "rtt-avg", &v, bitd_type_double);
+	v.value_double = rtt_max / 1e6;
+	bitd_nvp_add_elem(&nvp, "rtt-max", &v, bitd_type_double);
+	v.value_double = (n > 1) ? jitter_sum / 1e6 / (n - 1) : 0;
+	bitd_nvp_add_elem(&nvp, "rtt-jitter", &v, bitd_type_double);
+    }
+
+    memset(&results, 0, sizeof(results));
+    results.output.type = bitd_type_nvp;
+    results.output.v.value_nvp = nvp;
+    if (p->err[0]) {
+	results.error.type = bitd_type_string;
+	results.error.v.value_string = p->err;
+    }
+
+    /* Like ping, fail if nothing answered */
+    results.exit_code = n ? 0 : -1;
+
+    mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
+
+    bitd_nvp_free(nvp);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_report_error
+ *============================================================================
+ * Description:     Report a run that sent no probes
+ * Parameters:
+ * Returns:
+ */
+static void probe_report_error(bitd_task_inst_t p) {
+    mmr_task_inst_results_t results;
+
+    TTLOG(log_level_debug, s_log_keyid,
+	  "%s: %s", p->task_inst_name, p->err);
+
+    memset(&results, 0, sizeof(results));
+    results.error.type = bitd_type_string;
+    results.error.v.value_string = p->err;
+    results.exit_code = -1;
+    mmr_task_inst_report_results(p->mmr_task_inst_hdl, &results);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_stop
+ *============================================================================
+ * Description:     Unregister the handles of the run, and count the
+ *     unanswered probes as lost. Runs on the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void probe_stop(bitd_task_inst_t p) {
+    int i;
+
+    if (p->sock_h) {
+	bitd_reactor_remove(p->sock_h);
+	p->sock_h = NULL;
+    }
+    if (p->timer_h) {
+	bitd_reactor_remove(p->timer_h);
+	p->timer_h = NULL;
+    }
+
+    for (i = 0; i < p->n_sent; i++) {
+	if (p->probes[i].h) {
+	    bitd_reactor_remove(p->probes[i].h);
+	    p->probes[i].h = NULL;
+	}
+	if (p->probes[i].sock) {
+	    ts_close(p->probes[i].sock);
+	    p->probes[i].sock = NULL;
+	}
+    }
+
+    if (p->type != probe_type_tcp) {
+	probe_tx_drain(p, p->n_sent);
+    }
+
+    if (ttlog_enabled(log_level_trace, s_log_keyid)) {
+	for (i = 0; i < p->n_sent; i++) {
+	    ttlog(log_level_trace, s_log_keyid,
+		  "%s: Probe %d: %s, tx %llu (%s), rx %llu",
+		  p->task_inst_name, i,
+		  p->probes[i].done_p ? "answered" : "lost",
+		  p->probes[i].tx_nsec,
+		  p->probes[i].tx_kernel_p ? "kernel" : "software",
+		  p->probes[i].rx_nsec);
+	}
+    }
+
+    /* Icmp sequence numbers keep increasing across runs */
+    p->seq += p->n_sent;
+    p->busy_p = FALSE;
+}
+
+
+/*
+ *============================================================================
+ *                        probe_done
+ *============================================================================
+ * Description:     End the run, report its results, and complete it. Runs
+ *     on the reactor loop thread. The instance may be destroyed once the
+ *     run completes, so it is not touched afterwards.
+ * Parameters:
+ * Returns:
+ */
+static void probe_done(bitd_task_inst_t p) {
+
+    probe_stop(p);
+
+    if (!p->n_sent) {
+	probe_report_error(p);
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    probe_report(p, p->n_sent);
+    mmr_task_inst_run_complete(p->mmr_task_inst_hdl, 0);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_check_done
+ *============================================================================
+ * Description:     End the run early, once all probes are sent and answered
+ * Parameters:
+ * Returns:
+ */
+static void probe_check_done(bitd_task_inst_t p) {
+
+    if (p->n_sent == p->count && p->n_received == p->n_sent) {
+	probe_done(p);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        probe_sock_cb
+ *============================================================================
+ * Description:     Receive the answers to the icmp and udp probes, and the
+ *     kernel send timestamps queued on the socket
+ * Parameters:
+ * Returns:
+ */
+static void probe_sock_cb(bitd_reactor_handle h, bitd_uint32 events,
+			  void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    probe_recv(p, p->n_sent);
+    probe_tx_drain(p, p->n_sent);
+    probe_check_done(p);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_connect_cb
+ *============================================================================
+ * Description:     Complete the tcp probe whose socket became writable
+ * Parameters:
+ * Returns:
+ */
+static void probe_connect_cb(bitd_reactor_handle h, bitd_uint32 events,
+			     void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+    int i;
+
+    for (i = 0; i < p->n_sent; i++) {
+	if (p->probes[i].h == h) {
+	    bitd_reactor_remove(h);
+	    p->probes[i].h = NULL;
+	    probe_connected(p, i);
+	    break;
+	}
+    }
+
+    probe_check_done(p);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_next
+ *============================================================================
+ * Description:     Send the next probe, and arm the timer for the probe
+ *     after it, or for the timeout after the last one
+ * Parameters:
+ * Returns:
+ */
+static void probe_next(bitd_task_inst_t p) {
+    struct probe_s *pr;
+
+    if (probe_send(p, p->n_sent) < 0) {
+	probe_done(p);
+	return;
+    }
+    pr = &p->probes[p->n_sent++];
+
+    if (pr->sock) {
+	/* The tcp probe is answered when its socket becomes writable */
+	pr->h = bitd_reactor_fd_add(s_loop, ts_get_sock_fd(pr->sock),
+				    BITD_REACTOR_EV_WRITE,
+				    probe_connect_cb, p);
+    } else if (p->type != probe_type_tcp) {
+	probe_tx_drain(p, p->n_sent);
+    }
+
+    bitd_reactor_timer_set(p->timer_h,
+			   p->n_sent < p->count ? p->interval : p->tmo);
+
+    probe_check_done(p);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_timer_cb
+ *============================================================================
+ * Description:     Send the next probe, or end the run at the timeout
+ *     after the last probe
+ * Parameters:
+ * Returns:
+ */
+static void probe_timer_cb(bitd_reactor_handle h, bitd_uint32 events,
+			   void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    if (p->n_sent < p->count) {
+	probe_next(p);
+    } else {
+	probe_done(p);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        probe_start
+ *============================================================================
+ * Description:     Register the run handles, and send the first probe. Runs
+ *     on the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void probe_start(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    if (p->stopped_p) {
+	/* Killed before the run started */
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    p->run_id++;
+    p->n_sent = 0;
+    p->n_received = 0;
+
+    if (p->sock) {
+	/* Discard late answers and timestamps of earlier runs */
+	probe_recv(p, 0);
+	probe_tx_drain(p, 0);
+	p->err[0] = 0;
+
+	p->sock_h = bitd_reactor_fd_add(s_loop, ts_get_sock_fd(p->sock),
+					BITD_REACTOR_EV_READ,
+					probe_sock_cb, p);
+    }
+    p->timer_h = bitd_reactor_timer_add(s_loop, probe_timer_cb, p);
+    p->busy_p = TRUE;
+
+    probe_next(p);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_abort
+ *============================================================================
+ * Description:     Abort the run, and complete it without results. Runs on
+ *     the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void probe_abort(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    if (!p->busy_p) {
+	/* Not started yet, or already completed */
+	return;
+    }
+
+    probe_stop(p);
+    mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_free
+ *============================================================================
+ * Description:     Free the instance. Runs on the reactor loop thread,
+ *     after the calls queued for the instance before it.
+ * Parameters:
+ * Returns:
+ */
+static void probe_free(void *cookie) {
+    bitd_task_inst_t p = (bitd_task_inst_t)cookie;
+
+    /* The run has stopped, so the socket is not registered */
+    probe_close(p);
+
+    bitd_nvp_free(p->args);
+    free(p->host);
+    free(p->probes);
+    free(p->buf);
+    free(p);
+}
+
+
+/*
+ *============================================================================
+ *                        probe_sync
+ *============================================================================
+ * Description:     Nothing to do. Waiting for it on the reactor loop waits
+ *     for the calls queued before it.
+ * Parameters:
+ * Returns:
+ */
+static void probe_sync(void *cookie) {
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_udp_cb
+ *============================================================================
+ * Description:     Echo the udp datagrams back to their senders
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_udp_cb(bitd_reactor_handle h, bitd_uint32 events,
+			       void *cookie) {
+    struct echo_server_s *s = (struct echo_server_s *)cookie;
+    struct sockaddr_storage from;
+    bitd_socklen_t fromlen;
+    int len;
+
+    for (;;) {
+	fromlen = sizeof(from);
+	len = bitd_recvfrom(s->udp_sock, s->buf, PROBE_BUF_SIZE, 0,
+			    &from, &fromlen);
+	if (len < 0) {
+	    break;
+	}
+	bitd_sendto(s->udp_sock, s->buf, len, 0, &from, fromlen);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        echo_conn_close
+ *============================================================================
+ * Description:     Close an http connection. Runs on the reactor loop
+ *     thread.
+ * Parameters:
+ * Returns:
+ */
+static void echo_conn_close(struct echo_conn_s *c) {
+
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    bitd_reactor_remove(c->h);
+    bitd_close(c->sock);
+    free(c);
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_http_cb
+ *============================================================================
+ * Description:     Answer each http request on the connection with the
+ *     configured status, and an empty body. The request headers are
+ *     scanned for their end; request bodies are not supported.
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_http_cb(bitd_reactor_handle h, bitd_uint32 events,
+				void *cookie) {
+    struct echo_conn_s *c = (struct echo_conn_s *)cookie;
+    struct echo_server_s *s = c->s;
+    char rsp[64];
+    int len, rsp_len, i;
+
+    len = bitd_recv(c->sock, s->buf, PROBE_BUF_SIZE, 0);
+    if (len < 0 && (bitd_socket_errno == EAGAIN ||
+		    bitd_socket_errno == EINTR)) {
+	return;
+    }
+    if (len <= 0) {
+	/* Closed by the peer */
+	echo_conn_close(c);
+	return;
+    }
+
+    rsp_len = snprintf(rsp, sizeof(rsp),
+		       "HTTP/1.1 %d Probe\r\nContent-Length: 0\r\n\r\n",
+		       s->http_status);
+
+    for (i = 0; i < len; i++) {
+	if (s->buf[i] == PROBE_HTTP_EOH[c->eoh]) {
+	    c->eoh++;
+	} else {
+	    c->eoh = (s->buf[i] == '\r') ? 1 : 0;
+	}
+	if (c->eoh == sizeof(PROBE_HTTP_EOH) - 1) {
+	    c->eoh = 0;
+	    bitd_send(c->sock, rsp, rsp_len, 0);
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_tcp_cb
+ *============================================================================
+ * Description:     Accept the tcp connections, and close them right away -
+ *     or in http mode, serve them until the peer closes them
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_tcp_cb(bitd_reactor_handle h, bitd_uint32 events,
+			       void *cookie) {
+    struct echo_server_s *s = (struct echo_server_s *)cookie;
+    bitd_socket_t sock;
+    struct echo_conn_s *c;
+
+    while ((sock = bitd_accept(s->tcp_sock, NULL, NULL)) !=
+	   BITD_INVALID_SOCKID) {
+	if (!s->http_status || bitd_set_blocking(sock, FALSE) < 0) {
+	    bitd_close(sock);
+	    continue;
+	}
+
+	c = calloc(1, sizeof(*c));
+	c->s = s;
+	c->sock = sock;
+	c->h = bitd_reactor_fd_add(s_loop, sock,
+				   BITD_REACTOR_EV_READ,
+				   echo_server_http_cb, c);
+	c->next = s->conns.next;
+	c->prev = &s->conns;
+	c->next->prev = c;
+	s->conns.next = c;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_close_socks
+ *============================================================================
+ * Description:     Close the server sockets
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_close_socks(struct echo_server_s *s) {
+
+    if (s->udp_sock != BITD_INVALID_SOCKID) {
+	bitd_close(s->udp_sock);
+	s->udp_sock = BITD_INVALID_SOCKID;
+    }
+    if (s->tcp_sock != BITD_INVALID_SOCKID) {
+	bitd_close(s->tcp_sock);
+	s->tcp_sock = BITD_INVALID_SOCKID;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_start
+ *============================================================================
+ * Description:     Open the udp and tcp server sockets, and register them.
+ *     Runs on the reactor loop thread, after the stop of the server it
+ *     replaces, so the port is free again.
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_start(void *cookie) {
+    struct echo_server_s *s = (struct echo_server_s *)cookie;
+    int opt = 1;
+    int family = bitd_sin_family(&s->addr);
+
+    s->udp_sock = bitd_socket(family, SOCK_DGRAM, IPPROTO_UDP);
+    s->tcp_sock = bitd_socket(family, SOCK_STREAM, IPPROTO_TCP);
+    if (s->udp_sock == BITD_INVALID_SOCKID ||
+	s->tcp_sock == BITD_INVALID_SOCKID) {
+	goto error;
+    }
+
+    bitd_setsockopt(s->tcp_sock, SOL_SOCKET, SO_REUSEADDR,
+		    (char *)&opt, sizeof(opt));
+
+    if (bitd_bind(s->udp_sock, &s->addr, bitd_sockaddrlen(&s->addr)) < 0 ||
+	bitd_bind(s->tcp_sock, &s->addr, bitd_sockaddrlen(&s->addr)) < 0 ||
+	bitd_listen(s->tcp_sock, SOMAXCONN) < 0 ||
+	bitd_set_blocking(s->udp_sock, FALSE) < 0 ||
+	bitd_set_blocking(s->tcp_sock, FALSE) < 0) {
+	goto error;
+    }
+
+    s->udp_h = bitd_reactor_fd_add(s_loop, s->udp_sock,
+				   BITD_REACTOR_EV_READ,
+				   echo_server_udp_cb, s);
+    s->tcp_h = bitd_reactor_fd_add(s_loop, s->tcp_sock,
+				   BITD_REACTOR_EV_READ,
+				   echo_server_tcp_cb, s);
+    return;
+
+ error:
+    TTLOG(log_level_err, s_log_keyid,
+	  "%s: Could not open echo server on port %d: %s",
+	  s->task_inst_name, ntohs(*bitd_sin_port(&s->addr)),
+	  strerror(bitd_socket_errno));
+    echo_server_close_socks(s);
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_stop
+ *============================================================================
+ * Description:     Unregister and close the server sockets and the http
+ *     connections, and free the server. Runs on the reactor loop thread.
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_stop(void *cookie) {
+    struct echo_server_s *s = (struct echo_server_s *)cookie;
+
+    if (s->udp_h) {
+	bitd_reactor_remove(s->udp_h);
+    }
+    if (s->tcp_h) {
+	bitd_reactor_remove(s->tcp_h);
+    }
+    while (s->conns.next != &s->conns) {
+	echo_conn_close(s->conns.next);
+    }
+    echo_server_close_socks(s);
+
+    free(s->task_inst_name);
+    free(s->buf);
+    free(s);
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_close
+ *============================================================================
+ * Description:     Stop the echo server on the reactor. Called with the
+ *     module manager lock held, so it does not wait for the reactor.
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_close(bitd_task_inst_t p) {
+
+    if (p->server) {
+	bitd_reactor_call(s_loop, echo_server_stop, p->server, FALSE);
+	p->server = NULL;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        echo_server_open
+ *============================================================================
+ * Description:     Start serving the configured port on the reactor
+ * Parameters:
+ * Returns:
+ */
+static void echo_server_open(bitd_task_inst_t p) {
+    struct echo_server_s *s;
+
+    if (!p->host) {
+	/* Serve all local ip4 addresses */
+	p->host = strdup("0.0.0.0");
+    }
+    if (!probe_resolve(p)) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: %s", p->task_inst_name, p->err);
+	return;
+    }
+
+    /* The server keeps its own copy of the config, since the reactor
+       starts it after this returns */
+    s = calloc(1, sizeof(*s));
+    s->task_inst_name = strdup(p->task_inst_name);
+    s->addr = p->addr;
+    s->udp_sock = BITD_INVALID_SOCKID;
+    s->tcp_sock = BITD_INVALID_SOCKID;
+    s->http_status = p->http_status;
+    s->buf = malloc(PROBE_BUF_SIZE);
+    s->conns.next = &s->conns;
+    s->conns.prev = &s->conns;
+
+    p->server = s;
+    bitd_reactor_call(s_loop, echo_server_start, s, FALSE);
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_create
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+bitd_task_inst_t task_inst_create(char *task_name,
+				  char *task_inst_name,
+				  mmr_task_inst_t mmr_task_inst_hdl,
+				  bitd_nvp_t args,
+				  bitd_nvp_t tags) {
+    bitd_task_inst_t p;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", task_inst_name, __FUNCTION__);
+
+    p = calloc(1, sizeof(*p));
+
+    p->task_name = task_name;
+    p->task_inst_name = task_inst_name;
+    p->mmr_task_inst_hdl = mmr_task_inst_hdl;
+
+    if (!strcmp(task_name, "icmp-ping")) {
+	p->type = probe_type_icmp;
+    } else if (!strcmp(task_name, "udp-echo")) {
+	p->type = probe_type_udp;
+    } else if (!strcmp(task_name, "tcp-connect")) {
+	p->type = probe_type_tcp;
+    } else {
+	p->type = probe_type_echo_server;
+    }
+
+    p->buf = malloc(PROBE_BUF_SIZE);
+    p->icmp_id = s_icmp_id++;
+
+    /* Call the update routine to set further configuration */
+    task_inst_update(p, args, tags);
+
+    return p;
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_update
+ *============================================================================
+ * Description:     Guaranteed to be called only when run() has stopped
+ * Parameters:
+ * Returns:
+ */
+void task_inst_update(bitd_task_inst_t p,
+		      bitd_nvp_t args,
+		      bitd_nvp_t tags) {
+    char *buf = NULL;
+    int idx;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    /* Stop the instance */
+    if (p->type == probe_type_echo_server) {
+	echo_server_close(p);
+    }
+    probe_close(p);
+    p->resolved_p = FALSE;
+    p->stopped_p = FALSE;
+
+    /* Save the args */
+    bitd_nvp_free(p->args);
+    p->args = bitd_nvp_clone(args);
+
+    /* Log the args */
+    if (p->args && ttlog_enabled(log_level_trace, s_log_keyid)) {
+	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
+	ttlog(log_level_trace, s_log_keyid,
+	      "%s: Args:\n%s", p->task_inst_name, buf);
+	free(buf);
+    }
+
+    /* Parse the args */
+    free(p->host);
+    p->host = NULL;
+    if (bitd_nvp_lookup_elem(args, "host", &idx) &&
+	args->e[idx].type == bitd_type_string &&
+	args->e[idx].v.value_string) {
+	p->host = strdup(args->e[idx].v.value_string);
+    }
+
+    p->port = 0;
+    if (bitd_nvp_lookup_elem(args, "port", &idx)) {
+	if (args->e[idx].type == bitd_type_int64 &&
+	    args->e[idx].v.value_int64 > 0 &&
+	    args->e[idx].v.value_int64 <= 0xffff) {
+	    p->port = (int)args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid port, ignored", p->task_inst_name);
+	}
+    }
+
+    p->count = PROBE_COUNT_DEF;
+    if (bitd_nvp_lookup_elem(args, "count", &idx)) {
+	if (args->e[idx].type == bitd_type_int64 &&
+	    args->e[idx].v.value_int64 > 0 &&
+	    args->e[idx].v.value_int64 <= PROBE_COUNT_MAX) {
+	    p->count = (int)args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid count, using default of %d",
+		  p->task_inst_name, PROBE_COUNT_DEF);
+	}
+    }
+
+    p->interval = 0;
+    if (bitd_nvp_lookup_elem(args, "interval", &idx) &&
+	!get_msec_arg(args, "interval", &p->interval)) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid interval, using default of 0",
+	      p->task_inst_name);
+    }
+
+    p->tmo = PROBE_TMO_DEF;
+    if (bitd_nvp_lookup_elem(args, "timeout", &idx) &&
+	!get_msec_arg(args, "timeout", &p->tmo)) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid timeout, using default of %d msecs",
+	      p->task_inst_name, PROBE_TMO_DEF);
+    }
+
+    p->size = (p->type == probe_type_icmp) ?
+	PROBE_ICMP_SIZE_DEF : PROBE_UDP_SIZE_DEF;
+    if (bitd_nvp_lookup_elem(args, "size", &idx)) {
+	if (args->e[idx].type == bitd_type_int64 &&
+	    args->e[idx].v.value_int64 >= 0 &&
+	    args->e[idx].v.value_int64 <= PROBE_SIZE_MAX) {
+	    p->size = (int)args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid size, using default of %d",
+		  p->task_inst_name, p->size);
+	}
+    }
+    p->http_status = 0;
+    if (bitd_nvp_lookup_elem(args, "http-status", &idx)) {
+	if (args->e[idx].type == bitd_type_int64 &&
+	    args->e[idx].v.value_int64 >= 100 &&
+	    args->e[idx].v.value_int64 <= 999) {
+	    p->http_status = (int)args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid http-status, ignored", p->task_inst_name);
+	}
+    }
+
+    if (p->type == probe_type_udp) {
+	/* Room for the probe header */
+	p->size = MAX(p->size, PROBE_UDP_HDR_SIZE);
+    }
+
+    free(p->probes);
+    p->probes = calloc(p->count, sizeof(*p->probes));
+
+    /* (Re)start the echo server */
+    if (p->type == probe_type_echo_server) {
+	echo_server_open(p);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_destroy
+ *============================================================================
+ * Description:     Free the instance on the reactor loop thread, once the
+ *     calls still queued for it are done. Called with the module manager
+ *     lock held, so it does not wait for the reactor.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_destroy(bitd_task_inst_t p) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    if (p->type == probe_type_echo_server) {
+	echo_server_close(p);
+    }
+
+    bitd_reactor_call(s_loop, probe_free, p, FALSE);
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_async
+ *============================================================================
+ * Description:     Open the probe socket, and hand the probes to the
+ *     reactor, without holding the worker thread. The run completes on
+ *     the reactor thread, when the probes are answered or time out.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_run_async(bitd_task_inst_t p, bitd_object_t *input) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+
+    if (p->type == probe_type_echo_server) {
+	/* The echo server runs on the reactor */
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, 0);
+	return;
+    }
+
+    if (p->stopped_p) {
+	mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+	return;
+    }
+
+    p->err[0] = 0;
+
+    /* Reopen the socket after a resolve or send error */
+    if (!p->resolved_p) {
+	probe_close(p);
+	if (!probe_resolve(p)) {
+	    goto error;
+	}
+    }
+    if (p->type != probe_type_tcp && !p->sock && !probe_open(p)) {
+	goto error;
+    }
+
+    bitd_reactor_call(s_loop, probe_start, p, FALSE);
+    return;
+
+ error:
+    probe_report_error(p);
+    mmr_task_inst_run_complete(p->mmr_task_inst_hdl, -1);
+}
+
+
+/*
+ *============================================================================
+ *                        task_inst_kill
+ *============================================================================
+ * Description:     Abort the run in progress, which completes the run.
+ *     Called with the module manager lock held, so it does not wait for
+ *     the reactor.
+ * Parameters:
+ * Returns:
+ */
+void task_inst_kill(bitd_task_inst_t p, int signo) {
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
+
+    p->stopped_p = TRUE;
+    bitd_reactor_call(s_loop, probe_abort, p, FALSE);
+}
@@ -17,6 +17,9 @@
 #include "bitd/format.h"
 #include "bitd/log.h"
 #include "bitd/msg.h"
+#include "bitd/spool.h"
+#include "bitd/reactor.h"
+#include "bitd/resolve.h"
 #include "bitd/module-api.h"
 
 #include <ctype.h>
@@ -32,12 +35,15 @@
  *****************************************************************************/
 #define PLAINTEXT_PORT_DEF 2003
 #define QUOTA_DEF 1000
+#define RECONNECT_TMO 30000 /* How long to wait before reconnecting */
+#define SPOOL_SIZE_DEF (64*1024*1024)
+#define SPOOL_READ_SIZE (256*1024) /* Max size of a spool read */
 
 #define SOCK_NOERROR(s, log_keyid)					\
     do {								\
 	ret = (s);							\
 	if (ret < 0) {							\
-	    ttlog(log_level_trace, log_keyid,				\
+	    TTLOG(log_level_trace, log_keyid,				\
 		  "%s:%d: Socket routine returned %d, (%s %d)\n",	\
 		  __FILE__, __LINE__,					\
 		  ret, strerror(bitd_socket_errno), bitd_socket_errno);	\
@@ -52,6 +58,7 @@ static bitd_task_inst_create_t task_inst_create;
 static bitd_task_inst_update_t task_inst_update;
 static bitd_task_inst_destroy_t task_inst_destroy;
 static bitd_task_inst_run_t task_inst_run;
+static bitd_task_inst_run_batch_t task_inst_run_batch;
 static bitd_task_inst_kill_t task_inst_kill;
 static ttlog_keyid s_log_keyid;
 
@@ -59,10 +66,22 @@ struct tcp_background_cb {
     ttlog_keyid log_keyid;
     char *name;
     char *server;          /* In host:port format */
-    bitd_event stop_ev;      /* The stop event */
     bitd_boolean stopped_p;
     bitd_uint32 quota;       /* Message queue quota */
     bitd_queue queue;        /* The results queue */
+    bitd_spool spool;        /* The overflow spool, or NULL */
+    bitd_reactor_loop loop;  /* The reactor loop serving the instance */
+    bitd_reactor_handle queue_h;  /* Queue handle, NULL if stopped */
+    bitd_reactor_handle sock_h;   /* Socket handle */
+    bitd_reactor_handle timer_h;  /* Reconnect timer handle */
+    struct sockaddr_storage sock_addr; /* The server address */
+    bitd_socket_t sock;
+    bitd_boolean sock_write_p;    /* Socket is writable */
+    bitd_msg msg;            /* Dequeued and partially transmitted message */
+    bitd_uint32 msg_size;    /* Size of the message */
+    bitd_uint32 msg_idx;     /* Index of where we stopped transmitting
+				inside the message */
+    bitd_boolean msg_spooled_p; /* Message was read from the spool */
 };
 
 struct bitd_task_inst_s {
@@ -70,7 +89,6 @@ struct bitd_task_inst_s {
     char *task_inst_name;
     mmr_task_inst_t mmr_task_inst_hdl;
     bitd_nvp_t args;
-    bitd_thread th;                      /* The background thread */
     struct tcp_background_cb tcb;
 };
 
@@ -84,7 +102,6 @@ struct map_output_cb {
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-static void tcp_background(void *thread_args);
 
 
 /*****************************************************************************
@@ -115,7 +132,13 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-sink-graphite");
 
-    ttlog(log_level_trace, s_log_keyid,
+    /* The instances share the reactor I/O threads */
+    bitd_reactor_init(0);
+
+    /* Reconnects resolve the server through the resolver cache */
+    bitd_resolve_init();
+
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Initialize the task API structure to zero, in case we're not 
@@ -127,8 +150,12 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
     task_api.task_inst_update = task_inst_update;
     task_api.task_inst_destroy = task_inst_destroy;
     task_api.task_inst_run = task_inst_run;
+    task_api.task_inst_run_batch = task_inst_run_batch;
     task_api.task_inst_kill = task_inst_kill;
 
+    /* Task instance runs can execute in parallel */
+    task_api.flags = BITD_TASK_FLAG_CONCURRENT_RUN;
+
     /* Register the task */
     s_task = mmr_task_register(mmr_module, "sink-graphite", &task_api);
 
@@ -145,7 +172,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -155,6 +182,332 @@ void bitd_module_unload(void) {
 } 
 
 
+/*
+ *============================================================================
+ *                        tcp_close
+ *============================================================================
+ * Description:     Close the socket, and arm the reconnect timer
+ * Parameters:    
+ * Returns:  
+ */
+static void tcp_close(struct tcp_background_cb *tcb, 
+		      bitd_uint32 reconnect_tmo) {
+
+    if (tcb->sock_h) {
+	bitd_reactor_remove(tcb->sock_h);
+	tcb->sock_h = NULL;
+    }
+    if (tcb->sock != BITD_INVALID_SOCKID) {
+	bitd_close(tcb->sock);
+	tcb->sock = BITD_INVALID_SOCKID;
+    }
+    tcb->sock_write_p = FALSE;
+
+    bitd_reactor_timer_set(tcb->timer_h, reconnect_tmo);
+} 
+
+
+/*
+ *============================================================================
+ *                        tcp_send
+ *============================================================================
+ * Description:     Dequeue results and write them to the socket, until
+ *     the socket would block or there are no more results
+ * Parameters:    
+ * Returns:  
+ */
+static void tcp_send(struct tcp_background_cb *tcb) {
+    int ret;
+
+    for (;;) {
+	if (!tcb->msg) {
+	    /* Dequeue a result */
+	    tcb->msg = bitd_msg_receive_w_tmo(tcb->queue, 0);
+	    tcb->msg_spooled_p = FALSE;
+	    if (!tcb->msg && tcb->spool) {
+		/* Queue is drained, read from the spool */
+		tcb->msg = bitd_spool_read(tcb->spool, SPOOL_READ_SIZE);
+		tcb->msg_spooled_p = tcb->msg ? TRUE : FALSE;
+	    }
+	    if (!tcb->msg) {
+		/* Queue is empty */
+		break;
+	    }
+	    tcb->msg_idx = 0;
+	    tcb->msg_size = bitd_msg_get_size(tcb->msg);
+	}
+
+	if (!tcb->sock_write_p) {
+	    break;
+	}
+
+	ret = bitd_send(tcb->sock, 
+			(char *)tcb->msg + tcb->msg_idx, 
+			tcb->msg_size - tcb->msg_idx, 
+			0);
+	if (ret < 0) {
+	    if (bitd_socket_errno == BITD_EAGAIN ||
+		bitd_socket_errno == BITD_EWOULDBLOCK) {
+		TTLOG(log_level_trace, s_log_keyid,
+		      "%s: Socket would block", tcb->name);
+		tcb->sock_write_p = FALSE;
+	    } else {
+		TTLOG(log_level_debug, s_log_keyid,
+		      "%s: Connect to %s error (%s %d), retry in up to %d secs", 
+		      tcb->name, tcb->server,
+		      strerror(bitd_socket_errno), 
+		      bitd_socket_errno,
+		      RECONNECT_TMO/1000);
+		tcp_close(tcb, RECONNECT_TMO);
+	    }
+	    break;
+	}
+
+	TTLOG(log_level_trace, s_log_keyid,
+	      "%s: Wrote %d bytes", tcb->name, ret);
+
+	tcb->msg_idx += ret;
+	if (tcb->msg_idx == tcb->msg_size) {
+	    /* Done sending */
+	    if (tcb->msg_spooled_p) {
+		bitd_spool_commit(tcb->spool);
+	    }
+	    bitd_msg_free(tcb->msg);
+	    tcb->msg = NULL;
+	}
+    }
+
+    /* Wait on the queue only when there is no message in flight, and
+       on the socket only when it would block */
+    bitd_reactor_set_events(tcb->queue_h, 
+			    tcb->msg ? 0 : BITD_REACTOR_EV_READ);
+    bitd_reactor_set_events(tcb->sock_h, 
+			    tcb->sock_write_p ? 0 : BITD_REACTOR_EV_WRITE);
+} 
+
+
+/*
+ *============================================================================
+ *                        sock_cb
+ *============================================================================
+ * Description:     Socket event callback
+ * Parameters:    
+ * Returns:  
+ */
+static void sock_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    if (events & BITD_REACTOR_EV_WRITE) {
+	/* Can write to the socket. Errors are detected by the write. */
+	tcb->sock_write_p = TRUE;
+    } else if (events & BITD_REACTOR_EV_ERROR) {
+	TTLOG(log_level_debug, s_log_keyid,
+	      "%s: Connection to %s lost, retry in up to %d secs", 
+	      tcb->name, tcb->server, RECONNECT_TMO/1000);
+	tcp_close(tcb, RECONNECT_TMO);
+    }
+
+    tcp_send(tcb);
+} 
+
+
+/*
+ *============================================================================
+ *                        queue_cb
+ *============================================================================
+ * Description:     Queue event callback
+ * Parameters:    
+ * Returns:  
+ */
+static void queue_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    tcp_send((struct tcp_background_cb *)cookie);
+} 
+
+
+/*
+ *============================================================================
+ *                        spool_cb
+ *============================================================================
+ * Description:     Send the spooled results. Runs on the reactor loop 
+ *     thread, after run() spools a result bypassing the queue.
+ * Parameters:    
+ * Returns:  
+ */
+static void spool_cb(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    if (tcb->queue_h) {
+	tcp_send(tcb);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        tcp_connect
+ *============================================================================
+ * Description:     (Re)create the socket, and start connecting it
+ * Parameters:    
+ * Returns:  
+ */
+static void tcp_connect(struct tcp_background_cb *tcb) {
+    int ret;
+
+    tcb->sock = bitd_socket(bitd_sin_family(&tcb->sock_addr), 
+			    SOCK_STREAM, IPPROTO_TCP);
+    if (tcb->sock == BITD_INVALID_SOCKID) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: Failed to create tcp socket, %s (errno %d)", 
+	      tcb->name, strerror(bitd_socket_errno), bitd_socket_errno);
+	goto end;
+    }
+
+    /* Make the socket non-blocking */
+    SOCK_NOERROR(bitd_set_blocking(tcb->sock, FALSE), tcb->log_keyid);
+
+    /* Connect the socket */
+    ret = bitd_connect(tcb->sock, &tcb->sock_addr, 
+		       bitd_sockaddrlen(&tcb->sock_addr));
+    if (ret < 0) {
+	if (bitd_socket_errno != BITD_EINPROGRESS &&
+	    bitd_socket_errno != BITD_EWOULDBLOCK) {
+	    SOCK_NOERROR(ret, tcb->log_keyid);
+	}
+    }
+
+    /* The socket is writable once connected */
+    tcb->sock_h = bitd_reactor_fd_add(tcb->loop, tcb->sock, 
+				      BITD_REACTOR_EV_WRITE, sock_cb, tcb);
+    return;
+
+ end:
+    tcp_close(tcb, RECONNECT_TMO);
+} 
+
+
+/*
+ *============================================================================
+ *                        timer_cb
+ *============================================================================
+ * Description:     Reconnect timer callback
+ * Parameters:    
+ * Returns:  
+ */
+static void timer_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    tcp_connect((struct tcp_background_cb *)cookie);
+} 
+
+
+/*
+ *============================================================================
+ *                        tcp_start
+ *============================================================================
+ * Description:     Register the queue, and connect to the server. Runs on
+ *     the reactor loop thread.
+ * Parameters:    
+ * Returns:  
+ */
+static void tcp_start(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", tcb->name, __FUNCTION__);
+
+    tcb->queue_h = bitd_reactor_queue_add(tcb->loop, tcb->queue, 
+					  queue_cb, tcb);
+    tcb->timer_h = bitd_reactor_timer_add(tcb->loop, timer_cb, tcb);
+
+    tcp_connect(tcb);
+} 
+
+
+/*
+ *============================================================================
+ *                        tcp_stop
+ *============================================================================
+ * Description:     Unregister from the reactor, and close the socket. Runs
+ *     on the reactor loop thread.
+ * Parameters:    
+ * Returns:  
+ */
+static void tcp_stop(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    if (!tcb->queue_h) {
+	/* Already stopped */
+	return;
+    }
+
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", tcb->name, __FUNCTION__);
+
+    tcp_close(tcb, BITD_FOREVER);
+
+    bitd_reactor_remove(tcb->queue_h);
+    bitd_reactor_remove(tcb->timer_h);
+    tcb->queue_h = NULL;
+    tcb->timer_h = NULL;
+
+    if (tcb->msg) {
+	if (!tcb->msg_spooled_p && tcb->spool) {
+	    /* Spool the unsent message. Spooled messages are not
+	       committed, and will be read again. */
+	    bitd_spool_append(tcb->spool, (char *)tcb->msg, tcb->msg_size);
+	}
+	bitd_msg_free(tcb->msg);
+	tcb->msg = NULL;
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        tcp_resolve
+ *============================================================================
+ * Description:     Resolve the server address
+ * Parameters:    
+ * Returns:         TRUE on success
+ */
+static bitd_boolean tcp_resolve(struct tcp_background_cb *tcb) {
+    int ret, port;
+    char addr_str[128];
+
+    if (!tcb->server) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: No server configured", 
+	      tcb->name);
+	return FALSE;
+    }
+
+    ret = bitd_resolve_hostport_cached(&tcb->sock_addr,
+				       sizeof(tcb->sock_addr),
+				       tcb->server);
+    if (ret) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: Could not resolve %s: ret %d, %s", 
+	      tcb->name, tcb->server, ret, bitd_gai_strerror(ret));
+	return FALSE;
+    }
+
+    /* Set the default port, if not already set */
+    port = ntohs(*bitd_sin_port(&tcb->sock_addr));
+    if (!port) {
+	port = PLAINTEXT_PORT_DEF;
+	*bitd_sin_port(&tcb->sock_addr) = htons(port);
+    }
+    
+    inet_ntop(bitd_sin_family(&tcb->sock_addr), 
+	      bitd_sin_addr(&tcb->sock_addr),
+	      addr_str, sizeof(addr_str));
+    
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: Resolved %s as [%s]:%d", 
+	  tcb->name, tcb->server, addr_str, port);
+
+    return TRUE;
+} 
+
+
 /*
  *============================================================================
  *                        task_inst_create
@@ -170,7 +523,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 				  bitd_nvp_t tags) {
     bitd_task_inst_t p;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -182,7 +535,8 @@ bitd_task_inst_t task_inst_create(char *task_name,
     /* Set up the tcp control block */
     p->tcb.name = strdup(task_inst_name);
     p->tcb.log_keyid = s_log_keyid;
-    p->tcb.stop_ev = bitd_event_create(BITD_EVENT_FLAG_POLL);
+    p->tcb.sock = BITD_INVALID_SOCKID;
+    p->tcb.loop = bitd_reactor_loop_get();
 
     /* Get the queue quota */
     p->tcb.quota = QUOTA_DEF;
@@ -199,6 +553,69 @@ bitd_task_inst_t task_inst_create(char *task_name,
 } 
 
 
+/*
+ *============================================================================
+ *                        spool_open
+ *============================================================================
+ * Description:     (Re)open the overflow spool. Results that don't fit in
+ *     the queue quota are spooled to disk, and survive a restart.
+ * Parameters:    
+ * Returns:  
+ */
+static void spool_open(bitd_task_inst_t p) {
+    bitd_uint64 spool_size = SPOOL_SIZE_DEF;
+    char *spool_dir = NULL;
+    int idx;
+
+    if (p->tcb.spool) {
+	bitd_spool_close(p->tcb.spool);
+	p->tcb.spool = NULL;
+    }
+
+    if (!bitd_nvp_lookup_elem(p->args, "spool-dir", &idx)) {
+	return;
+    }
+    if (p->args->e[idx].type != bitd_type_string ||
+	!p->args->e[idx].v.value_string ||
+	!p->args->e[idx].v.value_string[0]) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid spool-dir, not spooling\n", 
+	      p->task_inst_name);
+	return;
+    }
+    
+    /* Each task instance gets its own spool subdirectory */
+    spool_dir = malloc(strlen(p->args->e[idx].v.value_string) + 
+		       strlen(p->task_inst_name) + 2);
+    sprintf(spool_dir, "%s/%s", 
+	    p->args->e[idx].v.value_string, p->task_inst_name);
+
+    if (bitd_nvp_lookup_elem(p->args, "spool-size", &idx)) {
+	if (p->args->e[idx].type == bitd_type_int64 &&
+	    p->args->e[idx].v.value_int64 > 0) {
+	    spool_size = (bitd_uint64)p->args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid spool-size, using default of %d\n", 
+		  p->task_inst_name, SPOOL_SIZE_DEF);
+	}
+    }
+
+    p->tcb.spool = bitd_spool_open(spool_dir, 0, spool_size, 0);
+    if (!p->tcb.spool) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: Could not open spool %s", 
+	      p->task_inst_name, spool_dir);
+    } else if (bitd_spool_count(p->tcb.spool)) {
+	TTLOG(log_level_info, s_log_keyid,
+	      "%s: Recovered %u spooled results from %s", 
+	      p->task_inst_name, bitd_spool_count(p->tcb.spool), spool_dir);
+    }
+
+    free(spool_dir);
+} 
+
+
 /*
  *============================================================================
  *                        task_inst_update
@@ -213,21 +630,12 @@ void task_inst_update(bitd_task_inst_t p,
     char *buf = NULL;
     int idx;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
-    if (p->th) {
-	/* Stop the instance */
-	p->tcb.stopped_p = TRUE;
-	
-	/* Set the stop event */
-	bitd_event_set(p->tcb.stop_ev);
-
-	/* Wait for the thread to exit */
-	bitd_join_thread(p->th);
-	p->th = NULL;
-	p->tcb.stopped_p = FALSE;
-    }
+    /* Stop the instance */
+    bitd_reactor_call(p->tcb.loop, tcp_stop, &p->tcb, TRUE);
+    p->tcb.stopped_p = FALSE;
 
     /* Save the args and tags */
     bitd_nvp_free(p->args);
@@ -236,7 +644,7 @@ void task_inst_update(bitd_task_inst_t p,
     /* Log the args */
     if (p->args) {
 	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Args:\n%s", p->task_inst_name, buf);
 	free(buf);
     }
@@ -264,7 +672,7 @@ void task_inst_update(bitd_task_inst_t p,
 	    p->args->e[idx].v.value_int64 > 0) {
 	    p->tcb.quota = (bitd_uint32)p->args->e[idx].v.value_int64;
 	} else {
-	    ttlog(log_level_warn, s_log_keyid,
+	    TTLOG(log_level_warn, s_log_keyid,
 		  "%s: Invalid queue-size, using default of %d\n", 
 		  p->task_inst_name, QUOTA_DEF);
 	}
@@ -273,10 +681,13 @@ void task_inst_update(bitd_task_inst_t p,
     /* Change the queue quota */
     bitd_queue_set_quota(p->tcb.queue, p->tcb.quota);
 
-    /* (Re)create the background thread */
-    p->th = bitd_create_thread("plaintext tcp background", 
-			     tcp_background,
-			     0, 128000, (void *)&p->tcb);
+    /* (Re)open the spool */
+    spool_open(p);
+
+    /* (Re)start the instance */
+    if (tcp_resolve(&p->tcb)) {
+	bitd_reactor_call(p->tcb.loop, tcp_start, &p->tcb, TRUE);
+    }
 } 
 
 
@@ -290,22 +701,31 @@ void task_inst_update(bitd_task_inst_t p,
  */
 void task_inst_destroy(bitd_task_inst_t p) {
     bitd_uint32 count;
+    bitd_msg msg;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     /* Stop the instance */
     p->tcb.stopped_p = TRUE;
-
-    /* Set the stop event */
-    bitd_event_set(p->tcb.stop_ev);
-
-    /* Wait for the thread to exit */
-    bitd_join_thread(p->th);
+    bitd_reactor_call(p->tcb.loop, tcp_stop, &p->tcb, TRUE);
+
+    /* Move the queued results to the spool */
+    while (p->tcb.spool && 
+	   (msg = bitd_msg_receive_w_tmo(p->tcb.queue, 0))) {
+	if (!bitd_spool_append(p->tcb.spool, 
+			       (char *)msg, bitd_msg_get_size(msg))) {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: %s(): Spool full, dropping result", 
+		  p->task_inst_name, __FUNCTION__);
+	}
+	bitd_msg_free(msg);
+    }
+    bitd_spool_close(p->tcb.spool);
 
     count = bitd_queue_count(p->tcb.queue);
     if (count) {
-	ttlog(log_level_warn, s_log_keyid,
+	TTLOG(log_level_warn, s_log_keyid,
 	      "%s: %s(): Dropping %u results", 
 	      p->task_inst_name, __FUNCTION__, count);
     }
@@ -314,7 +734,6 @@ void task_inst_destroy(bitd_task_inst_t p) {
     bitd_queue_destroy(p->tcb.queue);
 
     bitd_nvp_free(p->args);
-    bitd_event_destroy(p->tcb.stop_ev);
 
     if (p->tcb.name) {
 	free(p->tcb.name);
@@ -326,268 +745,6 @@ void task_inst_destroy(bitd_task_inst_t p) {
 } 
 
 
-/*
- *============================================================================
- *                        tcp_background
- *============================================================================
- * Description:     Background thread that reads messages from queue
- *     and writes contents of messages to tcp socket
- * Parameters:    
- * Returns:  
- */
-void tcp_background(void *thread_arg) {
-    struct tcp_background_cb *tcb = (struct tcp_background_cb *)thread_arg;
-    int ret, port;
-    struct bitd_pollfd pfd[3];
-    int poll_tmo;
-    struct sockaddr_storage sock_addr;
-    bitd_socket_t sock = BITD_INVALID_SOCKID;
-    int sock_wait_tmo = 0;   /* How long to wait before reconnecting socket */
-    char *addr_str = NULL;
-    int addr_str_len;
-    bitd_boolean queue_read_p = FALSE, sock_write_p = FALSE;
-    bitd_msg msg = NULL; /* Received and partially transmitted message */
-    bitd_uint32 msg_size = 0; /* Size of the message */
-    bitd_uint32 msg_idx = 0;  /* Index of where we stopped transmitting inside
-			       the message */
-
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() started", tcb->name, __FUNCTION__);
-
-    /* Resolve the server address */
-    if (!tcb->server) {
-	ttlog(log_level_err, s_log_keyid,
-	      "%s: No server configured", 
-	      tcb->name);
-	goto end;	
-    }
-
-    ret = bitd_resolve_hostport(&sock_addr, sizeof(sock_addr), tcb->server);
-    if (ret) {
-	ttlog(log_level_err, s_log_keyid,
-	      "%s: Could not resolve %s: ret %d, %s", 
-	      tcb->name, tcb->server, ret, bitd_gai_strerror(ret));
-	goto end;
-    }
-
-    /* Set the default port, if not already set */
-    port = ntohs(*bitd_sin_port(&sock_addr));
-    if (!port) {
-	port = PLAINTEXT_PORT_DEF;
-	*bitd_sin_port(&sock_addr) = htons(port);
-    }
-    
-    addr_str_len = 1024;
-    addr_str = malloc(addr_str_len);
-
-    inet_ntop(bitd_sin_family(&sock_addr), 
-	      bitd_sin_addr(&sock_addr),
-	      addr_str, addr_str_len);
-    
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: Resolved %s as [%s]:%d", 
-	  tcb->name, tcb->server, addr_str, port);
-
-    while (!tcb->stopped_p) {
-	if (sock == BITD_INVALID_SOCKID && sock_wait_tmo <= 0) {
-	    /* (Re)create the socket */
-	    sock = bitd_socket(bitd_sin_family(&sock_addr), 
-			     SOCK_STREAM, IPPROTO_TCP);
-	    if (sock == BITD_INVALID_SOCKID) {
-		ttlog(log_level_trace, s_log_keyid,
-		      "%s: Failed to create tcp socket, %s (errno %d)", 
-		      tcb->name, strerror(bitd_socket_errno), bitd_socket_errno);
-		break;
-	    }
-
-	    /* Make the socket non-blocking */
-	    SOCK_NOERROR(bitd_set_blocking(sock, FALSE), tcb->log_keyid);
-
-	    /* Connect the socket */
-	    ret = bitd_connect(sock, &sock_addr, 
-			     bitd_sockaddrlen(&sock_addr));
-	    if (ret < 0) {
-		if (bitd_socket_errno != BITD_EINPROGRESS &&
-		    bitd_socket_errno != BITD_EWOULDBLOCK) {
-		    SOCK_NOERROR(ret, tcb->log_keyid);
-		}
-	    }
-	}	
-
-	memset(&pfd, 0, sizeof(pfd));
-
-	/* Always wait on the stop event */
-	pfd[0].fd = bitd_event_to_fd(tcb->stop_ev);
-	pfd[0].events = BITD_POLLIN;	
-
-	if (!queue_read_p) {
-	    /* Wait on queue read events */
-	    pfd[1].fd = bitd_queue_fd(tcb->queue);
-	    pfd[1].events = BITD_POLLIN;
-	} else {
-	    pfd[1].fd = BITD_INVALID_SOCKID;
-	}
-
-	if (!sock_write_p && (sock != BITD_INVALID_SOCKID)) {
-	    /* Wait on socket write events*/
-	    pfd[2].fd = sock;
-	    pfd[2].events = BITD_POLLOUT;
-	} else {
-	    pfd[2].fd = BITD_INVALID_SOCKID;
-	}
-
-	if (sock_wait_tmo > 0) {
-	    poll_tmo = sock_wait_tmo;
-	} else {
-	    poll_tmo = -1;
-	}
-	sock_wait_tmo = 0;
-
-	ret = bitd_poll(pfd, 3, poll_tmo);
-	
-	/* Check the poll() return code */
-	if (ret < 0) {
-	    ttlog(log_level_err, s_log_keyid,
-		  "%s: bitd_poll() error %s (errno %d)", 
-		  tcb->name, 
-		  strerror(bitd_socket_errno), bitd_socket_errno);
-	    break;
-	} else if (ret == 0) {
-	    /* Timeout */
-	    continue;
-	} else {
-#ifdef _XDEBUG
-	    ttlog(log_level_trace, s_log_keyid,
-		  "%s: bitd_poll() ret %d stop %d queue_read %d sock_write %d", 
-		  tcb->name, ret,
-		  (pfd[0].fd != BITD_INVALID_SOCKID ? ((pfd[0].revents & BITD_POLLIN) ? 1 : 0) : -1),
-		  (pfd[1].fd != BITD_INVALID_SOCKID ? ((pfd[1].revents & BITD_POLLIN) ? 1 : 0) : -1),
-		  (pfd[2].fd != BITD_INVALID_SOCKID ? ((pfd[2].revents & BITD_POLLOUT) ? 1 : 0) : -1));
-#endif
-
-	    if ((pfd[0].fd != BITD_INVALID_SOCKID) && (pfd[0].revents & BITD_POLLIN)) {
-		/* Stop event is readable. Clear the stop event. */
-	        bitd_event_clear(tcb->stop_ev);
-	    } 
-
-	    /* Check the stop bit after checking the stop event */
-	    if (tcb->stopped_p) {
-		break;
-	    }
-
-	    if ((pfd[1].fd != BITD_INVALID_SOCKID) && (pfd[1].revents & BITD_POLLIN)) {
-		/* Can read from the queue */
-		queue_read_p = TRUE;
-
-		/* Clear the queue event */
-	    } 
-	    if ((pfd[2].fd != BITD_INVALID_SOCKID) && (pfd[2].revents & BITD_POLLOUT)) {
-		/* Can write to the socket */
-		sock_write_p = TRUE;
-	    }
-	    
-	send:
-	    /* Do we have a partially sent message, and can we write more? */
-	    if (msg && sock_write_p) {
-		while (sock_write_p && (sock != BITD_INVALID_SOCKID)) {
-		    ret = bitd_send(sock, 
-				  (char *)msg + msg_idx, 
-				  msg_size - msg_idx, 
-				  0);
-		    if (ret < 0) {
-			if (bitd_socket_errno == BITD_EAGAIN ||
-			    bitd_socket_errno == BITD_EWOULDBLOCK) {
-			    ttlog(log_level_trace, s_log_keyid,
-				  "%s: sock_write TRUE, socket would block", 
-				  tcb->name, ret);
-			    
-			    sock_write_p = FALSE;
-			} else {
-			    /* How long to wait before reconnecting */
-			    sock_wait_tmo = 30000;
-			    
-			    ttlog(log_level_debug, s_log_keyid,
-				  "%s: Connect to %s error (%s %d), retry in up to %d secs", 
-				  tcb->name, tcb->server,
-				  strerror(bitd_socket_errno), 
-				  bitd_socket_errno,
-				  sock_wait_tmo/1000);
-			    
-			    /* Close the socket */
-			    bitd_close(sock);
-			    sock = BITD_INVALID_SOCKID;
-			    sock_write_p = FALSE;
-			    
-			    /* Go back to top of the loop, socket needs to be
-			       re-created */
-			    continue;
-			}
-		    } else {
-			ttlog(log_level_trace, s_log_keyid,
-			      "%s: sock_write TRUE, wrote %d bytes", 
-			      tcb->name, ret);
-
-			msg_idx += ret;
-			if (msg_idx == msg_size) {
-			    /* Done sending, go receive */
-			    bitd_msg_free(msg);
-			    msg = NULL;
-			    goto recv;
-			}
-		    }
-		}
-	    }
-
-	recv:
-	    /* Can we both read and write? */
-	    if (queue_read_p && sock_write_p) {
-		/* Dequeue a result */
-		msg = bitd_msg_receive_w_tmo(tcb->queue, 0);
-		if (!msg) {
-		    /* Queue is empty */
-		    queue_read_p = FALSE;
-		    ttlog(log_level_trace, s_log_keyid,
-			  "%s: queue_read TRUE and no message in queue", 
-			  tcb->name);
-		    continue;
-		}
-	    
-		ttlog(log_level_trace, s_log_keyid,
-		      "%s: queue_read TRUE, message received", 
-		      tcb->name);
-		
-		/* Check the stop bit - and empty message will signal us
-		   to stop the background thread */
-		if (tcb->stopped_p) {
-		    break;
-		}
-
-		/* Got a message */
-		msg_idx = 0;
-		msg_size = bitd_msg_get_size(msg);
-
-		/* Write it to the socket */
-		goto send;
-	    }
-	}
-    }
-
- end:
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() stopped", tcb->name, __FUNCTION__);
-    
-    if (addr_str) {
-	free(addr_str);
-    }
-    if (sock != BITD_INVALID_SOCKID) {
-	bitd_close(sock);
-    }
-    if (msg) {
-	bitd_msg_free(msg);
-    }
-} 
-
-
 /*
  *============================================================================
  *                        plaintext_escape
@@ -680,19 +837,20 @@ static void map_output(object_node_t *node, void *cookie) {
  *============================================================================
  *                        format_plaintext_result
  *============================================================================
- * Description:     
+ * Description:     Append the formatted result to the message, 
+ *     allocating the message if needed
  * Parameters:    
- * Returns:  
+ * Returns:  TRUE if the result was formatted
  */
-static bitd_msg format_plaintext_result(bitd_object_t *input) {
+static bitd_boolean format_plaintext_result(struct map_output_cb *m,
+					    bitd_object_t *input) {
     int idx;
     bitd_nvp_t tags = NULL;
     char *task_name = NULL, *task_inst_name = NULL;
     int task_name_len, task_inst_name_len;
     bitd_int64 exit_code = 0;
-    struct map_output_cb m;
+    bitd_boolean ret = FALSE;
 
-    memset(&m, 0, sizeof(m));
 
     if (input->type != bitd_type_nvp) {
 	goto end;
@@ -705,7 +863,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
     }
 
     /* Convert from nanosecs to secs */
-    m.tstamp_secs = input->v.value_nvp->e[idx].v.value_uint64 / 1000000000ULL;
+    m->tstamp_secs = input->v.value_nvp->e[idx].v.value_uint64 / 1000000000ULL;
 
     /* Parse the exit code */
     if (!bitd_nvp_lookup_elem(input->v.value_nvp, "exit-code", &idx) ||
@@ -747,15 +905,17 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
     plaintext_escape(task_inst_name);
 	    
     /* Allocate the result */
-    m.size = 102400;
-    m.idx = 0;
-    m.msg = bitd_msg_alloc(0, m.size);
+    if (!m->msg) {
+	m->size = 102400;
+	m->idx = 0;
+	m->msg = bitd_msg_alloc(0, m->size);
+    }
 
-    snprintf_w_msg_realloc(&m.msg, &m.size, &m.idx, 
+    snprintf_w_msg_realloc(&m->msg, &m->size, &m->idx, 
 			   "%s.%s.exit_code %lld %llu\n", 
 			   task_name, task_inst_name,
 			   exit_code, 
-			   m.tstamp_secs);
+			   m->tstamp_secs);
 
     task_name_len = strlen(task_name);
     task_inst_name_len = strlen(task_inst_name);
@@ -773,7 +933,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	node.a.type = e->type;
 	node.a.v = e->v;
 	    
-	bitd_object_node_map(&node, &map_output, &m);
+	bitd_object_node_map(&node, &map_output, m);
 	
 	free(node.full_name);
     }
@@ -791,17 +951,16 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	node.a.type = e->type;
 	node.a.v = e->v;
 	    
-	bitd_object_node_map(&node, &map_output, &m);
+	bitd_object_node_map(&node, &map_output, m);
 	
 	free(node.full_name);
     }
     
-    /* Set the message size */
-    bitd_msg_set_size(m.msg, m.idx);
+    ret = TRUE;
 
  end:
-    if (!m.msg) {
-	ttlog(log_level_trace, s_log_keyid,
+    if (!ret) {
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s(): Dropping incorrectly formatted result from %s:%s", 
 	      __FUNCTION__,
 	      task_name ? task_name : "unknown",
@@ -815,7 +974,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	free(task_inst_name);
     }
 
-    return m.msg;
+    return ret;
 } 
 
 
@@ -828,28 +987,69 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
  * Returns:  
  */
 int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
+
+    return task_inst_run_batch(p, input, 1);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_batch
+ *============================================================================
+ * Description:     Format a batch of results into a single message
+ * Parameters:    
+ * Returns:  
+ */
+int task_inst_run_batch(bitd_task_inst_t p, bitd_object_t *inputs, int n) {
     bitd_msg msg;
+    struct map_output_cb m;
+    int i;
 
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called, %d inputs", p->task_inst_name, __FUNCTION__, n);
+
+    memset(&m, 0, sizeof(m));
 
+    for (i = 0; i < n; i++) {
 #ifdef _XDEBUG
-    if (input->type != bitd_type_void) {
-	char *buf = bitd_object_to_yaml(input, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
-	      "%s: Input:\n%s", p->task_inst_name, buf);
-	free(buf);
-    }
+	if (inputs[i].type != bitd_type_void) {
+	    char *buf = bitd_object_to_yaml(&inputs[i], FALSE);
+	    TTLOG(log_level_trace, s_log_keyid,
+		  "%s: Input:\n%s", p->task_inst_name, buf);
+	    free(buf);
+	}
 #endif
 
-    /* Format the result */
-    msg = format_plaintext_result(input);
+	/* Format the result */
+	format_plaintext_result(&m, &inputs[i]);
+    }
+
+    msg = m.msg;
     if (msg) {
+	/* Set the message size */
+	bitd_msg_set_size(msg, m.idx);
+    }
+
+    if (msg && p->tcb.spool) {
+	/* Spool the result if the queue quota is exceeded */
+	if (bitd_msg_send_w_tmo(msg, p->tcb.queue, 0) == bitd_msgerr_timeout) {
+	    if (!bitd_spool_append(p->tcb.spool, 
+				   (char *)msg, bitd_msg_get_size(msg))) {
+		TTLOG(log_level_warn, s_log_keyid,
+		      "%s: %s(): Spool full, dropping result", 
+		      p->task_inst_name, __FUNCTION__);
+	    }
+	    bitd_msg_free(msg);
+
+	    /* The queue is not signaled, so kick the sender */
+	    bitd_reactor_call(p->tcb.loop, spool_cb, &p->tcb, FALSE);
+	}
+    } else if (msg) {
 	/* Send the result message with a timeout, so we don't block 
 	   on the quota */
 	while (bitd_msg_send_w_tmo(msg, p->tcb.queue, 250) == bitd_msgerr_timeout) {
 	    if (p->tcb.stopped_p) {
-		ttlog(log_level_warn, s_log_keyid,
+		TTLOG(log_level_warn, s_log_keyid,
 		      "%s: %s(): Dropping result", 
 		      p->task_inst_name, __FUNCTION__);
 		bitd_msg_free(msg);
@@ -872,9 +1072,9 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->tcb.stopped_p = TRUE;
-    bitd_event_set(p->tcb.stop_ev);
+    bitd_reactor_call(p->tcb.loop, tcp_stop, &p->tcb, FALSE);
 } 
@@ -17,7 +17,10 @@
 #include "bitd/format.h"
 #include "bitd/log.h"
 #include "bitd/msg.h"
+#include "bitd/spool.h"
+#include "bitd/reactor.h"
 #include "bitd/module-api.h"
+#include "bitd/curl-multi.h"
 
 #include <ctype.h>
 #include "curl/curl.h"
@@ -33,12 +36,15 @@
  *****************************************************************************/
 #define PLAINTEXT_PORT_DEF 2003
 #define QUOTA_DEF 1000
+#define SPOOL_SIZE_DEF (64*1024*1024)
+#define SPOOL_READ_SIZE (256*1024) /* Max size of a spool read */
+#define RECONNECT_TMO 30000
 
 #define SOCK_NOERROR(s, log_keyid)					\
     do {								\
 	ret = (s);							\
 	if (ret < 0) {							\
-	    ttlog(log_level_trace, log_keyid,				\
+	    TTLOG(log_level_trace, log_keyid,				\
 		  "%s:%d: Socket routine returned %d, (%s %d)\n",	\
 		  __FILE__, __LINE__,					\
 		  ret, strerror(bitd_socket_errno), bitd_socket_errno);	\
@@ -53,19 +59,35 @@ static bitd_task_inst_create_t task_inst_create;
 static bitd_task_inst_update_t task_inst_update;
 static bitd_task_inst_destroy_t task_inst_destroy;
 static bitd_task_inst_run_t task_inst_run;
+static bitd_task_inst_run_batch_t task_inst_run_batch;
 static bitd_task_inst_kill_t task_inst_kill;
 static ttlog_keyid s_log_keyid;
 
+struct string {
+  char *ptr;
+  size_t len;
+};
+
 struct tcp_background_cb {
     ttlog_keyid log_keyid;
     char *name;
     char *url;             /* In http://host:port format */
     char *database;        /* Influxdb database name */
     char *post_url;
-    bitd_event stop_ev;      /* The stop event */
     bitd_boolean stopped_p;
     bitd_uint32 quota;       /* Outgoing queue quota */
     bitd_queue queue;        /* The outgoing queue */
+    bitd_spool spool;        /* The overflow spool, or NULL */
+    bitd_reactor_loop loop;  /* The reactor loop serving the instance */
+    bitd_reactor_handle queue_h;  /* Queue handle, NULL if stopped */
+    bitd_reactor_handle retry_h;  /* Retransmit timer handle */
+    CURL *curl;
+    bitd_curl_multi multi;
+    CURLM *multi_handle;
+    struct string s;         /* The http response body */
+    bitd_boolean http_post_p;  /* Http post in progress */
+    bitd_msg msg;            /* Message being posted */
+    bitd_boolean msg_spooled_p; /* Message was read from the spool */
 };
 
 struct bitd_task_inst_s {
@@ -73,7 +95,6 @@ struct bitd_task_inst_s {
     char *task_inst_name;
     mmr_task_inst_t mmr_task_inst_hdl;
     bitd_nvp_t args;
-    bitd_thread th;                      /* The background thread */
     struct tcp_background_cb tcb;
 };
 
@@ -91,16 +112,11 @@ struct map_output_cb {
     bitd_uint32 idx;          /* Write index in the message */
 };
 
-
-struct string {
-  char *ptr;
-  size_t len;
-};
-
 /*****************************************************************************
  *                           FUNCTION DECLARATION
  *****************************************************************************/
-static void tcp_background(void *thread_args);
+static bitd_reactor_call_t http_start;
+static bitd_reactor_call_t http_stop;
 static void reinit_string(struct string *s);
 static size_t writefunc(void *ptr, size_t size, size_t nmemb, struct string *s);
 
@@ -132,7 +148,10 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
 
     s_log_keyid = ttlog_register("bitd-sink-influxdb");
 
-    ttlog(log_level_trace, s_log_keyid,
+    /* The instances share the reactor I/O threads */
+    bitd_reactor_init(0);
+
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Initialize the task API structure to zero, in case we're not 
@@ -144,8 +163,12 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
     task_api.task_inst_update = task_inst_update;
     task_api.task_inst_destroy = task_inst_destroy;
     task_api.task_inst_run = task_inst_run;
+    task_api.task_inst_run_batch = task_inst_run_batch;
     task_api.task_inst_kill = task_inst_kill;
 
+    /* Task instance runs can execute in parallel */
+    task_api.flags = BITD_TASK_FLAG_CONCURRENT_RUN;
+
     /* Register the task */
     s_task = mmr_task_register(mmr_module, "sink-influxdb", &task_api);
 
@@ -162,7 +185,7 @@ bitd_boolean bitd_module_load(mmr_module_t mmr_module,
  * Returns:      
  */
 void bitd_module_unload(void) {    
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     /* Unregister the task */
@@ -187,7 +210,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
 				  bitd_nvp_t tags) {
     bitd_task_inst_t p;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", task_inst_name, __FUNCTION__);
 
     p = calloc(1, sizeof(*p));
@@ -199,7 +222,7 @@ bitd_task_inst_t task_inst_create(char *task_name,
     /* Set up the tcp control block */
     p->tcb.name = strdup(task_inst_name);
     p->tcb.log_keyid = s_log_keyid;
-    p->tcb.stop_ev = bitd_event_create(BITD_EVENT_FLAG_POLL);
+    p->tcb.loop = bitd_reactor_loop_get();
 
     /* Get the queue quota */
     p->tcb.quota = QUOTA_DEF;
@@ -216,6 +239,69 @@ bitd_task_inst_t task_inst_create(char *task_name,
 } 
 
 
+/*
+ *============================================================================
+ *                        spool_open
+ *============================================================================
+ * Description:     (Re)open the overflow spool. Results that don't fit in
+ *     the queue quota are spooled to disk, and survive a restart.
+ * Parameters:    
+ * Returns:  
+ */
+static void spool_open(bitd_task_inst_t p) {
+    bitd_uint64 spool_size = SPOOL_SIZE_DEF;
+    char *spool_dir = NULL;
+    int idx;
+
+    if (p->tcb.spool) {
+	bitd_spool_close(p->tcb.spool);
+	p->tcb.spool = NULL;
+    }
+
+    if (!bitd_nvp_lookup_elem(p->args, "spool-dir", &idx)) {
+	return;
+    }
+    if (p->args->e[idx].type != bitd_type_string ||
+	!p->args->e[idx].v.value_string ||
+	!p->args->e[idx].v.value_string[0]) {
+	TTLOG(log_level_warn, s_log_keyid,
+	      "%s: Invalid spool-dir, not spooling\n", 
+	      p->task_inst_name);
+	return;
+    }
+    
+    /* Each task instance gets its own spool subdirectory */
+    spool_dir = malloc(strlen(p->args->e[idx].v.value_string) + 
+		       strlen(p->task_inst_name) + 2);
+    sprintf(spool_dir, "%s/%s", 
+	    p->args->e[idx].v.value_string, p->task_inst_name);
+
+    if (bitd_nvp_lookup_elem(p->args, "spool-size", &idx)) {
+	if (p->args->e[idx].type == bitd_type_int64 &&
+	    p->args->e[idx].v.value_int64 > 0) {
+	    spool_size = (bitd_uint64)p->args->e[idx].v.value_int64;
+	} else {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: Invalid spool-size, using default of %d\n", 
+		  p->task_inst_name, SPOOL_SIZE_DEF);
+	}
+    }
+
+    p->tcb.spool = bitd_spool_open(spool_dir, 0, spool_size, 0);
+    if (!p->tcb.spool) {
+	TTLOG(log_level_err, s_log_keyid,
+	      "%s: Could not open spool %s", 
+	      p->task_inst_name, spool_dir);
+    } else if (bitd_spool_count(p->tcb.spool)) {
+	TTLOG(log_level_info, s_log_keyid,
+	      "%s: Recovered %u spooled results from %s", 
+	      p->task_inst_name, bitd_spool_count(p->tcb.spool), spool_dir);
+    }
+
+    free(spool_dir);
+} 
+
+
 /*
  *============================================================================
  *                        task_inst_update
@@ -230,21 +316,12 @@ void task_inst_update(bitd_task_inst_t p,
     char *buf = NULL;
     int idx;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
-    if (p->th) {
-	/* Stop the instance */
-	p->tcb.stopped_p = TRUE;
-	
-	/* Set the stop event */
-	bitd_event_set(p->tcb.stop_ev);
-
-	/* Wait for the thread to exit */
-	bitd_join_thread(p->th);
-	p->th = NULL;
-	p->tcb.stopped_p = FALSE;
-    }
+    /* Stop the instance */
+    bitd_reactor_call(p->tcb.loop, http_stop, &p->tcb, TRUE);
+    p->tcb.stopped_p = FALSE;
 
     /* Save the args and tags */
     bitd_nvp_free(p->args);
@@ -253,7 +330,7 @@ void task_inst_update(bitd_task_inst_t p,
     /* Log the args */
     if (p->args) {
 	buf = bitd_nvp_to_yaml(p->args, FALSE, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s: Args:\n%s", p->task_inst_name, buf);
 	free(buf);
     }
@@ -301,7 +378,7 @@ void task_inst_update(bitd_task_inst_t p,
 	    p->args->e[idx].v.value_int64 > 0) {
 	    p->tcb.quota = (bitd_uint32)p->args->e[idx].v.value_int64;
 	} else {
-	    ttlog(log_level_warn, s_log_keyid,
+	    TTLOG(log_level_warn, s_log_keyid,
 		  "%s: Invalid queue-size, using default of %d\n", 
 		  p->task_inst_name, QUOTA_DEF);
 	}
@@ -310,10 +387,11 @@ void task_inst_update(bitd_task_inst_t p,
     /* Change the queue quota */
     bitd_queue_set_quota(p->tcb.queue, p->tcb.quota);
 
-    /* (Re)create the background thread */
-    p->th = bitd_create_thread("plaintext tcp background", 
-			     tcp_background,
-			     0, 128000, (void *)&p->tcb);
+    /* (Re)open the spool */
+    spool_open(p);
+
+    /* (Re)start the instance */
+    bitd_reactor_call(p->tcb.loop, http_start, &p->tcb, TRUE);
 } 
 
 
@@ -327,22 +405,31 @@ void task_inst_update(bitd_task_inst_t p,
  */
 void task_inst_destroy(bitd_task_inst_t p) {
     bitd_uint32 count;
+    bitd_msg msg;
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
 
     /* Stop the instance */
     p->tcb.stopped_p = TRUE;
-
-    /* Set the stop event */
-    bitd_event_set(p->tcb.stop_ev);
-
-    /* Wait for the thread to exit */
-    bitd_join_thread(p->th);
+    bitd_reactor_call(p->tcb.loop, http_stop, &p->tcb, TRUE);
+
+    /* Move the queued results to the spool */
+    while (p->tcb.spool && 
+	   (msg = bitd_msg_receive_w_tmo(p->tcb.queue, 0))) {
+	if (!bitd_spool_append(p->tcb.spool, 
+			       (char *)msg, bitd_msg_get_size(msg))) {
+	    TTLOG(log_level_warn, s_log_keyid,
+		  "%s: %s(): Spool full, dropping result", 
+		  p->task_inst_name, __FUNCTION__);
+	}
+	bitd_msg_free(msg);
+    }
+    bitd_spool_close(p->tcb.spool);
 
     count = bitd_queue_count(p->tcb.queue);
     if (count) {
-	ttlog(log_level_warn, s_log_keyid,
+	TTLOG(log_level_warn, s_log_keyid,
 	      "%s: %s(): Dropping %u results", 
 	      p->task_inst_name, __FUNCTION__, count);
     }
@@ -351,7 +438,7 @@ void task_inst_destroy(bitd_task_inst_t p) {
     bitd_queue_destroy(p->tcb.queue);
 
     bitd_nvp_free(p->args);
-    bitd_event_destroy(p->tcb.stop_ev);
+    free(p->tcb.s.ptr);
 
     if (p->tcb.name) {
 	free(p->tcb.name);
@@ -406,45 +493,204 @@ size_t writefunc(void *ptr, size_t size, size_t nmemb, struct string *s) {
 
 /*
  *============================================================================
- *                        tcp_background
+ *                        http_post
+ *============================================================================
+ * Description:     Initiate the http post transaction for the current 
+ *     message. The transaction is driven by the curl socket and timer
+ *     callbacks.
+ * Parameters:    
+ * Returns:  
+ */
+static void http_post(struct tcp_background_cb *tcb) {
+    
+    curl_easy_setopt(tcb->curl, CURLOPT_POSTFIELDSIZE, 
+		     bitd_msg_get_size(tcb->msg));
+    curl_easy_setopt(tcb->curl, CURLOPT_POSTFIELDS, tcb->msg);
+
+    /* Adding the handle resets it - this is needed each time
+       a http transaction is initialized */
+    curl_multi_add_handle(tcb->multi_handle, tcb->curl);
+    tcb->http_post_p = TRUE;
+} 
+
+
+/*
+ *============================================================================
+ *                        http_send
+ *============================================================================
+ * Description:     Dequeue a result, and post it, unless a post is 
+ *     already in progress
+ * Parameters:    
+ * Returns:  
+ */
+static void http_send(struct tcp_background_cb *tcb) {
+
+    if (tcb->msg) {
+	/* Post in progress, or waiting to be retried */
+	return;
+    }
+
+    /* Dequeue a result */
+    tcb->msg = bitd_msg_receive_w_tmo(tcb->queue, 0);
+    tcb->msg_spooled_p = FALSE;
+    if (!tcb->msg && tcb->spool) {
+	/* Queue is drained, read from the spool */
+	tcb->msg = bitd_spool_read(tcb->spool, SPOOL_READ_SIZE);
+	tcb->msg_spooled_p = tcb->msg ? TRUE : FALSE;
+    }
+
+    /* Wait on the queue only when there is no message in flight */
+    bitd_reactor_set_events(tcb->queue_h, 
+			    tcb->msg ? 0 : BITD_REACTOR_EV_READ);
+
+    if (tcb->msg) {
+	TTLOG(log_level_trace, s_log_keyid,
+	      "%s: Message received", tcb->name);
+	http_post(tcb);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        http_check_done
  *============================================================================
- * Description:     Background thread that reads messages from queue
- *     and writes contents of messages to tcp socket
+ * Description:     Check for a completed http post, and process the
+ *     response
  * Parameters:    
  * Returns:  
  */
-void tcp_background(void *thread_arg) {
-    struct tcp_background_cb *tcb = (struct tcp_background_cb *)thread_arg;
-    struct curl_waitfd cpfd[2];
-    int poll_tmo;
-    bitd_boolean queue_read_p = FALSE, http_post_p = FALSE;
-    bitd_msg msg = NULL; /* Received and partially transmitted message */
-    CURL *curl = NULL;
-    CURLM *multi_handle = NULL;
-    int still_running;
-    struct string s = {};
-    long response_code;
+static void http_check_done(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+    CURLMsg *m;
+    int n_msgs;
+    long response_code = 0;
     ttlog_level log_level;
-    CURLMcode mc;
-    int numfds;
 
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() started", tcb->name, __FUNCTION__);
+    while ((m = curl_multi_info_read(tcb->multi_handle, &n_msgs))) {
+	if (m->msg != CURLMSG_DONE) {
+	    continue;
+	}
+
+	/* Http post is completed, and the response has been received */
+	curl_multi_remove_handle(tcb->multi_handle, tcb->curl);
+	tcb->http_post_p = FALSE;
+	log_level = log_level_trace;
+
+	curl_easy_getinfo(tcb->curl, CURLINFO_RESPONSE_CODE, 
+			  &response_code);
+
+	if ((response_code - (response_code % 100)) != 200) {
+	    /* Need to retransmit message */
+	    log_level = log_level_warn;
+	} else {
+	    /* Message successfully received. We can free the message. */
+	    if (tcb->msg_spooled_p) {
+		bitd_spool_commit(tcb->spool);
+	    }
+	    bitd_msg_free(tcb->msg);
+	    tcb->msg = NULL;
+	}
+
+	TTLOG(log_level, s_log_keyid,
+	      "HTTP response status: %ld", response_code);
+	if (tcb->s.ptr && tcb->s.ptr[0]) {
+	    TTLOG(log_level, s_log_keyid,
+		  "HTTP response body: %s",
+		  tcb->s.ptr);
+	    reinit_string(&tcb->s);
+	}
+
+	if (tcb->msg) {
+	    TTLOG(log_level_debug, s_log_keyid,
+		  "%s: Reconnect to %s in up to %d secs", 
+		  tcb->name, tcb->url,
+		  RECONNECT_TMO/1000);
+	    bitd_reactor_timer_set(tcb->retry_h, RECONNECT_TMO);
+	} else {
+	    /* Send the next result */
+	    http_send(tcb);
+	}
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        queue_cb
+ *============================================================================
+ * Description:     Queue event callback
+ * Parameters:    
+ * Returns:  
+ */
+static void queue_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    http_send((struct tcp_background_cb *)cookie);
+} 
+
+
+/*
+ *============================================================================
+ *                        retry_cb
+ *============================================================================
+ * Description:     Retry timer callback, re-posting the current message
+ * Parameters:    
+ * Returns:  
+ */
+static void retry_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    TTLOG(log_level_debug, s_log_keyid,
+	  "%s: Reconnecting to %s", 
+	  tcb->name, tcb->url);
+    http_post(tcb);
+} 
+
+
+/*
+ *============================================================================
+ *                        spool_cb
+ *============================================================================
+ * Description:     Send the spooled results. Runs on the reactor loop 
+ *     thread, after run() spools a result bypassing the queue.
+ * Parameters:    
+ * Returns:  
+ */
+static void spool_cb(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
+
+    if (tcb->queue_h) {
+	http_send(tcb);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        http_start
+ *============================================================================
+ * Description:     Set up the curl handles, and register the queue. Runs 
+ *     on the reactor loop thread.
+ * Parameters:    
+ * Returns:  
+ */
+static void http_start(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
 
-    reinit_string(&s);
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", tcb->name, __FUNCTION__);
 
     /* Check for missing parameters */
     if (!tcb->url) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: No url configured", 
 	      tcb->name);
-	goto end;	
+	return;
     }
     if (!tcb->database) {
-	ttlog(log_level_err, s_log_keyid,
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: No database configured", 
 	      tcb->name);
-	goto end;	
+	return;
     }
 
     /* Compute the post URL */
@@ -455,242 +701,85 @@ void tcp_background(void *thread_arg) {
     tcb->post_url = malloc(strlen(tcb->url) + strlen(tcb->database) + 24);
     sprintf(tcb->post_url, "%s/write?db=%s", tcb->url, tcb->database);
 
-    curl = curl_easy_init();
-    if (!curl) {
-	ttlog(log_level_err, s_log_keyid,
+    tcb->curl = curl_easy_init();
+    if (!tcb->curl) {
+	TTLOG(log_level_err, s_log_keyid,
 	      "%s: Could not create curl object", 
 	      tcb->name);
-	goto end;
-    }
-    multi_handle = curl_multi_init();
-    if (!multi_handle) {
-	ttlog(log_level_err, s_log_keyid,
-	      "%s: Could not create curl multi object", 
-	      tcb->name);
-	goto end;
+	return;
     }
 
-    curl_multi_add_handle(multi_handle, curl);
-
-    curl_easy_setopt(curl, CURLOPT_URL, tcb->post_url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writefunc);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
+    /* Drive the transfers from the reactor */
+    tcb->multi = bitd_curl_multi_create(tcb->loop, s_log_keyid,
+					http_check_done, tcb);
+    if (!tcb->multi) {
+	curl_easy_cleanup(tcb->curl);
+	tcb->curl = NULL;
+	return;
+    }
+    tcb->multi_handle = bitd_curl_multi_get_handle(tcb->multi);
 
-    while (!tcb->stopped_p) {
-	memset(&cpfd, 0, sizeof(cpfd));
+    reinit_string(&tcb->s);
 
-	/* Always wait on the stop event */
-	cpfd[0].fd = bitd_event_to_fd(tcb->stop_ev);
-	cpfd[0].events = CURL_WAIT_POLLIN;	
+    curl_easy_setopt(tcb->curl, CURLOPT_URL, tcb->post_url);
+    curl_easy_setopt(tcb->curl, CURLOPT_WRITEFUNCTION, writefunc);
+    curl_easy_setopt(tcb->curl, CURLOPT_WRITEDATA, &tcb->s);
 
-	if (!queue_read_p) {
-	    /* Wait on queue read events */
-	    cpfd[1].fd = bitd_queue_fd(tcb->queue);
-	    cpfd[1].events = CURL_WAIT_POLLIN;
-	} else {
-	    cpfd[1].fd = BITD_INVALID_SOCKID;
-	}
+    tcb->retry_h = bitd_reactor_timer_add(tcb->loop, retry_cb, tcb);
+    tcb->queue_h = bitd_reactor_queue_add(tcb->loop, tcb->queue, 
+					  queue_cb, tcb);
 
-	mc = curl_multi_wait(multi_handle, cpfd, 2, 2000, &numfds);
-	if (mc != CURLM_OK) {
-	    ttlog(log_level_err, s_log_keyid,
-		  "curl_multi_wait() failed: %s\n",
-		  curl_multi_strerror(mc));
-	    break;
-	}
+    /* Send the spooled results, if any */
+    http_send(tcb);
+} 
 
-	if (!numfds) {
-	    /* Timeout */
-	    continue;
-	} else {
-#ifdef _XDEBUG
-	    ttlog(log_level_trace, s_log_keyid,
-		  "%s: bitd_poll() ret %d stop %d queue_read %d", 
-		  tcb->name, ret,
-		  (cpfd[0].fd != BITD_INVALID_SOCKID ? ((cpfd[0].revents & BITD_POLLIN) ? 1 : 0) : -1),
-		  (cpfd[1].fd != BITD_INVALID_SOCKID ? ((cpfd[1].revents & BITD_POLLIN) ? 1 : 0) : -1));
-#endif
 
-	    if ((cpfd[0].fd != BITD_INVALID_SOCKID) && 
-		(cpfd[0].revents & BITD_POLLIN)) {
-		/* Stop event is readable. Clear the stop event. */
-	        bitd_event_clear(tcb->stop_ev);
-	    } 
+/*
+ *============================================================================
+ *                        http_stop
+ *============================================================================
+ * Description:     Unregister from the reactor, and release the curl 
+ *     handles. Runs on the reactor loop thread.
+ * Parameters:    
+ * Returns:  
+ */
+static void http_stop(void *cookie) {
+    struct tcp_background_cb *tcb = (struct tcp_background_cb *)cookie;
 
-	    /* Check the stop bit after checking the stop event */
-	    if (tcb->stopped_p) {
-		goto end;
-	    }
+    if (!tcb->queue_h) {
+	/* Already stopped */
+	return;
+    }
 
-	    if ((cpfd[1].fd != BITD_INVALID_SOCKID) && 
-		(cpfd[1].revents & BITD_POLLIN)) {
-		/* Can read from the queue */
-		queue_read_p = TRUE;
-
-		/* Clear the queue event */
-	    } 
-
-	send:
-	    /* Do we have a new or partially sent message? */
-	    if (msg) {
-		if (!http_post_p) {
-		    /* A new message - initiate the http post transaction */
-		    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 
-				     bitd_msg_get_size(msg));
-		    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg);
-		    
-		    /* Reset the curl handle - this is needed each time
-		       a http transaction is initialized */
-		    curl_multi_remove_handle(multi_handle, curl);
-		    curl_multi_add_handle(multi_handle, curl);
-
-		    http_post_p = TRUE;
-		}
-
-		/* Perform the http post - this routine must be called until
-		   still_running is FALSE, but we'd like to wait for
-		   other events in the meanwhile, so we're not
-		   calling curl_multi_perform() in a loop. Instead,
-		   we go back to the top of the event loop to call poll(). */
-		mc = curl_multi_perform(multi_handle, &still_running);
-		if (mc != CURLM_OK) {
-		    ttlog(log_level_err, s_log_keyid,
-			  "curl_easy_perform() failed: %s\n",
-			  curl_multi_strerror(mc));
-		    break;
-		}
-
-		/* Check the stop bit */
-		if (tcb->stopped_p) {
-		    goto end;
-		}
-
-		if (!still_running) {
-		    /* Http post is completed, and the response has been
-		       received. We can free the message. */
-		    http_post_p = FALSE;
-		    log_level = log_level_trace;
-		    
-		    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, 
-				      &response_code);
-		    
-		    if ((response_code - (response_code % 100)) != 200) {
-			log_level = log_level_warn;
-			/* Need to retransmit message */
-		    } else {
-			/* Message successfully received */
-			bitd_msg_free(msg);
-			msg = NULL;
-		    }
-		    
-		    ttlog(log_level, s_log_keyid,
-			  "HTTP response status: %ld", response_code);
-		    if (s.ptr && s.ptr[0]) {
-			ttlog(log_level, s_log_keyid,
-			      "HTTP response body: %s",
-			      s.ptr);
-			reinit_string(&s);
-		    }
-
-		    if (msg) {
-			int curl_wait_tmo = 0; /* How long to wait before reconnecting */
-			bitd_uint32 start_time, current_time;
-
-			/* Check the stop bit */
-			if (tcb->stopped_p) {
-			    goto end;
-			}
-			
-			start_time = bitd_get_time_msec();
-			current_time = start_time;
-			curl_wait_tmo = 30000;
-			    
-			ttlog(log_level_debug, s_log_keyid,
-			      "%s: Reconnect to %s in up to %d secs", 
-			      tcb->name, tcb->url,
-			      curl_wait_tmo/1000);
-
-			while (current_time - start_time < curl_wait_tmo) {
-			    struct bitd_pollfd pfd;
-
-			    /* Always wait on the stop event */
-			    pfd.fd = bitd_event_to_fd(tcb->stop_ev);
-			    pfd.events = CURL_WAIT_POLLIN;
-			    pfd.revents = 0;			    
-			    
-			    /* Estimate how long to wait */
-			    poll_tmo = curl_wait_tmo - (current_time - start_time);
-			    
-			    /* Round up by 20 msecs, so we don't end up in a tight loop at the end */
-			    poll_tmo += 20;
-			    
-			    bitd_poll(&pfd, 1,  poll_tmo);
-
-			    if (pfd.revents & BITD_POLLIN) {
-				/* Stop event is readable. Clear the stop event. */
-				bitd_event_clear(tcb->stop_ev);
-			    } 
-			    
-			    /* Check the stop bit after clearing the stop event */
-			    if (tcb->stopped_p) {
-				goto end;
-			    }
-
-			    /* Update the current time */
-			    current_time = bitd_get_time_msec();
-			}
-
-			ttlog(log_level_debug, s_log_keyid,
-			      "%s: Reconnecting to %s", 
-			      tcb->name, tcb->url);
-			goto send;
-		    }
-		}
-	    }
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called", tcb->name, __FUNCTION__);
 
-	    /* Can we both read and write? */
-	    if (queue_read_p && !http_post_p && !msg) {
-		/* Dequeue a result */
-		msg = bitd_msg_receive_w_tmo(tcb->queue, 0);
-		if (!msg) {
-		    /* Queue is empty */
-		    queue_read_p = FALSE;
-		    ttlog(log_level_trace, s_log_keyid,
-			  "%s: queue_read TRUE and no message in queue", 
-			  tcb->name);
-		    continue;
-		}
-	    
-		ttlog(log_level_trace, s_log_keyid,
-		      "%s: queue_read TRUE, message received", 
-		      tcb->name);
-		
-		/* Check the stop bit - and empty message will signal us
-		   to stop the background thread */
-		if (tcb->stopped_p) {
-		    goto end;
-		}
-
-		/* Write it through a http post transaction */
-		goto send;
-	    }
-	}
+    if (tcb->http_post_p) {
+	curl_multi_remove_handle(tcb->multi_handle, tcb->curl);
+	tcb->http_post_p = FALSE;
     }
 
- end:
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() stopped", tcb->name, __FUNCTION__);
-    
-    if (msg) {
-	bitd_msg_free(msg);
-    }
-    if (curl) {
-	curl_easy_cleanup(curl);
-    }
-    if (multi_handle) {
-	curl_multi_cleanup(multi_handle);
+    curl_easy_cleanup(tcb->curl);
+    bitd_curl_multi_destroy(tcb->multi);
+    tcb->curl = NULL;
+    tcb->multi = NULL;
+    tcb->multi_handle = NULL;
+
+    bitd_reactor_remove(tcb->queue_h);
+    bitd_reactor_remove(tcb->retry_h);
+    tcb->queue_h = NULL;
+    tcb->retry_h = NULL;
+
+    if (tcb->msg) {
+	if (!tcb->msg_spooled_p && tcb->spool) {
+	    /* Spool the unsent message. Spooled messages are not
+	       committed, and will be read again. */
+	    bitd_spool_append(tcb->spool, (char *)tcb->msg, 
+			      bitd_msg_get_size(tcb->msg));
+	}
+	bitd_msg_free(tcb->msg);
+	tcb->msg = NULL;
     }
-    free(s.ptr);
 } 
 
 
@@ -866,22 +955,23 @@ static void map_tags(object_node_t *node, void *cookie) {
  *============================================================================
  *                        format_plaintext_result
  *============================================================================
- * Description:     
+ * Description:     Append the formatted result to the message, 
+ *     allocating the message if needed
  * Parameters:    
- * Returns:  
+ * Returns:  TRUE if the result was formatted
  */
-static bitd_msg format_plaintext_result(bitd_object_t *input) {
+static bitd_boolean format_plaintext_result(struct map_output_cb *m,
+					    bitd_object_t *input) {
     int idx;
     bitd_nvp_t tags = NULL;
     char *task_name = NULL, *task_inst_name = NULL;
     int task_name_len;
     bitd_int64 exit_code = 0;
     struct map_tag_cb t;
-    struct map_output_cb m;
+    bitd_boolean ret = FALSE;
     object_node_t tags_node;
 
     memset(&t, 0, sizeof(t));
-    memset(&m, 0, sizeof(m));
 
     if (input->type != bitd_type_nvp) {
 	goto end;
@@ -894,7 +984,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
     }
 
     /* Convert from nanosecs to secs */
-    m.tstamp_nsecs = input->v.value_nvp->e[idx].v.value_uint64;
+    m->tstamp_nsecs = input->v.value_nvp->e[idx].v.value_uint64;
 
     /* Parse the exit code */
     if (!bitd_nvp_lookup_elem(input->v.value_nvp, "exit-code", &idx) ||
@@ -950,16 +1040,18 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
     bitd_object_node_map(&tags_node, &map_tags, &t);
 
     /* Allocate the result */
-    m.size = 102400;
-    m.idx = 0;
-    m.msg = bitd_msg_alloc(0, m.size);
-    m.t = &t;
+    if (!m->msg) {
+	m->size = 102400;
+	m->idx = 0;
+	m->msg = bitd_msg_alloc(0, m->size);
+    }
+    m->t = &t;
 
-    snprintf_w_msg_realloc(&m.msg, &m.size, &m.idx, 
+    snprintf_w_msg_realloc(&m->msg, &m->size, &m->idx, 
 			   "%s.exit_code%s value=%lld %llu\n", 
 			   task_name, t.buf,
 			   exit_code, 
-			   m.tstamp_nsecs);
+			   m->tstamp_nsecs);
 
     task_name_len = strlen(task_name);
 
@@ -976,7 +1068,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	node.a.type = e->type;
 	node.a.v = e->v;
 	    
-	bitd_object_node_map(&node, &map_output, &m);
+	bitd_object_node_map(&node, &map_output, m);
 	
 	free(node.full_name);
     }
@@ -994,20 +1086,19 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	node.a.type = e->type;
 	node.a.v = e->v;
 	    
-	bitd_object_node_map(&node, &map_output, &m);
+	bitd_object_node_map(&node, &map_output, m);
 	
 	free(node.full_name);
     }
     
-    /* Set the message size */
-    bitd_msg_set_size(m.msg, m.idx);
+    ret = TRUE;
 
  end:
     if (t.buf) {
 	free(t.buf);
     }
-    if (!m.msg) {
-	ttlog(log_level_trace, s_log_keyid,
+    if (!ret) {
+	TTLOG(log_level_trace, s_log_keyid,
 	      "%s(): Dropping incorrectly formatted result from %s:%s", 
 	      __FUNCTION__,
 	      task_name ? task_name : "unknown",
@@ -1021,7 +1112,7 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
 	free(task_inst_name);
     }
 
-    return m.msg;
+    return ret;
 } 
 
 
@@ -1034,28 +1125,69 @@ static bitd_msg format_plaintext_result(bitd_object_t *input) {
  * Returns:  
  */
 int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
+
+    return task_inst_run_batch(p, input, 1);
+} 
+
+
+/*
+ *============================================================================
+ *                        task_inst_run_batch
+ *============================================================================
+ * Description:     Format a batch of results into a single message
+ * Parameters:    
+ * Returns:  
+ */
+int task_inst_run_batch(bitd_task_inst_t p, bitd_object_t *inputs, int n) {
     bitd_msg msg;
+    struct map_output_cb m;
+    int i;
 
-    ttlog(log_level_trace, s_log_keyid,
-	  "%s: %s() called", p->task_inst_name, __FUNCTION__);
+    TTLOG(log_level_trace, s_log_keyid,
+	  "%s: %s() called, %d inputs", p->task_inst_name, __FUNCTION__, n);
 
+    memset(&m, 0, sizeof(m));
+
+    for (i = 0; i < n; i++) {
 #ifdef _XDEBUG
-    if (input->type != bitd_type_void) {
-	char *buf = bitd_object_to_yaml(input, FALSE);
-	ttlog(log_level_trace, s_log_keyid,
-	      "%s: Input:\n%s", p->task_inst_name, buf);
-	free(buf);
-    }
+	if (inputs[i].type != bitd_type_void) {
+	    char *buf = bitd_object_to_yaml(&inputs[i], FALSE);
+	    TTLOG(log_level_trace, s_log_keyid,
+		  "%s: Input:\n%s", p->task_inst_name, buf);
+	    free(buf);
+	}
 #endif
 
-    /* Format the result */
-    msg = format_plaintext_result(input);
+	/* Format the result */
+	format_plaintext_result(&m, &inputs[i]);
+    }
+
+    msg = m.msg;
     if (msg) {
+	/* Set the message size */
+	bitd_msg_set_size(msg, m.idx);
+    }
+
+    if (msg && p->tcb.spool) {
+	/* Spool the result if the queue quota is exceeded */
+	if (bitd_msg_send_w_tmo(msg, p->tcb.queue, 0) == bitd_msgerr_timeout) {
+	    if (!bitd_spool_append(p->tcb.spool, 
+				   (char *)msg, bitd_msg_get_size(msg))) {
+		TTLOG(log_level_warn, s_log_keyid,
+		      "%s: %s(): Spool full, dropping result", 
+		      p->task_inst_name, __FUNCTION__);
+	    }
+	    bitd_msg_free(msg);
+
+	    /* The queue is not signaled, so kick the sender */
+	    bitd_reactor_call(p->tcb.loop, spool_cb, &p->tcb, FALSE);
+	}
+    } else if (msg) {
 	/* Send the result message with a timeout, so we don't block 
 	   on the quota */
 	while (bitd_msg_send_w_tmo(msg, p->tcb.queue, 250) == bitd_msgerr_timeout) {
 	    if (p->tcb.stopped_p) {
-		ttlog(log_level_warn, s_log_keyid,
+		TTLOG(log_level_warn, s_log_keyid,
 		      "%s: %s(): Dropping result", 
 		      p->task_inst_name, __FUNCTION__);
 		bitd_msg_free(msg);
@@ -1078,9 +1210,9 @@ int task_inst_run(bitd_task_inst_t p, bitd_object_t *input) {
  */
 void task_inst_kill(bitd_task_inst_t p, int signo) {
 
-    ttlog(log_level_trace, s_log_keyid,
+    TTLOG(log_level_trace, s_log_keyid,
 	  "%s:%d:%s() called", __FILE__, __LINE__, __FUNCTION__);
 
     p->tcb.stopped_p = TRUE;
-    bitd_event_set(p->tcb.stop_ev);
+    bitd_reactor_call(p->tcb.loop, http_stop, &p->tcb, FALSE);
 } 
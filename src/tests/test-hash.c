@@ -20,6 +20,11 @@
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* Benchmark defaults */
+#define BENCH_KEYS_MIN 1000
+#define BENCH_KEYS_MAX_DEF 10000000
+#define BENCH_THREADS_MAX_DEF 32
+#define BENCH_OPS 2000000        /* Lookups per measurement, all threads */
 
 
 /*****************************************************************************
@@ -32,6 +37,17 @@
  *                                  TYPES
  *****************************************************************************/
 
+/* Benchmark thread control block */
+struct bench_thread_s {
+    bitd_hash h;
+    bitd_thread th;
+    int n_keys;        /* Keys in the hash */
+    int first;         /* Insert keys [first, last) */
+    int last;
+    int n_ops;         /* Lookups to perform */
+    bitd_uint32 seed;
+    int n_found;
+};
 
 
 /*****************************************************************************
@@ -69,8 +85,13 @@ static void usage() {
     printf("Options:\n"
            "    -n count\n"
            "            Number of elements in hash\n"
+           "    -bench [max_keys [max_threads]]\n"
+           "            Measure the insert and lookup rates, for 1000 to\n"
+           "            max_keys keys (default: %d), and 1 to max_threads\n"
+           "            threads (default: %d).\n"
            "    -h, --help, -?\n"
-           "            Show this help.\n");
+           "            Show this help.\n",
+	   BENCH_KEYS_MAX_DEF, BENCH_THREADS_MAX_DEF);
 } 
 
 
@@ -107,6 +128,141 @@ static void hash_map(bitd_hash_key k, bitd_hash_value v, void *cookie) {
 }
 
 
+/*
+ *============================================================================
+ *                        bench_insert_thread
+ *============================================================================
+ * Description:     Insert a range of integer keys
+ * Parameters:
+ * Returns:
+ */
+static void bench_insert_thread(void *thread_arg) {
+    struct bench_thread_s *t = (struct bench_thread_s *)thread_arg;
+    int i;
+
+    for (i = t->first; i < t->last; i++) {
+	bitd_hash_add(t->h, (bitd_hash_key)(long long)i,
+		      (bitd_hash_value)(long long)i);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        bench_lookup_thread
+ *============================================================================
+ * Description:     Look up random keys
+ * Parameters:
+ * Returns:
+ */
+static void bench_lookup_thread(void *thread_arg) {
+    struct bench_thread_s *t = (struct bench_thread_s *)thread_arg;
+    bitd_uint32 x = t->seed;
+    bitd_hash_value v;
+    int i, k;
+
+    for (i = 0; i < t->n_ops; i++) {
+	/* xorshift32 */
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	k = (int)(x % (bitd_uint32)t->n_keys);
+
+	if (bitd_hash_lookup(t->h, (bitd_hash_key)(long long)k, &v) &&
+	    (long long)v == k) {
+	    t->n_found++;
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        bench_run
+ *============================================================================
+ * Description:     Run the threads, and return the elapsed nsecs
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint64 bench_run(struct bench_thread_s *t, int n_threads,
+			     bitd_thread_entrypoint_t *entry) {
+    bitd_uint64 start;
+    int i;
+
+    start = bitd_get_time_nsec();
+
+    for (i = 0; i < n_threads; i++) {
+	t[i].th = bitd_create_thread("bench", entry, BITD_DEFAULT_PRIORITY,
+				     65536, &t[i]);
+    }
+    for (i = 0; i < n_threads; i++) {
+	bitd_join_thread(t[i].th);
+    }
+
+    return bitd_get_time_nsec() - start;
+}
+
+
+/*
+ *============================================================================
+ *                        bench
+ *============================================================================
+ * Description:     Measure the insert and lookup rates, in millions of
+ *     operations per second
+ * Parameters:
+ * Returns:
+ */
+static void bench(int max_keys, int max_threads) {
+    struct bench_thread_s *t;
+    bitd_uint64 insert_nsec, lookup_nsec;
+    int n_keys, n_threads, i, n_found;
+    bitd_hash h;
+
+    t = calloc(max_threads, sizeof(*t));
+
+    printf("%10s %8s %12s %12s\n", "keys", "threads",
+	   "insert-Mops", "lookup-Mops");
+
+    for (n_keys = BENCH_KEYS_MIN; n_keys <= max_keys; n_keys *= 10) {
+	for (n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+	    h = bitd_hash_create(&bitd_hash_func_int32,
+				 &bitd_hash_compare_int32,
+				 NULL);
+
+	    for (i = 0; i < n_threads; i++) {
+		memset(&t[i], 0, sizeof(t[i]));
+		t[i].h = h;
+		t[i].n_keys = n_keys;
+		t[i].first = (int)((long long)n_keys * i / n_threads);
+		t[i].last = (int)((long long)n_keys * (i + 1) / n_threads);
+		t[i].n_ops = BENCH_OPS / n_threads;
+		t[i].seed = 2463534242U + i;
+	    }
+
+	    insert_nsec = bench_run(t, n_threads, &bench_insert_thread);
+	    bitd_assert(bitd_hash_count(h) == (bitd_uint32)n_keys);
+
+	    lookup_nsec = bench_run(t, n_threads, &bench_lookup_thread);
+
+	    n_found = 0;
+	    for (i = 0; i < n_threads; i++) {
+		n_found += t[i].n_found;
+	    }
+	    bitd_assert(n_found == (BENCH_OPS / n_threads) * n_threads);
+
+	    printf("%10d %8d %12.2f %12.2f\n", n_keys, n_threads,
+		   1e3 * n_keys / insert_nsec,
+		   1e3 * n_found / lookup_nsec);
+	    fflush(stdout);
+
+	    bitd_hash_destroy(h);
+	}
+    }
+
+    free(t);
+}
+
+
 /*
  *============================================================================
  *                        main
@@ -119,6 +275,7 @@ int main(int argc, char ** argv) {
     bitd_hash h;
     int i, n_elements = 10;
     bitd_boolean bool_ret;
+    bitd_hash_value v;
     char *c;
 
     /* Work around compiler warning */
@@ -149,6 +306,27 @@ int main(int argc, char ** argv) {
             /* Get the timeout */
             n_elements = atoi(argv[0]);
             
+        } else if (!strcmp(argv[0], "-bench")) {
+	    int max_keys = BENCH_KEYS_MAX_DEF;
+	    int max_threads = BENCH_THREADS_MAX_DEF;
+
+	    if (argc > 1 && argv[1][0] != '-') {
+		argc--;
+		argv++;
+		max_keys = atoi(argv[0]);
+	    }
+	    if (argc > 1 && argv[1][0] != '-') {
+		argc--;
+		argv++;
+		max_threads = atoi(argv[0]);
+	    }
+	    if (max_keys < BENCH_KEYS_MIN || max_threads <= 0) {
+		usage();
+		exit(-1);
+	    }
+
+	    bench(max_keys, max_threads);
+	    exit(0);
         } else if (!strcmp(argv[0], "-h") ||
                    !strcmp(argv[0], "--help") ||
                    !strcmp(argv[0], "-?")) {
@@ -180,6 +358,18 @@ int main(int argc, char ** argv) {
     s_element_count = 0;
     bitd_hash_map(h, &hash_map, s_cookie);
     bitd_assert(s_element_count == n_elements);
+    bitd_assert(bitd_hash_count(h) == (bitd_uint32)n_elements);
+
+    /* Test the lookup API */
+    for (i = 0; i < n_elements; i++) {
+        c = malloc(10 + i/10);
+        sprintf(c, "%d", i);
+        bool_ret = bitd_hash_lookup(h, (bitd_hash_key)c, &v);
+        bitd_assert(bool_ret && (long long)v == i);
+        free(c);
+    }
+    bool_ret = bitd_hash_lookup(h, (bitd_hash_key)"-1", NULL);
+    bitd_assert(!bool_ret);
 
     /* Test re-adding the elements */
     for (i = 0; i < n_elements; i++) {
@@ -208,6 +398,7 @@ int main(int argc, char ** argv) {
     s_element_count = 0;
     bitd_hash_map(h, &hash_map, s_cookie);
     bitd_assert(!s_element_count);
+    bitd_assert(!bitd_hash_count(h));
 
     /* Test re-adding the elements */
     for (i = 0; i < n_elements; i++) {
@@ -222,6 +413,23 @@ int main(int argc, char ** argv) {
     bitd_hash_map(h, &hash_map, s_cookie);
     bitd_assert(s_element_count == n_elements);
 
+    /* Test lookups after removing every other element */
+    for (i = 0; i < n_elements; i += 2) {
+        c = malloc(10 + i/10);
+        sprintf(c, "%d", i);
+        bool_ret = bitd_hash_remove(h, (bitd_hash_key)c);
+        bitd_assert(bool_ret);
+        free(c);
+    }
+    for (i = 0; i < n_elements; i++) {
+        c = malloc(10 + i/10);
+        sprintf(c, "%d", i);
+        bool_ret = bitd_hash_lookup(h, (bitd_hash_key)c, &v);
+        bitd_assert(bool_ret == (i % 2) && (!bool_ret || (long long)v == i));
+        free(c);
+    }
+    bitd_assert(bitd_hash_count(h) == (bitd_uint32)(n_elements / 2));
+
     /* Test the destruction of the hash */
     bitd_hash_destroy(h);
 
@@ -36,6 +36,9 @@
 #define SLEEP_MSEC_DEF 1
 #define VERBOSE_LEVEL_DEF 2
 
+/* Tasks queued with deadlines by the deadline test */
+#define DEADLINE_TASK_COUNT 8
+
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
@@ -60,6 +63,12 @@ int g_task_sleep_msec = TASK_SLEEP_MSEC_DEF;
 int g_task_between_sleep_msec = TASK_BETWEEN_SLEEP_MSEC_DEF;
 int g_sleep_msec = SLEEP_MSEC_DEF;
 int g_verbose = VERBOSE_LEVEL_DEF;
+bitd_boolean g_classes_p = FALSE;
+bitd_boolean g_deadlines_p = FALSE;
+
+/* The order tasks ran in, in the deadline test */
+static int g_order[DEADLINE_TASK_COUNT + 2];
+static int g_n_order;
 
 
 /*****************************************************************************
@@ -97,6 +106,12 @@ static void usage() {
 	   "         How long to sleep between tasks. Default: %d,\n"
 	   "    -s|--sleep sleep_msecs\n"
 	   "         How long will unit tester sleep at the end. Default: %d,\n"
+	   "    -classes\n"
+	   "         Flood the pool with bulk tasks, then check that high\n"
+	   "         priority tasks run on the reserved threads.\n"
+	   "    -deadlines\n"
+	   "         Queue tasks with deadlines behind a busy thread, then\n"
+	   "         check that they run earliest deadline first.\n"
            "    -v verbose_level\n"
            "         Verbosity. Default: %d.\n"
            "    -h, --help, -?\n"
@@ -134,6 +149,194 @@ void exec_func(void *arg, bitd_boolean *stopping_p) {
 }
 
 
+/*
+ *============================================================================
+ *                        test_classes
+ *============================================================================
+ * Description:     Queue more bulk tasks than there are threads, then 
+ *     high priority tasks. The high priority tasks should not wait for 
+ *     the bulk tasks.
+ * Parameters:
+ * Returns:
+ */
+static void test_classes(void) {
+    bitd_lambda_handle lambda;
+    bitd_lambda_class_stats_t s;
+    char *names[] = {"high", "normal", "bulk"};
+    int thread_max = 8, n_bulk = 3 * thread_max;
+    int n_high = 2; /* The threads reserved for the high class */
+    int i, c;
+    char *buf;
+
+    lambda = bitd_lambda_init("test_lambda_classes");
+    bitd_lambda_set_thread_max(lambda, thread_max);
+
+    for (i = 0; i < n_bulk; i++) {
+        buf = malloc(256);
+        sprintf(buf, "bulk execution %u", i);
+	if (!bitd_lambda_exec_task_class(lambda, bitd_lambda_class_bulk, 1,
+					 exec_func, buf)) {
+	    printf("%s: bitd_lambda_exec_task_class() returned FALSE\n", 
+		   g_prog_name);
+	    exit(-1);
+	}
+    }
+
+    /* Let the bulk tasks take their threads */
+    bitd_sleep(g_task_sleep_msec / 5);
+
+    for (i = 0; i < n_high; i++) {
+        buf = malloc(256);
+        sprintf(buf, "high execution %u", i);
+	if (!bitd_lambda_exec_task_class(lambda, bitd_lambda_class_high, 1,
+					 exec_func, buf)) {
+	    printf("%s: bitd_lambda_exec_task_class() returned FALSE\n", 
+		   g_prog_name);
+	    exit(-1);
+	}
+    }
+
+    bitd_sleep(g_task_sleep_msec / 5);
+
+    for (c = 0; c < bitd_lambda_class_count; c++) {
+	bitd_lambda_get_class_stats(lambda, c, &s);
+	if (g_verbose >= 1) {
+	    printf("%s: %s: queued %d (max %d) running %d executed %llu "
+		   "wait mean %.1f msec max %.1f msec\n",
+		   g_prog_name, names[c],
+		   s.n_queued, s.max_queued, s.n_running,
+		   (unsigned long long)s.n_executed,
+		   s.n_executed ? s.wait_nsec / 1e6 / s.n_executed : 0,
+		   s.max_wait_nsec / 1e6);
+	}
+
+	if (c == bitd_lambda_class_bulk) {
+	    /* The bulk tasks are held back from the reserved threads */
+	    if (s.n_running > thread_max - 4 || !s.n_queued) {
+		printf("%s: bulk class: %d running, %d queued\n", 
+		       g_prog_name, s.n_running, s.n_queued);
+		exit(-1);
+	    }
+	} else if (c == bitd_lambda_class_high) {
+	    /* The high priority tasks started right away */
+	    if (s.n_executed != n_high ||
+		s.max_wait_nsec >= g_task_sleep_msec * 1000000ULL / 5) {
+		printf("%s: high class: %llu executed, waited %.1f msec\n", 
+		       g_prog_name, (unsigned long long)s.n_executed,
+		       s.max_wait_nsec / 1e6);
+		exit(-1);
+	    }
+	}
+    }
+
+    bitd_lambda_deinit(lambda);
+}
+
+
+/*
+ *============================================================================
+ *                        order_func
+ *============================================================================
+ * Description:     Record the order the task ran in
+ * Parameters:
+ * Returns:
+ */
+static void order_func(void *arg, bitd_boolean *stopping_p) {
+
+    /* A single thread runs the tasks */
+    g_order[g_n_order++] = (int)(long)arg;
+}
+
+
+/*
+ *============================================================================
+ *                        test_deadlines
+ *============================================================================
+ * Description:     Queue tasks with deadlines in reverse order behind a 
+ *     busy thread. They should run earliest deadline first, after the 
+ *     task without deadline that was queued first. The task whose 
+ *     deadline passes while queued is counted as missing it.
+ * Parameters:
+ * Returns:
+ */
+static void test_deadlines(void) {
+    bitd_lambda_handle lambda;
+    bitd_lambda_class_stats_t s;
+    bitd_uint64 t0;
+    char *buf;
+    int i;
+
+    lambda = bitd_lambda_init("test_lambda_deadlines");
+    bitd_lambda_set_thread_max(lambda, 1);
+
+    /* Keep the thread busy */
+    buf = malloc(256);
+    sprintf(buf, "busy execution");
+    if (!bitd_lambda_exec_task(lambda, exec_func, buf)) {
+	printf("%s: bitd_lambda_exec_task() returned FALSE\n", g_prog_name);
+	exit(-1);
+    }
+    bitd_sleep(g_task_sleep_msec / 5);
+
+    t0 = bitd_get_time_nsec();
+
+    /* Task 0 has no deadline, task 1 misses its deadline, and the other
+       tasks have later deadlines in reverse order */
+    if (!bitd_lambda_exec_task(lambda, order_func, (void *)0L) ||
+	!bitd_lambda_exec_task_deadline(lambda, bitd_lambda_class_normal, 1,
+					t0 + 1000000ULL,
+					order_func, (void *)1L)) {
+	printf("%s: bitd_lambda_exec_task() returned FALSE\n", g_prog_name);
+	exit(-1);
+    }
+    for (i = 0; i < DEADLINE_TASK_COUNT; i++) {
+	if (!bitd_lambda_exec_task_deadline(lambda, 
+					    bitd_lambda_class_normal, 1,
+					    t0 + 60000000000ULL - 
+					    i * 1000000ULL,
+					    order_func, 
+					    (void *)(long)(i + 2))) {
+	    printf("%s: bitd_lambda_exec_task_deadline() returned FALSE\n",
+		   g_prog_name);
+	    exit(-1);
+	}
+    }
+
+    /* Wait for the tasks to run */
+    for (i = 0; i < 100; i++) {
+	bitd_lambda_get_class_stats(lambda, bitd_lambda_class_normal, &s);
+	if (s.n_executed == DEADLINE_TASK_COUNT + 3 && !s.n_running) {
+	    break;
+	}
+	bitd_sleep(g_task_sleep_msec / 5);
+    }
+
+    if (g_verbose >= 1) {
+	printf("%s: order:", g_prog_name);
+	for (i = 0; i < g_n_order; i++) {
+	    printf(" %d", g_order[i]);
+	}
+	printf(", deadlines missed %llu\n", 
+	       (unsigned long long)s.n_deadline_missed);
+    }
+
+    if (g_n_order != DEADLINE_TASK_COUNT + 2 ||
+	g_order[0] != 0 || g_order[1] != 1 || s.n_deadline_missed != 1) {
+	printf("%s: deadline order or misses wrong\n", g_prog_name);
+	exit(-1);
+    }
+    for (i = 2; i < g_n_order; i++) {
+	if (g_order[i] != DEADLINE_TASK_COUNT + 3 - i) {
+	    printf("%s: task %d ran in position %d\n", 
+		   g_prog_name, g_order[i], i);
+	    exit(-1);
+	}
+    }
+
+    bitd_lambda_deinit(lambda);
+}
+
+
 /*
  *============================================================================
  *                        main
@@ -248,6 +451,12 @@ int main(int argc, char ** argv) {
 
 	    g_sleep_msec = atoi(argv[0]);
 
+	} else if (!strcmp(argv[0], "-classes")) {
+	    g_classes_p = TRUE;
+
+	} else if (!strcmp(argv[0], "-deadlines")) {
+	    g_deadlines_p = TRUE;
+
 	} else if (!strcmp(argv[0], "-v")) {
             /* Skip to next parameter */
             argc--;
@@ -275,6 +484,18 @@ int main(int argc, char ** argv) {
         argv++;        
     }
 
+    if (g_classes_p) {
+	test_classes();
+	bitd_sys_deinit();
+	return 0;
+    }
+
+    if (g_deadlines_p) {
+	test_deadlines();
+	bitd_sys_deinit();
+	return 0;
+    }
+
     if (g_task_max && (g_task_count > g_task_max)) {
 	if (g_verbose >= 1) {
 	    printf("%s: Warning: Task count %d larger than the task max %d\n", 
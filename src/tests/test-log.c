@@ -16,6 +16,8 @@
 #include "bitd/file.h"
 #include "bitd/log.h"
 
+#include <stdint.h>
+
 
 /*****************************************************************************
  *                             MANIFEST CONSTANTS
@@ -28,11 +30,31 @@
  *****************************************************************************/
 #define LOG_FILE_SIZE_DEF 10240
 #define LOG_FILE_COUNT_DEF 3
+#define BENCH_THREAD_COUNT_MAX 64
+#define CHECK_LINE_SIZE 4096
+#define CHECK_LINE_COUNT 16
+#define CHECK_BUILT_COUNT 10000 /* Formats built at run time, past the 
+				   dictionary cap */
+
+/* Log a message, and save the expected text */
+#define CHECK_LOG(keyid, format_string, ...)				\
+    do {								\
+	snprintf(expected[n_lines++], CHECK_LINE_SIZE,			\
+		 "TRACE: check: " format_string "\n", __VA_ARGS__);	\
+	ttlog(log_level_trace, keyid, format_string, __VA_ARGS__);	\
+    } while (0)
 
 /*****************************************************************************
  *                                  TYPES
  *****************************************************************************/
 
+/* A benchmark thread */
+struct bench_thread_s {
+    int idx;
+    int msg_count;
+    ttlog_keyid keyid;
+    bitd_thread th;
+};
 
 /*****************************************************************************
  *                           FUNCTION DECLARATION
@@ -54,6 +76,189 @@ int g_log_file_count = LOG_FILE_COUNT_DEF;
  *****************************************************************************/
 
 
+/*
+ *============================================================================
+ *                        bench_entry
+ *============================================================================
+ * Description:     Log messages as fast as possible
+ * Parameters:    
+ * Returns:  
+ */
+static void bench_entry(void *thread_arg) {
+    struct bench_thread_s *bt = (struct bench_thread_s *)thread_arg;
+    int i;
+
+    for (i = 0; i < bt->msg_count; i++) {
+	ttlog(log_level_trace, bt->keyid, 
+	      "thread %d message %d: the quick brown fox jumps over "
+	      "the lazy dog", bt->idx, i);
+    }
+} 
+
+
+/*
+ *============================================================================
+ *                        bench
+ *============================================================================
+ * Description:     Measure the log throughput, with several threads 
+ *     logging concurrently
+ * Parameters:    
+ * Returns:         0 on success
+ */
+static int bench(int thread_count, int msg_count) {
+    struct bench_thread_s bt[BENCH_THREAD_COUNT_MAX];
+    ttlog_keyid keyid;
+    bitd_uint64 start_nsec, stop_nsec;
+    int i;
+
+    if (thread_count < 1 || thread_count > BENCH_THREAD_COUNT_MAX ||
+	msg_count < 1) {
+	return -1;
+    }
+
+    keyid = ttlog_register("bench");
+    ttlog_set_level("bench", log_level_trace);
+
+    start_nsec = bitd_get_time_nsec();
+
+    for (i = 0; i < thread_count; i++) {
+	bt[i].idx = i;
+	bt[i].msg_count = msg_count;
+	bt[i].keyid = keyid;
+	bt[i].th = bitd_create_thread("bench", bench_entry, 0, 0, &bt[i]);
+    }
+
+    for (i = 0; i < thread_count; i++) {
+	bitd_join_thread(bt[i].th);
+    }
+
+    /* Include the time to write the messages */
+    ttlog_flush();
+
+    stop_nsec = bitd_get_time_nsec();
+
+    printf("%d threads, %d messages: %llu msgs/sec, %llu nsec/msg\n",
+	   thread_count, thread_count * msg_count,
+	   (bitd_uint64)thread_count * msg_count * 1000000000ULL / 
+	   (stop_nsec - start_nsec + 1),
+	   (stop_nsec - start_nsec) / ((bitd_uint64)thread_count * msg_count));
+
+    ttlog_unregister(keyid);
+
+    return 0;
+} 
+
+
+/*
+ *============================================================================
+ *                        binary_check
+ *============================================================================
+ * Description:     Log messages in binary format, and check that they
+ *     decode to the same text as printf
+ * Parameters:    
+ * Returns:         0 on success
+ */
+static int binary_check(char *file_name) {
+    static char expected[CHECK_LINE_COUNT][CHECK_LINE_SIZE];
+    char line[CHECK_LINE_SIZE], long_s[2000], *null_s = NULL, *s;
+    char built_fmt[64];
+    int n_lines = 0, i, ret = 0;
+    ttlog_keyid keyid;
+    FILE *f, *out;
+
+    unlink(file_name);
+    keyid = ttlog_register("check");
+    ttlog_set_level("check", log_level_trace);
+
+    /* A text line still buffered when the file and the format change
+       goes to the old file, and not to the binary one */
+    ttlog(log_level_info, keyid, "text line before the binary log");
+
+    ttlog_set_log_file_name(file_name);
+    ttlog_set_log_file_size(100*1024*1024);
+    ttlog_set_log_file_binary(TRUE);
+
+    memset(long_s, 'x', sizeof(long_s) - 1);
+    long_s[sizeof(long_s) - 1] = 0;
+
+    CHECK_LOG(keyid, "int %d unsigned %u hex %#x char %c", 
+	      -5, 7u, 255, 'z');
+    CHECK_LOG(keyid, "long %ld %lu long long %lld %llx", 
+	      -1L, 2UL, -3LL, 0x1234567890ULL);
+    CHECK_LOG(keyid, "size %zu ptrdiff %td intmax %jd", 
+	      (size_t)9, (ptrdiff_t)-10, (intmax_t)-11);
+    CHECK_LOG(keyid, "double %f %.3e %g %10.2f", 
+	      1.5, -2.25e10, 0.1, 3.14159);
+    CHECK_LOG(keyid, "string '%s' '%-8s' '%.3s' null '%s'", 
+	      "abc", "left", "truncate", null_s);
+    CHECK_LOG(keyid, "width '%*d' precision %.*f both '%*.*s'", 
+	      6, 42, 2, 2.71828, 8, 2, "xyz");
+    CHECK_LOG(keyid, "percent 100%% %s", "done");
+    CHECK_LOG(keyid, "pointer %p", (void *)&n_lines);
+    CHECK_LOG(keyid, "long double %.2Lf", (long double)1.25);
+    CHECK_LOG(keyid, "long string %s", long_s);
+
+    /* A raw message */
+    snprintf(expected[n_lines++], CHECK_LINE_SIZE, "raw %d\n", 5);
+    ttlog_raw("raw %d", 5);
+
+    /* Formats built at run time. Once the dictionary is full, they
+       are logged as text. */
+    for (i = 0; i < CHECK_BUILT_COUNT; i++) {
+	snprintf(built_fmt, sizeof(built_fmt), "built %d %%s", i);
+	ttlog(log_level_trace, keyid, built_fmt, "fmt");
+    }
+
+    ttlog_flush();
+    ttlog_unregister(keyid);
+
+    /* Decode the log */
+    f = fopen(file_name, "rb");
+    out = tmpfile();
+    if (!f || !out) {
+	fprintf(stderr, "%s: Failed to open %s.\n", g_prog_name, file_name);
+	return -1;
+    }
+
+    if (ttlog_decode(f, out) != n_lines + CHECK_BUILT_COUNT) {
+	fprintf(stderr, "%s: Failed to decode %s.\n", g_prog_name, file_name);
+	ret = -1;
+    }
+
+    /* Compare the lines, past the timestamp */
+    rewind(out);
+    for (i = 0; i < n_lines && !ret; i++) {
+	if (!fgets(line, sizeof(line), out) || 
+	    !(s = strstr(line, " : ")) ||
+	    strcmp(s + 3, expected[i])) {
+	    fprintf(stderr, "%s: Line %d: expected %s", 
+		    g_prog_name, i, expected[i]);
+	    ret = -1;
+	}
+    }
+    for (i = 0; i < CHECK_BUILT_COUNT && !ret; i++) {
+	snprintf(expected[0], CHECK_LINE_SIZE, 
+		 "TRACE: check: built %d fmt\n", i);
+	if (!fgets(line, sizeof(line), out) || 
+	    !(s = strstr(line, " : ")) ||
+	    strcmp(s + 3, expected[0])) {
+	    fprintf(stderr, "%s: Built line %d: expected %s", 
+		    g_prog_name, i, expected[0]);
+	    ret = -1;
+	}
+    }
+
+    fclose(f);
+    fclose(out);
+
+    if (!ret) {
+	printf("%d binary messages decoded\n", n_lines + CHECK_BUILT_COUNT);
+    }
+
+    return ret;
+} 
+
+
 /*
  *============================================================================
  *                        usage
@@ -74,6 +279,12 @@ void usage() {
 	   "       Set the log file size. Default: %d.\n"
 	   "    -lc|--log-file-count size\n"
 	   "       Set the log file count. Default: %d.\n"
+	   "    -lb|--log-file-binary\n"
+	   "       Log binary records instead of text lines.\n"
+	   "    -lfs|--log-flush-size size\n"
+	   "       Set the bytes a thread logs before they are written.\n"
+	   "    -lfi|--log-flush-interval msec\n"
+	   "       Set the max msecs before logged lines are written.\n"
 	   "    -l|--log-level none|crit|error|warn|info|debug|trace\n"
 	   "       Set global log level.\n"
 	   "    -reg|-unreg key_name\n"
@@ -88,6 +299,12 @@ void usage() {
 	   "       Log a raw message.\n"
 	   "    -s sleep_msec\n"
 	   "       Insert a sleep.\n"
+	   "    -binary-check file_name\n"
+	   "       Log messages in binary format to file_name, and check\n"
+	   "       that they decode to the expected text.\n"
+	   "    -bench thread_count msg_count\n"
+	   "       Measure the log throughput, with thread_count threads\n"
+	   "       logging msg_count trace messages each.\n"
            "    -v verbose_level, --verbose verbose_level\n"
            "       Set the verbosity level (default: 2).\n"
            "    -h, --help, -?\n"
@@ -184,6 +401,49 @@ int main(int argc, char ** argv) {
 		return -1;
 	    }
 
+	} else if (!strcmp(argv[0], "-lb") ||
+		   !strcmp(argv[0], "--log-file-binary")) {
+
+	    ttlog_set_log_file_binary(TRUE);
+
+	} else if (!strcmp(argv[0], "-lfs") ||
+		   !strcmp(argv[0], "--log-flush-size")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+            if (!ttlog_set_flush_size(atoi(argv[0]))) {
+		fprintf(stderr, 
+			"%s: Failed to set log flush size %s.\n", 
+			g_prog_name, argv[0]);
+		return -1;
+	    }
+
+	} else if (!strcmp(argv[0], "-lfi") ||
+		   !strcmp(argv[0], "--log-flush-interval")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+            if (!ttlog_set_flush_interval(atoi(argv[0]))) {
+		fprintf(stderr, 
+			"%s: Failed to set log flush interval %s.\n", 
+			g_prog_name, argv[0]);
+		return -1;
+	    }
+
 	} else if (!strcmp(argv[0], "-l") ||
 		   !strcmp(argv[0], "--log-level")) {
 
@@ -356,6 +616,43 @@ int main(int argc, char ** argv) {
 
             bitd_sleep(atoi(argv[0]));
 
+	} else if (!strcmp(argv[0], "-binary-check")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+		exit(-1);
+            }
+
+	    if (binary_check(argv[0])) {
+		return -1;
+	    }
+
+	} else if (!strcmp(argv[0], "-bench")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (argc < 2) {
+                usage();
+		exit(-1);
+            }
+
+	    if (bench(atoi(argv[0]), atoi(argv[1]))) {
+		fprintf(stderr, 
+			"%s: Invalid benchmark parameters %s %s.\n", 
+			g_prog_name, argv[0], argv[1]);
+		return -1;
+	    }
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+
 	} else if (!strcmp(argv[0], "-v") ||
 		   !strcmp(argv[0], "--verbose")) {
 
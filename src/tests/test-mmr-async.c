@@ -0,0 +1,256 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager asynchronous task run test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define ASYNC_MODULE "bitd-echo"
+#define ASYNC_TASK "echo-async"
+
+/* The task instance killed while its run is in progress */
+#define ASYNC_KILLED "killed"
+#define ASYNC_KILLED_SLEEP 60000
+
+/* The worker pool of the task instances */
+#define ASYNC_POOL "async-pool"
+
+/* Defaults */
+#define ASYNC_INSTS_DEF 100
+#define ASYNC_SLEEP_DEF 200
+#define ASYNC_THREADS_DEF 1
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The task instance results */
+static int g_n_results;
+static int g_n_killed_results;
+static int g_n_insts = ASYNC_INSTS_DEF;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program runs many slow asynchronous task instances in a\n"
+	   "small worker pool, and checks that their runs overlap without\n"
+	   "holding the pool threads. A task instance killed in the middle\n"
+	   "of its run is destroyed without waiting for the run.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+           "    -n task_inst_count\n"
+           "        The number of task instances (default: %d).\n"
+           "    -s sleep_msec\n"
+           "        How long each run takes (default: %d).\n"
+           "    -pool thread_max\n"
+           "        The worker pool thread_max (default: %d).\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , ASYNC_INSTS_DEF, ASYNC_SLEEP_DEF, ASYNC_THREADS_DEF,
+	   TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Count the results of the task instances
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+
+    if (strcmp(task_name, ASYNC_TASK)) {
+	return;
+    }
+
+    if (g_verbose) {
+	printf("%s: run %llu\n", task_inst_name, (unsigned long long)run_id);
+    }
+
+    bitd_mutex_lock(g_lock);
+    if (!strcmp(task_inst_name, ASYNC_KILLED)) {
+	g_n_killed_results++;
+    } else {
+	g_n_results++;
+	if (g_n_results == g_n_insts) {
+	    bitd_event_set(g_done_ev);
+	}
+    }
+    bitd_mutex_unlock(g_lock);
+}
+
+
+/*
+ *============================================================================
+ *                        create_task_inst
+ *============================================================================
+ * Description:     Create a task instance that runs once in the worker
+ *     pool, and sleeps in its run
+ * Parameters:
+ * Returns:
+ */
+static void create_task_inst(char *name, int sleep_msec) {
+    bitd_nvp_t sched = NULL;
+
+    test_nvp_add_string(&sched, "type", "once");
+    test_nvp_add_string(&sched, "worker-pool", ASYNC_POOL);
+    test_mmr_create(ASYNC_TASK, name, sched, sleep_msec);
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    int sleep_msec = ASYNC_SLEEP_DEF;
+    int pool_thread_max = ASYNC_THREADS_DEF;
+    bitd_uint64 t0, t1, t2;
+    int i;
+    char name[32];
+    bitd_nvp_t stats;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-n")) {
+            g_n_insts = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-s")) {
+            sleep_msec = test_arg_int(&argc, &argv, 0, usage);
+        } else if (!strcmp(argv[0], "-pool")) {
+            pool_thread_max = test_arg_int(&argc, &argv, 1, usage);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    test_mmr_init(load_path, ASYNC_MODULE, &report_results, NULL);
+    test_mmr_set_pool(ASYNC_POOL, pool_thread_max, 0);
+
+    /* The runs of all task instances are in progress at the same time */
+    t0 = bitd_get_time_nsec();
+    for (i = 0; i < g_n_insts; i++) {
+	snprintf(name, sizeof(name), "inst-%d", i);
+	create_task_inst(name, sleep_msec);
+    }
+
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC + sleep_msec));
+    t1 = bitd_get_time_nsec();
+
+    stats = test_mmr_pool_stats();
+
+    /* A task instance destroyed in the middle of its run */
+    create_task_inst(ASYNC_KILLED, ASYNC_KILLED_SLEEP);
+    bitd_sleep(50);
+    t2 = bitd_get_time_nsec();
+    test_mmr_destroy(ASYNC_TASK, ASYNC_KILLED);
+    t2 = bitd_get_time_nsec() - t2;
+
+    for (i = 0; i < g_n_insts; i++) {
+	snprintf(name, sizeof(name), "inst-%d", i);
+	test_mmr_destroy(ASYNC_TASK, name);
+    }
+
+    printf("%d task instances, runs of %d msec, %d pool threads: "
+	   "%.1f msec, kill %.1f msec\n",
+	   g_n_insts, sleep_msec, pool_thread_max,
+	   (t1 - t0) / 1000000.0, t2 / 1000000.0);
+
+    /* The runs were dispatched to the pool, within its thread limit */
+    TEST_CHECK(test_mmr_pool_stat(stats, ASYNC_POOL, "dispatched") >= 
+	       g_n_insts);
+    TEST_CHECK(test_mmr_pool_stat(stats, ASYNC_POOL, "thread-count") <= 
+	       pool_thread_max);
+    bitd_nvp_free(stats);
+
+    /* The runs overlapped, rather than taking turns on the pool threads */
+    TEST_CHECK((t1 - t0) / 1000000 >= (bitd_uint64)sleep_msec);
+    if (g_n_insts > pool_thread_max) {
+	TEST_CHECK((t1 - t0) / 1000000 <
+		   (bitd_uint64)g_n_insts * sleep_msec / pool_thread_max / 2);
+    }
+
+    /* The killed run ended early, without results */
+    TEST_CHECK(t2 / 1000000 < ASYNC_KILLED_SLEEP / 10);
+    TEST_CHECK(!g_n_killed_results);
+
+    test_mmr_deinit(ASYNC_MODULE);
+    test_deinit();
+
+    return 0;
+}
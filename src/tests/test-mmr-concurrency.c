@@ -0,0 +1,401 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager concurrent and batch triggered run test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define CONC_MODULE "bitd-echo"
+#define CONC_TASK "echo"
+
+/* The task instances */
+#define CONC_SOURCE "source"
+#define CONC_SINK "sink"
+
+/* The worker pool of the sink */
+#define CONC_POOL "sink-pool"
+
+/* The 'once' task instances that share the sink pool, when the pool
+   has a task-max */
+#define CONC_ONCE_COUNT 8
+
+/* Defaults */
+#define CONC_RUNS_DEF 20
+#define CONC_MAX_DEF 4
+#define CONC_BATCH_DEF 1
+#define CONC_SLEEP_DEF 50
+#define CONC_INTERVAL_DEF "10ms"
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The source run ids seen in the sink results, in report order */
+static bitd_int64 *g_run_ids;
+static int g_n_run_ids;
+static bitd_uint64 g_last_run_id;
+static int g_n_sink_runs;  /* Sink runs that reported results */
+static int g_n_runs = CONC_RUNS_DEF;
+
+/* The results of the source, and of the 'once' task instances */
+static int g_n_source_results;
+static bitd_event g_source_ev;
+static int g_n_once_results;
+static int g_n_once;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program runs a slow triggered task instance with a\n"
+	   "max-concurrency, and checks that it keeps up with its trigger,\n"
+	   "and that ordered results are reported in input order. Batch\n"
+	   "runs of the sink also keep up with the trigger. A sink worker\n"
+	   "pool limits the sink run concurrency.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+           "    -n run_count\n"
+           "        Sink results to wait for (default: %d).\n"
+           "    -c max_concurrency\n"
+           "        The sink max-concurrency (default: %d).\n"
+           "    -b max_batch_size\n"
+           "        The sink max-batch-size (default: %d).\n"
+           "    -s sleep_msec\n"
+           "        How long each sink run takes (default: %d).\n"
+           "    -pool thread_max\n"
+           "        Run the sink in a worker pool of thread_max threads.\n"
+           "    -task-max task_max\n"
+           "        Set the sink worker pool task-max. The source stops\n"
+           "        after run_count runs, and %d 'once' task instances fill\n"
+           "        the pool while the sink drains its queued inputs. Runs\n"
+           "        refused by the full pool are retried.\n"
+           "    -unordered\n"
+           "        Do not request ordered sink results.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , CONC_RUNS_DEF, CONC_MAX_DEF, CONC_BATCH_DEF, CONC_SLEEP_DEF, 
+	   CONC_ONCE_COUNT, TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        check_done
+ *============================================================================
+ * Description:     Set the done event once all results are in. Called with
+ *     g_lock held.
+ * Parameters:
+ * Returns:
+ */
+static void check_done(void) {
+
+    if (g_n_run_ids == g_n_runs && g_n_once_results == g_n_once) {
+	bitd_event_set(g_done_ev);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Record the source run id echoed by each sink result,
+ *     and count the results of the 'once' task instances
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+    int idx;
+
+    if (!strcmp(task_inst_name, CONC_SOURCE)) {
+	bitd_mutex_lock(g_lock);
+	if (++g_n_source_results == g_n_runs) {
+	    bitd_event_set(g_source_ev);
+	}
+	bitd_mutex_unlock(g_lock);
+	return;
+    }
+
+    if (!strncmp(task_inst_name, "once-", 5)) {
+	bitd_mutex_lock(g_lock);
+	g_n_once_results++;
+	check_done();
+	bitd_mutex_unlock(g_lock);
+	return;
+    }
+
+    if (strcmp(task_inst_name, CONC_SINK)) {
+	return;
+    }
+
+    /* The sink echoes the raw results of the source */
+    TEST_CHECK(r->output.type == bitd_type_nvp);
+    TEST_CHECK(bitd_nvp_lookup_elem(r->output.v.value_nvp, "run-id", &idx));
+    TEST_CHECK(r->output.v.value_nvp->e[idx].type == bitd_type_uint64);
+
+    bitd_mutex_lock(g_lock);
+    if (g_n_run_ids < g_n_runs) {
+	if (!g_n_run_ids || run_id != g_last_run_id) {
+	    g_n_sink_runs++;
+	}
+	g_last_run_id = run_id;
+	g_run_ids[g_n_run_ids++] = 
+	    (bitd_int64)r->output.v.value_nvp->e[idx].v.value_uint64;
+	if (g_verbose) {
+	    printf("sink run %llu: source run %lld\n", 
+		   (unsigned long long)run_id,
+		   (long long)g_run_ids[g_n_run_ids - 1]);
+	}
+	check_done();
+    }
+    bitd_mutex_unlock(g_lock);
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    int max_concurrency = CONC_MAX_DEF;
+    int max_batch_size = CONC_BATCH_DEF;
+    int sleep_msec = CONC_SLEEP_DEF;
+    bitd_boolean ordered_p = TRUE;
+    bitd_nvp_t sched = NULL;
+    bitd_value_t v;
+    bitd_uint64 t0, t1;
+    int i, n_reordered = 0;
+    int pool_thread_max = 0, pool_task_max = 0;
+    bitd_nvp_t stats;
+    char name[32];
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-n")) {
+            g_n_runs = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-c")) {
+            max_concurrency = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-b")) {
+            max_batch_size = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-s")) {
+            sleep_msec = test_arg_int(&argc, &argv, 0, usage);
+        } else if (!strcmp(argv[0], "-pool")) {
+            pool_thread_max = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-task-max")) {
+            pool_task_max = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-unordered")) {
+	    ordered_p = FALSE;
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    if (pool_task_max && !pool_thread_max) {
+	usage();
+	exit(-1);
+    }
+
+    g_run_ids = calloc(g_n_runs, sizeof(*g_run_ids));
+    g_source_ev = bitd_event_create(0);
+    if (pool_task_max) {
+	g_n_once = CONC_ONCE_COUNT;
+    }
+
+    test_mmr_init(load_path, CONC_MODULE, &report_results, NULL);
+
+    /* The sink worker pool */
+    if (pool_thread_max) {
+	test_mmr_set_pool(CONC_POOL, pool_thread_max, pool_task_max);
+    }
+
+    /* The sink is triggered by the raw results of the source, and
+       sleeps in each run */
+    test_nvp_add_string(&sched, "type", "triggered-raw");
+    test_nvp_add_string(&sched, "task-name", CONC_TASK);
+    test_nvp_add_string(&sched, "task-inst-name", CONC_SOURCE);
+    test_nvp_add_int64(&sched, "max-concurrency", max_concurrency);
+    v.value_boolean = ordered_p;
+    bitd_nvp_add_elem(&sched, "ordered", &v, bitd_type_boolean);
+    test_nvp_add_int64(&sched, "max-batch-size", max_batch_size);
+    if (pool_thread_max) {
+	test_nvp_add_string(&sched, "worker-pool", CONC_POOL);
+    }
+    test_mmr_create(CONC_TASK, CONC_SINK, sched, sleep_msec);
+
+    /* The source runs faster than a single sink run */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "periodic");
+    test_nvp_add_string(&sched, "interval", CONC_INTERVAL_DEF);
+    t0 = bitd_get_time_nsec();
+    test_mmr_create(CONC_TASK, CONC_SOURCE, sched, 0);
+
+    if (g_n_once) {
+	/* No more input arrives for the sink */
+	TEST_CHECK(bitd_event_wait(g_source_ev, TEST_WAIT_MSEC + 
+				   g_n_runs * 10));
+	test_mmr_destroy(CONC_TASK, CONC_SOURCE);
+
+	/* The 'once' task instances fill the pool, which refuses the runs 
+	   of the sink and of the other 'once' task instances. The refused 
+	   runs are retried, and the queued sink inputs aren't stranded. */
+	for (i = 0; i < g_n_once; i++) {
+	    sched = NULL;
+	    test_nvp_add_string(&sched, "type", "once");
+	    test_nvp_add_string(&sched, "worker-pool", CONC_POOL);
+	    snprintf(name, sizeof(name), "once-%d", i);
+	    test_mmr_create(CONC_TASK, name, sched, sleep_msec);
+	}
+    }
+
+    /* Wait for the sink results */
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC + 
+			       (g_n_runs + g_n_once) * sleep_msec));
+    t1 = bitd_get_time_nsec();
+
+    stats = test_mmr_pool_stats();
+
+    if (!g_n_once) {
+	test_mmr_destroy(CONC_TASK, CONC_SOURCE);
+    }
+    test_mmr_destroy(CONC_TASK, CONC_SINK);
+    for (i = 0; i < g_n_once; i++) {
+	snprintf(name, sizeof(name), "once-%d", i);
+	test_mmr_destroy(CONC_TASK, name);
+    }
+
+    bitd_mutex_lock(g_lock);
+    for (i = 1; i < g_n_runs; i++) {
+	if (g_run_ids[i] <= g_run_ids[i - 1]) {
+	    n_reordered++;
+	}
+    }
+    bitd_mutex_unlock(g_lock);
+
+    printf("%d results, %d runs of %d msec, max-concurrency %d%s, "
+	   "max-batch-size %d: %.1f msec, %d reordered, %d once\n",
+	   g_n_runs, g_n_sink_runs, sleep_msec, max_concurrency, 
+	   ordered_p ? " ordered" : "", max_batch_size,
+	   (t1 - t0) / 1000000.0, n_reordered, g_n_once_results);
+
+    /* The source runs in the default pool */
+    TEST_CHECK(test_mmr_pool_stat(stats, "default", "dispatched") >= 
+	       g_n_runs);
+
+    /* The sink runs in its pool, within the pool thread limit */
+    if (pool_thread_max) {
+	TEST_CHECK(test_mmr_pool_stat(stats, CONC_POOL, "dispatched") > 0);
+	TEST_CHECK(test_mmr_pool_stat(stats, CONC_POOL, "thread-count") <= 
+		   pool_thread_max);
+
+	/* The pool serializes the runs */
+	if (pool_thread_max == 1 && max_batch_size == 1) {
+	    TEST_CHECK((t1 - t0) / 1000000 >= 
+		       (bitd_uint64)(g_n_runs - 1) * sleep_msec);
+	}
+	max_concurrency = MIN(max_concurrency, pool_thread_max);
+
+	/* The full pool refused runs, and they were retried */
+	if (pool_task_max) {
+	    TEST_CHECK(test_mmr_pool_stat(stats, CONC_POOL, "rejected") > 0);
+	    max_concurrency = MIN(max_concurrency, pool_task_max);
+	}
+    }
+    bitd_nvp_free(stats);
+
+    /* Ordered results are reported in input order */
+    if (ordered_p) {
+	TEST_CHECK(!n_reordered);
+    }
+
+    /* Batch runs drain the queued results */
+    if (max_batch_size > 1) {
+	TEST_CHECK(g_n_sink_runs < g_n_runs);
+    }
+
+    /* Concurrent or batch runs keep up better than serial runs would */
+    if ((max_concurrency > 1 || max_batch_size > 1) && 
+	g_n_runs > max_concurrency) {
+	TEST_CHECK((t1 - t0) / 1000000 < 
+		   (bitd_uint64)g_n_runs * sleep_msec * 3 / 4);
+    }
+
+    test_mmr_deinit(CONC_MODULE);
+
+    free(g_run_ids);
+    bitd_event_destroy(g_source_ev);
+    test_deinit();
+
+    return 0;
+}
@@ -0,0 +1,534 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager scheduling jitter benchmark
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define JITTER_MODULE "bitd-echo"
+#define JITTER_TASK "echo"
+
+/* Max number of intervals on the command line */
+#define JITTER_INTERVALS_MAX 32
+
+/* Default number of runs per interval */
+#define JITTER_RUNS_DEF 200
+
+/* The interval of the phase spreading check, and the phase pinned by
+   the phase option */
+#define PHASE_INTERVAL "200ms"
+#define PHASE_INTERVAL_NSEC 200000000ULL
+#define PHASE_PINNED "100ms"
+#define PHASE_PINNED_NSEC 100000000ULL
+
+/* The run whose timestamp is checked. Earlier runs may be planned
+   before all task instances are created. */
+#define PHASE_RUN 3
+
+/* The catch-up check. Runs sleep longer than the interval, so they 
+   overrun. The sink reports the raw results of the overrunning task 
+   instance. */
+#define CATCH_UP_SOURCE "catch-up"
+#define CATCH_UP_SINK "catch-up-sink"
+#define CATCH_UP_INTERVAL "20ms"
+#define CATCH_UP_INTERVAL_NSEC 20000000ULL
+#define CATCH_UP_SLEEP 50
+#define CATCH_UP_MAX 2
+#define CATCH_UP_RUNS 10
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The default intervals */
+static char *g_intervals_def[] = {
+    "100us", "250us", "500us", "1ms", "2ms", "5ms", "10ms"
+};
+
+/* The result timestamps of the task instance being measured */
+static char *g_task_inst_name;
+static bitd_uint64 *g_tstamps;
+static int g_n_tstamps;
+static int g_n_runs = JITTER_RUNS_DEF;
+
+/* The phase spreading check. The last task instance pins its phase. */
+static int g_n_phase;
+static int *g_phase_runs;
+static bitd_uint64 *g_phase_tstamps;
+static int g_n_phase_done;
+
+/* The catch-up check */
+static char *g_catch_up;
+static bitd_uint64 g_missed_slots[CATCH_UP_RUNS];
+static bitd_int64 g_sched_lags[CATCH_UP_RUNS];
+static int g_n_catch_up;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program measures how late periodic task instances run\n"
+	   "compared to their schedule.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+           "    -n run_count\n"
+           "        Runs measured per interval (default: %d).\n"
+           "    -i interval\n"
+           "        Measure this interval, for instance 100us or 1ms. Can be\n"
+	   "        repeated. Default: 100us to 10ms.\n"
+           "    -phase task_inst_count\n"
+           "        Check that the runs of this many task instances with\n"
+           "        the same interval are spread over it.\n"
+           "    -catch-up coalesce|skip|burst\n"
+           "        Check the catch-up policy of overrunning runs.\n"
+           "    -slack timer_slack_nsec\n"
+           "        Set the module manager timer slack (default: 0).\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , JITTER_RUNS_DEF, TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Record the result timestamps of the measured task
+ *     instance
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+    int i, idx;
+    bitd_nvp_t nvp;
+
+    bitd_mutex_lock(g_lock);
+    if (g_catch_up && !strcmp(task_inst_name, CATCH_UP_SINK)) {
+	if (g_n_catch_up < CATCH_UP_RUNS) {
+	    /* The sink echoes the raw results */
+	    TEST_CHECK(r->output.type == bitd_type_nvp);
+	    nvp = r->output.v.value_nvp;
+	    TEST_CHECK(bitd_nvp_lookup_elem(nvp, "missed-slots", &idx));
+	    g_missed_slots[g_n_catch_up] = nvp->e[idx].v.value_uint64;
+	    TEST_CHECK(bitd_nvp_lookup_elem(nvp, "sched-lag-nsec", &idx));
+	    g_sched_lags[g_n_catch_up] = nvp->e[idx].v.value_uint64;
+	    if (++g_n_catch_up == CATCH_UP_RUNS) {
+		bitd_event_set(g_done_ev);
+	    }
+	}
+    } else if (g_n_phase && !strncmp(task_inst_name, "phase-", 6)) {
+	i = atoi(task_inst_name + 6);
+	if (i >= 0 && i < g_n_phase && ++g_phase_runs[i] == PHASE_RUN) {
+	    g_phase_tstamps[i] = tstamp_ns;
+	    if (++g_n_phase_done == g_n_phase) {
+		bitd_event_set(g_done_ev);
+	    }
+	}
+    } else if (g_task_inst_name && !strcmp(task_inst_name, g_task_inst_name) &&
+	g_n_tstamps < g_n_runs) {
+	g_tstamps[g_n_tstamps++] = tstamp_ns;
+	if (g_n_tstamps == g_n_runs) {
+	    bitd_event_set(g_done_ev);
+	}
+    }
+    bitd_mutex_unlock(g_lock);
+}
+
+
+/*
+ *============================================================================
+ *                        compare_int64
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static int compare_int64(const void *a, const void *b) {
+    bitd_int64 x = *(bitd_int64 *)a, y = *(bitd_int64 *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+
+/*
+ *============================================================================
+ *                        parse_interval
+ *============================================================================
+ * Description:     Parse an interval the way the scheduler does
+ * Parameters:
+ * Returns:
+ *     The interval in nsecs
+ */
+static bitd_uint64 parse_interval(char *s) {
+    bitd_uint64 ret = atoll(s);
+
+    if (strstr(s, "ns")) {
+	/* No-op */
+    } else if (strstr(s, "us")) {
+	ret *= 1000ULL;
+    } else if (strstr(s, "ms")) {
+	ret *= 1000000ULL;
+    } else if (strchr(s, 's')) {
+	ret *= 1000000000ULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        measure_interval
+ *============================================================================
+ * Description:     Run a periodic task instance, and print how late its
+ *     runs are compared to the schedule. The schedule is anchored at the
+ *     first run, and is re-anchored when a run is a full interval late,
+ *     as the scheduler does when it falls behind.
+ * Parameters:
+ * Returns:
+ */
+static void measure_interval(char *interval) {
+    char name[64];
+    bitd_nvp_t sched = NULL;
+    bitd_uint64 interval_nsec = parse_interval(interval);
+    bitd_uint64 sched_nsec;
+    bitd_int64 *late;
+    bitd_int64 late_sum = 0;
+    int i, n_missed = 0;
+
+    TEST_CHECK(interval_nsec > 0);
+
+    snprintf(name, sizeof(name), "jitter-%s", interval);
+
+    bitd_mutex_lock(g_lock);
+    g_task_inst_name = name;
+    g_n_tstamps = 0;
+    bitd_mutex_unlock(g_lock);
+
+    test_nvp_add_string(&sched, "type", "periodic");
+    test_nvp_add_string(&sched, "interval", interval);
+    test_mmr_create(JITTER_TASK, name, sched, 0);
+
+    /* Wait for the runs */
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC +
+			       g_n_runs * interval_nsec / 1000000));
+
+    test_mmr_destroy(JITTER_TASK, name);
+
+    bitd_mutex_lock(g_lock);
+    g_task_inst_name = NULL;
+    bitd_mutex_unlock(g_lock);
+
+    /* Lateness of each run after the first */
+    late = calloc(g_n_runs, sizeof(*late));
+    sched_nsec = g_tstamps[0];
+    for (i = 1; i < g_n_runs; i++) {
+	sched_nsec += interval_nsec;
+	late[i - 1] = (bitd_int64)(g_tstamps[i] - sched_nsec);
+	if (late[i - 1] >= (bitd_int64)interval_nsec) {
+	    n_missed++;
+	    sched_nsec = g_tstamps[i];
+	}
+	if (late[i - 1] < 0) {
+	    late[i - 1] = -late[i - 1];
+	}
+	late_sum += late[i - 1];
+    }
+
+    qsort(late, g_n_runs - 1, sizeof(*late), compare_int64);
+
+    printf("interval %6s: mean period %9.1f us, lateness mean %7.1f us "
+	   "p50 %7.1f us p99 %7.1f us max %8.1f us, re-anchored %d\n",
+	   interval,
+	   (g_tstamps[g_n_runs - 1] - g_tstamps[0]) / 1000.0 / (g_n_runs - 1),
+	   late_sum / 1000.0 / (g_n_runs - 1),
+	   late[(g_n_runs - 1) / 2] / 1000.0,
+	   late[(g_n_runs - 1) * 99 / 100] / 1000.0,
+	   late[g_n_runs - 2] / 1000.0,
+	   n_missed);
+
+    free(late);
+}
+
+
+/*
+ *============================================================================
+ *                        check_phases
+ *============================================================================
+ * Description:     Run task instances with the same interval, and check
+ *     that their run times are spread over the interval, and that
+ *     the pinned phase is respected
+ * Parameters:
+ * Returns:
+ */
+static void check_phases(void) {
+    char name[64];
+    bitd_nvp_t sched;
+    bitd_int64 *phases, gap, gap_min;
+    int i, n = g_n_phase - 1;
+
+    g_phase_runs = calloc(g_n_phase, sizeof(*g_phase_runs));
+    g_phase_tstamps = calloc(g_n_phase, sizeof(*g_phase_tstamps));
+    phases = calloc(g_n_phase, sizeof(*phases));
+
+    for (i = 0; i < g_n_phase; i++) {
+	sched = NULL;
+	test_nvp_add_string(&sched, "type", "periodic");
+	test_nvp_add_string(&sched, "interval", PHASE_INTERVAL);
+	if (i == n) {
+	    test_nvp_add_string(&sched, "phase", PHASE_PINNED);
+	}
+
+	snprintf(name, sizeof(name), "phase-%d", i);
+	test_mmr_create(JITTER_TASK, name, sched, 0);
+    }
+
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC));
+
+    for (i = 0; i < g_n_phase; i++) {
+	snprintf(name, sizeof(name), "phase-%d", i);
+	test_mmr_destroy(JITTER_TASK, name);
+    }
+
+    bitd_mutex_lock(g_lock);
+    for (i = 0; i < g_n_phase; i++) {
+	phases[i] = g_phase_tstamps[i] % PHASE_INTERVAL_NSEC;
+    }
+    bitd_mutex_unlock(g_lock);
+
+    /* The pinned task instance runs at its phase, or a bit later */
+    printf("pinned phase %s: run at %.1f ms\n", PHASE_PINNED,
+	   phases[n] / 1000000.0);
+    TEST_CHECK(phases[n] >= (bitd_int64)PHASE_PINNED_NSEC &&
+	       phases[n] < (bitd_int64)(PHASE_PINNED_NSEC + 
+					PHASE_INTERVAL_NSEC / 4));
+
+    /* The others take slots of the interval, which are at least a
+       quarter of the interval over their count. Random phases would
+       leave some of them much closer. */
+    qsort(phases, n, sizeof(*phases), compare_int64);
+    gap_min = phases[0] + PHASE_INTERVAL_NSEC - phases[n - 1];
+    for (i = 1; i < n; i++) {
+	gap = phases[i] - phases[i - 1];
+	gap_min = MIN(gap_min, gap);
+    }
+    printf("%d task instances every %s: min run spacing %.1f ms, "
+	   "even spacing %.1f ms\n",
+	   n, PHASE_INTERVAL, gap_min / 1000000.0, 
+	   PHASE_INTERVAL_NSEC / 1000000.0 / n);
+    if (g_verbose) {
+	for (i = 0; i < n; i++) {
+	    printf("  phase %.3f ms\n", phases[i] / 1000000.0);
+	}
+    }
+    TEST_CHECK(gap_min >= (bitd_int64)(PHASE_INTERVAL_NSEC / n / 4));
+
+    free(phases);
+    free(g_phase_tstamps);
+    free(g_phase_runs);
+}
+
+
+/*
+ *============================================================================
+ *                        check_catch_up
+ *============================================================================
+ * Description:     Run a periodic task instance that overruns, and check
+ *     how it catches up with its missed slots
+ * Parameters:
+ * Returns:
+ */
+static void check_catch_up(void) {
+    bitd_nvp_t sched = NULL;
+    bitd_int64 lag_max;
+    int i;
+
+    /* The sink of the raw results */
+    test_nvp_add_string(&sched, "type", "triggered-raw");
+    test_nvp_add_string(&sched, "task-name", JITTER_TASK);
+    test_nvp_add_string(&sched, "task-inst-name", CATCH_UP_SOURCE);
+    test_mmr_create(JITTER_TASK, CATCH_UP_SINK, sched, 0);
+
+    /* The overrunning task instance */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "periodic");
+    test_nvp_add_string(&sched, "interval", CATCH_UP_INTERVAL);
+    test_nvp_add_string(&sched, "catch-up", g_catch_up);
+    test_nvp_add_int64(&sched, "catch-up-max", CATCH_UP_MAX);
+    test_mmr_create(JITTER_TASK, CATCH_UP_SOURCE, sched, CATCH_UP_SLEEP);
+
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC));
+
+    test_mmr_destroy(JITTER_TASK, CATCH_UP_SOURCE);
+    test_mmr_destroy(JITTER_TASK, CATCH_UP_SINK);
+
+    bitd_mutex_lock(g_lock);
+    lag_max = 0;
+    for (i = 0; i < CATCH_UP_RUNS; i++) {
+	if (g_verbose) {
+	    printf("  run %d: missed slots %llu, lag %.1f ms\n", i,
+		   (unsigned long long)g_missed_slots[i],
+		   g_sched_lags[i] / 1000000.0);
+	}
+	lag_max = MAX(lag_max, g_sched_lags[i]);
+    }
+    qsort(g_sched_lags, CATCH_UP_RUNS, sizeof(*g_sched_lags), 
+	  compare_int64);
+    bitd_mutex_unlock(g_lock);
+
+    printf("catch-up %s: %d runs of %d ms every %s, missed slots %llu, "
+	   "lag p50 %.1f ms max %.1f ms\n",
+	   g_catch_up, CATCH_UP_RUNS, CATCH_UP_SLEEP, CATCH_UP_INTERVAL,
+	   (unsigned long long)g_missed_slots[CATCH_UP_RUNS - 1],
+	   g_sched_lags[CATCH_UP_RUNS / 2] / 1000000.0,
+	   lag_max / 1000000.0);
+
+    /* Overrunning runs miss slots */
+    TEST_CHECK(g_missed_slots[CATCH_UP_RUNS - 1] > 0);
+
+    if (!strcmp(g_catch_up, "burst")) {
+	/* Bursts run the missed slots late */
+	TEST_CHECK(lag_max >= (bitd_int64)CATCH_UP_INTERVAL_NSEC);
+    } else {
+	/* Runs start within an interval of their slot */
+	TEST_CHECK(g_sched_lags[CATCH_UP_RUNS / 2] < 
+		   (bitd_int64)CATCH_UP_INTERVAL_NSEC);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    char *intervals[JITTER_INTERVALS_MAX];
+    int n_intervals = 0, i;
+    bitd_int64 timer_slack_nsec = -1;
+    bitd_nvp_t config = NULL;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-n")) {
+            g_n_runs = test_arg_int(&argc, &argv, 2, usage);
+        } else if (!strcmp(argv[0], "-i")) {
+            if (n_intervals == JITTER_INTERVALS_MAX) {
+                usage();
+		exit(-1);
+            }
+            intervals[n_intervals++] = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-phase")) {
+            g_n_phase = test_arg_int(&argc, &argv, 3, usage);
+        } else if (!strcmp(argv[0], "-catch-up")) {
+            g_catch_up = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-slack")) {
+            timer_slack_nsec = atoll(test_arg(&argc, &argv, usage));
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    if (!n_intervals) {
+	n_intervals = sizeof(g_intervals_def)/sizeof(g_intervals_def[0]);
+	for (i = 0; i < n_intervals; i++) {
+	    intervals[i] = g_intervals_def[i];
+	}
+    }
+
+    g_tstamps = calloc(g_n_runs, sizeof(*g_tstamps));
+
+    if (timer_slack_nsec >= 0) {
+	test_nvp_add_int64(&config, "timer-slack-nsec", timer_slack_nsec);
+    }
+    test_mmr_init(load_path, JITTER_MODULE, &report_results, config);
+    bitd_nvp_free(config);
+
+    if (g_n_phase) {
+	check_phases();
+    } else if (g_catch_up) {
+	check_catch_up();
+    } else {
+	for (i = 0; i < n_intervals; i++) {
+	    measure_interval(intervals[i]);
+	}
+    }
+
+    test_mmr_deinit(JITTER_MODULE);
+
+    free(g_tstamps);
+    test_deinit();
+
+    return 0;
+}
@@ -0,0 +1,338 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager phase planner test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+#include "mmr.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define PLAN_MODULE "bitd-echo"
+#define PLAN_TASK "echo"
+
+/* The interval of the phase group. It is long, so that the runs do not
+   get in the way. */
+#define PLAN_INTERVAL "10s"
+#define PLAN_INTERVAL_NSEC 10000000000ULL
+
+/* The default number of task instances in the group */
+#define PLAN_N_DEF 20
+
+/* The task instance that joins the group */
+#define PLAN_JOINED "plan-joined"
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The number of task instances in the group */
+static int g_n = PLAN_N_DEF;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program checks the phase planner of periodic task\n"
+	   "instances with the same interval. A task instance joining or\n"
+	   "leaving the group only moves the phases of the task instances\n"
+	   "next to it, and the phases do not depend on the order in which\n"
+	   "the task instances are created.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+	   "    -n task_inst_count\n"
+	   "        Task instances in the group (default: %d). The slot\n"
+	   "        count must not double when one more joins.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , PLAN_N_DEF, TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Ignore the results
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+}
+
+
+/*
+ *============================================================================
+ *                        compare_uint64
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static int compare_uint64(const void *a, const void *b) {
+    bitd_uint64 x = *(bitd_uint64 *)a, y = *(bitd_uint64 *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+
+/*
+ *============================================================================
+ *                        create_task_inst
+ *============================================================================
+ * Description:     Create a task instance of the group
+ * Parameters:
+ * Returns:
+ */
+static void create_task_inst(char *task_inst_name) {
+    bitd_nvp_t sched = NULL;
+
+    test_nvp_add_string(&sched, "type", "periodic");
+    test_nvp_add_string(&sched, "interval", PLAN_INTERVAL);
+    test_mmr_create(PLAN_TASK, task_inst_name, sched, 0);
+}
+
+
+/*
+ *============================================================================
+ *                        get_phase
+ *============================================================================
+ * Description:     Get the planned phase of a task instance. Called with
+ *     the mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint64 get_phase(char *task_inst_name) {
+    struct mmr_task_s *task;
+    struct mmr_task_inst_s *ti;
+
+    task = mmr_task_find(PLAN_TASK);
+    TEST_CHECK(task);
+    ti = mmr_task_inst_find(task, task_inst_name);
+    TEST_CHECK(ti);
+    TEST_CHECK(ti->phase_group);
+
+    return mmr_phase_get(ti);
+}
+
+
+/*
+ *============================================================================
+ *                        get_phases
+ *============================================================================
+ * Description:     Get the planned phases of the task instances, and 
+ *     check that they are spread over the interval
+ * Parameters:
+ * Returns:
+ */
+static void get_phases(bitd_uint64 *phases) {
+    char name[64];
+    bitd_uint64 *sorted, gap, gap_min;
+    int i, n;
+
+    mmr_api_lock();
+    for (i = 0; i < g_n; i++) {
+	snprintf(name, sizeof(name), "plan-%d", i);
+	phases[i] = get_phase(name);
+	TEST_CHECK(phases[i] < PLAN_INTERVAL_NSEC);
+    }
+    n = g_mmr_cb->phase_head->n_task_insts;
+    mmr_api_unlock();
+
+    /* The phases are apart by at least a slot, which is at least a
+       quarter of the interval over the count */
+    sorted = calloc(g_n, sizeof(*sorted));
+    memcpy(sorted, phases, g_n * sizeof(*sorted));
+    qsort(sorted, g_n, sizeof(*sorted), compare_uint64);
+    gap_min = sorted[0] + PLAN_INTERVAL_NSEC - sorted[g_n - 1];
+    for (i = 1; i < g_n; i++) {
+	gap = sorted[i] - sorted[i - 1];
+	gap_min = MIN(gap_min, gap);
+    }
+    free(sorted);
+
+    if (g_verbose) {
+	printf("%d task instances every %s: min spacing %.1f ms\n",
+	       n, PLAN_INTERVAL, gap_min / 1000000.0);
+    }
+    TEST_CHECK(gap_min >= PLAN_INTERVAL_NSEC / n / 4);
+}
+
+
+/*
+ *============================================================================
+ *                        slot_count
+ *============================================================================
+ * Description:     Get the slot count of a group, the way the planner 
+ *     does
+ * Parameters:
+ * Returns:
+ */
+static bitd_uint64 slot_count(int n) {
+    bitd_uint64 n_slots;
+
+    for (n_slots = 2; n_slots < 2 * (bitd_uint64)n; n_slots <<= 1);
+
+    return n_slots;
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    char name[64];
+    bitd_uint64 *phases, *phases_joined, phase_joined, slot, shift;
+    int i, n_moved = 0;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-n")) {
+            g_n = atoi(test_arg(&argc, &argv, usage));
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    /* The slot count must not double when a task instance joins, as
+       all the phases then move */
+    TEST_CHECK(g_n >= 2 && slot_count(g_n) == slot_count(g_n + 1));
+    slot = PLAN_INTERVAL_NSEC / slot_count(g_n);
+    phases = calloc(g_n, sizeof(*phases));
+    phases_joined = calloc(g_n, sizeof(*phases_joined));
+
+    test_mmr_init(load_path, PLAN_MODULE, &report_results, NULL);
+
+    for (i = 0; i < g_n; i++) {
+	snprintf(name, sizeof(name), "plan-%d", i);
+	create_task_inst(name);
+    }
+    get_phases(phases);
+
+    /* A task instance joins the group. The others keep their phases,
+       except for the ones in the run of slots it lands in, which move
+       by a slot. */
+    create_task_inst(PLAN_JOINED);
+    get_phases(phases_joined);
+    mmr_api_lock();
+    phase_joined = get_phase(PLAN_JOINED);
+    mmr_api_unlock();
+    for (i = 0; i < g_n; i++) {
+	TEST_CHECK(phases_joined[i] != phase_joined);
+	if (phases_joined[i] != phases[i]) {
+	    shift = (phases_joined[i] + PLAN_INTERVAL_NSEC - phases[i]) %
+		PLAN_INTERVAL_NSEC;
+	    TEST_CHECK(shift >= slot && shift <= slot + 1);
+	    n_moved++;
+	}
+    }
+
+    printf("%d task instances every %s: %d moved when one joined\n",
+	   g_n, PLAN_INTERVAL, n_moved);
+    TEST_CHECK(n_moved < g_n / 2);
+
+    /* The phases come back when it leaves */
+    test_mmr_destroy(PLAN_TASK, PLAN_JOINED);
+    get_phases(phases_joined);
+    for (i = 0; i < g_n; i++) {
+	TEST_CHECK(phases_joined[i] == phases[i]);
+    }
+
+    /* The phases do not depend on the order of creation */
+    for (i = 0; i < g_n; i++) {
+	snprintf(name, sizeof(name), "plan-%d", i);
+	test_mmr_destroy(PLAN_TASK, name);
+    }
+    for (i = g_n - 1; i >= 0; i--) {
+	snprintf(name, sizeof(name), "plan-%d", i);
+	create_task_inst(name);
+    }
+    get_phases(phases_joined);
+    for (i = 0; i < g_n; i++) {
+	TEST_CHECK(phases_joined[i] == phases[i]);
+    }
+
+    for (i = 0; i < g_n; i++) {
+	snprintf(name, sizeof(name), "plan-%d", i);
+	test_mmr_destroy(PLAN_TASK, name);
+    }
+
+    free(phases_joined);
+    free(phases);
+
+    test_mmr_deinit(PLAN_MODULE);
+    test_deinit();
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager ready queue test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+#include "mmr.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define READY_MODULE "bitd-echo"
+#define READY_TASK "echo"
+
+/* The task instances */
+#define READY_SOURCE "source"
+#define READY_SINK "sink"
+#define READY_RELEASED "released"
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The task instance results */
+static int g_n_source_results;
+static int g_n_sink_results;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program checks the module manager ready queue. Runs that\n"
+	   "are due now, of 'once' and triggered task instances, are queued\n"
+	   "without going through the timer list. A task instance released\n"
+	   "while on the queue is taken off it. Runs queued while the queue\n"
+	   "drains are left for the event loop, which dispatches them.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Count the results of the source and of the sink
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+
+    if (g_verbose) {
+	printf("%s: run %llu\n", task_inst_name, (unsigned long long)run_id);
+    }
+
+    bitd_mutex_lock(g_lock);
+    if (!strcmp(task_inst_name, READY_SOURCE)) {
+	g_n_source_results++;
+    } else if (!strcmp(task_inst_name, READY_SINK)) {
+	/* One run for the test trigger, and one for the source run */
+	if (++g_n_sink_results == 2) {
+	    bitd_event_set(g_done_ev);
+	}
+    }
+    bitd_mutex_unlock(g_lock);
+}
+
+
+/*
+ *============================================================================
+ *                        find_task_inst
+ *============================================================================
+ * Description:     Find a task instance control block. Called with the mmr
+ *     lock held.
+ * Parameters:
+ * Returns:
+ */
+static struct mmr_task_inst_s *find_task_inst(char *task_inst_name) {
+    struct mmr_task_s *task;
+    struct mmr_task_inst_s *ti;
+
+    task = mmr_task_find(READY_TASK);
+    TEST_CHECK(task);
+    ti = mmr_task_inst_find(task, task_inst_name);
+    TEST_CHECK(ti);
+
+    return ti;
+}
+
+
+/*
+ *============================================================================
+ *                        ready_count
+ *============================================================================
+ * Description:     Count the task instances on the ready queue, and check
+ *     its tail. Called with the mmr lock held.
+ * Parameters:
+ * Returns:
+ */
+static int ready_count(void) {
+    struct mmr_task_inst_s *ti, *last = NULL;
+    int n = 0;
+
+    for (ti = g_mmr_cb->ready_head; ti; ti = ti->ready_next) {
+	TEST_CHECK(ti->ready_p);
+	last = ti;
+	n++;
+    }
+    TEST_CHECK(g_mmr_cb->ready_tail == last);
+
+    return n;
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    bitd_nvp_t sched;
+    bitd_value_t v;
+    struct mmr_task_inst_s *source, *sink;
+    mmr_task_inst_results_t r;
+    long n_timers;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    test_mmr_init(load_path, READY_MODULE, &report_results, NULL);
+
+    /* Stand in for a drain of the ready queue in progress, so that the
+       runs queued from here on stay on the queue */
+    mmr_api_lock();
+    TEST_CHECK(!g_mmr_cb->ready_draining_p);
+    TEST_CHECK(!g_mmr_cb->ready_head);
+    g_mmr_cb->ready_draining_p = TRUE;
+    n_timers = bitd_timer_list_count(g_mmr_cb->timers);
+
+    /* The sink echoes the raw results of the source. It has no input
+       yet, and isn't scheduled. */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "triggered-raw");
+    test_nvp_add_string(&sched, "task-name", READY_TASK);
+    test_nvp_add_string(&sched, "task-inst-name", READY_SOURCE);
+    v.value_boolean = FALSE;
+    bitd_nvp_add_elem(&sched, "inline", &v, bitd_type_boolean);
+    test_mmr_create(READY_TASK, READY_SINK, sched, 0);
+    sink = find_task_inst(READY_SINK);
+    TEST_CHECK(!sink->ready_p);
+    TEST_CHECK(!ready_count());
+
+    /* The first run of a 'once' task instance is queued, and not put on
+       the timer list */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "once");
+    test_mmr_create(READY_TASK, READY_SOURCE, sched, 0);
+    source = find_task_inst(READY_SOURCE);
+    TEST_CHECK(source->ready_p);
+    TEST_CHECK(IS_SET(source->state, TASK_INST_SCHEDULED));
+    TEST_CHECK(g_mmr_cb->ready_head == source);
+    TEST_CHECK(ready_count() == 1);
+    TEST_CHECK(bitd_timer_list_count(g_mmr_cb->timers) == n_timers);
+
+    /* A task instance released while queued is taken off the queue */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "once");
+    test_mmr_create(READY_TASK, READY_RELEASED, sched, 0);
+    TEST_CHECK(ready_count() == 2);
+    TEST_CHECK(g_mmr_cb->ready_tail == find_task_inst(READY_RELEASED));
+    test_mmr_destroy(READY_TASK, READY_RELEASED);
+    TEST_CHECK(ready_count() == 1);
+    TEST_CHECK(g_mmr_cb->ready_head == source);
+
+    /* The run of a triggered task instance with input is queued, and not
+       put on the timer list */
+    memset(&r, 0, sizeof(r));
+    mmr_schedule_triggers(source, &r, 0, bitd_get_time_nsec());
+    TEST_CHECK(sink->input_queue_len == 1);
+    TEST_CHECK(sink->ready_p);
+    TEST_CHECK(IS_SET(sink->state, TASK_INST_SCHEDULED));
+    TEST_CHECK(ready_count() == 2);
+    TEST_CHECK(g_mmr_cb->ready_tail == sink);
+    TEST_CHECK(bitd_timer_list_count(g_mmr_cb->timers) == n_timers);
+
+    /* Scheduling during the drain leaves the queue alone, rather than
+       recursing into it */
+    mmr_schedule_run_ready();
+    TEST_CHECK(ready_count() == 2);
+
+    /* End the drain, waking up the event loop as the drain does when it
+       leaves task instances on the queue. Only the event loop dispatches
+       the queued runs. */
+    g_mmr_cb->ready_draining_p = FALSE;
+    bitd_event_set(g_mmr_cb->event_loop_ev);
+    mmr_api_unlock();
+
+    TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC));
+
+    bitd_mutex_lock(g_lock);
+    TEST_CHECK(g_n_source_results == 1);
+    TEST_CHECK(g_n_sink_results == 2);
+    bitd_mutex_unlock(g_lock);
+
+    mmr_api_lock();
+    TEST_CHECK(!ready_count());
+    TEST_CHECK(bitd_timer_list_count(g_mmr_cb->timers) == n_timers);
+    mmr_api_unlock();
+
+    printf("Ready queue: %d source results, %d sink results\n",
+	   g_n_source_results, g_n_sink_results);
+
+    test_mmr_destroy(READY_TASK, READY_SOURCE);
+    test_mmr_destroy(READY_TASK, READY_SINK);
+
+    test_mmr_deinit(READY_MODULE);
+    test_deinit();
+
+    return 0;
+}
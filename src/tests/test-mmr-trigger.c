@@ -0,0 +1,287 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Module manager trigger chain latency test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The module and task that are scheduled */
+#define TRIGGER_MODULE "bitd-echo"
+#define TRIGGER_TASK "echo"
+
+/* The task instance that starts the chains */
+#define TRIGGER_SOURCE "source"
+#define TRIGGER_INTERVAL "20ms"
+
+/* The trigger chain depth past which inline runs are dispatched to
+   the worker pool (MMR_INLINE_DEPTH_MAX) */
+#define TRIGGER_INLINE_DEPTH_MAX 8
+
+/* Defaults */
+#define TRIGGER_STAGES_DEF 12
+#define TRIGGER_CHAINS_DEF 50
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The latencies of the chains, from the source results to the results
+   of the last stage */
+static char g_last_stage[32];
+static bitd_uint64 *g_latencies;
+static int g_n_latencies;
+static int g_n_chains = TRIGGER_CHAINS_DEF;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program runs chains of triggered task instances, and\n"
+	   "measures the latency from the results of the source to the\n"
+	   "results of the last stage. Cheap triggered runs are chained\n"
+	   "inline on the worker thread, up to a chain depth.\n\n");
+
+    printf("Options:\n"
+	   "    -lp load_path\n"
+	   "        DLL load library path (default: lib).\n"
+           "    -n chain_count\n"
+           "        Chains to measure (default: %d).\n"
+           "    -stages stage_count\n"
+           "        Triggered task instances in a chain (default: %d).\n"
+           "    -noinline\n"
+           "        Set the inline schedule option of the stages to false.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , TRIGGER_CHAINS_DEF, TRIGGER_STAGES_DEF, TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        report_results
+ *============================================================================
+ * Description:     Record the chain latency from the results of the last
+ *     stage, which echo the raw results of the source
+ * Parameters:
+ * Returns:
+ */
+static void report_results(char *task_name,
+			   char *task_inst_name,
+			   bitd_nvp_t tags,
+			   bitd_uint64 run_id,
+			   bitd_uint64 tstamp_ns,
+			   mmr_task_inst_results_t *r) {
+    int idx;
+    bitd_uint64 source_tstamp_ns;
+
+    if (strcmp(task_inst_name, g_last_stage)) {
+	return;
+    }
+
+    TEST_CHECK(r->output.type == bitd_type_nvp);
+    TEST_CHECK(bitd_nvp_lookup_elem(r->output.v.value_nvp,
+				    "run-timestamp", &idx));
+    TEST_CHECK(r->output.v.value_nvp->e[idx].type == bitd_type_uint64);
+    source_tstamp_ns = r->output.v.value_nvp->e[idx].v.value_uint64;
+
+    bitd_mutex_lock(g_lock);
+    if (g_n_latencies < g_n_chains) {
+	g_latencies[g_n_latencies++] = tstamp_ns > source_tstamp_ns ?
+	    tstamp_ns - source_tstamp_ns : 0;
+	if (g_verbose) {
+	    printf("chain %d: %.1f usec\n", g_n_latencies,
+		   g_latencies[g_n_latencies - 1] / 1000.0);
+	}
+	if (g_n_latencies == g_n_chains) {
+	    bitd_event_set(g_done_ev);
+	}
+    }
+    bitd_mutex_unlock(g_lock);
+}
+
+
+/*
+ *============================================================================
+ *                        compare_uint64
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static int compare_uint64(const void *a, const void *b) {
+    bitd_uint64 x = *(bitd_uint64 *)a, y = *(bitd_uint64 *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    char *load_path = "lib";
+    int n_stages = TRIGGER_STAGES_DEF;
+    bitd_boolean inline_p = TRUE;
+    bitd_nvp_t sched = NULL;
+    bitd_value_t v;
+    int i;
+    char name[32], prev_name[32];
+    bitd_uint64 n_inlined, n_dispatched;
+    bitd_nvp_t stats;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-lp")) {
+            load_path = test_arg(&argc, &argv, usage);
+        } else if (!strcmp(argv[0], "-n")) {
+            g_n_chains = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-stages")) {
+            n_stages = test_arg_int(&argc, &argv, 1, usage);
+        } else if (!strcmp(argv[0], "-noinline")) {
+	    inline_p = FALSE;
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    g_latencies = calloc(g_n_chains, sizeof(*g_latencies));
+    snprintf(g_last_stage, sizeof(g_last_stage), "stage-%d", n_stages);
+
+    test_mmr_init(load_path, TRIGGER_MODULE, &report_results, NULL);
+
+    /* The first stage is triggered by the raw results of the source,
+       and each following stage echoes the results of the previous one */
+    strcpy(prev_name, TRIGGER_SOURCE);
+    for (i = 1; i <= n_stages; i++) {
+	snprintf(name, sizeof(name), "stage-%d", i);
+
+	sched = NULL;
+	test_nvp_add_string(&sched, "type", 
+			    i == 1 ? "triggered-raw" : "triggered");
+	test_nvp_add_string(&sched, "task-name", TRIGGER_TASK);
+	test_nvp_add_string(&sched, "task-inst-name", prev_name);
+	v.value_boolean = inline_p;
+	bitd_nvp_add_elem(&sched, "inline", &v, bitd_type_boolean);
+	test_mmr_create(TRIGGER_TASK, name, sched, 0);
+
+	strcpy(prev_name, name);
+    }
+
+    /* The source starts a chain in each run */
+    sched = NULL;
+    test_nvp_add_string(&sched, "type", "periodic");
+    test_nvp_add_string(&sched, "interval", TRIGGER_INTERVAL);
+    test_mmr_create(TRIGGER_TASK, TRIGGER_SOURCE, sched, 0);
+
+    /* Wait for the chains */
+    TEST_CHECK(bitd_event_wait(g_done_ev, 
+			       TEST_WAIT_MSEC + g_n_chains * 100));
+
+    test_mmr_destroy(TRIGGER_TASK, TRIGGER_SOURCE);
+
+    stats = test_mmr_pool_stats();
+    n_inlined = test_mmr_pool_stat(stats, "default", "inlined");
+    n_dispatched = test_mmr_pool_stat(stats, "default", "dispatched");
+    bitd_nvp_free(stats);
+
+    for (i = 1; i <= n_stages; i++) {
+	snprintf(name, sizeof(name), "stage-%d", i);
+	test_mmr_destroy(TRIGGER_TASK, name);
+    }
+
+    bitd_mutex_lock(g_lock);
+    qsort(g_latencies, g_n_chains, sizeof(*g_latencies), compare_uint64);
+    bitd_mutex_unlock(g_lock);
+
+    printf("%d chains of %d stages%s: latency median %.1f usec, "
+	   "max %.1f usec, %llu runs inlined, %llu dispatched\n",
+	   g_n_chains, n_stages, inline_p ? "" : " (no inline)",
+	   g_latencies[g_n_chains / 2] / 1000.0,
+	   g_latencies[g_n_chains - 1] / 1000.0,
+	   (unsigned long long)n_inlined,
+	   (unsigned long long)n_dispatched);
+
+    if (inline_p) {
+	/* The first stages of each chain ran inline on the worker of the
+	   source run, up to the depth limit */
+	TEST_CHECK(n_inlined >= (bitd_uint64)g_n_chains *
+		   MIN(n_stages, TRIGGER_INLINE_DEPTH_MAX));
+
+	/* The stages past the depth limit were dispatched */
+	if (n_stages > TRIGGER_INLINE_DEPTH_MAX) {
+	    TEST_CHECK(n_dispatched >= (bitd_uint64)g_n_chains * 2);
+	}
+    } else {
+	TEST_CHECK(!n_inlined);
+	TEST_CHECK(n_dispatched >= (bitd_uint64)g_n_chains * (n_stages + 1));
+    }
+
+    test_mmr_deinit(TRIGGER_MODULE);
+
+    free(g_latencies);
+    test_deinit();
+
+    return 0;
+}
@@ -32,6 +32,13 @@
  *                                  TYPES
  *****************************************************************************/
 
+/* Pack encodings under test */
+typedef enum {
+    pack_format_legacy,
+    pack_format_compact,
+    pack_format_compact_lz4
+} pack_format_t;
+
 
 
 /*****************************************************************************
@@ -44,6 +51,8 @@
  *                                VARIABLES
  *****************************************************************************/
 static char* g_prog_name = "";
+static pack_format_t g_format = pack_format_legacy;
+static int g_lz4_threshold = BITD_PACK_LZ4_THRESHOLD_DEF;
 
 /*****************************************************************************
  *                          FUNCTION IMPLEMENTATION
@@ -67,6 +76,15 @@ void usage() {
     printf("Options:\n"
            "    -t type value\n"
            "       Pack and unpack value.\n"
+           "    -c\n"
+           "       Use the compact encoding in the -t tests that follow.\n"
+           "    -z threshold\n"
+           "       Use the compact encoding in the -t tests that follow,\n"
+           "       compressing payloads of at least threshold bytes.\n"
+           "    -bench n outputs\n"
+           "       Compare size and speed of the encodings over n pack-unpack\n"
+           "       iterations, on a sample result with the given number of\n"
+           "       outputs.\n"
            "    -h, --help, -?\n"
            "       Show this help.\n");
 
@@ -75,6 +93,48 @@ void usage() {
 
 
 
+/*
+ *============================================================================
+ *                        pack_object
+ *============================================================================
+ * Description:     Pack an object using an encoding
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_boolean pack_object(char *buf, int size, int *idx, 
+				bitd_object_t *a, pack_format_t format) {
+
+    switch (format) {
+    case pack_format_compact:
+	return bitd_pack_object_compact(buf, size, idx, a, 0);
+    case pack_format_compact_lz4:
+	return bitd_pack_object_compact(buf, size, idx, a, g_lz4_threshold);
+    default:
+	break;
+    }
+
+    return bitd_pack_object(buf, size, idx, a);
+} 
+
+
+/*
+ *============================================================================
+ *                        get_packed_size
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static int get_packed_size(bitd_object_t *a, pack_format_t format) {
+
+    if (format == pack_format_legacy) {
+	return bitd_get_packed_size_object(a);
+    }
+
+    return bitd_get_packed_size_object_compact(a);
+} 
+
+
 /*
  *============================================================================
  *                        test_pack
@@ -107,15 +167,17 @@ int test_pack(char *type, char *value) {
 	goto end;
     }
 
-    if (!bitd_pack_object(buf, sizeof(buf), &idx, &a1) ||
-	!bitd_unpack_object(buf, sizeof(buf), &idx1, &a2)) {
+    if (!pack_object(buf, sizeof(buf), &idx, &a1, g_format) ||
+	!bitd_unpack_object(buf, sizeof(buf), &idx1, &a2) ||
+	idx1 != idx) {
 	bitd_assert(0);
 	ret = 1;
 	goto end;
     }
 
-    /* Are they the same value? Exact comparison for non-double */
-    if (t != bitd_type_double) {
+    /* Are they the same value? Exact comparison for non-double, and for
+       the compact encoding */
+    if (t != bitd_type_double || g_format != pack_format_legacy) {
 	if (!bitd_object_compare(&a1, &a2)) {
 	    ret = 0;
 	    goto end;
@@ -137,6 +199,159 @@ int test_pack(char *type, char *value) {
 
 
 
+/*
+ *============================================================================
+ *                        make_sample_result
+ *============================================================================
+ * Description:     Build an object shaped like task instance results, 
+ *     with a list of outputs sharing the same element names.
+ * Parameters:    
+ * Returns:  
+ */
+static void make_sample_result(bitd_object_t *a, int n_outputs) {
+    bitd_nvp_t nvp = NULL, tags = NULL, output = NULL, sample;
+    bitd_value_t v;
+    char host[64];
+    int i;
+
+    v.value_string = "ping";
+    bitd_nvp_add_elem(&tags, "task", &v, bitd_type_string);
+    v.value_string = "ping-gateway";
+    bitd_nvp_add_elem(&tags, "task-instance", &v, bitd_type_string);
+    v.value_string = "agent-0001.example.com";
+    bitd_nvp_add_elem(&tags, "host", &v, bitd_type_string);
+
+    for (i = 0; i < n_outputs; i++) {
+	sample = NULL;
+	snprintf(host, sizeof(host), "10.0.%d.%d", (i >> 8) & 0xff, i & 0xff);
+	v.value_string = host;
+	bitd_nvp_add_elem(&sample, "target", &v, bitd_type_string);
+	v.value_double = 0.25 + i * 0.001;
+	bitd_nvp_add_elem(&sample, "rtt-min", &v, bitd_type_double);
+	v.value_double = 0.5 + i * 0.001;
+	bitd_nvp_add_elem(&sample, "rtt-avg", &v, bitd_type_double);
+	v.value_double = 1.0 + i * 0.001;
+	bitd_nvp_add_elem(&sample, "rtt-max", &v, bitd_type_double);
+	v.value_int64 = i % 3;
+	bitd_nvp_add_elem(&sample, "loss", &v, bitd_type_int64);
+	v.value_nvp = sample;
+	bitd_nvp_add_elem(&output, "sample", &v, bitd_type_nvp);
+	bitd_nvp_free(sample);
+    }
+
+    v.value_uint64 = 1543000000000000000ULL;
+    bitd_nvp_add_elem(&nvp, "run-timestamp", &v, bitd_type_uint64);
+    v.value_uint64 = 12345;
+    bitd_nvp_add_elem(&nvp, "run-id", &v, bitd_type_uint64);
+    v.value_int64 = 0;
+    bitd_nvp_add_elem(&nvp, "exit-code", &v, bitd_type_int64);
+    v.value_nvp = tags;
+    bitd_nvp_add_elem(&nvp, "tags", &v, bitd_type_nvp);
+    v.value_nvp = output;
+    bitd_nvp_add_elem(&nvp, "output", &v, bitd_type_nvp);
+
+    bitd_nvp_free(tags);
+    bitd_nvp_free(output);
+
+    a->type = bitd_type_nvp;
+    a->v.value_nvp = nvp;
+} 
+
+
+/*
+ *============================================================================
+ *                        bench_format
+ *============================================================================
+ * Description:     Measure packed size, pack and unpack time of an object
+ * Parameters:    
+ * Returns:  
+ */
+static int bench_format(bitd_object_t *a, pack_format_t format, 
+			char *format_name, int n_iter) {
+    bitd_object_t a1;
+    char *buf;
+    int i, idx = 0, size, ret = 0;
+    bitd_uint64 t0, t1, t2;
+
+    bitd_object_init(&a1);
+
+    size = get_packed_size(a, format);
+    buf = malloc(size);
+
+    t0 = bitd_get_time_nsec();
+    for (i = 0; i < n_iter; i++) {
+	idx = 0;
+	if (!pack_object(buf, size, &idx, a, format)) {
+	    printf("%s: Failed to pack %s.\n", g_prog_name, format_name);
+	    ret = 1;
+	    goto end;
+	}
+    }
+
+    t1 = bitd_get_time_nsec();
+    for (i = 0; i < n_iter; i++) {
+	bitd_object_free(&a1);
+	bitd_object_init(&a1);
+	size = idx;
+	idx = 0;
+	if (!bitd_unpack_object(buf, size, &idx, &a1) || idx != size) {
+	    printf("%s: Failed to unpack %s.\n", g_prog_name, format_name);
+	    ret = 1;
+	    goto end;
+	}
+    }
+    t2 = bitd_get_time_nsec();
+
+    /* The compact encoding packs doubles exactly */
+    if (format != pack_format_legacy && bitd_object_compare(a, &a1)) {
+	printf("%s: Unpacked %s object differs.\n", g_prog_name, format_name);
+	ret = 1;
+	goto end;
+    }
+
+    printf("%-12s %10d bytes %10llu ns/pack %10llu ns/unpack\n",
+	   format_name, size, 
+	   (t1 - t0) / n_iter, (t2 - t1) / n_iter);
+
+ end:
+    bitd_object_free(&a1);
+    free(buf);
+
+    return ret;
+} 
+
+
+/*
+ *============================================================================
+ *                        test_bench
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+int test_bench(int n_iter, int n_outputs) {
+    bitd_object_t a;
+    int ret;
+
+    if (n_iter <= 0) {
+	n_iter = 1;
+    }
+
+    make_sample_result(&a, n_outputs);
+
+    printf("Sample result with %d outputs, %d iterations:\n", 
+	   n_outputs, n_iter);
+
+    ret = bench_format(&a, pack_format_legacy, "legacy", n_iter) ||
+	bench_format(&a, pack_format_compact, "compact", n_iter) ||
+	bench_format(&a, pack_format_compact_lz4, "compact-lz4", n_iter);
+
+    bitd_object_free(&a);
+
+    return ret;
+} 
+
+
 /*
  *============================================================================
  *                        main
@@ -176,6 +391,39 @@ int main(int argc, char ** argv) {
             argc--;
             argv++;
 
+        } else if (!strcmp(argv[0], "-c")) {
+	    g_format = pack_format_compact;
+        } else if (!strcmp(argv[0], "-z")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (argc < 1) {
+                usage();
+            }
+
+	    g_format = pack_format_compact_lz4;
+	    g_lz4_threshold = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-bench")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (argc < 2) {
+                usage();
+            }
+
+	    ret = test_bench(atoi(argv[0]), atoi(argv[1]));
+	    if (ret) {
+		return ret;
+	    }
+	    
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+
         } else if (!strcmp(argv[0], "-h") ||
                    !strcmp(argv[0], "--help") ||
                    !strcmp(argv[0], "-?")) {
@@ -0,0 +1,303 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description:
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/platform-poll-event.h"
+#include "bitd/file.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+#define ITERATION_COUNT_DEFAULT 10000
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static char* g_prog_name = "";
+static bitd_poll_event g_ping_ev, g_pong_ev;
+static int g_iteration_count = ITERATION_COUNT_DEFAULT;
+bitd_int32 g_verbose;
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+
+/*
+ *============================================================================
+ *                        poll_event_readable
+ *============================================================================
+ * Description:     Check whether the event fd polls readable
+ * Parameters:
+ * Returns:
+ */
+static bitd_boolean poll_event_readable(bitd_poll_event e) {
+    struct bitd_pollfd pfd;
+
+    pfd.fd = bitd_poll_event_to_fd(e);
+    pfd.events = BITD_POLLIN;
+    pfd.revents = 0;
+
+    return bitd_poll(&pfd, 1, 0) == 1 && (pfd.revents & BITD_POLLIN);
+}
+
+
+/*
+ *============================================================================
+ *                        test_semantics
+ *============================================================================
+ * Description:     Check the set/clear/wait semantics
+ * Parameters:
+ * Returns:         0 on success
+ */
+static int test_semantics(void) {
+    bitd_poll_event e;
+    bitd_uint32 start_time;
+    int ret = -1;
+
+    e = bitd_poll_event_create();
+    if (!e) {
+	printf("Could not create poll event\n");
+	return -1;
+    }
+
+    if (poll_event_readable(e) || bitd_poll_event_wait(e, 0)) {
+	printf("New event is set\n");
+	goto end;
+    }
+
+    /* Setting twice, then clearing once, should clear the event */
+    bitd_poll_event_set(e);
+    bitd_poll_event_set(e);
+    if (!poll_event_readable(e)) {
+	printf("Set event is not readable\n");
+	goto end;
+    }
+    bitd_poll_event_clear(e);
+    if (poll_event_readable(e)) {
+	printf("Cleared event is readable\n");
+	goto end;
+    }
+
+    /* Clearing a cleared event should not block */
+    bitd_poll_event_clear(e);
+
+    /* Wait should consume the event */
+    bitd_poll_event_set(e);
+    if (!bitd_poll_event_wait(e, 100) || poll_event_readable(e)) {
+	printf("Wait did not consume the event\n");
+	goto end;
+    }
+
+    /* Wait should time out on a cleared event */
+    start_time = bitd_get_time_msec();
+    if (bitd_poll_event_wait(e, 50)) {
+	printf("Wait on cleared event returned TRUE\n");
+	goto end;
+    }
+    if (bitd_get_time_msec() - start_time < 40) {
+	printf("Wait returned early, after %u msec\n",
+	       bitd_get_time_msec() - start_time);
+	goto end;
+    }
+
+    ret = 0;
+
+ end:
+    bitd_poll_event_destroy(e);
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        pong_entry
+ *============================================================================
+ * Description:     Wait for ping, and answer with pong
+ * Parameters:
+ * Returns:
+ */
+static void pong_entry(void *thread_arg) {
+    int i;
+
+    for (i = 0; i < g_iteration_count; i++) {
+	bitd_poll_event_wait(g_ping_ev, BITD_FOREVER);
+	bitd_poll_event_set(g_pong_ev);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        bench
+ *============================================================================
+ * Description:     Measure set/clear and cross-thread set/wait latency
+ * Parameters:
+ * Returns:         0 on success
+ */
+static int bench(void) {
+    bitd_poll_event e;
+    bitd_thread th;
+    bitd_uint64 start_nsec, stop_nsec;
+    int i;
+
+    e = bitd_poll_event_create();
+    if (!e) {
+	return -1;
+    }
+
+    /* Set and clear */
+    start_nsec = bitd_get_time_nsec();
+    for (i = 0; i < g_iteration_count; i++) {
+	bitd_poll_event_set(e);
+	bitd_poll_event_clear(e);
+    }
+    stop_nsec = bitd_get_time_nsec();
+    printf("set/clear:      %llu nsec/op\n",
+	   (stop_nsec - start_nsec) / g_iteration_count);
+
+    /* Set and wait, same thread */
+    start_nsec = bitd_get_time_nsec();
+    for (i = 0; i < g_iteration_count; i++) {
+	bitd_poll_event_set(e);
+	bitd_poll_event_wait(e, 0);
+    }
+    stop_nsec = bitd_get_time_nsec();
+    printf("set/wait:       %llu nsec/op\n",
+	   (stop_nsec - start_nsec) / g_iteration_count);
+
+    bitd_poll_event_destroy(e);
+
+    /* Ping-pong between two threads */
+    g_ping_ev = bitd_poll_event_create();
+    g_pong_ev = bitd_poll_event_create();
+    th = bitd_create_thread("pong", pong_entry, 0, 0, NULL);
+
+    start_nsec = bitd_get_time_nsec();
+    for (i = 0; i < g_iteration_count; i++) {
+	bitd_poll_event_set(g_ping_ev);
+	bitd_poll_event_wait(g_pong_ev, BITD_FOREVER);
+    }
+    stop_nsec = bitd_get_time_nsec();
+    printf("ping-pong:      %llu nsec/round-trip\n",
+	   (stop_nsec - start_nsec) / g_iteration_count);
+
+    bitd_join_thread(th);
+    bitd_poll_event_destroy(g_ping_ev);
+    bitd_poll_event_destroy(g_pong_ev);
+
+    return 0;
+}
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void usage() {
+
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program tests and benchmarks the poll event API.\n\n");
+
+    printf("Options:\n"
+           "    -n iteration_count\n"
+           "            Number of benchmark iterations. Default: %d.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "            Set the verbosity level (default: 0).\n"
+           "    -h, --help, -?\n"
+           "            Show this help.\n",
+           ITERATION_COUNT_DEFAULT);
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    int ret;
+
+    bitd_sys_init();
+
+    /* Parse program name argument */
+    g_prog_name = bitd_get_leaf_filename(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    /* Parse vector size and help */
+    while (argc) {
+        if (!strcmp(argv[0], "-n") && argc > 1) {
+            argc--;
+            argv++;
+            g_iteration_count = atoi(argv[0]);
+        } else if ((!strcmp(argv[0], "-v") ||
+		    !strcmp(argv[0], "--verbose")) && argc > 1) {
+            argc--;
+            argv++;
+            g_verbose = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-h") ||
+                   !strcmp(argv[0], "--help") ||
+                   !strcmp(argv[0], "-?")) {
+            usage();
+	    exit(0);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    ret = test_semantics();
+    if (!ret && g_iteration_count > 0) {
+	ret = bench();
+    }
+
+    bitd_sys_deinit();
+
+    return ret;
+}
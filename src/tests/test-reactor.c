@@ -0,0 +1,266 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description:
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/reactor.h"
+#include "bitd/file.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+#define INSTANCE_COUNT_DEFAULT 10
+#define MSG_COUNT_DEFAULT 100
+#define TIMER_TMO 5
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* A simulated sink instance: a queue drained by the reactor, and a timer
+   that fires after the queue is drained */
+struct instance_cb {
+    int idx;
+    bitd_reactor_loop loop;
+    bitd_queue queue;
+    bitd_reactor_handle queue_h;
+    bitd_reactor_handle timer_h;
+    int n_msgs_recv;
+    int n_timer_fired;
+    bitd_event done_ev;
+};
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static char* g_prog_name = "";
+static int g_msg_count = MSG_COUNT_DEFAULT;
+bitd_int32 g_verbose;
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+
+/*
+ *============================================================================
+ *                        timer_cb
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void timer_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    struct instance_cb *p = (struct instance_cb *)cookie;
+
+    p->n_timer_fired++;
+
+    /* Remove both handles from within the callback */
+    bitd_reactor_remove(p->queue_h);
+    bitd_reactor_remove(p->timer_h);
+    p->queue_h = NULL;
+    p->timer_h = NULL;
+
+    bitd_event_set(p->done_ev);
+}
+
+
+/*
+ *============================================================================
+ *                        queue_cb
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void queue_cb(bitd_reactor_handle h, bitd_uint32 events, void *cookie) {
+    struct instance_cb *p = (struct instance_cb *)cookie;
+    bitd_msg m;
+
+    while ((m = bitd_msg_receive_w_tmo(p->queue, 0))) {
+	if (bitd_msg_get_opcode(m) != p->n_msgs_recv) {
+	    printf("Instance %d: message %u out of order\n",
+		   p->idx, bitd_msg_get_opcode(m));
+	}
+	p->n_msgs_recv++;
+	bitd_msg_free(m);
+    }
+
+    if (p->n_msgs_recv == g_msg_count) {
+	bitd_reactor_timer_set(p->timer_h, TIMER_TMO);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        instance_start
+ *============================================================================
+ * Description:     Register the instance handles, on the loop thread
+ * Parameters:
+ * Returns:
+ */
+static void instance_start(void *cookie) {
+    struct instance_cb *p = (struct instance_cb *)cookie;
+
+    p->queue_h = bitd_reactor_queue_add(p->loop, p->queue, queue_cb, p);
+    p->timer_h = bitd_reactor_timer_add(p->loop, timer_cb, p);
+}
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void usage() {
+
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program tests the reactor API.\n\n");
+
+    printf("Options:\n"
+           "    -n instance_count\n"
+           "            Number of instances. Default: %d.\n"
+           "    -m msg_count\n"
+           "            Number of messages per instance. Default: %d.\n"
+           "    -l loop_count\n"
+           "            Number of reactor loops. Default: %d.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "            Set the verbosity level (default: 0).\n"
+           "    -h, --help, -?\n"
+           "            Show this help.\n",
+           INSTANCE_COUNT_DEFAULT, MSG_COUNT_DEFAULT, BITD_REACTOR_LOOPS_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    int instance_count = INSTANCE_COUNT_DEFAULT, i, j, ret = 0;
+    bitd_uint32 loop_count = 0;
+    struct instance_cb *p;
+
+    bitd_sys_init();
+
+    /* Parse program name argument */
+    g_prog_name = bitd_get_leaf_filename(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    /* Parse vector size and help */
+    while (argc) {
+        if (!strcmp(argv[0], "-n") && argc > 1) {
+            argc--;
+            argv++;
+            instance_count = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-m") && argc > 1) {
+            argc--;
+            argv++;
+            g_msg_count = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-l") && argc > 1) {
+            argc--;
+            argv++;
+            loop_count = atoi(argv[0]);
+        } else if ((!strcmp(argv[0], "-v") ||
+		    !strcmp(argv[0], "--verbose")) && argc > 1) {
+            argc--;
+            argv++;
+            g_verbose = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-h") ||
+                   !strcmp(argv[0], "--help") ||
+                   !strcmp(argv[0], "-?")) {
+            usage();
+	    exit(0);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    bitd_reactor_init(loop_count);
+
+    /* Start the instances */
+    p = calloc(instance_count, sizeof(*p));
+    for (i = 0; i < instance_count; i++) {
+	p[i].idx = i;
+	p[i].queue = bitd_queue_create("instance queue",
+				       BITD_QUEUE_FLAG_POLL, 0);
+	p[i].done_ev = bitd_event_create(0);
+	p[i].loop = bitd_reactor_loop_get();
+	bitd_reactor_call(p[i].loop, instance_start, &p[i], TRUE);
+    }
+
+    /* Send the messages */
+    for (j = 0; j < g_msg_count; j++) {
+	for (i = 0; i < instance_count; i++) {
+	    bitd_msg_send(bitd_msg_alloc(j, 0), p[i].queue);
+	}
+    }
+
+    /* Wait for the instances to drain their queues, and fire their
+       timers */
+    for (i = 0; i < instance_count; i++) {
+	if (!bitd_event_wait(p[i].done_ev, 5000)) {
+	    printf("Instance %d timed out\n", i);
+	    ret = -1;
+	} else if (p[i].n_msgs_recv != g_msg_count ||
+		   p[i].n_timer_fired != 1) {
+	    printf("Instance %d: %d messages, %d timer expirations\n",
+		   i, p[i].n_msgs_recv, p[i].n_timer_fired);
+	    ret = -1;
+	}
+    }
+
+    bitd_reactor_deinit();
+
+    for (i = 0; i < instance_count; i++) {
+	bitd_queue_destroy(p[i].queue);
+	bitd_event_destroy(p[i].done_ev);
+    }
+    free(p);
+
+    bitd_sys_deinit();
+
+    return ret;
+}
@@ -0,0 +1,317 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Resolver cache test
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+#include "bitd/resolve.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* The hostports used by the test */
+#define HOSTPORT_NUMERIC "127.0.0.1:80"
+#define HOSTPORT_NAME "localhost:8080"
+#define HOSTPORT_BAD ":1"  /* Empty host name, fails without a DNS query */
+
+/* The cache ttls */
+#define TTL_MSEC 400
+#define NEG_TTL_MSEC 200
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* Completed async requests */
+static int g_n_completed;
+static int g_n_failed;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program tests the resolver cache.\n\n");
+
+    printf("Options:\n"
+           "    -n request_count\n"
+           "        Concurrent async requests for the same name (default: 100).\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "        Set the verbosity level (default: %d).\n"
+           "    -h, --help, -?\n"
+           "        Show this help.\n"
+           , TEST_VERBOSE_DEF);
+}
+
+
+/*
+ *============================================================================
+ *                        print_stats
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void print_stats(char *prefix, bitd_resolve_stats_t *s) {
+
+    bitd_resolve_get_stats(s);
+
+    if (g_verbose) {
+	printf("%s: lookups %llu hits %llu negative-hits %llu misses %llu "
+	       "coalesced %llu resolves %llu failures %llu prefetches %llu "
+	       "evictions %llu entries %llu\n",
+	       prefix,
+	       (unsigned long long)s->lookups,
+	       (unsigned long long)s->hits,
+	       (unsigned long long)s->negative_hits,
+	       (unsigned long long)s->misses,
+	       (unsigned long long)s->coalesced,
+	       (unsigned long long)s->resolves,
+	       (unsigned long long)s->failures,
+	       (unsigned long long)s->prefetches,
+	       (unsigned long long)s->evictions,
+	       (unsigned long long)s->entries);
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        async_cb
+ *============================================================================
+ * Description:     Async request completion callback
+ * Parameters:
+ * Returns:
+ */
+static void async_cb(bitd_resolve_req r, int ret,
+		     struct sockaddr_storage *sa, void *cookie) {
+
+    bitd_mutex_lock(g_lock);
+    g_n_completed++;
+    if (ret || bitd_sin_family(sa) == 0) {
+	g_n_failed++;
+    }
+    bitd_mutex_unlock(g_lock);
+
+    bitd_event_set(g_done_ev);
+}
+
+
+/*
+ *============================================================================
+ *                        wait_completed
+ *============================================================================
+ * Description:     Wait for the async requests to complete
+ * Parameters:
+ * Returns:
+ */
+static void wait_completed(int n) {
+    int n_completed;
+
+    for (;;) {
+	bitd_mutex_lock(g_lock);
+	n_completed = g_n_completed;
+	bitd_mutex_unlock(g_lock);
+
+	if (n_completed >= n) {
+	    break;
+	}
+
+	TEST_CHECK(bitd_event_wait(g_done_ev, TEST_WAIT_MSEC));
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    int n_reqs = 100, i, ret;
+    bitd_resolve_req *reqs, r;
+    struct sockaddr_storage sa;
+    bitd_resolve_stats_t s, s1;
+    struct bitd_pollfd p;
+    bitd_uint64 t0, t1;
+
+    test_init(argv[0]);
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    while (argc) {
+        if (test_arg_common(&argc, &argv, usage)) {
+	    /* Handled */
+        } else if (!strcmp(argv[0], "-n")) {
+            n_reqs = test_arg_int(&argc, &argv, 1, usage);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    /* Without the resolver, the cached API resolves directly */
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    TEST_CHECK(bitd_resolve_hostport_async(HOSTPORT_NUMERIC,
+					   NULL, NULL) == NULL);
+
+    TEST_CHECK(bitd_resolve_init());
+    bitd_resolve_set_ttl(TTL_MSEC, NEG_TTL_MSEC);
+
+    /* A miss, then a hit */
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    TEST_CHECK(bitd_sin_family(&sa) == AF_INET);
+    TEST_CHECK(ntohs(*bitd_sin_port(&sa)) == 80);
+    print_stats("numeric", &s);
+    TEST_CHECK(s.misses == 1 && s.hits == 1 && s.resolves == 1);
+
+    /* Concurrent requests for the same name share one resolution */
+    reqs = calloc(n_reqs, sizeof(*reqs));
+    for (i = 0; i < n_reqs; i++) {
+	reqs[i] = bitd_resolve_hostport_async(HOSTPORT_NAME, &async_cb, NULL);
+	TEST_CHECK(reqs[i] != NULL);
+    }
+    wait_completed(n_reqs);
+    for (i = 0; i < n_reqs; i++) {
+	TEST_CHECK(bitd_resolve_req_result(reqs[i], &ret, &sa, sizeof(sa)));
+	TEST_CHECK(!ret);
+	TEST_CHECK(ntohs(*bitd_sin_port(&sa)) == 8080);
+	bitd_resolve_req_free(reqs[i]);
+    }
+    print_stats("coalesced", &s);
+    TEST_CHECK(!g_n_failed);
+    TEST_CHECK(s.resolves == 2);
+    TEST_CHECK(s.misses - 1 + s.hits - 1 == (bitd_uint64)n_reqs);
+    TEST_CHECK(s.coalesced == s.misses - 2);
+
+    /* The pollable fd of a completed request is readable */
+    r = bitd_resolve_hostport_async(HOSTPORT_NAME, NULL, NULL);
+    TEST_CHECK(r != NULL);
+    p.fd = bitd_resolve_req_fd(r);
+    p.events = BITD_POLLIN;
+    p.revents = 0;
+    TEST_CHECK(bitd_poll(&p, 1, 10000) == 1);
+    TEST_CHECK(bitd_resolve_req_result(r, &ret, NULL, 0) && !ret);
+    bitd_resolve_req_free(r);
+
+    /* Failures are cached with the negative ttl */
+    TEST_CHECK(bitd_resolve_hostport_cached(&sa, sizeof(sa), HOSTPORT_BAD));
+    TEST_CHECK(bitd_resolve_hostport_cached(&sa, sizeof(sa), HOSTPORT_BAD));
+    print_stats("negative", &s);
+    TEST_CHECK(s.failures == 1 && s.negative_hits == 1);
+
+    /* After the negative ttl, the failure is retried */
+    bitd_sleep(NEG_TTL_MSEC + 50);
+    TEST_CHECK(bitd_resolve_hostport_cached(&sa, sizeof(sa), HOSTPORT_BAD));
+    print_stats("negative-expired", &s);
+    TEST_CHECK(s.failures == 2);
+
+    /* Past 80% of the ttl, a hit starts a background refresh */
+    bitd_resolve_flush();
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    print_stats("flushed", &s1);
+    bitd_sleep(TTL_MSEC * 85 / 100);
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    for (i = 0; i < 100; i++) {
+	print_stats("prefetch", &s);
+	if (s.resolves > s1.resolves) {
+	    break;
+	}
+	bitd_sleep(10);
+    }
+    TEST_CHECK(s.prefetches == 1 && s.resolves == s1.resolves + 1);
+    TEST_CHECK(s.misses == s1.misses);
+
+    /* The refreshed entry did not expire */
+    bitd_sleep(TTL_MSEC * 30 / 100);
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa),
+					     HOSTPORT_NUMERIC));
+    print_stats("refreshed", &s);
+    TEST_CHECK(s.misses == s1.misses);
+
+    /* Cancel a pending request */
+    bitd_resolve_flush();
+    r = bitd_resolve_hostport_async(HOSTPORT_NAME, &async_cb, NULL);
+    bitd_resolve_req_free(r);
+
+    /* Cache hit cost */
+    bitd_resolve_set_ttl(60000, 60000);
+    bitd_resolve_flush();
+    TEST_CHECK(!bitd_resolve_hostport_cached(&sa, sizeof(sa), HOSTPORT_NAME));
+    t0 = bitd_get_time_nsec();
+    for (i = 0; i < 100000; i++) {
+	bitd_resolve_hostport_cached(&sa, sizeof(sa), HOSTPORT_NAME);
+    }
+    t1 = bitd_get_time_nsec();
+    printf("Cached lookup: %.0f nsec\n", (t1 - t0) / 100000.0);
+
+    t0 = bitd_get_time_nsec();
+    for (i = 0; i < 100; i++) {
+	bitd_resolve_hostport(&sa, sizeof(sa), HOSTPORT_NAME);
+    }
+    t1 = bitd_get_time_nsec();
+    printf("Uncached lookup: %.0f nsec\n", (t1 - t0) / 100.0);
+
+    print_stats("final", &s);
+
+    bitd_resolve_deinit();
+
+    free(reqs);
+    test_deinit();
+
+    return 0;
+}
@@ -0,0 +1,478 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description:
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/spool.h"
+#include "bitd/file.h"
+
+#include <dirent.h>
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+#define RECORD_COUNT_DEFAULT 1000
+#define SEGMENT_SIZE_DEFAULT 4096
+#define READ_SIZE_DEFAULT 2000
+#define RECORD_SIZE_MAX 256
+#define CORRUPT_RECORD "corrupt-me"
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static char* g_prog_name = "";
+static char g_dir[256];
+static bitd_uint32 g_segment_size = SEGMENT_SIZE_DEFAULT;
+static bitd_uint32 g_flags;
+bitd_int32 g_verbose;
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+
+/*
+ *============================================================================
+ *                        record_gen
+ *============================================================================
+ * Description:     Generate the contents of record i
+ * Parameters:
+ * Returns:     The record size
+ */
+static int record_gen(char *buf, int i) {
+    int size = 16 + (i * 37) % (RECORD_SIZE_MAX - 16), j;
+
+    sprintf(buf, "record %08d", i);
+    for (j = 15; j < size; j++) {
+	buf[j] = 'a' + (i + j) % 26;
+    }
+
+    return size;
+}
+
+
+/*
+ *============================================================================
+ *                        spool_check_read
+ *============================================================================
+ * Description:     Read records and check them against the expected
+ *     record sequence
+ * Parameters:
+ * Returns:     The number of records read, or -1 on mismatch
+ */
+static int spool_check_read(bitd_spool s, int first_record, bitd_uint32 max_size) {
+    bitd_msg m;
+    char buf[RECORD_SIZE_MAX];
+    bitd_uint32 off = 0, msg_size;
+    int size, n = 0;
+
+    m = bitd_spool_read(s, max_size);
+    if (!m) {
+	return 0;
+    }
+
+    msg_size = bitd_msg_get_size(m);
+    while (off < msg_size) {
+	size = record_gen(buf, first_record + n);
+	if (off + size > msg_size || memcmp((char *)m + off, buf, size)) {
+	    printf("Record %d mismatch\n", first_record + n);
+	    bitd_msg_free(m);
+	    return -1;
+	}
+	off += size;
+	n++;
+    }
+    bitd_msg_free(m);
+
+    if (g_verbose) {
+	printf("Read records %d..%d, %u bytes\n",
+	       first_record, first_record + n - 1, msg_size);
+    }
+
+    return n;
+}
+
+
+/*
+ *============================================================================
+ *                        seg_file_count
+ *============================================================================
+ * Description:     Count the segment files in the spool directory
+ * Parameters:
+ * Returns:
+ */
+static int seg_file_count(void) {
+    DIR *d;
+    struct dirent *de;
+    int n = 0;
+
+    d = opendir(g_dir);
+    if (!d) {
+	return 0;
+    }
+    while ((de = readdir(d))) {
+	if (strstr(de->d_name, ".seg")) {
+	    n++;
+	}
+    }
+    closedir(d);
+
+    return n;
+}
+
+
+/*
+ *============================================================================
+ *                        spool_dir_remove
+ *============================================================================
+ * Description:     Remove the spool directory and its segment files
+ * Parameters:
+ * Returns:
+ */
+static void spool_dir_remove(void) {
+    DIR *d;
+    struct dirent *de;
+    char path[512];
+
+    d = opendir(g_dir);
+    if (!d) {
+	return;
+    }
+    while ((de = readdir(d))) {
+	if (strstr(de->d_name, ".seg")) {
+	    snprintf(path, sizeof(path), "%s/%s", g_dir, de->d_name);
+	    unlink(path);
+	}
+    }
+    closedir(d);
+    rmdir(g_dir);
+}
+
+
+/*
+ *============================================================================
+ *                        spool_corrupt
+ *============================================================================
+ * Description:     Flip a byte of the CORRUPT_RECORD record, in whichever
+ *     segment file holds it
+ * Parameters:
+ * Returns:     TRUE if the record was found
+ */
+static bitd_boolean spool_corrupt(void) {
+    DIR *d;
+    struct dirent *de;
+    char path[512], *buf;
+    int size, i, len = strlen(CORRUPT_RECORD);
+    bitd_boolean ret = FALSE;
+    FILE *f;
+
+    d = opendir(g_dir);
+    if (!d) {
+	return FALSE;
+    }
+    buf = malloc(g_segment_size);
+    while (!ret && (de = readdir(d))) {
+	if (!strstr(de->d_name, ".seg")) {
+	    continue;
+	}
+	snprintf(path, sizeof(path), "%s/%s", g_dir, de->d_name);
+	f = fopen(path, "r+b");
+	if (!f) {
+	    continue;
+	}
+	size = fread(buf, 1, g_segment_size, f);
+	for (i = 0; i + len <= size; i++) {
+	    if (!memcmp(buf + i, CORRUPT_RECORD, len)) {
+		fseek(f, i, SEEK_SET);
+		fputc('C', f);
+		ret = TRUE;
+		break;
+	    }
+	}
+	fclose(f);
+    }
+    free(buf);
+    closedir(d);
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        spool_test
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:     0 on success
+ */
+static int spool_test(int record_count, bitd_uint32 read_size) {
+    bitd_spool s;
+    char buf[RECORD_SIZE_MAX];
+    int i, n, size, n_read;
+
+    spool_dir_remove();
+
+    /* Append the records */
+    s = bitd_spool_open(g_dir, g_segment_size,
+			(bitd_uint64)g_segment_size * 1024, g_flags);
+    if (!s) {
+	printf("Could not open spool %s\n", g_dir);
+	return -1;
+    }
+    for (i = 0; i < record_count; i++) {
+	size = record_gen(buf, i);
+	if (!bitd_spool_append(s, buf, size)) {
+	    printf("Could not append record %d\n", i);
+	    return -1;
+	}
+    }
+    if (bitd_spool_count(s) != record_count) {
+	printf("Spool count %u, expected %d\n",
+	       bitd_spool_count(s), record_count);
+	return -1;
+    }
+
+    /* Uncommitted records should be read again */
+    n = spool_check_read(s, 0, read_size);
+    if (n <= 0 || spool_check_read(s, 0, read_size) != n) {
+	printf("Uncommitted read replay failed\n");
+	return -1;
+    }
+
+    /* Consume about half the records */
+    n_read = 0;
+    while (n_read < record_count / 2) {
+	n = spool_check_read(s, n_read, read_size);
+	if (n <= 0) {
+	    return -1;
+	}
+	bitd_spool_commit(s);
+	n_read += n;
+    }
+    bitd_spool_close(s);
+
+    /* Reopen, and recover the unconsumed records */
+    s = bitd_spool_open(g_dir, g_segment_size,
+			(bitd_uint64)g_segment_size * 1024, g_flags);
+    if (!s || bitd_spool_count(s) != record_count - n_read) {
+	printf("Spool recovered %u records, expected %d\n",
+	       bitd_spool_count(s), record_count - n_read);
+	return -1;
+    }
+
+    /* Append a record, and corrupt it after closing the spool */
+    bitd_spool_append(s, CORRUPT_RECORD, strlen(CORRUPT_RECORD));
+    bitd_spool_close(s);
+    if (!spool_corrupt()) {
+	printf("Could not find the record to corrupt\n");
+	return -1;
+    }
+
+    /* The corrupted record should be dropped on recovery */
+    s = bitd_spool_open(g_dir, g_segment_size,
+			(bitd_uint64)g_segment_size * 1024, g_flags);
+    if (!s || bitd_spool_count(s) != record_count - n_read) {
+	printf("Spool recovered %u records after corruption, expected %d\n",
+	       bitd_spool_count(s), record_count - n_read);
+	return -1;
+    }
+
+    /* Consume the rest of the records */
+    while ((n = spool_check_read(s, n_read, read_size)) > 0) {
+	bitd_spool_commit(s);
+	n_read += n;
+    }
+    if (n < 0 || n_read != record_count || bitd_spool_count(s) ||
+	bitd_spool_size(s)) {
+	printf("Read %d records, expected %d\n", n_read, record_count);
+	return -1;
+    }
+
+    /* Consumed segments should have been recycled */
+    if (seg_file_count() > 4) {
+	printf("%d segment files left over\n", seg_file_count());
+	return -1;
+    }
+    bitd_spool_close(s);
+
+    /* Fill up a spool with a 4-segment quota */
+    s = bitd_spool_open(g_dir, g_segment_size,
+			(bitd_uint64)g_segment_size * 4, g_flags);
+    for (i = 0; ; i++) {
+	size = record_gen(buf, i);
+	if (!bitd_spool_append(s, buf, size)) {
+	    break;
+	}
+    }
+    if (!i || bitd_spool_size(s) > (bitd_uint64)g_segment_size * 4) {
+	printf("Quota not enforced\n");
+	return -1;
+    }
+    if (g_verbose) {
+	printf("Quota reached after %d records\n", i);
+    }
+
+    /* A record larger than a segment can't be appended */
+    if (bitd_spool_append(s, buf, g_segment_size)) {
+	printf("Oversized record appended\n");
+	return -1;
+    }
+
+    /* Drain the spool, and append again */
+    n_read = 0;
+    while ((n = spool_check_read(s, n_read, read_size)) > 0) {
+	bitd_spool_commit(s);
+	n_read += n;
+    }
+    if (n < 0 || n_read != i) {
+	printf("Read %d records, expected %d\n", n_read, i);
+	return -1;
+    }
+    size = record_gen(buf, 0);
+    if (!bitd_spool_append(s, buf, size)) {
+	printf("Could not append to drained spool\n");
+	return -1;
+    }
+    bitd_spool_close(s);
+
+    spool_dir_remove();
+
+    return 0;
+}
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void usage() {
+
+    printf("\nUsage: %s [OPTIONS ... ]\n\n", g_prog_name);
+    printf("This program tests the spool API.\n\n");
+
+    printf("Options:\n"
+           "    -n record_count\n"
+           "            Number of records. Default: %d.\n"
+           "    -seg segment_size\n"
+           "            Segment size. Default: %d.\n"
+           "    -r read_size\n"
+           "            Max read size. Default: %d.\n"
+           "    -d dir\n"
+           "            Spool directory. Default: a temporary directory.\n"
+           "    -sync\n"
+           "            Sync each record to disk.\n"
+           "    -v verbose_level, --verbose verbose_level\n"
+           "            Set the verbosity level (default: 0).\n"
+           "    -h, --help, -?\n"
+           "            Show this help.\n",
+           RECORD_COUNT_DEFAULT, SEGMENT_SIZE_DEFAULT, READ_SIZE_DEFAULT);
+}
+
+
+/*
+ *============================================================================
+ *                        main
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+int main(int argc, char ** argv) {
+    int record_count = RECORD_COUNT_DEFAULT, ret;
+    bitd_uint32 read_size = READ_SIZE_DEFAULT;
+
+    bitd_sys_init();
+
+    /* Parse program name argument */
+    g_prog_name = bitd_get_leaf_filename(argv[0]);
+
+    snprintf(g_dir, sizeof(g_dir), "/tmp/%s.%d", g_prog_name, (int)getpid());
+
+    /* Skip to next parameter */
+    argc--;
+    argv++;
+
+    /* Parse vector size and help */
+    while (argc) {
+        if (!strcmp(argv[0], "-n") && argc > 1) {
+            argc--;
+            argv++;
+            record_count = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-seg") && argc > 1) {
+            argc--;
+            argv++;
+            g_segment_size = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-r") && argc > 1) {
+            argc--;
+            argv++;
+            read_size = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-d") && argc > 1) {
+            argc--;
+            argv++;
+            snprintf(g_dir, sizeof(g_dir), "%s", argv[0]);
+        } else if (!strcmp(argv[0], "-sync")) {
+	    g_flags |= BITD_SPOOL_FLAG_SYNC;
+        } else if ((!strcmp(argv[0], "-v") ||
+		    !strcmp(argv[0], "--verbose")) && argc > 1) {
+            argc--;
+            argv++;
+            g_verbose = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-h") ||
+                   !strcmp(argv[0], "--help") ||
+                   !strcmp(argv[0], "-?")) {
+            usage();
+	    exit(0);
+        } else {
+            usage();
+	    exit(-1);
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    ret = spool_test(record_count, read_size);
+    if (ret) {
+	spool_dir_remove();
+    }
+
+    bitd_sys_deinit();
+
+    return ret;
+}
@@ -21,6 +21,12 @@
  *                             MANIFEST CONSTANTS
  *****************************************************************************/
 
+/* Max difference between the fast clock and the system clock readings
+   around it. Covers the tsc extrapolation error between anchors. */
+#define BENCH_FAST_MAX_DIFF_NSEC 250000ULL
+
+/* Max lag of the coarse clock behind the system clock */
+#define BENCH_COARSE_MAX_LAG_NSEC 20000000ULL
 
 
 /*****************************************************************************
@@ -32,6 +38,8 @@
  *                                  TYPES
  *****************************************************************************/
 
+/* Clock read function */
+typedef bitd_uint64 (bench_clock_t)(void);
 
 
 /*****************************************************************************
@@ -73,6 +81,9 @@ void usage() {
            "    -i loop_interval, --interval loop_interval\n"
            "            Number of milliseconds to sleep between loops.\n"
            "            Default: 100.\n"
+           "    -bench read_count\n"
+           "            Benchmark the clock read cost, and check the fast\n"
+           "            and coarse clocks against the system clock.\n"
            "    -v verbose_level, --verbose verbose_level\n"
            "            Set the verbosity level (default: 2).\n"
            "    -h, --help, -?\n"
@@ -81,6 +92,151 @@ void usage() {
     exit(0);
 } 
 
+/*
+ *============================================================================
+ *                        bench_gettimeofday
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_uint64 bench_gettimeofday(void) {
+    struct timeval tm;
+
+    bitd_gettimeofday(&tm);
+
+    return BITD_TIMEVAL_TO_NANO(&tm);
+} 
+
+
+/*
+ *============================================================================
+ *                        bench_msec
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_uint64 bench_msec(void) {
+    return bitd_get_time_msec();
+} 
+
+
+/*
+ *============================================================================
+ *                        bench_msec_coarse
+ *============================================================================
+ * Description:     
+ * Parameters:    
+ * Returns:  
+ */
+static bitd_uint64 bench_msec_coarse(void) {
+    return bitd_get_time_msec_coarse();
+} 
+
+
+/*
+ *============================================================================
+ *                        bench_clock
+ *============================================================================
+ * Description:     Time read_count reads of a clock
+ * Parameters:    
+ * Returns:  
+ */
+static void bench_clock(char *name, bench_clock_t *clock, int read_count) {
+    bitd_uint64 t0, t1;
+    int i;
+
+    t0 = bitd_get_time_nsec();
+    for (i = 0; i < read_count; i++) {
+        clock();
+    }
+    t1 = bitd_get_time_nsec();
+
+    printf("%-28s %8.1f nsec/read\n", name, 
+           (double)(t1 - t0) / read_count);
+} 
+
+
+/*
+ *============================================================================
+ *                        bench
+ *============================================================================
+ * Description:     Benchmark the clock read cost, and check the fast and
+ *     coarse clocks.
+ * Parameters:    
+ * Returns:  
+ *     Zero on success
+ */
+static int bench(int read_count) {
+    bitd_uint64 t, t_fast, t_after, t_last = 0, t_cached;
+    int i;
+    
+    printf("Fast clock source: %s\n", bitd_get_time_fast_source());
+
+    bench_clock("bitd_gettimeofday", &bench_gettimeofday, read_count);
+    bench_clock("bitd_get_time_msec", &bench_msec, read_count);
+    bench_clock("bitd_get_time_msec_coarse", &bench_msec_coarse, read_count);
+    bench_clock("bitd_get_time_nsec", &bitd_get_time_nsec, read_count);
+    bench_clock("bitd_get_time_nsec_coarse", &bitd_get_time_nsec_coarse, 
+                read_count);
+    bench_clock("bitd_get_time_nsec_fast", &bitd_get_time_nsec_fast, 
+                read_count);
+
+    bitd_time_cache_begin();
+    bench_clock("bitd_get_time_nsec_cached", &bitd_get_time_nsec_cached, 
+                read_count);
+    bitd_time_cache_end();
+
+    /* The fast clock tracks the system clock, and does not go back */
+    for (i = 0; i < read_count; i++) {
+        t = bitd_get_time_nsec();
+        t_fast = bitd_get_time_nsec_fast();
+        t_after = bitd_get_time_nsec();
+
+        if (t_fast < t_last) {
+            printf("Fast clock went back by %llu nsec\n", 
+                   (unsigned long long)(t_last - t_fast));
+            return 1;
+        }
+        if (t_fast + BENCH_FAST_MAX_DIFF_NSEC < t) {
+            printf("Fast clock behind by %llu nsec\n", 
+                   (unsigned long long)(t - t_fast));
+            return 1;
+        }
+        if (t_fast > t_after + BENCH_FAST_MAX_DIFF_NSEC) {
+            printf("Fast clock ahead by %llu nsec\n", 
+                   (unsigned long long)(t_fast - t_after));
+            return 1;
+        }
+        t_last = t_fast;
+    }
+
+    /* The coarse clock lags the system clock by at most a few ticks */
+    t = bitd_get_time_nsec_coarse();
+    if (t + BENCH_COARSE_MAX_LAG_NSEC < bitd_get_time_nsec()) {
+        printf("Coarse clock lags by %llu nsec\n",
+               (unsigned long long)(bitd_get_time_nsec() - t));
+        return 1;
+    }
+
+    /* The cached time holds until the end of the cache */
+    t_cached = bitd_time_cache_begin();
+    bitd_sleep(2);
+    if (bitd_get_time_nsec_cached() != t_cached) {
+        printf("Cached time changed\n");
+        return 1;
+    }
+    bitd_time_cache_end();
+    if (bitd_get_time_nsec_cached() <= t_cached) {
+        printf("Cached time did not end\n");
+        return 1;
+    }
+
+    return 0;
+} 
+
+
 /*
  *============================================================================
  *                        main
@@ -91,6 +247,7 @@ void usage() {
  */
 int main(int argc, char ** argv) {
     int count = 100, interval = 100, i;
+    int bench_count = 0, ret = 0;
     struct timeval time, time_last;
 
     bitd_sys_init();
@@ -130,6 +287,18 @@ int main(int argc, char ** argv) {
 
             /* Get the interval */
             interval = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "-bench")) {
+
+            /* Skip to next parameter */
+            argc--;
+            argv++;
+            
+            if (!argc) {
+                usage();
+            }
+
+            /* Get the read count */
+            bench_count = atoi(argv[0]);
         } else if (!strcmp(argv[0], "-v") ||
                    !strcmp(argv[0], "--verbose")) {
 
@@ -156,6 +325,12 @@ int main(int argc, char ** argv) {
         argv++;        
     }
 
+    if (bench_count > 0) {
+        ret = bench(bench_count);
+        bitd_sys_deinit();
+        return ret;
+    }
+
     for (i = 0; i < count; i++) {
         bitd_gettimeofday(&time);
 
@@ -195,5 +370,5 @@ int main(int argc, char ** argv) {
 
     bitd_sys_deinit();
     
-    return 0;
+    return ret;
 }
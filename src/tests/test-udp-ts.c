@@ -0,0 +1,468 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: UDP timestamp test, per-packet and batched
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/platform-inetutil.h"
+#include "bitd/file.h"
+#include "bitd/tstamp.h"
+
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+#define PKT_COUNT_DEF 10000
+#define BATCH_DEF 64
+#define BATCH_MAX 1024
+#define PKT_SIZE 64
+
+#define VERBOSE_DEF 0
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+#define TESTUDP_SOCK_NOERROR(s)						\
+    do {								\
+	int s_ret = (s);						\
+	if (s_ret < 0) {						\
+	    fprintf(stderr,						\
+		    "%s: %s:%d: Socket routine returned %d, (%s %d)\n",	\
+		    g_prog_name, __FILE__, __LINE__, 			\
+		    s_ret, strerror(bitd_socket_errno), bitd_socket_errno);	\
+	    exit(1);							\
+	}								\
+    } while (0)
+
+#define TESTUDP_CHECK(c)						\
+    do {								\
+	if (!(c)) {							\
+	    fprintf(stderr, "%s: %s:%d: Check failed: %s\n",		\
+		    g_prog_name, __FILE__, __LINE__, #c);		\
+	    exit(1);							\
+	}								\
+    } while (0)
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+/* Counters of one test phase */
+struct phase_s {
+    char *name;
+    int sent;
+    int recvd;
+    int tx_tstamps;
+    bitd_uint32 tx_seq_base;     /* The tx sequence of the first packet */
+    bitd_uint32 tx_seq_next;
+    bitd_uint64 start_nsec;
+    bitd_uint64 end_nsec;
+};
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+static char* g_prog_name = "";
+static int g_verbose = VERBOSE_DEF;
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        usage
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+static void usage(void) {
+    printf("Usage: %s OPTIONS\n", g_prog_name);
+    printf("OPTIONS:\n"
+           "  -n packet_count\n"
+           "      Send that many packets in each phase (default: %d)\n"
+           "  -b batch_size\n"
+           "      Packets per batch in the batched phase (default: %d,\n"
+           "      max: %d)\n"
+           "  -v verbose_level, --verbose verbose_level\n"
+           "      Set the verbosity level (default: %d).\n"
+           "  -h, --help, -?\n"
+           "      Show this help.\n"
+	   , PKT_COUNT_DEF, BATCH_DEF, BATCH_MAX, VERBOSE_DEF
+        );
+}
+
+
+/*
+ *============================================================================
+ *                        check_rx
+ *============================================================================
+ * Description:     Check a received packet
+ * Parameters:
+ * Returns:
+ */
+static void check_rx(struct phase_s *ph, char *buf, int len,
+		     ts_timestamp_t *ts) {
+    bitd_uint32 idx;
+
+    TESTUDP_CHECK(len == PKT_SIZE);
+    TESTUDP_CHECK(ts->flags & (TS_FLAG_KERNEL|TS_FLAG_SW));
+    TESTUDP_CHECK(ts->tstamp != 0);
+
+    /* Loopback preserves the packet order */
+    memcpy(&idx, buf, sizeof(idx));
+    TESTUDP_CHECK(idx == (bitd_uint32)ph->recvd);
+
+    ph->recvd++;
+}
+
+
+/*
+ *============================================================================
+ *                        check_tx
+ *============================================================================
+ * Description:     Check a tx timestamp
+ * Parameters:
+ * Returns:
+ */
+static void check_tx(struct phase_s *ph, ts_timestamp_t *ts) {
+
+    if (g_verbose >= 2) {
+	printf("\t%s: tx tstamp %u.%09u seq %u flags 0x%x\n",
+	       ph->name,
+	       (bitd_uint32)(ts->tstamp/1000000000),
+	       (bitd_uint32)(ts->tstamp % 1000000000),
+	       ts->seq, ts->flags);
+    }
+
+    if (ts->flags & TS_FLAG_SND) {
+	TESTUDP_CHECK(ts->seq == ph->tx_seq_next);
+	ph->tx_seq_next++;
+	ph->tx_tstamps++;
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        drain_tx
+ *============================================================================
+ * Description:     Wait briefly for the remaining tx timestamps
+ * Parameters:
+ * Returns:
+ */
+static void drain_tx(ts_socket_t s, struct phase_s *ph,
+		     bitd_boolean batch_p) {
+    struct bitd_pollfd p;
+    ts_timestamp_t ts[BATCH_MAX];
+    int i, n;
+
+    while (ph->tx_tstamps < ph->sent) {
+	p.fd = ts_get_tstamp_fd(s);
+	p.events = BITD_POLLIN|BITD_POLLERR;
+	p.revents = 0;
+	if (bitd_poll(&p, 1, 1000) <= 0) {
+	    break;
+	}
+
+	if (batch_p) {
+	    n = ts_get_tstamp_tx_batch(s, ts, BATCH_MAX);
+	    TESTUDP_SOCK_NOERROR(n);
+	    for (i = 0; i < n; i++) {
+		check_tx(ph, &ts[i]);
+	    }
+	} else {
+	    while (ts_get_tstamp_tx(s, &ts[0]) >= 0 && ts[0].flags) {
+		check_tx(ph, &ts[0]);
+	    }
+	}
+    }
+}
+
+
+/*
+ *============================================================================
+ *                        run_single
+ *============================================================================
+ * Description:     Send and receive one packet at a time
+ * Parameters:
+ * Returns:
+ */
+static void run_single(ts_socket_t tx, ts_socket_t rx, int count,
+		       struct phase_s *ph) {
+    char buf[PKT_SIZE];
+    ts_timestamp_t ts;
+    bitd_uint32 idx;
+    int i, ret;
+
+    memset(buf, 0, sizeof(buf));
+    ph->start_nsec = bitd_get_time_nsec();
+
+    for (i = 0; i < count; i++) {
+	idx = i;
+	memcpy(buf, &idx, sizeof(idx));
+	ret = ts_send(tx, buf, sizeof(buf), 0);
+	TESTUDP_SOCK_NOERROR(ret);
+	ph->sent++;
+
+	ret = ts_recv(rx, buf, sizeof(buf), 0, &ts);
+	TESTUDP_SOCK_NOERROR(ret);
+	check_rx(ph, buf, ret, &ts);
+
+	while (ts_get_tstamp_tx(tx, &ts) >= 0 && ts.flags) {
+	    check_tx(ph, &ts);
+	}
+    }
+
+    drain_tx(tx, ph, FALSE);
+    ph->end_nsec = bitd_get_time_nsec();
+}
+
+
+/*
+ *============================================================================
+ *                        run_batch
+ *============================================================================
+ * Description:     Send and receive batches of packets
+ * Parameters:
+ * Returns:
+ */
+static void run_batch(ts_socket_t tx, ts_socket_t rx, int count, int batch,
+		      struct phase_s *ph) {
+    static char tx_buf[BATCH_MAX][PKT_SIZE];
+    static char rx_buf[BATCH_MAX][PKT_SIZE];
+    static ts_mmsg_t tx_msgs[BATCH_MAX];
+    static ts_mmsg_t rx_msgs[BATCH_MAX];
+    static ts_timestamp_t ts[BATCH_MAX];
+    bitd_uint32 idx;
+    int i, n, ret, recvd;
+
+    ph->start_nsec = bitd_get_time_nsec();
+
+    while (ph->sent < count) {
+	n = MIN(batch, count - ph->sent);
+
+	for (i = 0; i < n; i++) {
+	    idx = ph->sent + i;
+	    memset(tx_buf[i], 0, PKT_SIZE);
+	    memcpy(tx_buf[i], &idx, sizeof(idx));
+	    tx_msgs[i].buf = tx_buf[i];
+	    tx_msgs[i].len = PKT_SIZE;
+	    tx_msgs[i].addr = NULL;
+	    tx_msgs[i].addrlen = 0;
+	}
+
+	ret = ts_sendmmsg(tx, tx_msgs, n, 0);
+	TESTUDP_SOCK_NOERROR(ret);
+	TESTUDP_CHECK(ret == n);
+	for (i = 0; i < n; i++) {
+	    TESTUDP_CHECK(tx_msgs[i].ts.flags & TS_FLAG_SND);
+	    TESTUDP_CHECK(tx_msgs[i].ts.seq ==
+			  ph->tx_seq_base + (bitd_uint32)(ph->sent + i));
+	}
+	ph->sent += n;
+
+	/* Receive the whole batch */
+	for (recvd = 0; recvd < n; recvd += ret) {
+	    for (i = 0; i < n - recvd; i++) {
+		rx_msgs[i].buf = rx_buf[i];
+		rx_msgs[i].len = PKT_SIZE;
+		rx_msgs[i].addr = NULL;
+		rx_msgs[i].addrlen = 0;
+	    }
+
+	    ret = ts_recvmmsg(rx, rx_msgs, n - recvd, 0);
+	    TESTUDP_SOCK_NOERROR(ret);
+	    for (i = 0; i < ret; i++) {
+		check_rx(ph, rx_msgs[i].buf, rx_msgs[i].len, &rx_msgs[i].ts);
+	    }
+	}
+
+	/* Bulk drain of the tx timestamps */
+	ret = ts_get_tstamp_tx_batch(tx, ts, BATCH_MAX);
+	TESTUDP_SOCK_NOERROR(ret);
+	for (i = 0; i < ret; i++) {
+	    check_tx(ph, &ts[i]);
+	}
+    }
+
+    drain_tx(tx, ph, TRUE);
+    ph->end_nsec = bitd_get_time_nsec();
+}
+
+
+/*
+ *============================================================================
+ *                        report
+ *============================================================================
+ * Description:     Report and check the phase counters
+ * Parameters:
+ * Returns:
+ */
+static double report(struct phase_s *ph) {
+    double sec, rate;
+
+    sec = (ph->end_nsec - ph->start_nsec) / 1e9;
+    rate = sec > 0 ? ph->sent / sec : 0;
+
+    printf("%s: sent %d, received %d, tx tstamps %d, %.3f sec, "
+	   "%.0f pkts/sec\n",
+	   ph->name, ph->sent, ph->recvd, ph->tx_tstamps, sec, rate);
+
+    TESTUDP_CHECK(ph->recvd == ph->sent);
+    TESTUDP_CHECK(ph->tx_tstamps == ph->sent);
+
+    return rate;
+}
+
+
+/*
+ *============================================================================
+ *                        open_socket
+ *============================================================================
+ * Description:     Open a loopback UDP timestamp socket
+ * Parameters:
+ * Returns:
+ */
+static ts_socket_t open_socket(struct sockaddr_in *addr) {
+    ts_socket_t s;
+    bitd_socklen_t addrlen = sizeof(*addr);
+
+    s = ts_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    TESTUDP_CHECK(s != NULL);
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = 0;
+
+    TESTUDP_SOCK_NOERROR(bitd_bind(ts_get_sock_fd(s),
+				   (struct sockaddr *)addr, sizeof(*addr)));
+    TESTUDP_SOCK_NOERROR(bitd_getsockname(ts_get_sock_fd(s),
+					  (struct sockaddr *)addr,
+					  &addrlen));
+
+    return s;
+}
+
+
+int main(int argc, char **argv) {
+    int count = PKT_COUNT_DEF, batch = BATCH_DEF;
+    ts_socket_t tx, rx;
+    struct sockaddr_in tx_addr, rx_addr;
+    struct phase_s single, batched;
+    double single_rate, batch_rate;
+
+    /* Windows needs winsock.dll initialized */
+    if (!bitd_sys_init()) {
+        printf("Failed to initialize the system\n");
+        return 1;
+    }
+
+    /* Parse program name argument */
+    g_prog_name = bitd_get_leaf_filename(argv[0]);
+
+    /* Skip to next argument */
+    argc--;
+    argv++;
+
+    while(argc) {
+        if (!strcmp(argv[0], "-n")) {
+            /* Get next parameter */
+            argc--;
+            argv++;
+
+            if (!argc) {
+                usage();
+                return 1;
+            }
+
+            count = atoi(argv[0]);
+            if (count <= 0) {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(argv[0], "-b")) {
+            /* Get next parameter */
+            argc--;
+            argv++;
+
+            if (!argc) {
+                usage();
+                return 1;
+            }
+
+            batch = atoi(argv[0]);
+            if (batch <= 0 || batch > BATCH_MAX) {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(argv[0], "-v") ||
+                   !strcmp(argv[0], "--verbose")) {
+            /* Get next parameter */
+            argc--;
+            argv++;
+
+            if (!argc) {
+                usage();
+                return 1;
+            }
+
+            g_verbose = atoi(argv[0]);
+        } else {
+            usage();
+            return 1;
+        }
+
+        /* Skip to next argument */
+        argc--;
+        argv++;
+    }
+
+    /* Open the loopback sockets */
+    rx = open_socket(&rx_addr);
+    tx = open_socket(&tx_addr);
+    TESTUDP_SOCK_NOERROR(ts_connect(tx, (struct sockaddr *)&rx_addr,
+				    sizeof(rx_addr)));
+
+    /* Per-packet phase */
+    memset(&single, 0, sizeof(single));
+    single.name = "single";
+    run_single(tx, rx, count, &single);
+    single_rate = report(&single);
+
+    /* Batched phase. The tx timestamp sequence continues. */
+    memset(&batched, 0, sizeof(batched));
+    batched.name = "batch";
+    batched.tx_seq_base = single.sent;
+    batched.tx_seq_next = single.sent;
+    run_batch(tx, rx, count, batch, &batched);
+    batch_rate = report(&batched);
+
+    if (single_rate > 0) {
+	printf("Batch speedup: %.2fx\n", batch_rate / single_rate);
+    }
+
+    ts_close(tx);
+    ts_close(rx);
+
+    return 0;
+}
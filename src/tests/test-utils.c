@@ -0,0 +1,366 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Helpers shared by the unit test programs
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "test-utils.h"
+
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+char *g_prog_name = "";
+int g_verbose = TEST_VERBOSE_DEF;
+bitd_mutex g_lock;
+bitd_event g_done_ev;
+
+
+/*****************************************************************************
+ *                          FUNCTION IMPLEMENTATION
+ *****************************************************************************/
+
+
+/*
+ *============================================================================
+ *                        test_init
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_init(char *argv0) {
+
+    bitd_sys_init();
+
+    g_prog_name = bitd_get_leaf_filename(argv0);
+    g_lock = bitd_mutex_create();
+    g_done_ev = bitd_event_create(0);
+}
+
+
+/*
+ *============================================================================
+ *                        test_deinit
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_deinit(void) {
+
+    bitd_event_destroy(g_done_ev);
+    bitd_mutex_destroy(g_lock);
+
+    bitd_sys_deinit();
+}
+
+
+/*
+ *============================================================================
+ *                        test_check_failed
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_check_failed(char *file, int line, char *check) {
+
+    fprintf(stderr, "%s: %s:%d: Check failed: %s\n",
+	    g_prog_name, file, line, check);
+    exit(1);
+}
+
+
+/*
+ *============================================================================
+ *                        test_arg
+ *============================================================================
+ * Description:     Skip to the value of the current option
+ * Parameters:
+ * Returns:
+ */
+char *test_arg(int *argc, char ***argv, void (*usage)(void)) {
+
+    (*argc)--;
+    (*argv)++;
+
+    if (!*argc) {
+	usage();
+	exit(-1);
+    }
+
+    return (*argv)[0];
+}
+
+
+/*
+ *============================================================================
+ *                        test_arg_int
+ *============================================================================
+ * Description:     Skip to the int value of the current option
+ * Parameters:
+ * Returns:
+ */
+int test_arg_int(int *argc, char ***argv, int min, void (*usage)(void)) {
+    int ret = atoi(test_arg(argc, argv, usage));
+
+    if (ret < min) {
+	usage();
+	exit(-1);
+    }
+
+    return ret;
+}
+
+
+/*
+ *============================================================================
+ *                        test_arg_common
+ *============================================================================
+ * Description:     Handle the help and verbosity options
+ * Parameters:
+ * Returns:
+ *     FALSE if the current option is not a common one
+ */
+bitd_boolean test_arg_common(int *argc, char ***argv, void (*usage)(void)) {
+    char *arg = (*argv)[0];
+
+    if (!strcmp(arg, "-h") ||
+	!strcmp(arg, "--help") ||
+	!strcmp(arg, "-?")) {
+	usage();
+	exit(0);
+    } else if (!strcmp(arg, "-v") ||
+	       !strcmp(arg, "--verbose")) {
+	g_verbose = atoi(test_arg(argc, argv, usage));
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/*
+ *============================================================================
+ *                        test_nvp_add_string
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_nvp_add_string(bitd_nvp_t *nvp, char *name, char *value) {
+    bitd_value_t v;
+
+    v.value_string = value;
+    bitd_nvp_add_elem(nvp, name, &v, bitd_type_string);
+}
+
+
+/*
+ *============================================================================
+ *                        test_nvp_add_int64
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_nvp_add_int64(bitd_nvp_t *nvp, char *name, bitd_int64 value) {
+    bitd_value_t v;
+
+    v.value_int64 = value;
+    bitd_nvp_add_elem(nvp, name, &v, bitd_type_int64);
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_init
+ *============================================================================
+ * Description:     Initialize the module manager, and load a module
+ * Parameters:
+ *     config - the module manager config, or NULL
+ * Returns:
+ */
+void test_mmr_init(char *load_path, char *module_name,
+		   mmr_report_results_t *report_results,
+		   bitd_nvp_t config) {
+
+    TEST_CHECK(mmr_init() == mmr_err_ok);
+    TEST_CHECK(mmr_results_register(report_results) == mmr_err_ok);
+    TEST_CHECK(mmr_set_module_path(load_path) == mmr_err_ok);
+    if (config) {
+	TEST_CHECK(mmr_set_config(config) == mmr_err_ok);
+    }
+    TEST_CHECK(mmr_load_module(module_name) == mmr_err_ok);
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_deinit
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_mmr_deinit(char *module_name) {
+
+    TEST_CHECK(mmr_unload_module(module_name) == mmr_err_ok);
+    mmr_deinit();
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_set_pool
+ *============================================================================
+ * Description:     Configure a single worker pool
+ * Parameters:
+ * Returns:
+ */
+void test_mmr_set_pool(char *pool_name, int thread_max, int task_max) {
+    bitd_nvp_t pool = NULL, pools = NULL;
+    bitd_value_t v;
+
+    test_nvp_add_string(&pool, "name", pool_name);
+    test_nvp_add_int64(&pool, "thread-max", thread_max);
+    if (task_max) {
+	test_nvp_add_int64(&pool, "task-max", task_max);
+    }
+    v.value_nvp = pool;
+    bitd_nvp_add_elem(&pools, "worker-pool", &v, bitd_type_nvp);
+    TEST_CHECK(mmr_set_worker_pools(pools) == mmr_err_ok);
+    bitd_nvp_free(pool);
+    bitd_nvp_free(pools);
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_create
+ *============================================================================
+ * Description:     Create a task instance, and free its schedule
+ * Parameters:
+ * Returns:
+ */
+void test_mmr_create(char *task_name, char *task_inst_name,
+		     bitd_nvp_t sched, int sleep_msec) {
+    mmr_task_inst_params_t params;
+
+    mmr_task_inst_params_init(&params);
+    if (sleep_msec) {
+	test_nvp_add_int64(&params.tags, "task-inst-sleep", sleep_msec);
+    }
+
+    TEST_CHECK(mmr_task_inst_create(task_name, task_inst_name,
+				    sched, &params) == mmr_err_ok);
+    bitd_nvp_free(sched);
+    bitd_nvp_free(params.tags);
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_destroy
+ *============================================================================
+ * Description:
+ * Parameters:
+ * Returns:
+ */
+void test_mmr_destroy(char *task_name, char *task_inst_name) {
+
+    TEST_CHECK(mmr_task_inst_prepare_destroy(task_name,
+					     task_inst_name) == mmr_err_ok);
+    TEST_CHECK(mmr_task_inst_destroy(task_name,
+				     task_inst_name) == mmr_err_ok);
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_pool_stats
+ *============================================================================
+ * Description:     Get the worker pool stats, and print them if verbose
+ * Parameters:
+ * Returns:
+ */
+bitd_nvp_t test_mmr_pool_stats(void) {
+    bitd_nvp_t stats = NULL, yaml_nvp = NULL;
+    bitd_value_t v;
+    char *buf;
+
+    TEST_CHECK(mmr_get_worker_pool_stats(&stats) == mmr_err_ok);
+
+    if (g_verbose) {
+	v.value_nvp = stats;
+	bitd_nvp_add_elem(&yaml_nvp, "worker-pools", &v, bitd_type_nvp);
+	buf = bitd_nvp_to_yaml(yaml_nvp, FALSE, FALSE);
+	if (buf) {
+	    printf("%s", buf);
+	    free(buf);
+	}
+	bitd_nvp_free(yaml_nvp);
+    }
+
+    return stats;
+}
+
+
+/*
+ *============================================================================
+ *                        test_mmr_pool_stat
+ *============================================================================
+ * Description:     Get a counter of a worker pool
+ * Parameters:
+ * Returns:
+ */
+bitd_int64 test_mmr_pool_stat(bitd_nvp_t stats, char *pool_name,
+			      char *stat_name) {
+    bitd_nvp_t nvp;
+    int idx;
+
+    TEST_CHECK(bitd_nvp_lookup_elem(stats, pool_name, &idx));
+    TEST_CHECK(stats->e[idx].type == bitd_type_nvp);
+    nvp = stats->e[idx].v.value_nvp;
+    TEST_CHECK(bitd_nvp_lookup_elem(nvp, stat_name, &idx));
+
+    if (nvp->e[idx].type == bitd_type_uint64) {
+	return (bitd_int64)nvp->e[idx].v.value_uint64;
+    }
+    TEST_CHECK(nvp->e[idx].type == bitd_type_int64);
+
+    return nvp->e[idx].v.value_int64;
+}
@@ -0,0 +1,127 @@
+/*****************************************************************************
+ *
+ * Original Author: Andrei Radulescu-Banu
+ * Creation Date:
+ * Description: Helpers shared by the unit test programs
+ *
+ * Copyright 2018 by Andrei Radulescu-Banu.  All Rights Reserved.
+ * Unauthorized reproduction, modification, distribution, transmission,
+ * republication, display or performance are strictly prohibited.
+ ****************************************************************************/
+
+#ifndef _TEST_UTILS_H_
+#define _TEST_UTILS_H_
+
+/*****************************************************************************
+ *                                INCLUDE FILES
+ *****************************************************************************/
+#include "bitd/common.h"
+#include "bitd/file.h"
+#include "bitd/mmr-api.h"
+
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*****************************************************************************
+ *                             MANIFEST CONSTANTS
+ *****************************************************************************/
+
+/* How long a test waits for results, on top of the expected run time */
+#define TEST_WAIT_MSEC 10000
+
+/* The default verbosity level */
+#define TEST_VERBOSE_DEF 0
+
+/*****************************************************************************
+ *                                  MACROS
+ *****************************************************************************/
+
+/* Check a condition, and fail the test program if it is false */
+#define TEST_CHECK(c)							\
+    do {								\
+	if (!(c)) {							\
+	    test_check_failed(__FILE__, __LINE__, #c);			\
+	}								\
+    } while (0)
+
+/*****************************************************************************
+ *                                  TYPES
+ *****************************************************************************/
+
+
+
+/*****************************************************************************
+ *                                VARIABLES
+ *****************************************************************************/
+
+/* The program name, set by test_init() */
+extern char *g_prog_name;
+
+/* The verbosity level, set by test_arg_common() */
+extern int g_verbose;
+
+/* Results reported by other threads are counted under this lock, and the
+   event is set when the expected count is reached */
+extern bitd_mutex g_lock;
+extern bitd_event g_done_ev;
+
+/*****************************************************************************
+ *                           FUNCTION DECLARATION
+ *****************************************************************************/
+
+/* Initialize the system, the program name, the lock and the done event.
+   Deinitialize them at the end of the test. */
+void test_init(char *argv0);
+void test_deinit(void);
+
+/* Print the failed check, and exit */
+void test_check_failed(char *file, int line, char *check);
+
+/*
+ * Command line parsing. The caller has argv[0] pointing to the option:
+ * skip to its value, or show the usage and exit if there is none.
+ * test_arg_int() also exits if the value is less than min.
+ */
+char *test_arg(int *argc, char ***argv, void (*usage)(void));
+int test_arg_int(int *argc, char ***argv, int min, void (*usage)(void));
+
+/* Handle the options common to all test programs: -h, --help, -? and
+   -v, --verbose. Returns FALSE if the option is not one of them. */
+bitd_boolean test_arg_common(int *argc, char ***argv, void (*usage)(void));
+
+/* Add a string or int64 element to a name-value pair list */
+void test_nvp_add_string(bitd_nvp_t *nvp, char *name, char *value);
+void test_nvp_add_int64(bitd_nvp_t *nvp, char *name, bitd_int64 value);
+
+/* Initialize the module manager, register the results callback, and
+   load a module. Deinitialize after unloading the module. */
+void test_mmr_init(char *load_path, char *module_name,
+		   mmr_report_results_t *report_results,
+		   bitd_nvp_t config);
+void test_mmr_deinit(char *module_name);
+
+/* Configure a worker pool. A zero task_max leaves the default. */
+void test_mmr_set_pool(char *pool_name, int thread_max, int task_max);
+
+/* Create a task instance. The echo module runs sleep for sleep_msec, if
+   not zero. The schedule is freed. */
+void test_mmr_create(char *task_name, char *task_inst_name,
+		     bitd_nvp_t sched, int sleep_msec);
+
+/* Destroy a task instance */
+void test_mmr_destroy(char *task_name, char *task_inst_name);
+
+/* Get the worker pool stats, and a counter of a pool */
+bitd_nvp_t test_mmr_pool_stats(void);
+bitd_int64 test_mmr_pool_stat(bitd_nvp_t stats, char *pool_name,
+			      char *stat_name);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _TEST_UTILS_H_ */